@@ -17,13 +17,75 @@
 #include <Eigen/Sparse>
 #include "limboint.hpp"
 #include "solnoutclass.hpp"
-#include "layeredFdtd.hpp"
+#include "hybridThreads.hpp"
+#include "parasiticExtractor.hpp"
 
 // Manipulate namespace
 using std::cerr;
 using std::cout;
 using std::endl;
 
+/// @brief mesh-only planning mode: read the design, generate the grid lines, and forecast problem size 
+/// @param inGDSIIFile name of GDSII file to read 
+/// @param inSimFile name of sim_input file to read 
+/// @param outJSONFile name of JSON file to write (empty for console report only) 
+/// @return 0 if succeed 
+int planMesh(const string &inGDSIIFile, const string &inSimFile, const string &outJSONFile)
+{
+    SolverDataBase sdb;
+    fdtdMesh sys;
+    int status = 0;
+
+    // Read GDSII file
+    AsciiDataBase adb;
+    adb.setFileName(inGDSIIFile);
+    GdsParser::GdsReader adbReader(adb);
+    if (!adbReader(inGDSIIFile.c_str()))
+    {
+        cerr << "Unable to read in GDSII file" << endl;
+        return 1;
+    }
+
+    // Read simulation input file
+    if (!sdb.readSimInput(inSimFile))
+    {
+        cerr << "Unable to read in simulation input file" << endl;
+        return 1;
+    }
+
+    // Flatten the design and generate the grid lines without allocating mesh-sized arrays
+    unordered_set<double> portCoorx, portCoory;
+    string topCellName = adb.getCell(adb.getNumCell() - 1).getCellName();
+    adb.saveToMesh(topCellName, { 0., 0. }, strans(), &sys, sdb.findLayerIgnore());
+    if (!sdb.convertToFDTDMesh(&sys, adb.getNumCdtIn(), &portCoorx, &portCoory))
+    {
+        return 1;
+    }
+    unordered_map<double, int> xi, yi, zi;
+    clock_t t1 = clock();
+    status = meshAndMark(&sys, xi, yi, zi, &portCoorx, &portCoory, true);
+    if (status != 0)
+    {
+        cerr << "meshAndMark Fail!" << endl;
+        return status;
+    }
+    cout << "Line generation time is " << (clock() - t1) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
+
+    // Report the forecast
+    fdtdMeshSize meshSize(sys.nx, sys.ny, sys.nz, sys.numPorts, sys.nfreq);
+    meshSize.printForecast();
+    if (!outJSONFile.empty())
+    {
+        if (!meshSize.writeJson(outJSONFile, adb.findNames().back()))
+        {
+            cerr << "Unable to write JSON file " << outJSONFile << endl;
+            return 1;
+        }
+        cout << "File ready at " << outJSONFile << endl;
+    }
+    return status;
+}
+
 /// @brief main function 
 /// @param argc number of arguments 
 /// @param argv values of arguments 
@@ -44,6 +106,7 @@ int main(int argc, char** argv)
             cout << "  -w, --write           Write database in memory to given SPEF file." << endl;
             cout << "  -i, --imp             Read given interconnect modeling platform file and write GDSII file with name also given." << endl;
             cout << "  -t, --pslg            Read GDSII files of design and outline and write a PSLG file for each layer." << endl;
+            cout << "  -m, --plan            Read GDSII and sim input files, generate grid lines only, and report problem size with memory and time forecasts." << endl;
             cout << "  -s, --simulate        Read GDSII and sim input files, simulate, and write solution to Xyce (SPICE) subcircuit." << endl;
             cout << "  -sx, --xyce           Identical to \"-s\"." << endl;
             cout << "  -sp, --spef           Read GDSII and sim input files into memory, simulate, and write solution to SPEF file." << endl;
@@ -54,6 +117,7 @@ int main(int argc, char** argv)
             cout << " The file passed after -w or --write must be a blank SPEF file." << endl;
             cout << " The first file passed after -i or --imp must be a 3D description .imp file, and the second must be a blank .gds file." << endl;
             cout << " The first file passed after -t or --pslg must be a Calma GDSII stream file of the design, and the second must be a GDSII file of just the design's outline." << endl;
+            cout << " The first file passed after -m or --plan must be a Calma GDSII stream file, the second must be a sim_input file, and an optional third names a JSON file for the forecast." << endl;
             cout << " The first file passed after -s or --simulate (or -sx or --xyce) must be a Calma GDSII stream file, the second must be a sim_input file, and the third must be a blank Xyce file." << endl;
             cout << " The first file passed after -sp or --spef must be a Calma GDSII stream file, the second must be a sim_input file, and the third must be a blank SPEF file." << endl;
             cout << " The first file passed after -sc or --citi must be a Calma GDSII stream file, the second must be a sim_input file, and the third must be a blank CITIfile." << endl;
@@ -230,159 +294,83 @@ int main(int argc, char** argv)
             }
             cout << "Created PSLG file for each layer" << endl;
         }
+        else if ((strcmp(argv[1], "-m") == 0) || (strcmp(argv[1], "--plan") == 0))
+        {
+            // Forecast problem size without meshing
+            return planMesh(argv[2], argv[3], "");
+        }
         else
         {
             cerr << "Must pass a .imp file to read and blank GDSII file to write after \"-i\" flag, rerun with \"--help\" flag for details" << endl;
             cerr << "Must pass two related GDSII files to read after \"-t\" flag, rerun with \"--help\" flag for details" << endl;
+            cerr << "Must pass a GDSII file and sim_input file to read after \"-m\" flag, rerun with \"--help\" flag for details" << endl;
         }
     }
     else if (argc == 5)
     {
-        if ((strcmp(argv[1], "-s") == 0) || (strcmp(argv[1], "--simulate") == 0) || (strcmp(argv[1], "-sx") == 0) || (strcmp(argv[1], "--xyce") == 0) || (strcmp(argv[1], "-sp") == 0) || (strcmp(argv[1], "--spef") == 0) || (strcmp(argv[1], "-sc") == 0) || (strcmp(argv[1], "--citi") == 0) || (strcmp(argv[1], "-st") == 0) || (strcmp(argv[1], "--touchstone") == 0))
+        if ((strcmp(argv[1], "-m") == 0) || (strcmp(argv[1], "--plan") == 0))
+        {
+            // Forecast problem size without meshing and write JSON file
+            return planMesh(argv[2], argv[3], argv[4]);
+        }
+        else if ((strcmp(argv[1], "-s") == 0) || (strcmp(argv[1], "--simulate") == 0) || (strcmp(argv[1], "-sx") == 0) || (strcmp(argv[1], "--xyce") == 0) || (strcmp(argv[1], "-sp") == 0) || (strcmp(argv[1], "--spef") == 0) || (strcmp(argv[1], "-sc") == 0) || (strcmp(argv[1], "--citi") == 0) || (strcmp(argv[1], "-st") == 0) || (strcmp(argv[1], "--touchstone") == 0))
         {
-            // Initialize SolverDataBase, mesh, and set variables for performance tracking
+            // Set variables for performance tracking
             clock_t t1 = clock();
-            SolverDataBase sdb;
-            fdtdMesh sys;
             int status = 0; // Initialize as able to return successfully
-            bool adbIsGood, sdbIsGood, sdbCouldDump;
+            bool sdbCouldDump;
 
             // Get file names
             string inGDSIIFile = argv[2];
             string inSimFile = argv[3];
-            size_t indExtension = inGDSIIFile.find_last_of(".");
 
-            // Read GDSII file
-            AsciiDataBase adb;
-            adb.setFileName(inGDSIIFile);
-            GdsParser::GdsReader adbReader(adb);
-            adbIsGood = adbReader(inGDSIIFile.c_str());
-            if (adbIsGood)
-            {
-                vector<size_t> indCellPrint = {}; // { adb.getNumCell() - 1 };
-                adb.print(indCellPrint);
-                cout << "GDSII file read" << endl;
-            }
-            else
-            {
-                cerr << "Unable to read in GDSII file" << endl;
-                status = 1;
-                return status;
-            }
+            // Start MPI for the whole extraction
+            mpiSession mpi(&argc, &argv);
 
-            // Read simulation input file
-            sdbIsGood = sdb.readSimInput(inSimFile);
-            if (sdbIsGood)
-            {
-                cout << "Simulation input file read" << endl;
-            }
-            else
-            {
-                cerr << "Unable to read in simulation input file" << endl;
-                status = 1;
-                return status;
-            }
+            // Set threads per MPI rank and their cores from the ranks sharing this node, before any parallel region or MKL call
+            hybridThreads threadSetting;
+            threadSetting.apply();
+            threadSetting.print();
 
-            // Append information so far to fdtdMesh
-            unordered_set<double> portCoorx, portCoory;
-            string topCellName = adb.getCell(adb.getNumCell() - 1).getCellName();
-            adb.saveToMesh(topCellName, { 0., 0. }, strans(), &sys, sdb.findLayerIgnore()); // Recursively save GDSII conductor information to sys
-            sdb.convertToFDTDMesh(&sys, adb.getNumCdtIn(), &portCoorx, &portCoory); // Save simulation input information to sys
+            // The extractor running on every rank
+            parasiticExtractor extractor;
 
-            // Mesh the domain and mark conductors
-            unordered_map<double, int> xi, yi, zi;
-            clock_t t2 = clock();
-            status = meshAndMark(&sys, xi, yi, zi, &portCoorx, &portCoory);
-            if (status == 0)
-            {
-                cout << "meshAndMark Success!" << endl;
-                cout << "meshAndMark time is " << (clock() - t2) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
-            }
-            else
+            // Read GDSII and simulation input files
+            if (!extractor.loadDesign(inGDSIIFile) || !extractor.loadSimInput(inSimFile))
             {
-                cerr << "meshAndMark Fail!" << endl;
+                status = 1;
                 return status;
             }
-            //sys.print();
 
-            // Set D_eps and D_sig
-            clock_t t3 = clock();
-            status = matrixConstruction(&sys);
-            if (status == 0)
+            // Only Touchstone keeps the Z-parameters as they are, every other output inverts them
+            if (!extractor.getSolverData().excitesAllPorts() && (strcmp(argv[1], "-st") != 0) && (strcmp(argv[1], "--touchstone") != 0))
             {
-                cout << "matrixConstruction Success!" << endl;
-                cout << "matrixConstruction time is " << (clock() - t3) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
-            }
-            else {
-                cerr << "matrixConstruction Fail!" << endl;
+                cerr << "The SOURCE block does not excite every port, so only Z-parameter output with the \"-st\" flag is supported" << endl;
+                status = 1;
                 return status;
             }
-            //sys.print();
 
-            // Set port
-            clock_t t4 = clock();
-            status = portSet(&sys, xi, yi, zi);
-            if (status == 0)
-            {
-                cout << "portSet Success!" << endl;
-                cout << "portSet time is " << (clock() - t4) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
-            }
-            else
+            // Mesh the top cell and solve for its Z-parameters
+            clock_t t2 = clock();
+            status = extractor.mesh();
+            if (status != 0)
             {
-                cerr << "portSet Fail!" << endl;
                 return status;
             }
-            //sys.print();
-
-            // Generate Stiffness Matrix
-#ifndef SKIP_GENERATE_STIFF
-            clock_t t5 = clock();
-            status = generateStiff(&sys);
-            if (status == 0)
-            {
-                cout << "generateStiff Success!" << endl;
-                cout << "generateStiff time is " << (clock() - t5) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
-            }
-            else
+            status = extractor.solve();
+            if (status != 0)
             {
-                cerr << "generateStiff Fail!" << endl;
                 return status;
             }
-#endif
-
-            // Write object sys to files
-#ifndef SKIP_LAYERED_FD
-            WriteSysToFile(sys);
-#endif
-
-            // Parameter generation
-            clock_t t6 = clock();
-#ifndef SKIP_LAYERED_FD     // Run layered Finite-Difference solver
-            cout << endl << endl << "Results from Layered Finite-Difference Solver: " << endl;
-            status = solveE_Zpara_layered(&sys);
-            //cout << endl << endl << "Results from Reference (direct backslash with PARDISO): " << endl;
-            //solveE_Zpara_reference(&sys);
-#else                       // Run VoVh solver
-            cout << endl << endl << "Results from V0Vh Solver: " << endl;
-            status = paraGenerator(&sys, xi, yi, zi);
-#endif
-            if (status == 0)
+            int worldRank;
+            MPI_Comm_rank(MPI_COMM_WORLD, &worldRank);
+            if (worldRank != 0)
             {
-                cout << "paraGenerator Success!" << endl;
-                cout << "paraGenerator time is " << (clock() - t6) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
-            }
-            else
-            {
-                cerr << "paraGenerator Fail!" << endl;
-                return status;
+                return status;    // every rank holds the same Z-parameters, world rank 0 writes them
             }
             cout << "Engine time to this point: " << (clock() - t2) * 1.0 / CLOCKS_PER_SEC << " s" << endl;
             cout << "Total time to this point: " << (clock() - t1) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
-
-            // Network parameter storage
-            Parasitics newPara = sdb.getParasitics(); // Start with outdated parastics to update
-            newPara.saveNetworkParam('Z', sdb.getSimSettings().getFreqsHertz(), sys.x); // Save the Z-parameters in fdtdMesh to Parasitics class
-            sdb.setParasitics(newPara);
+            SolverDataBase sdb = extractor.getSolverData();
 
             // Select Output File Based on Control Mode
             cout << endl;
@@ -391,7 +379,7 @@ int main(int argc, char** argv)
                 // Output SPEF file
                 string outSPEFFile = argv[4];
                 vector<size_t> indLayerPrint = { 0, 1 * sdb.getNumLayer() / 3, 2 * sdb.getNumLayer() / 3, sdb.getNumLayer() - 1 }; // {}; // Can use integer division
-                sdb.setDesignName(adb.findNames().back());
+                sdb.setDesignName(extractor.getCellName());
                 sdb.setOutSPEF(outSPEFFile);
                 sdb.print(indLayerPrint);
                 bool sdbCouldDump = sdb.dumpSPEF();
@@ -407,7 +395,7 @@ int main(int argc, char** argv)
                 // Output Common Instrumentation Transfer and Interchange file (CITIfile)
                 string outCITIFile = argv[4];
                 vector<size_t> indLayerPrint = { 0, 1 * sdb.getNumLayer() / 3, 2 * sdb.getNumLayer() / 3, sdb.getNumLayer() - 1 }; // {}; // Can use integer division
-                sdb.setDesignName(adb.findNames().back());
+                sdb.setDesignName(extractor.getCellName());
                 sdb.setOutCITI(outCITIFile);
                 sdb.print(indLayerPrint);
                 bool sdbCouldDump = sdb.dumpCITI();
@@ -418,7 +406,7 @@ int main(int argc, char** argv)
                 // Output Touchstone file
                 string outTstoneFile = argv[4];
                 vector<size_t> indLayerPrint = { 0, 1 * sdb.getNumLayer() / 3, 2 * sdb.getNumLayer() / 3, sdb.getNumLayer() - 1 }; // {}; // Can use integer division
-                sdb.setDesignName(adb.findNames().back());
+                sdb.setDesignName(extractor.getCellName());
                 sdb.setOutTouchstone(outTstoneFile);
                 sdb.print(indLayerPrint);
                 bool sdbCouldDump = sdb.dumpTouchstone();
@@ -429,7 +417,7 @@ int main(int argc, char** argv)
                 // Output Xyce subcircuit file
                 string outXyceFile = argv[4];
                 vector<size_t> indLayerPrint = { 0, sdb.getNumLayer() / 2, sdb.getNumLayer() - 1 }; // {}; // Can use integer division
-                sdb.setDesignName(adb.findNames().back());
+                sdb.setDesignName(extractor.getCellName());
                 sdb.setOutXyce(outXyceFile);
                 sdb.print(indLayerPrint);
                 sdbCouldDump = sdb.dumpXyce();
@@ -442,6 +430,7 @@ int main(int argc, char** argv)
             cerr << "Must pass a GDSII file, sim_input file, and blank SPEF file to write after \"-sp\" flag" << endl;
             cerr << "Must pass a GDSII file, sim_input file, and blank CITI file to write after \"-sc\" flag" << endl;
             cerr << "Must pass a GDSII file, sim_input file, and blank Touchstone file to write after \"-st\" flag" << endl;
+            cerr << "Must pass a GDSII file, sim_input file, and blank JSON file to write after \"-m\" flag" << endl;
             cerr << "Rerun with \"--help\" flag for details" << endl;
         }
     }
@@ -0,0 +1,200 @@
+#ifndef GDS2PARA_CONDUCTOR_BLOCK_SOLVER_H_
+#define GDS2PARA_CONDUCTOR_BLOCK_SOLVER_H_
+
+#include "fdtd.hpp"
+#include "matrixTypeDef.hpp"
+#include "hypreSolver.h"
+
+#define AC_DENSE_BLOCK_MAX (2000) // Conductor blocks of Ac up to this many rows are LU factorized densely, larger ones go to PARDISO (or HYPRE with SKIP_PARDISO)
+
+// Solver of Ac * y0c = V0ca' * J with Ac = V0ca' * D_sig * V0c, which is block diagonal by conductor
+class conductorBlockSolver {
+public:
+    conductorBlockSolver() {}
+    conductorBlockSolver(const conductorBlockSolver &) = delete;
+    conductorBlockSolver &operator=(const conductorBlockSolver &) = delete;
+    ~conductorBlockSolver() {
+        this->release();
+    }
+
+    // Split Ac into its conductor blocks and factorize each block once, returns nonzero if Ac can't be split
+    int factorize(fdtdMesh *psys, myint leng_v0c) {
+        /* Conductor k (starting from 1) owns rows acu_cnno[k - 1] ~ acu_cnno[k] - 1 of Ac and its nonzeros
+        cindex[k - 1] + 1 ~ cindex[k], as Ac is row-sorted. */
+        this->release();
+        this->psys = psys;
+        if (psys->acu_cnno.size() < 2 || psys->acu_cnno.back() != leng_v0c || psys->cindex.size() != psys->acu_cnno.size()) {
+            cerr << "Conductor blocks of Ac are not recorded!" << endl;
+            return 1;
+        }
+        myint N_blocks = psys->acu_cnno.size() - 1;
+        this->blocks.resize(N_blocks);
+        for (myint k = 0; k < N_blocks; k++) {
+            acBlock &blk = this->blocks[k];
+            blk.rowStart = psys->acu_cnno[k];
+            blk.N = psys->acu_cnno[k + 1] - psys->acu_cnno[k];
+            blk.nnzStart = psys->cindex[k] + 1;
+            blk.nnz = psys->cindex[k + 1] - psys->cindex[k];
+        }
+
+        int status = 0;
+#pragma omp parallel for schedule(dynamic, 1)
+        for (myint k = 0; k < N_blocks; k++) {
+            int blkStatus = this->factorizeBlock(this->blocks[k]);
+            if (blkStatus != 0) {
+#pragma omp atomic write
+                status = blkStatus;
+            }
+        }
+        if (status != 0) {
+            this->release();
+            return status;
+        }
+
+        myint N_dense = 0;
+        for (const auto &blk : this->blocks) {
+            N_dense += blk.dense;
+        }
+        cout << "Ac is split into " << N_blocks << " conductor blocks, " << N_dense << " of them factorized densely" << endl;
+        return 0;
+    }
+
+    // solution = Ac \ rhs, the dense blocks in parallel, then the large sparse ones each with its own threaded solver
+    int solve(double *rhs, double *solution) {
+        if (this->psys == nullptr) {
+            cerr << "Ac blocks are solved before being factorized!" << endl;
+            return 1;
+        }
+
+        int status = 0;
+#pragma omp parallel for schedule(dynamic, 1)
+        for (myint k = 0; k < (myint)this->blocks.size(); k++) {
+            acBlock &blk = this->blocks[k];
+            if (!blk.dense) {
+                continue;
+            }
+            for (myint i = 0; i < blk.N; i++) {
+                solution[blk.rowStart + i] = rhs[blk.rowStart + i];
+            }
+            lapack_int info = LAPACKE_dgetrs(LAPACK_COL_MAJOR, 'N', blk.N, 1, blk.lu.data(), blk.N, blk.ipiv.data(), &solution[blk.rowStart], blk.N);
+            if (info != 0) {
+#pragma omp atomic write
+                status = 1;
+            }
+        }
+        if (status != 0) {
+            cerr << "Issue on solving a dense Ac block, LAPACKE_dgetrs failed" << endl;
+            return status;
+        }
+
+        for (auto &blk : this->blocks) {
+            if (blk.dense) {
+                continue;
+            }
+#ifndef SKIP_PARDISO
+            MKL_INT maxfct = 1, mnum = 1, mtype = 11, phase = 33, perm, nrhs = 1, msglvl = 0, error = 0;    // solve with the kept factors
+            pardiso(blk.pt, &maxfct, &mnum, &mtype, &phase, &blk.N, blk.val.data(), blk.rowPtr.data(), blk.colId.data(),
+                &perm, &nrhs, blk.iparm, &msglvl, &rhs[blk.rowStart], &solution[blk.rowStart], &error);
+            if (error != 0) {
+                cerr << "ERROR during PARDISO solve of an Ac block: " << error << endl;
+                return 1;
+            }
+#else
+            status = hypreSolve(this->psys, blk.rowId.data(), blk.colId.data(), blk.val.data(), blk.nnz, &rhs[blk.rowStart], blk.N, &solution[blk.rowStart]);
+            if (status != 0) {
+                return status;
+            }
+#endif
+        }
+        return 0;
+    }
+
+private:
+    struct acBlock {
+        myint rowStart = 0;            // first row of this conductor in Ac
+        myint N = 0;                   // num of rows (= cols) of the block
+        myint nnzStart = 0;            // first nonzero of this conductor in Ac
+        myint nnz = 0;
+        bool dense = true;
+        vector<double> lu;             // dense LU factors, column-major
+        vector<lapack_int> ipiv;
+        vector<myint> rowId, colId;    // block-local COO (rowId) and CSR (rowPtr) of a large block
+        vector<myint> rowPtr;
+        vector<double> val;
+        void *pt[64];                  // PARDISO handle of a large block
+        myint iparm[64];
+        bool factorized = false;
+    };
+
+    int factorizeBlock(acBlock &blk) {
+        fdtdMesh *psys = this->psys;
+        for (myint indi = blk.nnzStart; indi < blk.nnzStart + blk.nnz; indi++) {
+            if (psys->AcColId[indi] < blk.rowStart || psys->AcColId[indi] >= blk.rowStart + blk.N) {
+                cerr << "Ac couples two conductors at row " << psys->AcRowId[indi] << ", col " << psys->AcColId[indi] << endl;
+                return 1;
+            }
+        }
+
+        blk.dense = (blk.N <= AC_DENSE_BLOCK_MAX);
+        if (blk.dense) {
+            blk.lu.assign(blk.N * blk.N, 0.);
+            for (myint indi = blk.nnzStart; indi < blk.nnzStart + blk.nnz; indi++) {
+                blk.lu[(psys->AcColId[indi] - blk.rowStart) * blk.N + psys->AcRowId[indi] - blk.rowStart] += psys->Acval[indi];
+            }
+            blk.ipiv.resize(blk.N);
+            lapack_int info = LAPACKE_dgetrf(LAPACK_COL_MAJOR, blk.N, blk.N, blk.lu.data(), blk.N, blk.ipiv.data());
+            if (info != 0) {
+                cerr << "Issue on LU factorization of an Ac block, LAPACKE_dgetrf returns: " << info << endl;
+                return 1;
+            }
+            blk.factorized = true;
+            return 0;
+        }
+
+        blk.rowId.resize(blk.nnz);
+        blk.colId.resize(blk.nnz);
+        blk.val.assign(&psys->Acval[blk.nnzStart], &psys->Acval[blk.nnzStart + blk.nnz]);
+        for (myint indi = 0; indi < blk.nnz; indi++) {
+            blk.rowId[indi] = psys->AcRowId[blk.nnzStart + indi] - blk.rowStart;
+            blk.colId[indi] = psys->AcColId[blk.nnzStart + indi] - blk.rowStart;
+        }
+#ifndef SKIP_PARDISO
+        blk.rowPtr.resize(blk.N + 1);
+        countCooRowsToCsr(blk.nnz, blk.N, [&blk](myint k) { return blk.rowId[k]; }, blk.rowPtr.data());
+        vector<myint>().swap(blk.rowId);
+
+        MKL_INT maxfct = 1, mnum = 1, mtype = 11, phase = 12, perm, nrhs = 1, msglvl = 0, error = 0;    // real and nonsymmetric, analysis and factorization
+        double ddum;
+        pardisoinit(blk.pt, &mtype, blk.iparm);
+        blk.iparm[34] = 1;    // 0-based indexing
+        pardiso(blk.pt, &maxfct, &mnum, &mtype, &phase, &blk.N, blk.val.data(), blk.rowPtr.data(), blk.colId.data(),
+            &perm, &nrhs, blk.iparm, &msglvl, &ddum, &ddum, &error);
+        if (error != 0) {
+            cerr << "ERROR during PARDISO factorization of an Ac block: " << error << endl;
+            return 1;
+        }
+        blk.factorized = true;
+#endif
+        return 0;
+    }
+
+    void release() {
+#ifndef SKIP_PARDISO
+        for (auto &blk : this->blocks) {
+            if (!blk.dense && blk.factorized) {
+                MKL_INT maxfct = 1, mnum = 1, mtype = 11, phase = -1, perm, nrhs = 1, msglvl = 0, error = 0;    // release internal memory
+                double ddum;
+                pardiso(blk.pt, &maxfct, &mnum, &mtype, &phase, &blk.N, &ddum, blk.rowPtr.data(), blk.colId.data(),
+                    &perm, &nrhs, blk.iparm, &msglvl, &ddum, &ddum, &error);
+            }
+        }
+#endif
+        this->blocks.clear();
+        this->psys = nullptr;
+    }
+
+    fdtdMesh *psys = nullptr;
+    vector<acBlock> blocks;
+};
+
+#endif
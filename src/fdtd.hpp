@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <cctype>
 #include <cerrno>
+#include <climits>
 #include <cstring>
 #include <cmath>
 #include <ctime>
@@ -22,18 +23,22 @@
 #include <unordered_set>
 #include <string>
 #include <algorithm>
+#include <iterator>
 #include <utility>
 
 #define SKIP_LAYERED_FD   // Comment out if you want to run layered FD code in Linux, doesn't matter for Windows system
 
 // HYPRE and MKL data type control
-#define LARGE_SYSTEM (1) // Must leave defined with the current makefile
+#ifndef SMALL_SYSTEM
+#define LARGE_SYSTEM (1) // Default 64-bit indices with ILP64 MKL; build with "make INDEX32=1" to define SMALL_SYSTEM instead
+#endif
 #if defined(LARGE_SYSTEM) && defined(__linux__)
 #define MKL_ILP64 (1) // Must define before including mkl.h if using long long int, MKL_ILP64 only works for Linux not for Windows
 typedef long long int myint;
 #else
-typedef int myint;
+typedef int myint; // 32-bit indices with LP64 MKL halve index memory and sparse matrix-vector bandwidth
 #endif
+typedef int mycdt; // Conductor index stored per edge, node or cell (isolated conductor count stays far below 2^31 in either index mode)
 
 #include <mkl.h>
 #include <mkl_spblas.h>
@@ -50,13 +55,15 @@ using namespace std;
 #define SIGMA (5.8e+7) // Default conductivity for conductors is copper (S/m)
 #define DOUBLEMAX (1.e+30)
 #define DOUBLEMIN (-1.e+30)
-#define MINDISFRACX (5e-3) // Fraction setting minimum discretization retained in x-directions after node merging in terms of smaller of x-extent
-#define MINDISFRACY (5e-3) // Fraction setting minimum discretization retained in y-directions after node merging in terms of smaller of y-extent
-#define MINDISFRACZ (0.05) // Fraction setting minimum discretization retained in z-direction after node merging in terms of distance between closest layers
-#define MAXDISFRACX (0.1) // Fraction setting largest discretization in x-direction in terms of x-extent
-#define MAXDISFRACY (0.1) // Fraction setting largest discretization in y-direction in terms of y-extent
+#define MINDISFRACX (5e-3) // Default fraction setting minimum discretization retained in x-directions after node merging in terms of smaller of x-extent (MESH section of .sim_input may override)
+#define MINDISFRACY (5e-3) // Default fraction setting minimum discretization retained in y-directions after node merging in terms of smaller of y-extent (MESH section of .sim_input may override)
+#define MINDISFRACZ (0.05) // Default fraction setting minimum discretization retained in z-direction after node merging in terms of distance between closest layers (MESH section of .sim_input may override)
+#define MAXDISFRACX (0.1) // Default fraction setting largest discretization in x-direction in terms of x-extent (MESH section of .sim_input may override)
+#define MAXDISFRACY (0.1) // Default fraction setting largest discretization in y-direction in terms of y-extent (MESH section of .sim_input may override)
 #define MAXDISLAYERZ (2.) // Largest discretization in z-direction represented as fewest nodes placed between closest layers (1. = distance between closest layers, 2. = half distance between closest layers)
 #define DT (1.e-15) // Time step for finding high-frequency modes (s)
+#define FORECAST_FLOPS (1.e10) // Sustained floating-point rate (flop/s) assumed by the run-time forecasts of the mesh-only planning mode
+#define REFERENCE_PORT_BATCH (16) // Source ports solved together by the sparse direct reference(), bounding its right-hand sides to this many vectors
 
 // Debug testing macros (comment out if not necessary)
 #define UPPER_BOUNDARY_PEC
@@ -67,6 +74,7 @@ using namespace std;
 #define PRINT_VERBOSE_TIMING // Terminal output has extra runtime clock information
 //#define PRINT_PORT_SET // Terminal output shows logical tests in portSet()
 //#define PRINT_V0D_BLOCKS
+//#define PRINT_EPS_SIG // Write D_eps and D_sig after PEC removal to eps.txt and sig.txt in matrixConstruction()
 //#define V0_NEW_SCHEMA
 #define PRINT_V0_Z_PARAM
 //#define PRINT_V0_Vh_Z_PARAM
@@ -172,12 +180,637 @@ public:
 	}
 };
 
+// Sparse vector over the original edges (no PEC removal), e.g. the current density of one source port
+class sparseExcitation {
+public:
+	vector<myint> edge;    // ascending edge #
+	vector<double> val;
+
+	size_t size() const {
+		return this->edge.size();
+	}
+	void clear() {
+		this->edge.clear();
+		this->val.clear();
+	}
+};
+
+// Rows of a column-compressed matrix V (N_edge x N_col) at a few edges, to form V' * J for a J nonzero only there
+/* V' * J needs only the rows of V at the nonzero edges of J. The rows of all port edges are gathered by one pass over
+V, then each port costs the nonzeros of its own rows instead of a pass over V and a dense J. */
+class edgeRowsOfCsc {
+public:
+	edgeRowsOfCsc(const myint *colPtr, const myint *rowId, const double *val, myint N_col, const vector<myint> &edges) {
+		/* colPtr, rowId, val: V in CSC, column j has nonzeros colPtr[j] ~ colPtr[j + 1] - 1
+		edges: the edges (rows of V) that J can be nonzero at */
+		this->N_col = N_col;
+		for (auto e : edges) {
+			if (this->slotOfEdge.find(e) == this->slotOfEdge.end()) {
+				myint slot = this->slotOfEdge.size();
+				this->slotOfEdge[e] = slot;
+			}
+		}
+
+		this->rowPtr.assign(this->slotOfEdge.size() + 1, 0);
+		for (myint j = 0; j < N_col; j++) {
+			for (myint k = colPtr[j]; k < colPtr[j + 1]; k++) {
+				auto it = this->slotOfEdge.find(rowId[k]);
+				if (it != this->slotOfEdge.end()) {
+					this->rowPtr[it->second + 1]++;
+				}
+			}
+		}
+		for (size_t slot = 0; slot < this->slotOfEdge.size(); slot++) {
+			this->rowPtr[slot + 1] += this->rowPtr[slot];
+		}
+		this->colId.resize(this->rowPtr.back());
+		this->rowVal.resize(this->rowPtr.back());
+		vector<myint> next(this->rowPtr.begin(), this->rowPtr.end() - 1);
+		for (myint j = 0; j < N_col; j++) {
+			for (myint k = colPtr[j]; k < colPtr[j + 1]; k++) {
+				auto it = this->slotOfEdge.find(rowId[k]);
+				if (it != this->slotOfEdge.end()) {
+					this->colId[next[it->second]] = j;
+					this->rowVal[next[it->second]] = val[k];
+					next[it->second]++;
+				}
+			}
+		}
+	}
+
+	// y = V' * J, y has length N_col
+	void multiplyTranspose(const sparseExcitation &J, double *y) const {
+		for (myint j = 0; j < this->N_col; j++) {
+			y[j] = 0.;
+		}
+		for (size_t ind = 0; ind < J.size(); ind++) {
+			auto it = this->slotOfEdge.find(J.edge[ind]);
+			if (it == this->slotOfEdge.end()) {
+				cerr << "Edge " << J.edge[ind] << " of the excitation is not among the gathered rows!" << endl;
+				exit(2);
+			}
+			for (myint k = this->rowPtr[it->second]; k < this->rowPtr[it->second + 1]; k++) {
+				y[this->colId[k]] += this->rowVal[k] * J.val[ind];
+			}
+		}
+	}
+
+private:
+	myint N_col;
+	unordered_map<myint, myint> slotOfEdge;    // edge # -> gathered row
+	vector<myint> rowPtr, colId;               // gathered rows in CSR
+	vector<double> rowVal;
+};
+
 class fdtdPatch {
 public:
 	double patchArea;
 	int *node;
 };
 
+class fdtdMeshPolicy {
+	/* Runtime mesh-density policy read from the MESH section of the simulation input file */
+public:
+	double minDisFracX, minDisFracY, minDisFracZ;    // Minimum discretization retained after node merging near ports (same meaning as MINDISFRACX/Y/Z)
+	double maxDisFracX, maxDisFracY;                 // Largest discretization near ports (same meaning as MAXDISFRACX/Y)
+	double gradeDistFrac;                            // Distance from the nearest port line, as fraction of the extent, over which spacing grows to its far-field value
+	double farDisScale;                              // Multiplier on minimum and maximum discretization far from ports (1. = same density everywhere)
+	double memLimitGB;                               // Stop before allocating the mesh if the predicted memory exceeds this (GB, 0. = no limit)
+
+	/* Default Constructor */
+	fdtdMeshPolicy() {
+		this->minDisFracX = MINDISFRACX;
+		this->minDisFracY = MINDISFRACY;
+		this->minDisFracZ = MINDISFRACZ;
+		this->maxDisFracX = MAXDISFRACX;
+		this->maxDisFracY = MAXDISFRACY;
+		this->gradeDistFrac = 0.1;
+		this->farDisScale = 1.;
+		this->memLimitGB = 0.;
+	}
+
+	/* Set a policy value from its name in the simulation input file
+	Return 0 if set, 1 if the name is unknown, 2 if a spacing fraction or gradeDistFrac is not positive (left unchanged) */
+	int setByName(const string &name, double value) {
+		if (name == "farDisScale") this->farDisScale = value;
+		else if (name == "memLimitGB") this->memLimitGB = value;
+		else {
+			double *fraction;    // zero or negative spacing never ends line generation
+			if (name == "minDisFracX") fraction = &this->minDisFracX;
+			else if (name == "minDisFracY") fraction = &this->minDisFracY;
+			else if (name == "minDisFracZ") fraction = &this->minDisFracZ;
+			else if (name == "maxDisFracX") fraction = &this->maxDisFracX;
+			else if (name == "maxDisFracY") fraction = &this->maxDisFracY;
+			else if (name == "gradeDistFrac") fraction = &this->gradeDistFrac;
+			else return 1;
+			if (value <= 0.) {
+				cerr << "Mesh policy setting " << name << " must be positive, not " << value << endl;
+				return 2;
+			}
+			*fraction = value;
+		}
+		return 0;
+	}
+
+	/* Spacing multiplier for a grid line at coord, growing linearly with distance from the nearest port line along the same axis */
+	double gradeScale(double coord, const vector<double> &portLines, double extent) const {
+		if (this->farDisScale <= 1. || this->gradeDistFrac <= 0. || portLines.empty()) {
+			return 1.;
+		}
+		double dist = DOUBLEMAX;
+		for (double line : portLines) {
+			dist = fmin(dist, fabs(coord - line));
+		}
+		return 1. + (this->farDisScale - 1.) * fmin(dist / (this->gradeDistFrac * extent), 1.);
+	}
+
+	/* Print Function */
+	void print() const {
+		cout << "  Mesh policy: minDisFrac = (" << this->minDisFracX << ", " << this->minDisFracY << ", " << this->minDisFracZ << "), maxDisFrac = (" << this->maxDisFracX << ", " << this->maxDisFracY << ")" << endl;
+		cout << "  Far-field spacing is " << this->farDisScale << "x beyond " << this->gradeDistFrac << " of the extent from ports";
+		if (this->memLimitGB > 0.) {
+			cout << ", memory limit is " << this->memLimitGB << " GB";
+		}
+		cout << endl;
+	}
+};
+
+class fdtdMeshSize {
+	/* Problem size predicted from the grid line counts before any mesh-sized allocation */
+public:
+	long long nx, ny, nz;
+	long long N_edge, N_node, N_patch;
+	long long nnzS;          // nonzeros of the curl-curl stiffness matrix before PEC removal
+	int numPorts, nfreq;
+	double markerBytes;      // markEdge, markNode, mapEdge and mapEdgeR
+	double stiffBytes;       // stiffness matrix in COO format, allocated once at its exact size by generateStiff()
+	double v0Bytes;          // V0d, V0c and the Laplacian-like Ad and Ac matrices in COO format
+	double portBytes;        // per-port excitation and solution vectors of paraGenerator()
+	double totalBytes;
+
+	/* Forecasts for each solver engine (order of magnitude at FORECAST_FLOPS) */
+	double v0HypreBytes, v0HypreSec;          // paraGenerator(): V0 projection with HYPRE solves of Ad and Ac
+	double layeredBytes, layeredSec;          // solveE_Zpara_layered(): dense cascade of surface blocks along y
+	double pardisoBytes, pardisoSec;          // reference(): sparse direct solve of the whole curl-curl system
+
+	/* Parametrized Constructor */
+	fdtdMeshSize(long long nx, long long ny, long long nz, int numPorts, int nfreq) {
+		this->nx = nx;
+		this->ny = ny;
+		this->nz = nz;
+		this->numPorts = numPorts;
+		this->nfreq = nfreq;
+		long long ncx = nx - 1, ncy = ny - 1, ncz = nz - 1;
+		long long nEdgeS = ncy * (ncx + 1) + ncx * (ncy + 1);
+		long long nEdgeV = (ncx + 1) * (ncy + 1);
+		this->N_edge = nEdgeS * (ncz + 1) + nEdgeV * ncz;
+		this->N_node = nEdgeV * (ncz + 1);
+		this->N_patch = ncx * ncy * (ncz + 1) + ((ncx + 1) * ncy + (ncy + 1) * ncx) * ncz;
+		this->nnzS = 12 * this->N_patch + this->N_edge;    // each patch couples its 4 edges pairwise, distinct edges share at most one patch
+
+		double cooEntry = 2. * sizeof(myint) + sizeof(double);
+		this->markerBytes = this->N_edge * (sizeof(mycdt) + 2. * sizeof(myint)) + this->N_node * sizeof(mycdt);
+		this->stiffBytes = this->nnzS * cooEntry;
+		this->v0Bytes = this->N_node * (6. * (cooEntry + sizeof(double)) + 7. * cooEntry);    // about 6 V0 (values and averaged values) and 7 A entries per node
+		this->portBytes = 10. * this->N_edge * sizeof(double);    // reused from one port to the next
+		this->totalBytes = this->markerBytes + this->stiffBytes + this->v0Bytes + this->portBytes;
+
+		/* V0 with HYPRE: three AMG-preconditioned solves per port, each about 30 iterations of 20 flops per nonzero (S is applied matrix-free) */
+		double nnzA = 7. * this->N_node;
+		this->v0HypreBytes = this->totalBytes - this->stiffBytes + (this->N_edge + this->N_patch) * sizeof(double);
+		this->v0HypreSec = (3. * numPorts * 30. * 20. * 2. * nnzA) / FORECAST_FLOPS;
+
+		/* Layered: per layer, dense complex blocks of the surface edges and a cubic cascade per frequency */
+		double nSurfE = (double)ncx * nz + (double)(ncx + 1) * ncz;    // x- and z-edges on one y-surface
+		this->layeredBytes = this->markerBytes + this->stiffBytes + (4. * ncy + 4.) * nSurfE * nSurfE * sizeof(complex<double>);
+		this->layeredSec = nfreq * ncy * 40. * nSurfE * nSurfE * nSurfE / FORECAST_FLOPS;
+
+		/* PARDISO reference: nested-dissection fill of a 3-D grid grows as N^(4/3) and work as N^2 */
+		double nUnknown = (double)this->N_edge;
+		this->pardisoBytes = this->markerBytes + this->stiffBytes + 10. * pow(nUnknown, 4. / 3.) * sizeof(complex<double>);
+		this->pardisoSec = nfreq * 4. * nUnknown * nUnknown / FORECAST_FLOPS;
+	}
+
+	/* Print Function */
+	void print() const {
+		cout << "Predicted problem size: " << endl;
+		cout << " Grid lines = " << this->nx << " x " << this->ny << " x " << this->nz << endl;
+		cout << " N_edge = " << this->N_edge << ", N_node = " << this->N_node << ", N_patch = " << this->N_patch << endl;
+		cout << " nnz(S) <= " << this->nnzS << endl;
+		cout << " Estimated peak memory = " << this->totalBytes / 1.e9 << " GB (markers " << this->markerBytes / 1.e9 << ", stiffness " << this->stiffBytes / 1.e9 << ", V0 " << this->v0Bytes / 1.e9 << ", ports " << this->portBytes / 1.e9 << ")" << endl;
+	}
+
+	/* Print the memory and time forecast of each solver engine */
+	void printForecast() const {
+		cout << "Solver forecast for " << this->numPorts << " ports and " << this->nfreq << " frequencies at " << FORECAST_FLOPS / 1.e9 << " Gflop/s: " << endl;
+		cout << " V0 + HYPRE        : " << this->v0HypreBytes / 1.e9 << " GB, " << this->v0HypreSec << " s" << endl;
+		cout << " Layered cascade   : " << this->layeredBytes / 1.e9 << " GB, " << this->layeredSec << " s" << endl;
+		cout << " PARDISO reference : " << this->pardisoBytes / 1.e9 << " GB, " << this->pardisoSec << " s" << endl;
+	}
+
+	/* Text with the characters that cannot appear in a JSON string escaped */
+	static string jsonEscape(const string &text) {
+		string escaped;
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				escaped += '\\';
+				escaped += c;
+			}
+			else if ((unsigned char)c < 0x20) {
+				char code[7];
+				snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+				escaped += code;
+			}
+			else {
+				escaped += c;
+			}
+		}
+		return escaped;
+	}
+
+	/* Write the prediction and forecast as a JSON object, return false if the file cannot be opened */
+	bool writeJson(const string &fileName, const string &designName) const {
+		ofstream out(fileName.c_str(), std::ofstream::out | std::ofstream::trunc);
+		if (!out.is_open()) {
+			return false;
+		}
+		out << "{" << endl;
+		out << "  \"design\": \"" << jsonEscape(designName) << "\"," << endl;
+		out << "  \"grid\": { \"nx\": " << this->nx << ", \"ny\": " << this->ny << ", \"nz\": " << this->nz << " }," << endl;
+		out << "  \"N_edge\": " << this->N_edge << "," << endl;
+		out << "  \"N_node\": " << this->N_node << "," << endl;
+		out << "  \"N_patch\": " << this->N_patch << "," << endl;
+		out << "  \"nnzS\": " << this->nnzS << "," << endl;
+		out << "  \"numPorts\": " << this->numPorts << "," << endl;
+		out << "  \"nfreq\": " << this->nfreq << "," << endl;
+		out << "  \"assumedFlops\": " << FORECAST_FLOPS << "," << endl;
+		out << "  \"engines\": {" << endl;
+		out << "    \"v0_hypre\": { \"memoryGB\": " << this->v0HypreBytes / 1.e9 << ", \"timeSec\": " << this->v0HypreSec << " }," << endl;
+		out << "    \"layered\": { \"memoryGB\": " << this->layeredBytes / 1.e9 << ", \"timeSec\": " << this->layeredSec << " }," << endl;
+		out << "    \"pardiso_reference\": { \"memoryGB\": " << this->pardisoBytes / 1.e9 << ", \"timeSec\": " << this->pardisoSec << " }" << endl;
+		out << "  }" << endl;
+		out << "}" << endl;
+		out.close();
+		return true;
+	}
+};
+
+class fdtdStiffStencil {
+	/* Matrix-free application of the curl-curl stiffness matrix S = Sh*Se'/mu (PEC edges removed) on the tensor grid.
+	The first pass takes the curl of the edge field on every patch scaled by the cell widths (Se'*x), and the second pass
+	takes the dual curl back to the edges scaled by the averaged widths around each edge (Sh*h/mu). Both passes loop over
+	z-planes so they can be threaded over z-slabs. */
+public:
+	myint ncx, ncy, ncz;                // number of cells along x, y, z
+	myint N_edge_s, N_edge_v, N_edge;   // edge counts with the same layout as fdtdMesh (layers grow along z)
+	myint N_edge_rmPEC;                 // length of the vectors S acts on (edges left after PEC removal)
+	const myint *mapEdgeR;              // new edge # to original edge #
+	vector<double> rdx, rdy, rdz;       // 1 / cell width
+	vector<double> rdxa, rdya, rdza;    // 1 / (mu * averaged width around each grid line)
+	vector<double> eFull, sFull;        // work vectors over all edges (PEC edges stay zero in eFull)
+	vector<double> hz, hx, hy;          // work vectors over xy-, yz- and xz-patches
+
+	/* Parametrized Constructor */
+	fdtdStiffStencil(myint N_cell_x, myint N_cell_y, myint N_cell_z, const double *xn, const double *yn, const double *zn, const myint *mapEdgeR, myint N_edge_rmPEC) {
+		this->ncx = N_cell_x;
+		this->ncy = N_cell_y;
+		this->ncz = N_cell_z;
+		this->N_edge_s = N_cell_y * (N_cell_x + 1) + N_cell_x * (N_cell_y + 1);
+		this->N_edge_v = (N_cell_x + 1) * (N_cell_y + 1);
+		this->N_edge = this->N_edge_s * (N_cell_z + 1) + this->N_edge_v * N_cell_z;
+		this->N_edge_rmPEC = N_edge_rmPEC;
+		this->mapEdgeR = mapEdgeR;
+		setSpacing(xn, N_cell_x, this->rdx, this->rdxa);
+		setSpacing(yn, N_cell_y, this->rdy, this->rdya);
+		setSpacing(zn, N_cell_z, this->rdz, this->rdza);
+		this->eFull.assign(this->N_edge, 0.);
+		this->sFull.assign(this->N_edge, 0.);
+		this->hz.assign((N_cell_z + 1) * N_cell_x * N_cell_y, 0.);
+		this->hx.assign(N_cell_z * (N_cell_x + 1) * N_cell_y, 0.);
+		this->hy.assign(N_cell_z * N_cell_x * (N_cell_y + 1), 0.);
+	}
+
+	/* y = S * x for one vector, reading x[i * inc] and writing y[i * inc] (inc = 2 walks the real or imaginary part of a complex vector) */
+	void multiply(const double *x, double *y, myint inc = 1) {
+		myint i;
+		for (i = 0; i < this->N_edge_rmPEC; i++) {
+			this->eFull[this->mapEdgeR[i]] = x[i * inc];
+		}
+		curlE();
+		curlH();
+		for (i = 0; i < this->N_edge_rmPEC; i++) {
+			y[i * inc] = this->sFull[this->mapEdgeR[i]];
+		}
+	}
+
+	/* Y = S * X for a block of nrhs column-major vectors with leading dimension N_edge_rmPEC */
+	void multiplyBlock(const double *X, double *Y, myint nrhs, myint inc = 1) {
+		for (myint j = 0; j < nrhs; j++) {
+			multiply(X + j * this->N_edge_rmPEC * inc, Y + j * this->N_edge_rmPEC * inc, inc);
+		}
+	}
+
+	/* Nonzeros of row eno (original edge #) of Sh*Se'/mu before PEC removal, sorted by column; returns the count (at most 13) */
+	int rowEntries(myint eno, myint *cols, double *vals) const {
+		myint layer = eno / (this->N_edge_s + this->N_edge_v), r = eno % (this->N_edge_s + this->N_edge_v);
+		myint ptype[4], pa[4], pb[4], pc[4];    // patches around the edge: type (0 = xy, 1 = yz, 2 = xz) and indices as in patchEdges()
+		double sh[4];         // Sh coefficient of this edge on each patch
+		int np = 0;
+		if (r < this->ncy * (this->ncx + 1)) {    // y-edge (ix, iy, layer)
+			myint ix = r / this->ncy, iy = r % this->ncy;
+			if (ix > 0) { ptype[np] = 0; pa[np] = ix - 1; pb[np] = iy; pc[np] = layer; sh[np++] = this->rdxa[ix]; }
+			if (ix < this->ncx) { ptype[np] = 0; pa[np] = ix; pb[np] = iy; pc[np] = layer; sh[np++] = -this->rdxa[ix]; }
+			if (layer < this->ncz) { ptype[np] = 1; pa[np] = ix; pb[np] = iy; pc[np] = layer; sh[np++] = this->rdza[layer]; }
+			if (layer > 0) { ptype[np] = 1; pa[np] = ix; pb[np] = iy; pc[np] = layer - 1; sh[np++] = -this->rdza[layer]; }
+		}
+		else if (r < this->N_edge_s) {    // x-edge (ix, iy, layer)
+			r -= this->ncy * (this->ncx + 1);
+			myint ix = r / (this->ncy + 1), iy = r % (this->ncy + 1);
+			if (iy < this->ncy) { ptype[np] = 0; pa[np] = ix; pb[np] = iy; pc[np] = layer; sh[np++] = this->rdya[iy]; }
+			if (iy > 0) { ptype[np] = 0; pa[np] = ix; pb[np] = iy - 1; pc[np] = layer; sh[np++] = -this->rdya[iy]; }
+			if (layer > 0) { ptype[np] = 2; pa[np] = ix; pb[np] = iy; pc[np] = layer - 1; sh[np++] = this->rdza[layer]; }
+			if (layer < this->ncz) { ptype[np] = 2; pa[np] = ix; pb[np] = iy; pc[np] = layer; sh[np++] = -this->rdza[layer]; }
+		}
+		else {    // z-edge (ix, iy) of slab layer
+			r -= this->N_edge_s;
+			myint ix = r / (this->ncy + 1), iy = r % (this->ncy + 1);
+			if (iy > 0) { ptype[np] = 1; pa[np] = ix; pb[np] = iy - 1; pc[np] = layer; sh[np++] = this->rdya[iy]; }
+			if (iy < this->ncy) { ptype[np] = 1; pa[np] = ix; pb[np] = iy; pc[np] = layer; sh[np++] = -this->rdya[iy]; }
+			if (ix < this->ncx) { ptype[np] = 2; pa[np] = ix; pb[np] = iy; pc[np] = layer; sh[np++] = this->rdxa[ix]; }
+			if (ix > 0) { ptype[np] = 2; pa[np] = ix - 1; pb[np] = iy; pc[np] = layer; sh[np++] = -this->rdxa[ix]; }
+		}
+
+		/* Every patch adds Sh(eno, p) * Se(f, p) for its four edges f; the diagonal collects one term per patch */
+		int n = 1;
+		cols[0] = eno;
+		vals[0] = 0.;
+		for (int ip = 0; ip < np; ip++) {
+			myint pe[4];
+			double se[4];
+			patchEdges(ptype[ip], pa[ip], pb[ip], pc[ip], pe, se);
+			for (int k = 0; k < 4; k++) {
+				if (pe[k] == eno) {
+					vals[0] += sh[ip] * se[k];
+				}
+				else {
+					cols[n] = pe[k];
+					vals[n++] = sh[ip] * se[k];
+				}
+			}
+		}
+		for (int i = 1; i < n; i++) {    // insertion sort of at most 13 entries
+			myint c = cols[i];
+			double v = vals[i];
+			int j = i - 1;
+			while (j >= 0 && cols[j] > c) {
+				cols[j + 1] = cols[j];
+				vals[j + 1] = vals[j];
+				j--;
+			}
+			cols[j + 1] = c;
+			vals[j + 1] = v;
+		}
+		return n;
+	}
+
+private:
+	/* Four edges (original #) of a patch and their Se coefficients (circulation over the patch divided by its area) */
+	void patchEdges(myint type, myint a, myint b, myint c, myint *pe, double *se) const {
+		if (type == 0) {    // xy-patch of cell (a, b) on plane c
+			pe[0] = eY(a, b, c); se[0] = -this->rdx[a];
+			pe[1] = eY(a + 1, b, c); se[1] = this->rdx[a];
+			pe[2] = eX(a, b, c); se[2] = this->rdy[b];
+			pe[3] = eX(a, b + 1, c); se[3] = -this->rdy[b];
+		}
+		else if (type == 1) {    // yz-patch on x-line a, y-cell b, z-cell c
+			pe[0] = eZ(a, b, c); se[0] = -this->rdy[b];
+			pe[1] = eZ(a, b + 1, c); se[1] = this->rdy[b];
+			pe[2] = eY(a, b, c); se[2] = this->rdz[c];
+			pe[3] = eY(a, b, c + 1); se[3] = -this->rdz[c];
+		}
+		else {    // xz-patch on x-cell a, y-line b, z-cell c
+			pe[0] = eX(a, b, c); se[0] = -this->rdz[c];
+			pe[1] = eX(a, b, c + 1); se[1] = this->rdz[c];
+			pe[2] = eZ(a, b, c); se[2] = this->rdx[a];
+			pe[3] = eZ(a + 1, b, c); se[3] = -this->rdx[a];
+		}
+	}
+
+	/* Reciprocal cell widths and reciprocal averaged widths (the latter folded with 1/mu as in Sval) along one direction */
+	static void setSpacing(const double *coor, myint nCell, vector<double> &rd, vector<double> &rda) {
+		rd.assign(nCell, 0.);
+		rda.assign(nCell + 1, 0.);
+		for (myint i = 0; i < nCell; i++) {
+			rd[i] = 1. / (coor[i + 1] - coor[i]);
+		}
+		rda[0] = 1. / ((coor[1] - coor[0]) * MU);
+		rda[nCell] = 1. / ((coor[nCell] - coor[nCell - 1]) * MU);
+		for (myint i = 1; i < nCell; i++) {
+			rda[i] = 2. / ((coor[i + 1] - coor[i - 1]) * MU);
+		}
+	}
+
+	/* Edge numbers (original) of y-, x- and z-directed edges */
+	myint eY(myint ix, myint iy, myint iz) const { return iz * (this->N_edge_s + this->N_edge_v) + ix * this->ncy + iy; }
+	myint eX(myint ix, myint iy, myint iz) const { return iz * (this->N_edge_s + this->N_edge_v) + this->ncy * (this->ncx + 1) + ix * (this->ncy + 1) + iy; }
+	myint eZ(myint ix, myint iy, myint iz) const { return iz * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + ix * (this->ncy + 1) + iy; }
+
+	/* Patch values of Se' * eFull */
+	void curlE() {
+		const double *e = this->eFull.data();
+#pragma omp parallel for
+		for (myint iz = 0; iz <= this->ncz; iz++) {
+			for (myint ix = 0; ix < this->ncx; ix++) {    // xy-patches on plane iz
+				double *h = &this->hz[(iz * this->ncx + ix) * this->ncy];
+				for (myint iy = 0; iy < this->ncy; iy++) {
+					h[iy] = (e[eY(ix + 1, iy, iz)] - e[eY(ix, iy, iz)]) * this->rdx[ix] - (e[eX(ix, iy + 1, iz)] - e[eX(ix, iy, iz)]) * this->rdy[iy];
+				}
+			}
+			if (iz == this->ncz) {
+				continue;
+			}
+			for (myint ix = 0; ix <= this->ncx; ix++) {    // yz-patches of slab iz
+				double *h = &this->hx[(iz * (this->ncx + 1) + ix) * this->ncy];
+				for (myint iy = 0; iy < this->ncy; iy++) {
+					h[iy] = (e[eZ(ix, iy + 1, iz)] - e[eZ(ix, iy, iz)]) * this->rdy[iy] - (e[eY(ix, iy, iz + 1)] - e[eY(ix, iy, iz)]) * this->rdz[iz];
+				}
+			}
+			for (myint ix = 0; ix < this->ncx; ix++) {    // xz-patches of slab iz
+				double *h = &this->hy[(iz * this->ncx + ix) * (this->ncy + 1)];
+				for (myint iy = 0; iy <= this->ncy; iy++) {
+					h[iy] = (e[eX(ix, iy, iz + 1)] - e[eX(ix, iy, iz)]) * this->rdz[iz] - (e[eZ(ix + 1, iy, iz)] - e[eZ(ix, iy, iz)]) * this->rdx[ix];
+				}
+			}
+		}
+	}
+
+	/* Edge values of Sh * h / mu, patches outside the grid count as zero */
+	void curlH() {
+		double *s = this->sFull.data();
+		myint ncx = this->ncx, ncy = this->ncy, ncz = this->ncz;
+#pragma omp parallel for
+		for (myint iz = 0; iz <= ncz; iz++) {
+			const double *hzp = &this->hz[iz * ncx * ncy];
+			const double *hxu = (iz < ncz) ? &this->hx[iz * (ncx + 1) * ncy] : NULL;          // yz-patches above plane iz
+			const double *hxd = (iz > 0) ? &this->hx[(iz - 1) * (ncx + 1) * ncy] : NULL;      // yz-patches below plane iz
+			const double *hyu = (iz < ncz) ? &this->hy[iz * ncx * (ncy + 1)] : NULL;
+			const double *hyd = (iz > 0) ? &this->hy[(iz - 1) * ncx * (ncy + 1)] : NULL;
+			for (myint ix = 0; ix <= ncx; ix++) {    // y-edges on plane iz
+				for (myint iy = 0; iy < ncy; iy++) {
+					double v = ((ix > 0) ? hzp[(ix - 1) * ncy + iy] : 0.) - ((ix < ncx) ? hzp[ix * ncy + iy] : 0.);
+					double w = ((hxu != NULL) ? hxu[ix * ncy + iy] : 0.) - ((hxd != NULL) ? hxd[ix * ncy + iy] : 0.);
+					s[eY(ix, iy, iz)] = v * this->rdxa[ix] + w * this->rdza[iz];
+				}
+			}
+			for (myint ix = 0; ix < ncx; ix++) {    // x-edges on plane iz
+				for (myint iy = 0; iy <= ncy; iy++) {
+					double v = ((iy < ncy) ? hzp[ix * ncy + iy] : 0.) - ((iy > 0) ? hzp[ix * ncy + iy - 1] : 0.);
+					double w = ((hyd != NULL) ? hyd[ix * (ncy + 1) + iy] : 0.) - ((hyu != NULL) ? hyu[ix * (ncy + 1) + iy] : 0.);
+					s[eX(ix, iy, iz)] = v * this->rdya[iy] + w * this->rdza[iz];
+				}
+			}
+			if (iz == ncz) {
+				continue;
+			}
+			for (myint ix = 0; ix <= ncx; ix++) {    // z-edges of slab iz
+				for (myint iy = 0; iy <= ncy; iy++) {
+					double v = ((iy > 0) ? hxu[ix * ncy + iy - 1] : 0.) - ((iy < ncy) ? hxu[ix * ncy + iy] : 0.);
+					double w = ((ix < ncx) ? hyu[ix * (ncy + 1) + iy] : 0.) - ((ix > 0) ? hyu[(ix - 1) * (ncy + 1) + iy] : 0.);
+					s[eZ(ix, iy, iz)] = v * this->rdya[iy] + w * this->rdxa[ix];
+				}
+			}
+		}
+	}
+};
+
+// Set of indices kept as sorted, coalesced ranges [first, last), e.g. the edges and nodes of whole PEC planes
+/* It has the insert / find / size / iteration interface of set<myint> used on the boundary sets. Membership is O(1)
+while the set is one range and O(log(num of ranges)) otherwise, and a whole plane takes one range instead of one tree
+node per index. */
+class indexRangeSet {
+public:
+	class const_iterator {
+	public:
+		typedef forward_iterator_tag iterator_category;
+		typedef myint value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const myint *pointer;
+		typedef myint reference;
+
+		const_iterator(const vector<pair<myint, myint>> *ranges, size_t i_range, myint value) : ranges(ranges), i_range(i_range), value(value) {}
+		myint operator*() const {
+			return this->value;
+		}
+		const_iterator &operator++() {
+			this->value++;
+			if (this->value == (*this->ranges)[this->i_range].second) {    // step to the next range
+				this->i_range++;
+				this->value = (this->i_range < this->ranges->size()) ? (*this->ranges)[this->i_range].first : 0;
+			}
+			return *this;
+		}
+		bool operator==(const const_iterator &other) const {
+			return this->i_range == other.i_range && this->value == other.value;
+		}
+		bool operator!=(const const_iterator &other) const {
+			return !(*this == other);
+		}
+	private:
+		const vector<pair<myint, myint>> *ranges;
+		size_t i_range;
+		myint value;
+	};
+	typedef const_iterator iterator;
+
+	const_iterator begin() const {
+		return this->ranges.empty() ? this->end() : const_iterator(&this->ranges, 0, this->ranges[0].first);
+	}
+	const_iterator end() const {
+		return const_iterator(&this->ranges, this->ranges.size(), 0);
+	}
+	size_t size() const {
+		return this->N;
+	}
+	bool empty() const {
+		return this->N == 0;
+	}
+
+	const_iterator find(myint ind) const {
+		size_t i_range = this->rangeAfter(ind);    // first range starting after ind
+		if (i_range > 0 && ind < this->ranges[i_range - 1].second) {
+			return const_iterator(&this->ranges, i_range - 1, ind);
+		}
+		return this->end();
+	}
+	size_t count(myint ind) const {
+		return this->find(ind) != this->end();
+	}
+
+	void insert(myint ind) {
+		this->insertRange(ind, ind + 1);
+	}
+
+	// Insert all indices first ~ last - 1, merging with the ranges it touches or overlaps
+	void insertRange(myint first, myint last) {
+		if (first >= last) {
+			return;
+		}
+		if (this->ranges.empty() || first > this->ranges.back().second) {    // common cases: append or extend the last range
+			this->ranges.emplace_back(first, last);
+			this->N += last - first;
+			return;
+		}
+		if (first >= this->ranges.back().first) {
+			this->N += max(last - this->ranges.back().second, (myint)0);
+			this->ranges.back().second = max(last, this->ranges.back().second);
+			return;
+		}
+		size_t i_first = this->rangeAfter(first);
+		if (i_first > 0 && first <= this->ranges[i_first - 1].second) {     // touches the range before
+			i_first--;
+		}
+		size_t i_last = this->rangeAfter(last);                            // ranges i_first ~ i_last - 1 get merged
+		if (i_first < i_last) {
+			first = min(first, this->ranges[i_first].first);
+			last = max(last, this->ranges[i_last - 1].second);
+		}
+		for (size_t i_range = i_first; i_range < i_last; i_range++) {
+			this->N -= this->ranges[i_range].second - this->ranges[i_range].first;
+		}
+		this->ranges.erase(this->ranges.begin() + i_first, this->ranges.begin() + i_last);
+		this->ranges.insert(this->ranges.begin() + i_first, make_pair(first, last));
+		this->N += last - first;
+	}
+
+	// True if the set is exactly first ~ last - 1
+	bool isRange(myint first, myint last) const {
+		return (first >= last) ? this->empty() : (this->ranges.size() == 1 && this->ranges[0].first == first && this->ranges[0].second == last);
+	}
+
+	void clear() {
+		vector<pair<myint, myint>>().swap(this->ranges);
+		this->N = 0;
+	}
+
+	// The ranges [first, last) in ascending order, e.g. to copy the set
+	const vector<pair<myint, myint>> &rangeList() const {
+		return this->ranges;
+	}
+
+private:
+	// Index of the first range whose first index is larger than ind
+	size_t rangeAfter(myint ind) const {
+		if (this->ranges.size() == 1) {
+			return (ind < this->ranges[0].first) ? 0 : 1;
+		}
+		return upper_bound(this->ranges.begin(), this->ranges.end(), ind,
+			[](myint value, const pair<myint, myint> &range) { return value < range.first; }) - this->ranges.begin();
+	}
+
+	vector<pair<myint, myint>> ranges;    // sorted, disjoint and not touching
+	myint N = 0;                          // num of indices
+};
+
 class fdtdMesh {
 	/* Mesh information */
 public:
@@ -193,6 +826,7 @@ public:
 	int freqScale;
 
 	/* Discretization information*/
+	fdtdMeshPolicy meshPolicy;    // runtime mesh-density policy
 	myint nx, ny, nz;    // number of nodes along x, y, z
 
 	double *xn, *yn, *zn;    // coordinates of the nodes along x, y, z
@@ -228,8 +862,8 @@ public:
 	int *bd_node1;   //lower PEC
 	int *bd_node2;   //upper PEC
 	int *bd_edge;
-	set<myint> ubde, lbde;    // upper boundary edge and lower boundary edge
-	set<myint> ubdn, lbdn;    // upper boundary node and lower boundary node
+	indexRangeSet ubde, lbde;    // upper boundary edge and lower boundary edge
+	indexRangeSet ubdn, lbdn;    // upper boundary node and lower boundary node
 	myint* mapEdge;   // map the original edges to the new edge # with upper and lower PEC boundaries
 	myint* mapEdgeR;    // map the new edge # to the original edges
 	int bden;    // boundary edge number
@@ -241,7 +875,7 @@ public:
 	vector<double> stackBegCoor;
 	vector<double> stackEndCoor;
 	vector<string> stackName;
-	vector<double> eps;
+	vector<double> eps;                   // D_eps: permittivity of each edge after PEC removal (set by matrixConstruction())
 	vector<double> stackEpsn;
 	vector<double> stackSign;
 	double *stackCdtMark;
@@ -250,12 +884,13 @@ public:
 	vector<fdtdOneCondct> conductorIn;
 	myint numCdtRow;                      // how many input rows
 	myint numCdt;                         // number of isolated conductors in design
-	myint *markEdge;                      // mark if this edge is inside a conductor
-	myint *markCell;
+	mycdt *markEdge;                      // mark if this edge is inside a conductor
+	mycdt *markCell;
 	myint *cdtNumNode;                    // number of nodes along each isolated conductor
-	double *sig;
+	double *sig;                          // D_sig: conductivity of each edge after PEC removal (set by matrixConstruction())
 	fdtdCdt *conductor;                   // information about isolated conductors
-	myint *markNode;                      // mark this node if it is inside the conductor
+	mycdt *markNode;                      // mark this node if it is inside the conductor
+	bool meshArraysShared;                // markEdge, markNode, markCell, mapEdge, mapEdgeR, sig, conductor nodes and S live in a meshShare window, read-only and not freed here
 	vector<vector<int>> edgeCell;         // for each cell which edge is around it
 	vector<vector<double>> edgeCellArea;  // for each cell the area of the perpendicular rectangle
 	vector<int> acu_cnno;                 // accumulated conductor number of nodes
@@ -345,9 +980,10 @@ public:
 								  /* Port information */
 	int numPorts;
 	vector<fdtdPort> portCoor;
+	vector<int> sourcePorts;        // indices of the excited ports (SOURCE block), every port responds
 
-	/* Current sources */
-	double *J;
+	/* Current source of the port being solved, nonzero only at its port edges */
+	sparseExcitation J;
 
 	/* Current V0c,s^T*I matrix */
 	complex<double> *v0csJ;
@@ -435,11 +1071,14 @@ public:
 		this->SRowId = NULL;
 		this->SColId = NULL;
 		this->Sval = NULL;
+		this->meshArraysShared = false;
 		this->y = NULL;
-		this->J = NULL;
 		this->v0csJ = NULL;
 		this->Y = NULL;
 
+		// Use default mesh policy unless the simulation input file overrides it
+		this->meshPolicy = fdtdMeshPolicy();
+
 		// Set all vectors to empty vectors
 		this->nodeEdge = {};
 		this->nodeEdgea = {};
@@ -1790,19 +2429,9 @@ public:
 
 	/* Generate V0d: both V0d1 and V0d2 are put into V0d1 */
 	void merge_v0d1(double block1_x, double block1_y, double block2_x, double block2_y, double block3_x, double block3_y, myint &v0d1num, myint &leng_v0d1, myint &v0d1anum, myint &leng_v0d1a, myint *map, double sideLen) {
-		int *visited;
-		clock_t t1;
-		double ratio;
-		double startx, starty;    // the start coordinates of each block
-		queue<int> st;    // dfs stack
-						  //vector<int> ind;
-		int indsize;
-
 		myint indi = 0;
-		int indx, indy;
 		int mark;
-		int indnum;
-		int *markLayerNode = (int*)calloc(this->N_node_s, sizeof(int));
+		vector<bool> markLayerNode(this->N_node_s, false);
 		/* Mark layer nodes from port sides */
 		for (int indPort = 0; indPort < this->numPorts; indPort++) {
 
@@ -1821,581 +2450,116 @@ public:
 
 
 		/* V0d1 generation */
-		int count = 1;    /* count which box it is */
-		clock_t t2 = clock();
-		unordered_map<myint, double> va, v;
-		vector<set<myint>> node_group;
-		set<myint> base;
-		myint eno, nno;
-		double lx_avg, ly_avg, lz_avg;
-		double t = 0., ta = 0.;
-		myint ix = 0, iy = 0, iz = 0;
-		myint node1, node2;
-		int nodegs;   // node group #
-		for (int iz = 0; iz < this->nz; iz++) {    // merge on each layer
-			visited = (int*)calloc(this->nx * this->ny, sizeof(int));
-			for (int ix = 0; ix < this->nx; ix++) {
-				for (int iy = 0; iy < this->ny; iy++) {
-					nno = iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy;
-					if ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(nno) == this->lbdn.end() && this->ubdn.find(nno) == this->ubdn.end())) {   // if this node is not boundary node
-						if (visited[ix * (this->N_cell_y + 1) + iy] == 0 && this->markNode[iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy] == 0) {
-							if (markLayerNode[ix * (this->N_cell_y + 1) + iy] == 0 && !this->markProSide[iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy]) {    // this point is not visited and it is outside the conductor, not in the projection of the excited conductor
-																																									 //if (!ind.empty())
-																																									 //    ind.clear();
-								startx = this->xn[ix];
-								starty = this->yn[iy];
-								node_group.push_back(base);
-								nodegs = node_group.size() - 1;
-								node_group[nodegs].insert(iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy);
-								map[iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy] = count;
-								//ind.push_back(iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy);
-								st.push(ix * (this->N_cell_y + 1) + iy);
-								visited[ix * (this->N_cell_y + 1) + iy] = 1;
-
-								while (!st.empty()) {
-									indx = (st.front()) / (this->N_cell_y + 1);
-									indy = st.front() % (this->N_cell_y + 1);
-									if (indx != this->nx - 1) {    // it must have a right x edge, thus right x node
-										if ((this->xn[indx + 1] - startx) >= 0 && (this->xn[indx + 1] - startx) <= block1_x && (this->yn[indy] - starty) >= 0 && (this->yn[indy] - starty) <= block1_y) {   // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() + this->N_cell_y + 1] == 0
-												&& visited[(indx + 1) * (this->N_cell_y + 1) + indy] == 0
-												&& markLayerNode[(indx + 1) * (this->N_cell_y + 1) + indy] == 0
-												&& !this->markProSide[iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited, not in the markLayerNode (Projection of the excited conductors), not in the projection side, not among the boundary nodes
-												st.push((indx + 1)*(this->N_cell_y + 1) + indy);
-												visited[(indx + 1)*(this->N_cell_y + 1) + indy] = 1;
-												map[iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy);
-											}
-										}
-									}
-									if (indx != 0) {    // it must have a left x edge, thus left x node
-										if ((this->xn[indx - 1] - startx) >= 0 && (this->xn[indx - 1] - startx) <= block1_x && (this->yn[indy] - starty) >= 0 && (this->yn[indy] - starty) <= block1_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() - this->N_cell_y - 1] == 0
-												&& visited[(indx - 1) * (this->N_cell_y + 1) + indy] == 0
-												&& markLayerNode[(indx - 1) * (this->N_cell_y + 1) + indy] == 0 && !this->markProSide[iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited, not in the markLayerNode (Projection of the excited conductors), not in the projection side, not among the boundary nodes
-
-												st.push((indx - 1)*(this->N_cell_y + 1) + indy);
-												visited[(indx - 1)*(this->N_cell_y + 1) + indy] = 1;
-												map[iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy);
-											}
-										}
-									}
-									if (indy != this->ny - 1) {    // it must have a farther y edge, thus farther y node
-										if ((this->xn[indx] - startx) >= 0 && (this->xn[indx] - startx) <= block1_x && (this->yn[indy + 1] - starty) >= 0 && (this->yn[indy + 1] - starty) <= block1_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() + 1] == 0
-												&& visited[indx * (this->N_cell_y + 1) + indy + 1] == 0
-												&& markLayerNode[indx * (this->N_cell_y + 1) + indy + 1] == 0
-												&& !this->markProSide[iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy + 1]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy + 1) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy + 1) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited
-
-												st.push((indx)*(this->N_cell_y + 1) + indy + 1);
-												visited[(indx)*(this->N_cell_y + 1) + indy + 1] = 1;
-												map[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1);
-											}
-										}
-									}
-									if (indy != 0) {    // it must have a closer y edge, thus closer y node
-										if ((this->xn[indx] - startx) >= 0 && (this->xn[indx] - startx) <= block1_x && (this->yn[indy - 1] - starty) >= 0 && (this->yn[indy - 1] - starty) <= block1_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() - 1] == 0
-												&& visited[(indx)* (this->N_cell_y + 1) + indy - 1] == 0
-												&& markLayerNode[(indx)* (this->N_cell_y + 1) + indy - 1] == 0
-												&& !this->markProSide[iz * this->N_node_s + (indx)* (this->N_cell_y + 1) + indy - 1]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy - 1) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy - 1) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited
-
-												st.push((indx)*(this->N_cell_y + 1) + indy - 1);
-												visited[(indx)*(this->N_cell_y + 1) + indy - 1] = 1;
-												map[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1);
-											}
-										}
-									}
-									st.pop();
-								}
-
-								for (auto ndi : node_group[nodegs]) {
-									indx = (ndi % this->N_node_s) / (this->N_cell_y + 1);
-									indy = (ndi % this->N_node_s) % (this->N_cell_y + 1);
-									avg_length(iz, indy, indx, lx_avg, ly_avg, lz_avg);
-									if (iz != 0) {    // this node is not on the bottom plane
-										eno = (iz - 1) * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the lower edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (iz != this->nz - 1) {   // this node is not on the top plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the upper edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indx != 0) {    // this node is not on the left plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + (indx - 1) * (this->N_cell_y + 1) + indy;    // the left edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-
-									}
-									if (indx != this->nx - 1) {    // this node is not on the right plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + indx * (this->N_cell_y + 1) + indy;    // the right edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indy != 0) {    // this node is not on the front plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy - 1;    // the front edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indy != this->ny - 1) {   // this node is not on the back plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy;    // the back edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
+		/* Nodes only merge with nodes of the same layer, so the layers are merged concurrently, each into its own sorted node groups.
+		The groups of layer iz are layerNode[iz][layerStart[iz][g] ~ layerStart[iz][g + 1] - 1] */
+		auto isBoundary = [this](int iz, myint nno) {    // node on the top or bottom plane among the boundary nodes
+			return (iz == 0 || iz == this->nz - 1) && (this->lbdn.find(nno) != this->lbdn.end() || this->ubdn.find(nno) != this->ubdn.end());
+		};
+		auto nodeKind = [&](int iz, myint inLayer) {    // 1: in the dielectric, 2: in the projection of the excited conductors, 3: in the projection side
+			if (this->markProSide[iz * this->N_node_s + inLayer]) {
+				return 3;
+			}
+			return (markLayerNode[inLayer] == 1) ? 2 : 1;
+		};
+		vector<vector<myint>> layerNode(this->nz), layerStart(this->nz);
+#pragma omp parallel
+		{
+			vector<bool> visited;    // one bit per node of the layer
+			queue<int> st;    // bfs queue
+#pragma omp for schedule(dynamic, 1)
+			for (int iz = 0; iz < this->nz; iz++) {    // merge on each layer
+				vector<myint> &node = layerNode[iz];
+				layerStart[iz].assign(1, 0);
+				visited.assign(this->nx * this->ny, false);
+				for (int ix = 0; ix < this->nx; ix++) {
+					for (int iy = 0; iy < this->ny; iy++) {
+						myint nno = iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy;
+						if (isBoundary(iz, nno) || visited[ix * (this->N_cell_y + 1) + iy] || this->markNode[nno] != 0) {
+							continue;
+						}
+						/* this point is not visited and it is outside the conductor, grow its group within the block of its kind */
+						int kind = nodeKind(iz, ix * (this->N_cell_y + 1) + iy);
+						double block_x = (kind == 1) ? block1_x : ((kind == 2) ? block2_x : block3_x);
+						double block_y = (kind == 1) ? block1_y : ((kind == 2) ? block2_y : block3_y);
+						double startx = this->xn[ix];    // the start coordinates of each block
+						double starty = this->yn[iy];
+						auto tryNode = [&](int jx, int jy) {    // this node is within the block area, in dielectric, not visited, of the same kind and not among the boundary nodes
+							if ((this->xn[jx] - startx) >= 0 && (this->xn[jx] - startx) <= block_x && (this->yn[jy] - starty) >= 0 && (this->yn[jy] - starty) <= block_y) {
+								myint inLayer = jx * (this->N_cell_y + 1) + jy;
+								if (this->markNode[iz * this->N_node_s + inLayer] == 0 && !visited[inLayer] && nodeKind(iz, inLayer) == kind && !isBoundary(iz, iz * this->N_node_s + inLayer)) {
+									st.push(inLayer);
+									visited[inLayer] = 1;
+									node.push_back(iz * this->N_node_s + inLayer);
 								}
-
-								count++;
 							}
-
-							else if (markLayerNode[ix * (this->N_cell_y + 1) + iy] == 1 && !this->markProSide[iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy]) {//&& this->exciteCdtLayer[iz] == 1) {    // this point is not visited and it is outside the conductor, in the projection of the excited conductor
-								startx = this->xn[ix];
-								starty = this->yn[iy];
-
-								map[iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy] = count;
-								st.push(ix * (this->N_cell_y + 1) + iy);
-								visited[ix * (this->N_cell_y + 1) + iy] = 1;
-								node_group.push_back(base);
-								nodegs = node_group.size() - 1;
-								node_group[nodegs].insert(iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy);
-								while (!st.empty()) {
-									mark = 0;
-									indx = (st.front()) / (this->N_cell_y + 1);
-									indy = st.front() % (this->N_cell_y + 1);
-
-									if (indx != this->nx - 1) {    // it must have a right x edge, thus right x node
-										if ((this->xn[indx + 1] - startx) >= 0 && (this->xn[indx + 1] - startx) <= block2_x && (this->yn[indy] - starty) >= 0 && (this->yn[indy] - starty) <= block2_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() + this->N_cell_y + 1] == 0
-												&& visited[(indx + 1) * (this->N_cell_y + 1) + indy] == 0
-												&& markLayerNode[(indx + 1) * (this->N_cell_y + 1) + indy] == 1
-												&& !this->markProSide[iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited and not the boundary nodes
-
-												st.push((indx + 1)*(this->N_cell_y + 1) + indy);
-												visited[(indx + 1)*(this->N_cell_y + 1) + indy] = 1;
-												map[iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy);
-											}
-										}
-									}
-
-									if (indx != 0) {    // it must have a left x edge, thus left x node
-										if ((this->xn[indx - 1] - startx) >= 0 && (this->xn[indx - 1] - startx) <= block2_x && (this->yn[indy] - starty) >= 0 && (this->yn[indy] - starty) <= block2_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() - this->N_cell_y - 1] == 0
-												&& visited[(indx - 1) * (this->N_cell_y + 1) + indy] == 0
-												&& markLayerNode[(indx - 1) * (this->N_cell_y + 1) + indy] == 1
-												&& !this->markProSide[iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited
-
-												st.push((indx - 1)*(this->N_cell_y + 1) + indy);
-												visited[(indx - 1)*(this->N_cell_y + 1) + indy] = 1;
-												map[iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy);
-											}
-										}
-									}
-									if (indy != this->ny - 1) {    // it must have a farther y edge, thus farther y node
-										if ((this->xn[indx] - startx) >= 0 && (this->xn[indx] - startx) <= block2_x && (this->yn[indy + 1] - starty) >= 0 && (this->yn[indy + 1] - starty) <= block2_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() + 1] == 0
-												&& visited[indx * (this->N_cell_y + 1) + indy + 1] == 0
-												&& markLayerNode[indx * (this->N_cell_y + 1) + indy + 1] == 1
-												&& !this->markProSide[iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy + 1]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy + 1) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy + 1) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited
-
-												st.push((indx)*(this->N_cell_y + 1) + indy + 1);
-												visited[(indx)*(this->N_cell_y + 1) + indy + 1] = 1;
-												map[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1);
-											}
-										}
-									}
-									if (indy != 0) {    // it must have a closer y edge, thus closer y node
-										if ((this->xn[indx] - startx) >= 0 && (this->xn[indx] - startx) <= block2_x && (this->yn[indy - 1] - starty) >= 0 && (this->yn[indy - 1] - starty) <= block2_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() - 1] == 0
-												&& visited[(indx)* (this->N_cell_y + 1) + indy - 1] == 0
-												&& markLayerNode[(indx)* (this->N_cell_y + 1) + indy - 1] == 1
-												&& !this->markProSide[iz * this->N_node_s + (indx)* (this->N_cell_y + 1) + indy - 1]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy - 1) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy - 1) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited
-
-												st.push((indx)*(this->N_cell_y + 1) + indy - 1);
-												visited[(indx)*(this->N_cell_y + 1) + indy - 1] = 1;
-												map[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1);
-											}
-										}
-									}
-									st.pop();
-								}
-
-								for (auto ndi : node_group[nodegs]) {
-									indx = (ndi % this->N_node_s) / (this->N_cell_y + 1);
-									indy = (ndi % this->N_node_s) % (this->N_cell_y + 1);
-									avg_length(iz, indy, indx, lx_avg, ly_avg, lz_avg);
-									if (iz != 0) {    // this node is not on the bottom plane
-										eno = (iz - 1) * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the lower edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (iz != this->nz - 1) {   // this node is not on the top plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the upper edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indx != 0) {    // this node is not on the left plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + (indx - 1) * (this->N_cell_y + 1) + indy;    // the left edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indx != this->nx - 1) {    // this node is not on the right plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + indx * (this->N_cell_y + 1) + indy;    // the right edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indy != 0) {    // this node is not on the front plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy - 1;    // the front edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indy != this->ny - 1) {   // this node is not on the back plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy;    // the back edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-								}
-								count++;
-
+						};
+						st.push(ix * (this->N_cell_y + 1) + iy);
+						visited[ix * (this->N_cell_y + 1) + iy] = 1;
+						node.push_back(nno);
+						while (!st.empty()) {
+							int indx = st.front() / (this->N_cell_y + 1);
+							int indy = st.front() % (this->N_cell_y + 1);
+							st.pop();
+							if (indx != this->nx - 1) {    // it must have a right x edge, thus right x node
+								tryNode(indx + 1, indy);
 							}
-
-							else {
-								startx = this->xn[ix];
-								starty = this->yn[iy];
-
-								map[iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy] = count;
-								st.push(ix * (this->N_cell_y + 1) + iy);
-								visited[ix * (this->N_cell_y + 1) + iy] = 1;
-								node_group.push_back(base);
-								nodegs = node_group.size() - 1;
-								node_group[nodegs].insert(iz * this->N_node_s + ix * (this->N_cell_y + 1) + iy);
-
-								while (!st.empty()) {
-									mark = 0;
-									indx = (st.front()) / (this->N_cell_y + 1);
-									indy = st.front() % (this->N_cell_y + 1);
-
-									if (indx != this->nx - 1) {    // it must have a right x edge, thus right x node
-										if ((this->xn[indx + 1] - startx) >= 0 && (this->xn[indx + 1] - startx) <= block3_x && (this->yn[indy] - starty) >= 0 && (this->yn[indy] - starty) <= block3_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() + this->N_cell_y + 1] == 0
-												&& visited[(indx + 1) * (this->N_cell_y + 1) + indy] == 0
-												&& this->markProSide[iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + (indx + 1) * (this->N_cell_y + 1) + indy) == this->ubdn.end()))) {    // this node is in the sideLen && this node is not among the boundary nodes
-
-												st.push((indx + 1)*(this->N_cell_y + 1) + indy);
-												visited[(indx + 1)*(this->N_cell_y + 1) + indy] = 1;
-												map[iz * this->N_node_s + (indx + 1)*(this->N_cell_y + 1) + indy] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx + 1)*(this->N_cell_y + 1) + indy);
-											}
-										}
-									}
-									if (indx != 0) {    // it must have a left x edge, thus left x node
-										if ((this->xn[indx - 1] - startx) >= 0 && (this->xn[indx - 1] - startx) <= block3_x && (this->yn[indy] - starty) >= 0 && (this->yn[indy] - starty) <= block3_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() - this->N_cell_y - 1] == 0
-												&& visited[(indx - 1) * (this->N_cell_y + 1) + indy] == 0
-												&& this->markProSide[iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + (indx - 1) * (this->N_cell_y + 1) + indy) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited
-
-												st.push((indx - 1)*(this->N_cell_y + 1) + indy);
-												visited[(indx - 1)*(this->N_cell_y + 1) + indy] = 1;
-												map[iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy);
-											}
-										}
-									}
-									if (indy != this->ny - 1) {    // it must have a farther y edge, thus farther y node
-										if ((this->xn[indx] - startx) >= 0 && (this->xn[indx] - startx) <= block3_x && (this->yn[indy + 1] - starty) >= 0 && (this->yn[indy + 1] - starty) <= block3_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() + 1] == 0
-												&& visited[indx * (this->N_cell_y + 1) + indy + 1] == 0
-												&& this->markProSide[iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy + 1]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy + 1) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy + 1) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited
-
-												st.push((indx)*(this->N_cell_y + 1) + indy + 1);
-												visited[(indx)*(this->N_cell_y + 1) + indy + 1] = 1;
-												map[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1);
-											}
-										}
-									}
-									if (indy != 0) {    // it must have a closer y edge, thus closer y node
-										if ((this->xn[indx] - startx) >= 0 && (this->xn[indx] - startx) <= block3_x && (this->yn[indy - 1] - starty) >= 0 && (this->yn[indy - 1] - starty) <= block3_y) {    // this node is within the block area
-											if (this->markNode[iz * this->N_node_s + st.front() - 1] == 0
-												&& visited[(indx)* (this->N_cell_y + 1) + indy - 1] == 0
-												&& this->markProSide[iz * this->N_node_s + (indx)* (this->N_cell_y + 1) + indy - 1]
-												&& ((iz != 0 && iz != this->nz - 1) || (this->lbdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy - 1) == this->lbdn.end() && this->ubdn.find(iz * this->N_node_s + indx * (this->N_cell_y + 1) + indy - 1) == this->ubdn.end()))) {    // this node is in dielectric and this node is not visited
-
-												st.push((indx)*(this->N_cell_y + 1) + indy - 1);
-												visited[(indx)*(this->N_cell_y + 1) + indy - 1] = 1;
-												map[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1] = count;
-												node_group[nodegs].insert(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1);
-											}
-										}
-									}
-									st.pop();
-								}
-								for (auto ndi : node_group[nodegs]) {
-									indx = (ndi % this->N_node_s) / (this->N_cell_y + 1);
-									indy = (ndi % this->N_node_s) % (this->N_cell_y + 1);
-									avg_length(iz, indy, indx, lx_avg, ly_avg, lz_avg);
-									if (iz != 0) {    // this node is not on the bottom plane
-										eno = (iz - 1) * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the lower edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (iz != this->nz - 1) {   // this node is not on the top plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the upper edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indx != 0) {    // this node is not on the left plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + (indx - 1) * (this->N_cell_y + 1) + indy;    // the left edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indx != this->nx - 1) {    // this node is not on the right plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + indx * (this->N_cell_y + 1) + indy;    // the right edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indy != 0) {    // this node is not on the front plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy - 1;    // the front edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-									if (indy != this->ny - 1) {   // this node is not on the back plane
-										eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy;    // the back edge
-										compute_edgelink(eno, node1, node2);
-										if (node1 != ndi) {
-											if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-										else if (node2 != ndi) {
-											if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-												v0d1num++;
-												v0d1anum++;
-											}
-										}
-									}
-								}
-								count++;
+							if (indx != 0) {    // it must have a left x edge, thus left x node
+								tryNode(indx - 1, indy);
+							}
+							if (indy != this->ny - 1) {    // it must have a farther y edge, thus farther y node
+								tryNode(indx, indy + 1);
+							}
+							if (indy != 0) {    // it must have a closer y edge, thus closer y node
+								tryNode(indx, indy - 1);
 							}
 						}
+						sort(node.begin() + layerStart[iz].back(), node.end());
+						layerStart[iz].push_back(node.size());
 					}
 				}
 			}
-			free(visited); visited = NULL;
 		}
 
+		/* Columns are numbered layer by layer as in a serial sweep: flatten the groups and mark each node with its column plus one */
+		vector<myint> layerCol(this->nz + 1, 0), layerOff(this->nz + 1, 0);
+		for (int iz = 0; iz < this->nz; iz++) {
+			layerCol[iz + 1] = layerCol[iz] + layerStart[iz].size() - 1;
+			layerOff[iz + 1] = layerOff[iz] + layerNode[iz].size();
+		}
+		myint numGroup = layerCol[this->nz];
+		vector<myint> groupNode(layerOff[this->nz]), groupStart(numGroup + 1);
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int iz = 0; iz < this->nz; iz++) {
+			for (myint g = 0; g < (myint)layerStart[iz].size() - 1; g++) {
+				groupStart[layerCol[iz] + g] = layerOff[iz] + layerStart[iz][g];
+				for (myint k = layerStart[iz][g]; k < layerStart[iz][g + 1]; k++) {
+					groupNode[layerOff[iz] + k] = layerNode[iz][k];
+					map[layerNode[iz][k]] = layerCol[iz] + g + 1;
+				}
+			}
+			vector<myint>().swap(layerNode[iz]);
+			vector<myint>().swap(layerStart[iz]);
+		}
+		groupStart[numGroup] = layerOff[this->nz];
+
+		/* Count the entries of each column, their prefix sums are where each column is written */
+		vector<myint> colStart(numGroup + 1, 0);
+#pragma omp parallel for schedule(dynamic, 256)
+		for (myint g = 0; g < numGroup; g++) {
+			colStart[g + 1] = this->v0GroupColumn(&groupNode[groupStart[g]], groupStart[g + 1] - groupStart[g], g, NULL, NULL, NULL, NULL);
+		}
+		for (myint g = 0; g < numGroup; g++) {
+			colStart[g + 1] += colStart[g];
+		}
+		v0d1num = colStart[numGroup];
+		v0d1anum = colStart[numGroup];
+		int count = numGroup + 1;    /* count which box it is */
+
 		/* V0d2 generation */
-		myint inz, inx, iny;
+		myint ix = 0, iy = 0, iz = 0;
+		myint eno;
+		double lx_avg, ly_avg, lz_avg;
 		int indj;
-		queue<myint> qu;
-		visited = (int*)calloc(this->N_node, sizeof(int));
-		t2 = clock();
 
 		for (indi = 0; indi < this->numCdt; indi++) {
 			//cout << this->conductor[indi].markPort << " ";
@@ -2480,165 +2644,15 @@ public:
 		lx_whole_avg = (this->xn[this->nx - 1] - this->xn[0]) / (this->nx - 1);
 		ly_whole_avg = (this->yn[this->ny - 1] - this->yn[0]) / (this->ny - 1);
 		lz_whole_avg = (this->zn[this->nz - 1] - this->zn[0]) / (this->nz - 1);
-		leng_v0d1 = 0;
-		leng_v0d1a = 0;
-		v0d1num = 0;
-		v0d1anum = 0;
-		for (nodegs = 0; nodegs < node_group.size(); nodegs++) {
-			for (auto ndi : node_group[nodegs]) {
-				iz = ndi / (this->N_node_s);
-				indx = (ndi % this->N_node_s) / (this->N_cell_y + 1);
-				indy = (ndi % this->N_node_s) % (this->N_cell_y + 1);
-				avg_length(iz, indy, indx, lx_avg, ly_avg, lz_avg);
-				if (iz != 0) {    // this node is not on the bottom plane
-					eno = (iz - 1) * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the lower edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = -1 / (this->zn[iz] - this->zn[iz - 1]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = -1 / lz_avg; // -lx_avg * ly_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = -1 / (this->zn[iz] - this->zn[iz - 1]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = -1 / lz_avg; // -lx_avg * ly_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-				}
-				if (iz != this->nz - 1) {   // this node is not on the top plane
-					eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the upper edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = 1 / (this->zn[iz + 1] - this->zn[iz]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = 1 / lz_avg; // lx_avg * ly_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = 1 / (this->zn[iz + 1] - this->zn[iz]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = 1 / lz_avg; // lx_avg * ly_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-				}
-				if (indx != 0) {    // this node is not on the left plane
-					eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + (indx - 1) * (this->N_cell_y + 1) + indy;    // the left edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = -1 / (this->xn[indx] - this->xn[indx - 1]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = -1 / lx_avg; // -ly_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = -1 / (this->xn[indx] - this->xn[indx - 1]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = -1 / lx_avg; // -ly_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-				}
-				if (indx != this->nx - 1) {    // this node is not on the right plane
-					eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + indx * (this->N_cell_y + 1) + indy;    // the right edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = 1 / (this->xn[indx + 1] - this->xn[indx]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = 1 / lx_avg; // ly_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = 1 / (this->xn[indx + 1] - this->xn[indx]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = 1 / lx_avg; // ly_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-				}
-				if (indy != 0) {    // this node is not on the front plane
-					eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy - 1;    // the front edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = -1 / (this->yn[indy] - this->yn[indy - 1]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = -1 / ly_avg; // -lx_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = -1 / (this->yn[indy] - this->yn[indy - 1]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = -1 / ly_avg; // -lx_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-				}
-				if (indy != this->ny - 1) {   // this node is not on the back plane
-					eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy;    // the back edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = 1 / (this->yn[indy + 1] - this->yn[indy]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = 1 / ly_avg; // lx_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0d1RowId[v0d1num] = eno;
-							this->v0d1ColId[v0d1num] = leng_v0d1;
-							this->v0d1val[v0d1num] = 1 / (this->yn[indy + 1] - this->yn[indy]);
-							v0d1num++;
-							this->v0d1aval[v0d1anum] = 1 / ly_avg; // lx_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0d1anum++;
-						}
-					}
-				}
-			}
-			leng_v0d1++;
-			leng_v0d1a++;
-		}
-
+#pragma omp parallel for schedule(dynamic, 256)
+		for (myint g = 0; g < numGroup; g++) {
+			myint c = colStart[g];
+			this->v0GroupColumn(&groupNode[groupStart[g]], groupStart[g + 1] - groupStart[g], g, &this->v0d1RowId[c], &this->v0d1ColId[c], &this->v0d1val[c], &this->v0d1aval[c]);
+		}
+		leng_v0d1 = numGroup;
+		leng_v0d1a = numGroup;
+		v0d1num = colStart[numGroup];
+		v0d1anum = colStart[numGroup];
 		for (indi = 0; indi < this->numCdt; indi++) {
 			if (this->conductor[indi].markPort == -1) {
 				continue;
@@ -2726,114 +2740,186 @@ public:
 				leng_v0d1a++;
 			}
 		}
-		//ofstream out;
-		//out.open("V0d.txt", std::ofstream::out | std::ofstream::trunc);
-		//for (indi = 0; indi < v0d1num; indi++) {
-		//    out << this->v0d1RowId[indi] << " " << this->v0d1ColId[indi] << " ";
-		//    out << std::setprecision(15) << this->v0d1val[indi] << endl;
-		//}
-		//out.close();
-		//out.open("V0da.txt", std::ofstream::out | std::ofstream::trunc);
-		//for (indi = 0; indi < v0d1num; indi++) {
-		//    out << this->v0d1RowId[indi] << " " << this->v0d1ColId[indi] << " ";
-		//    out << std::setprecision(15) << this->v0d1aval[indi] << endl;
-		//}
-		//out.close();
-		node_group.clear();
+	}
+
+	/* Column of V0d1 or V0c for one merged node group: an entry on each edge from a node of the group to a node outside it.
+	group: the sorted nodes of the group, all in one layer. With rowId == NULL the entries are only counted.
+	Returns the number of entries, written to rowId[0 ~ num - 1] etc. in the order they are counted. */
+	myint v0GroupColumn(const myint *group, myint groupSize, myint col, myint *rowId, myint *colId, double *val, double *aval) {
+		myint num = 0;
+		for (myint k = 0; k < groupSize; k++) {
+			myint ndi = group[k];
+			int iz = ndi / this->N_node_s;
+			int indx = (ndi % this->N_node_s) / (this->N_cell_y + 1);
+			int indy = (ndi % this->N_node_s) % (this->N_cell_y + 1);
+			double lx_avg, ly_avg, lz_avg;
+			avg_length(iz, indy, indx, lx_avg, ly_avg, lz_avg);
+			auto edgeOut = [&](myint eno, double v, double va) {
+				myint node1, node2;
+				compute_edgelink(eno, node1, node2);
+				if (binary_search(group, group + groupSize, (node1 != ndi) ? node1 : node2)) {    // the other node is in this group
+					return;
+				}
+				if (rowId != NULL) {
+					rowId[num] = eno;
+					colId[num] = col;
+					val[num] = v;
+					aval[num] = va;
+				}
+				num++;
+			};
+			if (iz != 0) {    // this node is not on the bottom plane
+				edgeOut((iz - 1) * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy,    // the lower edge
+					-1 / (this->zn[iz] - this->zn[iz - 1]), -1 / lz_avg);
+			}
+			if (iz != this->nz - 1) {   // this node is not on the top plane
+				edgeOut(iz * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy,    // the upper edge
+					1 / (this->zn[iz + 1] - this->zn[iz]), 1 / lz_avg);
+			}
+			if (indx != 0) {    // this node is not on the left plane
+				edgeOut(iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + (indx - 1) * (this->N_cell_y + 1) + indy,    // the left edge
+					-1 / (this->xn[indx] - this->xn[indx - 1]), -1 / lx_avg);
+			}
+			if (indx != this->nx - 1) {    // this node is not on the right plane
+				edgeOut(iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + indx * (this->N_cell_y + 1) + indy,    // the right edge
+					1 / (this->xn[indx + 1] - this->xn[indx]), 1 / lx_avg);
+			}
+			if (indy != 0) {    // this node is not on the front plane
+				edgeOut(iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy - 1,    // the front edge
+					-1 / (this->yn[indy] - this->yn[indy - 1]), -1 / ly_avg);
+			}
+			if (indy != this->ny - 1) {   // this node is not on the back plane
+				edgeOut(iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy,    // the back edge
+					1 / (this->yn[indy + 1] - this->yn[indy]), 1 / ly_avg);
+			}
+		}
+		return num;
 	}
 
 
 	/* Generate Ad */
-	void generateAd(myint *map, myint v0d1num, myint v0d1anum, myint leng_v0d1, myint& leng_Ad) {
-		unordered_map<myint, unordered_map<myint, double>> Ad1;
-		myint indi, inz, inx, iny, node1, node2;
-
-		for (indi = 0; indi < v0d1anum; indi++) {
-			if (this->v0d1RowId[indi] % (this->N_edge_s + this->N_edge_v) >= this->N_edge_s) {    // this edge is along z axis
-				inz = this->v0d1RowId[indi] / (this->N_edge_s + this->N_edge_v);
-				inx = ((this->v0d1RowId[indi] % (this->N_edge_s + this->N_edge_v)) - this->N_edge_s) / (this->N_cell_y + 1);
-				iny = ((this->v0d1RowId[indi] % (this->N_edge_s + this->N_edge_v)) - this->N_edge_s) % (this->N_cell_y + 1);
-				node1 = inz * this->N_node_s + (this->N_cell_y + 1) * inx + iny;
-				node2 = (inz + 1) * this->N_node_s + (this->N_cell_y + 1) * inx + iny;
-				if (map[node1] != this->v0d1ColId[indi] + 1 && map[node1] != 0) {
-					Ad1[this->v0d1ColId[indi]][map[node1] - 1] += this->v0d1aval[indi] * 1 / (this->zn[inz + 1] - this->zn[inz]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
-					Ad1[this->v0d1ColId[indi]][this->v0d1ColId[indi]] += this->v0d1aval[indi] * (-1) / (this->zn[inz + 1] - this->zn[inz]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
+	void generateAd(myint *map, myint leng_v0d1, myint& leng_Ad) {
+		/* Ad = V0da1'*D_eps*V0d, with v0d1ColId already holding the CSR row pointers of V0d1^T.
+		D_eps is applied inside the product, so no sqrt(D_eps)-scaled copy of V0d1 is kept. */
+		this->galerkinV0(map, this->v0d1ColId, this->v0d1RowId, this->v0d1aval, leng_v0d1,
+			[this](myint eno) { return this->stackEpsn[(eno + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0; }, 1e-8,
+			this->AdRowId, this->AdColId, this->Adval, leng_Ad);
+	}
+
+	/* Galerkin product A = V0a'*D*V0 straight into row-sorted COO (CSR order), one row of A per column of V0 */
+	template <typename EdgeWeight>
+	void galerkinV0(const myint *map, const myint *colPtr, const myint *rowId, const double *vala, myint leng, EdgeWeight weight, double dropTol,
+		myint *&ARowId, myint *&AColId, double *&Aval, myint &leng_A) {
+		/* colPtr:   CSR row pointers of V0^T, the entries of V0 column c are colPtr[c] ~ colPtr[c + 1] - 1
+		rowId:    edge of each entry, vala: V0a value of each entry (V0 and V0a share one sparsity pattern)
+		map:      V0 column of each node plus one, 0 if the node is in no column
+		weight:   D entry of an edge, e.g. eps of its layer (edges of zero weight are skipped)
+		Each edge couples its column with the column of its other end node (a Laplacian stencil), so every
+		row is small and rows are independent: count them in parallel, then fill them in parallel. */
+
+		auto rowOfA = [&](myint c, vector<pair<myint, double>> &row) {
+			row.clear();
+			for (myint indi = colPtr[c]; indi < colPtr[c + 1]; indi++) {
+				myint eno = rowId[indi];
+				double w = weight(eno);
+				if (w == 0.) {
+					continue;
 				}
-				else if (map[node2] != this->v0d1ColId[indi] + 1 && map[node2] != 0) {
-					Ad1[this->v0d1ColId[indi]][map[node2] - 1] += this->v0d1aval[indi] * (-1) / (this->zn[inz + 1] - this->zn[inz]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
-					Ad1[this->v0d1ColId[indi]][this->v0d1ColId[indi]] += this->v0d1aval[indi] * 1 / (this->zn[inz + 1] - this->zn[inz]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
+				myint inz = eno / (this->N_edge_s + this->N_edge_v);
+				myint inLayer = eno % (this->N_edge_s + this->N_edge_v);
+				myint node1, node2;
+				double leng;
+				if (inLayer >= this->N_edge_s) {    // this edge is along z axis
+					myint inx = (inLayer - this->N_edge_s) / (this->N_cell_y + 1);
+					myint iny = (inLayer - this->N_edge_s) % (this->N_cell_y + 1);
+					node1 = inz * this->N_node_s + (this->N_cell_y + 1) * inx + iny;
+					node2 = (inz + 1) * this->N_node_s + (this->N_cell_y + 1) * inx + iny;
+					leng = this->zn[inz + 1] - this->zn[inz];
 				}
-				else {//if (map[this->edgelink[this->v0d1aRowId[indi] * 2]] == 0 || map[this->edgelink[this->v0d1aRowId[indi] * 2] + 1] == 0) {
-					Ad1[this->v0d1ColId[indi]][this->v0d1ColId[indi]] += abs(this->v0d1aval[indi] * 1 / (this->zn[inz + 1] - this->zn[inz]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0);
+				else if (inLayer >= (this->N_cell_y) * (this->N_cell_x + 1)) {    // this edge is along x axis
+					myint inx = (inLayer - (this->N_cell_y) * (this->N_cell_x + 1)) / (this->N_cell_y + 1);
+					myint iny = (inLayer - (this->N_cell_y) * (this->N_cell_x + 1)) % (this->N_cell_y + 1);
+					node1 = inz * this->N_node_s + inx * (this->N_cell_y + 1) + iny;
+					node2 = inz * this->N_node_s + (inx + 1) * (this->N_cell_y + 1) + iny;
+					leng = this->xn[inx + 1] - this->xn[inx];
 				}
-			}
-			else if (this->v0d1RowId[indi] % (this->N_edge_s + this->N_edge_v) >= (this->N_cell_y) * (this->N_cell_x + 1)) {    // this edge is along x axis
-				inz = this->v0d1RowId[indi] / (this->N_edge_s + this->N_edge_v);
-				inx = ((this->v0d1RowId[indi] % (this->N_edge_s + this->N_edge_v)) - (this->N_cell_y) * (this->N_cell_x + 1)) / (this->N_cell_y + 1);
-				iny = ((this->v0d1RowId[indi] % (this->N_edge_s + this->N_edge_v)) - (this->N_cell_y) * (this->N_cell_x + 1)) % (this->N_cell_y + 1);
-				node1 = inz * this->N_node_s + inx * (this->N_cell_y + 1) + iny;
-				node2 = inz * this->N_node_s + (inx + 1) * (this->N_cell_y + 1) + iny;
-				if (map[node1] != this->v0d1ColId[indi] + 1 && map[node1] != 0) {
-					Ad1[this->v0d1ColId[indi]][map[node1] - 1] += this->v0d1aval[indi] * 1 / (this->xn[inx + 1] - this->xn[inx]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
-					Ad1[this->v0d1ColId[indi]][this->v0d1ColId[indi]] += this->v0d1aval[indi] * (-1) / (this->xn[inx + 1] - this->xn[inx]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
+				else {    // this edge is along y axis
+					myint inx = inLayer / this->N_cell_y;
+					myint iny = inLayer % this->N_cell_y;
+					node1 = inz * this->N_node_s + inx * (this->N_cell_y + 1) + iny;
+					node2 = inz * this->N_node_s + inx * (this->N_cell_y + 1) + iny + 1;
+					leng = this->yn[iny + 1] - this->yn[iny];
 				}
-				else if (map[node2] != this->v0d1ColId[indi] + 1 && map[node2] != 0) {
-					Ad1[this->v0d1ColId[indi]][map[node2] - 1] += this->v0d1aval[indi] * (-1) / (this->xn[inx + 1] - this->xn[inx]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
-					Ad1[this->v0d1ColId[indi]][this->v0d1ColId[indi]] += this->v0d1aval[indi] * 1 / (this->xn[inx + 1] - this->xn[inx]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
+
+				double a = vala[indi] / leng * w;
+				if (map[node1] != c + 1 && map[node1] != 0) {
+					row.push_back(make_pair(map[node1] - 1, a));
+					row.push_back(make_pair(c, -a));
 				}
-				else {//if (map[this->edgelink[this->v0d1aRowId[indi] * 2]] == 0 || map[this->edgelink[this->v0d1aRowId[indi] * 2] + 1] == 0) {
-					Ad1[this->v0d1ColId[indi]][this->v0d1ColId[indi]] += abs(this->v0d1aval[indi] * 1 / (this->xn[inx + 1] - this->xn[inx]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0);
+				else if (map[node2] != c + 1 && map[node2] != 0) {
+					row.push_back(make_pair(map[node2] - 1, -a));
+					row.push_back(make_pair(c, a));
 				}
-			}
-			else {    // this edge is along y axis
-				inz = this->v0d1RowId[indi] / (this->N_edge_s + this->N_edge_v);
-				inx = (this->v0d1RowId[indi] % (this->N_edge_s + this->N_edge_v)) / this->N_cell_y;
-				iny = (this->v0d1RowId[indi] % (this->N_edge_s + this->N_edge_v)) % this->N_cell_y;
-				node1 = inz * this->N_node_s + inx * (this->N_cell_y + 1) + iny;
-				node2 = inz * this->N_node_s + inx * (this->N_cell_y + 1) + iny + 1;
-				if (map[node1] != this->v0d1ColId[indi] + 1 && map[node1] != 0) {
-					Ad1[this->v0d1ColId[indi]][map[node1] - 1] += this->v0d1aval[indi] * 1 / (this->yn[iny + 1] - this->yn[iny]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
-					Ad1[this->v0d1ColId[indi]][this->v0d1ColId[indi]] += this->v0d1aval[indi] * (-1) / (this->yn[iny + 1] - this->yn[iny]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
+				else {
+					row.push_back(make_pair(c, abs(a)));
 				}
-				else if (map[node2] != this->v0d1ColId[indi] + 1 && map[node2] != 0) {
-					Ad1[this->v0d1ColId[indi]][map[node2] - 1] += this->v0d1aval[indi] * (-1) / (this->yn[iny + 1] - this->yn[iny]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
-					Ad1[this->v0d1ColId[indi]][this->v0d1ColId[indi]] += this->v0d1aval[indi] * 1 / (this->yn[iny + 1] - this->yn[iny]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
+			}
+
+			// Sum entries of the same col, then drop the small ones
+			sort(row.begin(), row.end(), [](const pair<myint, double> &x, const pair<myint, double> &y) { return x.first < y.first; });
+			size_t n = 0;
+			for (size_t k = 0; k < row.size(); k++) {
+				if (n > 0 && row[n - 1].first == row[k].first) {
+					row[n - 1].second += row[k].second;
 				}
-				else {//if (map[this->edgelink[this->v0d1aRowId[indi] * 2]] == 0 || map[this->edgelink[this->v0d1aRowId[indi] * 2] + 1] == 0) {
-					Ad1[this->v0d1ColId[indi]][this->v0d1ColId[indi]] += abs(this->v0d1aval[indi] * 1 / (this->yn[iny + 1] - this->yn[iny]) * this->stackEpsn[(this->v0d1RowId[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0);
+				else {
+					row[n++] = row[k];
 				}
 			}
-		}
+			row.resize(n);
+			row.erase(remove_if(row.begin(), row.end(), [dropTol](const pair<myint, double> &x) { return abs(x.second) <= dropTol; }), row.end());
+		};
 
-		for (indi = 0; indi < leng_v0d1; indi++) {
-			leng_Ad += Ad1[indi].size();
+		myint *rowStart = (myint*)calloc(leng + 1, sizeof(myint));
+#pragma omp parallel
+		{
+			vector<pair<myint, double>> row;
+#pragma omp for schedule(dynamic, 256)
+			for (myint c = 0; c < leng; c++) {
+				rowOfA(c, row);
+				rowStart[c + 1] = row.size();
+			}
 		}
+		for (myint c = 0; c < leng; c++) {
+			rowStart[c + 1] += rowStart[c];
+		}
+		leng_A = rowStart[leng];
 
-		this->AdRowId = (myint*)calloc(leng_Ad, sizeof(myint));
-		this->AdColId = (myint*)calloc(leng_Ad, sizeof(myint));
-		this->Adval = (double*)calloc(leng_Ad, sizeof(double));
-		myint indj = 0;
-
-		for (indi = 0; indi < leng_v0d1; indi++) {
-			vector<pair<myint, double>> v(Ad1[indi].begin(), Ad1[indi].end());
-			sort(v.begin(), v.end());
-			for (auto adi : v) {
-				if (abs(adi.second) > 1e-8) {
-					this->AdRowId[indj] = indi;
-					this->AdColId[indj] = adi.first;
-					this->Adval[indj] = adi.second;
+		ARowId = (myint*)malloc(leng_A * sizeof(myint));
+		AColId = (myint*)malloc(leng_A * sizeof(myint));
+		Aval = (double*)malloc(leng_A * sizeof(double));
+#pragma omp parallel
+		{
+			vector<pair<myint, double>> row;
+#pragma omp for schedule(dynamic, 256)
+			for (myint c = 0; c < leng; c++) {
+				rowOfA(c, row);
+				myint indj = rowStart[c];
+				for (const auto &ai : row) {
+					ARowId[indj] = c;
+					AColId[indj] = ai.first;
+					Aval[indj] = ai.second;
 					indj++;
 				}
 			}
-			v.clear();
 		}
-		Ad1.clear();
+		free(rowStart);
 	}
 
 	/* Generate V0c */
 
 	void merge_v0c(double block_x, double block_y, double block2_x, double block2_y, myint &v0cnum, myint &leng_v0c, myint &v0canum, myint &leng_v0ca, myint *map) {
-		int *visited;
+		vector<bool> visited;    // one bit per node
 		double ratio;
 		double startx, starty;    // the start coordinates of each block
 		queue<int> st;    // dfs stack
@@ -2851,17 +2937,15 @@ public:
 		myint ix = 0, iy = 0, iz = 0;
 		myint ic = 0;
 		int n;
-		int map_count = 1;
+		myint map_count = 1;
 		myint eno;
 		double lx_avg, ly_avg, lz_avg;
 		myint node1, node2;
 
 
 		unordered_map<myint, double> v, va;
-		visited = (int*)calloc(this->N_node, sizeof(int));
-		vector<set<myint>> node_group;
-		set<myint> base;
-		int nodegs;
+		visited.assign(this->N_node, false);
+		vector<myint> groupNode, groupStart(1, 0);    // sorted nodes of each group, group g is groupNode[groupStart[g] ~ groupStart[g + 1] - 1]
 
 		for (ic = 0; ic < this->numCdt; ic++) {
 			if (this->conductor[ic].markPort <= 0) {    // not excited conductors
@@ -2884,9 +2968,7 @@ public:
 						st.push(ix * (this->N_cell_y + 1) + iy);
 						visited[this->conductor[ic].node[jc]] = 1;
 						map[this->conductor[ic].node[jc]] = map_count;
-						node_group.push_back(base);
-						nodegs = node_group.size() - 1;
-						node_group[nodegs].insert(this->conductor[ic].node[jc]);
+						groupNode.push_back(this->conductor[ic].node[jc]);
 						while (!st.empty()) {
 							mark = 0;
 							indx = (st.front()) / (this->N_cell_y + 1);
@@ -2899,7 +2981,7 @@ public:
 										st.push((indx + 1)*(this->N_cell_y + 1) + indy);
 										visited[iz * this->N_node_s + (indx + 1)*(this->N_cell_y + 1) + indy] = 1;
 										map[iz * this->N_node_s + (indx + 1)*(this->N_cell_y + 1) + indy] = map_count;
-										node_group[nodegs].insert(iz * this->N_node_s + (indx + 1)*(this->N_cell_y + 1) + indy);
+										groupNode.push_back(iz * this->N_node_s + (indx + 1)*(this->N_cell_y + 1) + indy);
 									}
 								}
 							}
@@ -2912,7 +2994,7 @@ public:
 										st.push((indx - 1)*(this->N_cell_y + 1) + indy);
 										visited[iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy] = 1;
 										map[iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy] = map_count;
-										node_group[nodegs].insert(iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy);
+										groupNode.push_back(iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy);
 										//mark = 1;
 										//continue;
 									}
@@ -2927,7 +3009,7 @@ public:
 										st.push((indx)*(this->N_cell_y + 1) + indy + 1);
 										visited[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1] = 1;
 										map[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1] = map_count;
-										node_group[nodegs].insert(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1);
+										groupNode.push_back(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1);
 										//mark = 1;
 										//continue;
 									}
@@ -2942,7 +3024,7 @@ public:
 										st.push((indx)*(this->N_cell_y + 1) + indy - 1);
 										visited[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1] = 1;
 										map[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1] = map_count;
-										node_group[nodegs].insert(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1);
+										groupNode.push_back(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1);
 										//mark = 1;
 										//continue;
 									}
@@ -2952,113 +3034,14 @@ public:
 							st.pop();
 							//}
 						}
-						for (auto ndi : node_group[nodegs]) {
-							indx = (ndi % this->N_node_s) / (this->N_cell_y + 1);
-							indy = (ndi % this->N_node_s) % (this->N_cell_y + 1);
-							avg_length(iz, indy, indx, lx_avg, ly_avg, lz_avg);
-							if (iz != 0) {    // this node is not on the bottom plane
-								eno = (iz - 1) * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the lower edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-							if (iz != this->nz - 1) {   // this node is not on the top plane
-								eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the upper edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-							if (indx != 0) {    // this node is not on the left plane
-								eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + (indx - 1) * (this->N_cell_y + 1) + indy;    // the left edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-							if (indx != this->nx - 1) {    // this node is not on the right plane
-								eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + indx * (this->N_cell_y + 1) + indy;    // the right edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-							if (indy != 0) {    // this node is not on the front plane
-								eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy - 1;    // the front edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-							if (indy != this->ny - 1) {   // this node is not on the back plane
-								eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy;    // the back edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-						}
+						sort(groupNode.begin() + groupStart.back(), groupNode.end());
+						groupStart.push_back(groupNode.size());
 						map_count++;
 					}
 				}
 
-				if (leng_v0c > this->acu_cnno.back()) {
-					this->acu_cnno.push_back(leng_v0c);
+				if (map_count - 1 > this->acu_cnno.back()) {
+					this->acu_cnno.push_back(map_count - 1);
 				}
 				//free(visited); visited = NULL;
 			}
@@ -3080,9 +3063,7 @@ public:
 						st.push(ix * (this->N_cell_y + 1) + iy);
 						visited[this->conductor[ic].node[jc]] = 1;
 						map[this->conductor[ic].node[jc]] = map_count;
-						node_group.push_back(base);
-						nodegs = node_group.size() - 1;
-						node_group[nodegs].insert(this->conductor[ic].node[jc]);
+						groupNode.push_back(this->conductor[ic].node[jc]);
 						while (!st.empty()) {
 							mark = 0;
 							indx = (st.front()) / (this->N_cell_y + 1);
@@ -3093,7 +3074,7 @@ public:
 										st.push((indx + 1)*(this->N_cell_y + 1) + indy);
 										visited[iz * this->N_node_s + (indx + 1)*(this->N_cell_y + 1) + indy] = 1;
 										map[iz * this->N_node_s + (indx + 1)*(this->N_cell_y + 1) + indy] = map_count;
-										node_group[nodegs].insert(iz * this->N_node_s + (indx + 1)*(this->N_cell_y + 1) + indy);
+										groupNode.push_back(iz * this->N_node_s + (indx + 1)*(this->N_cell_y + 1) + indy);
 										//mark = 1;
 										//continue;
 									}
@@ -3106,7 +3087,7 @@ public:
 										st.push((indx - 1)*(this->N_cell_y + 1) + indy);
 										visited[iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy] = 1;
 										map[iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy] = map_count;
-										node_group[nodegs].insert(iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy);
+										groupNode.push_back(iz * this->N_node_s + (indx - 1)*(this->N_cell_y + 1) + indy);
 										//mark = 1;
 										//continue;
 									}
@@ -3119,7 +3100,7 @@ public:
 										st.push((indx)*(this->N_cell_y + 1) + indy + 1);
 										visited[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1] = 1;
 										map[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1] = map_count;
-										node_group[nodegs].insert(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1);
+										groupNode.push_back(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy + 1);
 										//mark = 1;
 										//continue;
 									}
@@ -3132,7 +3113,7 @@ public:
 										st.push((indx)*(this->N_cell_y + 1) + indy - 1);
 										visited[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1] = 1;
 										map[iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1] = map_count;
-										node_group[nodegs].insert(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1);
+										groupNode.push_back(iz * this->N_node_s + (indx)*(this->N_cell_y + 1) + indy - 1);
 										//mark = 1;
 										//continue;
 									}
@@ -3142,289 +3123,45 @@ public:
 							st.pop();
 							//}
 						}
-						for (auto ndi : node_group[nodegs]) {
-							indx = (ndi % this->N_node_s) / (this->N_cell_y + 1);
-							indy = (ndi % this->N_node_s) % (this->N_cell_y + 1);
-							avg_length(iz, indy, indx, lx_avg, ly_avg, lz_avg);
-							if (iz != 0) {    // this node is not on the bottom plane
-								eno = (iz - 1) * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the lower edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-							if (iz != this->nz - 1) {   // this node is not on the top plane
-								eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the upper edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-							if (indx != 0) {    // this node is not on the left plane
-								eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + (indx - 1) * (this->N_cell_y + 1) + indy;    // the left edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-							if (indx != this->nx - 1) {    // this node is not on the right plane
-								eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + indx * (this->N_cell_y + 1) + indy;    // the right edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-							if (indy != 0) {    // this node is not on the front plane
-								eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy - 1;    // the front edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-							if (indy != this->ny - 1) {   // this node is not on the back plane
-								eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy;    // the back edge
-								compute_edgelink(eno, node1, node2);
-								if (node1 != ndi) {
-									if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-								else if (node2 != ndi) {
-									if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-										v0cnum++;
-										v0canum++;
-									}
-								}
-							}
-						}
+						sort(groupNode.begin() + groupStart.back(), groupNode.end());
+						groupStart.push_back(groupNode.size());
 						map_count++;
 					}
 				}
 
-				if (leng_v0c > this->acu_cnno.back()) {
-					this->acu_cnno.push_back(leng_v0c);
+				if (map_count - 1 > this->acu_cnno.back()) {
+					this->acu_cnno.push_back(map_count - 1);
 				}
 				//free(visited); visited = NULL;
 
 			}
 		}
+		/* The groups stay in their layers and only read the grid, so the columns are counted and then written concurrently, each at its prefix offset */
+		myint numGroup = groupStart.size() - 1;
+		vector<myint> colStart(numGroup + 1, 0);
+#pragma omp parallel for schedule(dynamic, 256)
+		for (myint g = 0; g < numGroup; g++) {
+			colStart[g + 1] = this->v0GroupColumn(&groupNode[groupStart[g]], groupStart[g + 1] - groupStart[g], g, NULL, NULL, NULL, NULL);
+		}
+		for (myint g = 0; g < numGroup; g++) {
+			colStart[g + 1] += colStart[g];
+		}
+		v0cnum = colStart[numGroup];
+		v0canum = colStart[numGroup];
+
 		this->v0cRowId = (myint*)malloc(v0cnum * sizeof(myint));
 		this->v0cColId = (myint*)malloc(v0cnum * sizeof(myint));
 		this->v0cval = (double*)malloc(v0cnum * sizeof(double));
 		//this->v0caRowId = (myint*)malloc(v0canum * sizeof(myint));
 		//this->v0caColId = (myint*)malloc(v0canum * sizeof(myint));
 		this->v0caval = (double*)malloc(v0canum * sizeof(double));
-		v0cnum = 0;
-		v0canum = 0;
-		leng_v0c = 0;
-		leng_v0ca = 0;
-		double lx_whole_avg = 0;
-		double ly_whole_avg = 0;
-		double lz_whole_avg = 0;
-		lx_whole_avg = (this->xn[this->nx - 1] - this->xn[0]) / (this->nx - 1);
-		ly_whole_avg = (this->yn[this->ny - 1] - this->yn[0]) / (this->ny - 1);
-		lz_whole_avg = (this->zn[this->nz - 1] - this->zn[0]) / (this->nz - 1);
-
-		for (nodegs = 0; nodegs < node_group.size(); nodegs++) {
-			for (auto ndi : node_group[nodegs]) {
-				iz = ndi / (this->N_node_s);
-				indx = (ndi % this->N_node_s) / (this->N_cell_y + 1);
-				indy = (ndi % this->N_node_s) % (this->N_cell_y + 1);
-				avg_length(iz, indy, indx, lx_avg, ly_avg, lz_avg);
-				if (iz != 0) {    // this node is not on the bottom plane
-					eno = (iz - 1) * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the lower edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = -1 / (this->zn[iz] - this->zn[iz - 1]);
-							v0cnum++;
-							this->v0caval[v0canum] = -1 / lz_avg; // -lx_avg * ly_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = -1 / (this->zn[iz] - this->zn[iz - 1]);
-							v0cnum++;
-							this->v0caval[v0canum] = -1 / lz_avg; // -lx_avg * ly_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-				}
-				if (iz != this->nz - 1) {   // this node is not on the top plane
-					eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_edge_s + indx * (this->N_cell_y + 1) + indy;    // the upper edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = 1 / (this->zn[iz + 1] - this->zn[iz]);
-							v0cnum++;
-							this->v0caval[v0canum] = 1 / lz_avg; // lx_avg * ly_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = 1 / (this->zn[iz + 1] - this->zn[iz]);
-							v0cnum++;
-							this->v0caval[v0canum] = 1 / lz_avg; // lx_avg * ly_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-				}
-				if (indx != 0) {    // this node is not on the left plane
-					eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + (indx - 1) * (this->N_cell_y + 1) + indy;    // the left edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = -1 / (this->xn[indx] - this->xn[indx - 1]);
-							v0cnum++;
-							this->v0caval[v0canum] = -1 / lx_avg; // -ly_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = -1 / (this->xn[indx] - this->xn[indx - 1]);
-							v0cnum++;
-							this->v0caval[v0canum] = -1 / lx_avg; // -ly_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-				}
-				if (indx != this->nx - 1) {    // this node is not on the right plane
-					eno = iz * (this->N_edge_s + this->N_edge_v) + this->N_cell_y * (this->N_cell_x + 1) + indx * (this->N_cell_y + 1) + indy;    // the right edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = 1 / (this->xn[indx + 1] - this->xn[indx]);
-							v0cnum++;
-							this->v0caval[v0canum] = 1 / lx_avg; // ly_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = 1 / (this->xn[indx + 1] - this->xn[indx]);
-							v0cnum++;
-							this->v0caval[v0canum] = 1 / lx_avg; // ly_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-				}
-				if (indy != 0) {    // this node is not on the front plane
-					eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy - 1;    // the front edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = -1 / (this->yn[indy] - this->yn[indy - 1]);
-							v0cnum++;
-							this->v0caval[v0canum] = -1 / ly_avg; // -lx_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = -1 / (this->yn[indy] - this->yn[indy - 1]);
-							v0cnum++;
-							this->v0caval[v0canum] = -1 / ly_avg; // -lx_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-				}
-				if (indy != this->ny - 1) {   // this node is not on the back plane
-					eno = iz * (this->N_edge_s + this->N_edge_v) + indx * this->N_cell_y + indy;    // the back edge
-					compute_edgelink(eno, node1, node2);
-					if (node1 != ndi) {
-						if (node_group[nodegs].find(node1) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = 1 / (this->yn[indy + 1] - this->yn[indy]);
-							v0cnum++;
-							this->v0caval[v0canum] = 1 / ly_avg; // lx_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-					else if (node2 != ndi) {
-						if (node_group[nodegs].find(node2) == node_group[nodegs].end()) {
-							this->v0cRowId[v0cnum] = eno;
-							this->v0cColId[v0cnum] = leng_v0c;
-							this->v0cval[v0cnum] = 1 / (this->yn[indy + 1] - this->yn[indy]);
-							v0cnum++;
-							this->v0caval[v0canum] = 1 / ly_avg; // lx_avg * lz_avg / (lx_whole_avg * ly_whole_avg * lz_whole_avg);
-							v0canum++;
-						}
-					}
-				}
-			}
-			leng_v0c++;
-			leng_v0ca++;
+#pragma omp parallel for schedule(dynamic, 256)
+		for (myint g = 0; g < numGroup; g++) {
+			myint c = colStart[g];
+			this->v0GroupColumn(&groupNode[groupStart[g]], groupStart[g + 1] - groupStart[g], g, &this->v0cRowId[c], &this->v0cColId[c], &this->v0cval[c], &this->v0caval[c]);
 		}
+		leng_v0c = numGroup;
+		leng_v0ca = numGroup;
 		//ofstream out;
 		//out.open("V0c.txt", std::ofstream::out | std::ofstream::trunc);
 		//for (int indi = 0; indi < v0cnum; indi++) {
@@ -3440,95 +3177,22 @@ public:
 		//out.close();
 	}
 
-	void generateAc(myint *map, myint v0cnum, myint v0canum, myint leng_v0c, myint& leng_Ac) {
-		int indi, indj, inx, iny, inz;
-		myint node1, node2;
-		unordered_map<myint, unordered_map<myint, double>> Ac;
-
-		for (indi = 0; indi < v0canum; indi++) {    // the upper and lower planes are PEC
-			if (this->v0cRowId[indi] % (this->N_edge_s + this->N_edge_v) >= this->N_edge_s) {    // this edge is along z axis
-				inz = this->v0cRowId[indi] / (this->N_edge_s + this->N_edge_v);
-				inx = ((this->v0cRowId[indi] % (this->N_edge_s + this->N_edge_v)) - this->N_edge_s) / (this->N_cell_y + 1);
-				iny = ((this->v0cRowId[indi] % (this->N_edge_s + this->N_edge_v)) - this->N_edge_s) % (this->N_cell_y + 1);
-				node1 = inz * this->N_node_s + (this->N_cell_y + 1) * inx + iny;
-				node2 = (inz + 1) * this->N_node_s + (this->N_cell_y + 1) * inx + iny;
-				if (map[node1] != this->v0cColId[indi] + 1 && map[node1] != 0 && this->markEdge[this->v0cRowId[indi]] != 0) {
-					Ac[this->v0cColId[indi]][map[node1] - 1] += this->v0caval[indi] * 1 / (this->zn[inz + 1] - this->zn[inz]) * SIGMA;
-					Ac[this->v0cColId[indi]][this->v0cColId[indi]] += this->v0caval[indi] * (-1) / (this->zn[inz + 1] - this->zn[inz]) * SIGMA;
-				}
-				else if (map[node2] != this->v0cColId[indi] + 1 && map[node2] != 0 && this->markEdge[this->v0cRowId[indi]] != 0) {
-					Ac[this->v0cColId[indi]][map[node2] - 1] += this->v0caval[indi] * (-1) / (this->zn[inz + 1] - this->zn[inz]) * SIGMA;
-					Ac[this->v0cColId[indi]][this->v0cColId[indi]] += this->v0caval[indi] * 1 / (this->zn[inz + 1] - this->zn[inz]) * SIGMA;
-				}
-				else if (this->markEdge[this->v0cRowId[indi]] != 0) {
-					Ac[this->v0cColId[indi]][this->v0cColId[indi]] += abs(this->v0caval[indi] * 1 / (this->zn[inz + 1] - this->zn[inz]) * SIGMA);
-				}
-			}
-			else if (this->v0cRowId[indi] % (this->N_edge_s + this->N_edge_v) >= (this->N_cell_y) * (this->N_cell_x + 1)) {    // this edge is along x axis
-				inz = this->v0cRowId[indi] / (this->N_edge_s + this->N_edge_v);
-				inx = ((this->v0cRowId[indi] % (this->N_edge_s + this->N_edge_v)) - (this->N_cell_y) * (this->N_cell_x + 1)) / (this->N_cell_y + 1);
-				iny = ((this->v0cRowId[indi] % (this->N_edge_s + this->N_edge_v)) - (this->N_cell_y) * (this->N_cell_x + 1)) % (this->N_cell_y + 1);
-				node1 = inz * this->N_node_s + inx * (this->N_cell_y + 1) + iny;
-				node2 = inz * this->N_node_s + (inx + 1) * (this->N_cell_y + 1) + iny;
-				if (map[node1] != this->v0cColId[indi] + 1 && map[node1] != 0 && this->markEdge[this->v0cRowId[indi]] != 0) {
-					Ac[this->v0cColId[indi]][map[node1] - 1] += this->v0caval[indi] * 1 / (this->xn[inx + 1] - this->xn[inx]) * SIGMA;
-					Ac[this->v0cColId[indi]][this->v0cColId[indi]] += this->v0caval[indi] * (-1) / (this->xn[inx + 1] - this->xn[inx]) * SIGMA;
-				}
-				else if (map[node2] != this->v0cColId[indi] + 1 && map[node2] != 0 && this->markEdge[this->v0cRowId[indi]] != 0) {
-					Ac[this->v0cColId[indi]][map[node2] - 1] += this->v0caval[indi] * (-1) / (this->xn[inx + 1] - this->xn[inx]) * SIGMA;
-					Ac[this->v0cColId[indi]][this->v0cColId[indi]] += this->v0caval[indi] * 1 / (this->xn[inx + 1] - this->xn[inx]) * SIGMA;
-				}
-				else if (this->markEdge[this->v0cRowId[indi]] != 0) {
-					Ac[this->v0cColId[indi]][this->v0cColId[indi]] += abs(this->v0caval[indi] * 1 / (this->xn[inx + 1] - this->xn[inx]) * SIGMA);
-				}
-			}
-			else {    // this edge is along y axis
-				inz = this->v0cRowId[indi] / (this->N_edge_s + this->N_edge_v);
-				inx = (this->v0cRowId[indi] % (this->N_edge_s + this->N_edge_v)) / this->N_cell_y;
-				iny = (this->v0cRowId[indi] % (this->N_edge_s + this->N_edge_v)) % this->N_cell_y;
-				node1 = inz * this->N_node_s + inx * (this->N_cell_y + 1) + iny;
-				node2 = inz * this->N_node_s + inx * (this->N_cell_y + 1) + iny + 1;
-				if (map[node1] != this->v0cColId[indi] + 1 && map[node1] != 0 && this->markEdge[this->v0cRowId[indi]] != 0) {
-					Ac[this->v0cColId[indi]][map[node1] - 1] += this->v0caval[indi] * 1 / (this->yn[iny + 1] - this->yn[iny]) * SIGMA;
-					Ac[this->v0cColId[indi]][this->v0cColId[indi]] += this->v0caval[indi] * (-1) / (this->yn[iny + 1] - this->yn[iny]) * SIGMA;
-				}
-				else if (map[node2] != this->v0cColId[indi] + 1 && map[node2] != 0 && this->markEdge[this->v0cRowId[indi]] != 0) {
-					Ac[this->v0cColId[indi]][map[node2] - 1] += this->v0caval[indi] * (-1) / (this->yn[iny + 1] - this->yn[iny]) * SIGMA;
-					Ac[this->v0cColId[indi]][this->v0cColId[indi]] += this->v0caval[indi] * 1 / (this->yn[iny + 1] - this->yn[iny]) * SIGMA;
-				}
-				else if (this->markEdge[this->v0cRowId[indi]] != 0) {
-					Ac[this->v0cColId[indi]][this->v0cColId[indi]] += abs(this->v0caval[indi] * 1 / (this->yn[iny + 1] - this->yn[iny]) * SIGMA);
-				}
-			}
-		}
+	void generateAc(myint *map, myint leng_v0c, myint& leng_Ac) {
+		/* Ac = V0ca'*D_sig*V0c, with v0cColId already holding the CSR row pointers of V0c^T (the upper and lower planes are PEC).
+		D_sig is applied inside the product, so no sqrt(D_sig)-scaled copy of V0c is kept. */
+		this->galerkinV0(map, this->v0cColId, this->v0cRowId, this->v0caval, leng_v0c,
+			[this](myint eno) { return (this->markEdge[eno] != 0) ? SIGMA : 0.; }, 1e5,
+			this->AcRowId, this->AcColId, this->Acval, leng_Ac);
 
-		for (indi = 0; indi < leng_v0c; indi++) {
-			leng_Ac += Ac[indi].size();
-		}
-		this->AcRowId = (myint*)calloc(leng_Ac, sizeof(myint));
-		this->AcColId = (myint*)calloc(leng_Ac, sizeof(myint));
-		this->Acval = (double*)calloc(leng_Ac, sizeof(double));
-		indj = 0;
-		int k = 1;
-		for (indi = 0; indi < leng_v0c; indi++) {
-			vector<pair<myint, double>> v(Ac[indi].begin(), Ac[indi].end());
-			sort(v.begin(), v.end());
-			for (auto aci : v) {
-				if (abs(aci.second) > 1e5) {
-					this->AcRowId[indj] = indi;
-					this->AcColId[indj] = aci.first;
-					this->Acval[indj] = aci.second;
-					if (this->AcRowId[indj] >= this->acu_cnno[k]) {
-						this->cindex.push_back(indj - 1);
-						k++;
-					}
-					indj++;
-				}
+		// cindex: last index in Ac of the rows of each conductor
+		myint k = 1;
+		for (myint indj = 0; indj < leng_Ac; indj++) {
+			if (this->AcRowId[indj] >= this->acu_cnno[k]) {
+				this->cindex.push_back(indj - 1);
+				k++;
 			}
-			v.clear();
 		}
-		this->cindex.push_back(indj - 1);
-		Ac.clear();
+		this->cindex.push_back(leng_Ac - 1);
 	}
 
 	/* Find Vh by using Arnoldi method */
@@ -3539,28 +3203,25 @@ public:
 
 		// Arnoldi method
 		double scale = 1.e+14;    // balance the matrix
-		int i, j, indi, start;
+		int i, j;
+		myint start;
 		double* V = new double[(k + 1) * 2 * (this->N_edge - this->bden)]();   // Arnoldi orthogonal vectors
 		double* w = new double[2 * (this->N_edge - this->bden)];
 		double* H = new double[k * k]();   // Hessenberg matrix with (k + 1) rows and k columns, stored in column major and initial with 0
 		double temp;
 
+		fdtdStiffStencil stencil(this->N_cell_x, this->N_cell_y, this->N_cell_z, this->xn, this->yn, this->zn, this->mapEdgeR, this->N_edge - this->bden);
+
 		for (i = 0; i < 2 * (this->N_edge - this->bden); i++) {
 			V[i] = 1 / sqrt(2 * (this->N_edge - this->bden));   // arbitrary starting vector
 		}
 		for (j = 1; j <= k; j++) {
-			indi = 0;
-			while (indi < this->leng_S) {
-				// w = B^-1*A*v_j-1
-				start = this->SRowId[indi];
-				w[this->N_edge - this->bden + start] = 0;
+			// w = B^-1*A*v_j-1
+			stencil.multiply(&V[(j - 1) * 2 * (this->N_edge - this->bden)], &w[this->N_edge - this->bden]);
+			for (start = 0; start < this->N_edge - this->bden; start++) {
 				w[start] = V[(j - 1) * 2 * (this->N_edge - this->bden) + (this->N_edge - this->bden) + start];
-				while (indi < this->leng_S && this->SRowId[indi] == start) {
-					w[this->N_edge - this->bden + start] += -this->Sval[indi] * V[(j - 1) * 2 * (this->N_edge - this->bden) + this->SColId[indi]] / (this->stackEpsn[(this->mapEdgeR[start] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0 * pow(scale, 2));
-					indi++;
-				}
-				if (this->markEdge[this->mapEdgeR[start]] != 0)
-					w[this->N_edge - this->bden + start] += -V[(j - 1) * 2 * (this->N_edge - this->bden) + (this->N_edge - this->bden) + start] * SIGMA / (this->stackEpsn[(this->mapEdgeR[start] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0 * scale);
+				w[this->N_edge - this->bden + start] = -w[this->N_edge - this->bden + start] / (this->eps[start] * pow(scale, 2))
+					- V[(j - 1) * 2 * (this->N_edge - this->bden) + (this->N_edge - this->bden) + start] * this->sig[start] / (this->eps[start] * scale);
 			}
 			for (i = 0; i <= j - 1; i++) {
 				for (int in = 0; in < (this->N_edge - this->bden) * 2; in++) {
@@ -3832,18 +3493,16 @@ public:
 		}
 		indi = 0;
 		while (indi < (this->N_edge - this->bden)) {
-			A[(this->N_edge - this->bden + indi) * (this->N_edge - this->bden) * 2 + this->N_edge - this->bden + indi] = pow(scale, 2) * this->stackEpsn[(this->mapEdgeR[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
+			A[(this->N_edge - this->bden + indi) * (this->N_edge - this->bden) * 2 + this->N_edge - this->bden + indi] = pow(scale, 2) * this->eps[indi];
 			indi++;
 		}
 
 		// set B
 		indi = 0;
 		while (indi < (this->N_edge - this->bden)) {
-			if (this->markEdge[this->mapEdgeR[indi]] != 0) {
-				B[indi * (this->N_edge - this->bden) * 2 + indi] = scale * SIGMA;
-			}
-			B[(this->N_edge - this->bden + indi) * (this->N_edge - this->bden) * 2 + indi] = pow(scale, 2) * this->stackEpsn[(this->mapEdgeR[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
-			B[indi * (this->N_edge - this->bden) * 2 + this->N_edge - this->bden + indi] = pow(scale, 2) * this->stackEpsn[(this->mapEdgeR[indi] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0;
+			B[indi * (this->N_edge - this->bden) * 2 + indi] = scale * this->sig[indi];
+			B[(this->N_edge - this->bden + indi) * (this->N_edge - this->bden) * 2 + indi] = pow(scale, 2) * this->eps[indi];
+			B[indi * (this->N_edge - this->bden) * 2 + this->N_edge - this->bden + indi] = pow(scale, 2) * this->eps[indi];
 			indi++;
 		}
 
@@ -3917,6 +3576,26 @@ public:
 		delete[] rscale;
 	}
 
+	/* Current density of port sourcePort on its port edges, J = portDirection of the side (later sides win on shared edges) */
+	void setPortCurrent(int sourcePort, sparseExcitation &J) const {
+		vector<pair<myint, double>> entries;
+		for (int sourcePortSide = 0; sourcePortSide < this->portCoor[sourcePort].multiplicity; sourcePortSide++) {
+			for (auto e : this->portCoor[sourcePort].portEdge[sourcePortSide]) {
+				entries.emplace_back(e, this->portCoor[sourcePort].portDirection[sourcePortSide]);
+			}
+		}
+		stable_sort(entries.begin(), entries.end(), [](const pair<myint, double> &a, const pair<myint, double> &b) { return a.first < b.first; });
+
+		J.clear();
+		for (size_t ind = 0; ind < entries.size(); ind++) {
+			if (ind + 1 < entries.size() && entries[ind + 1].first == entries[ind].first) {
+				continue;
+			}
+			J.edge.push_back(entries[ind].first);
+			J.val.push_back(entries[ind].second);
+		}
+	}
+
 	/* Calculate the reference */
 	void reference1(int freqNo, int sourcePort, complex<double>* xr) {
 		double freq = this->freqNo2freq(freqNo);
@@ -3929,14 +3608,14 @@ public:
 		valc = (complex<double>*)calloc(this->leng_S, sizeof(complex<double>));
 		complex<double> *J;
 		J = (complex<double>*)calloc((this->N_edge - this->bden), sizeof(complex<double>));
+		vector<myint> perm(size, 0);    // marks the nonzeros of J for the sparse right-hand side solve
 		int indz, indy, temp;
 
-		for (int sourcePortSide = 0; sourcePortSide < this->portCoor[sourcePort].multiplicity; sourcePortSide++) {
-			for (int inde = 0; inde < this->portCoor[sourcePort].portEdge[sourcePortSide].size(); inde++) {
-				J[this->mapEdge[this->portCoor[sourcePort].portEdge[sourcePortSide][inde]]] = 0. - (1i) * (this->portCoor[sourcePort].portDirection[sourcePortSide] * 1.0) * freq * 2. * M_PI;
-				//cout << "SourcePort " << sourcePort << " sourcePortSide " << sourcePortSide << " is " << this->portCoor[sourcePort].portDirection[sourcePortSide] << endl;
-
-			}
+		sparseExcitation portCurrent;
+		this->setPortCurrent(sourcePort, portCurrent);
+		for (size_t inde = 0; inde < portCurrent.size(); inde++) {
+			J[this->mapEdge[portCurrent.edge[inde]]] = 0. - (1i) * portCurrent.val[inde] * freq * 2. * M_PI;
+			perm[this->mapEdge[portCurrent.edge[inde]]] = 1;
 		}
 
 
@@ -3964,14 +3643,8 @@ public:
 			while (indi < nnz && this->SRowId[indi] == start) {
 				valc[indi] += this->Sval[indi]; // val[indi] is real
 				if (this->SRowId[indi] == this->SColId[indi]) {
-					if (this->markEdge[this->mapEdgeR[this->SRowId[indi]]] != 0) {
-						complex<double> addedPart(-(2. * M_PI * freq) * this->stackEpsn[(this->mapEdgeR[this->SRowId[indi]] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0, SIGMA);
-						valc[indi] += (2. * M_PI * freq) * addedPart;
-					}
-					else {
-						complex<double> addedPart(-(2. * M_PI * freq) * this->stackEpsn[(this->mapEdgeR[this->SRowId[indi]] + this->N_edge_v) / (this->N_edge_s + this->N_edge_v)] * EPSILON0, 0);
-						valc[indi] += (2. * M_PI * freq) * addedPart;
-					}
+					complex<double> addedPart(-(2. * M_PI * freq) * this->eps[this->SRowId[indi]], this->sig[this->SRowId[indi]]);
+					valc[indi] += (2. * M_PI * freq) * addedPart;
 				}
 				//out << valc[indi].real() << " " << valc[indi].imag() << endl;
 				count++;
@@ -3991,7 +3664,6 @@ public:
 		myint maxfct, mnum, phase, error, msglvl, solver;
 		double dparm[64];
 		int v0csin;
-		myint perm;
 
 		/* Auxiliary variables */
 		char *var;
@@ -4004,8 +3676,9 @@ public:
 		phase = 13;
 
 		pardisoinit(pt, &mtype, iparm);
-		iparm[38] = 1;
+		iparm[38] = 0;    // no low rank update, which would read perm as changed entries
 		iparm[34] = 1;    // 0-based indexing
+		iparm[30] = 2;    // J is nonzero only at the perm-marked port edges, the whole xr is computed
 		iparm[3] = 2;    // number of processors
 						 //iparm[59] = 2;    // out of core version to solve very large problem
 						 //iparm[10] = 0;        /* Use nonsymmetric permutation and scaling MPS */
@@ -4013,14 +3686,14 @@ public:
 						 //cout << "Begin to solve (-w^2*D_eps+iwD_sig+S)x=-iwJ\n";
 		complex<double> * ddum;
 
-		pardiso(pt, &maxfct, &mnum, &mtype, &phase, &size, valc, RowId1, this->SColId, &perm, &nrhs, iparm, &msglvl, J, xr, &error);
+		pardiso(pt, &maxfct, &mnum, &mtype, &phase, &size, valc, RowId1, this->SColId, perm.data(), &nrhs, iparm, &msglvl, J, xr, &error);
 		if (error != 0) {
 			printf("\nERROR during numerical factorization: %d", error);
 			exit(2);
 		}
 
 		phase = -1;     // Release internal memory
-		pardiso(pt, &maxfct, &mnum, &mtype, &phase, &size, &ddum, RowId1, this->SColId, &perm, &nrhs, iparm, &msglvl, &ddum, &ddum, &error);
+		pardiso(pt, &maxfct, &mnum, &mtype, &phase, &size, &ddum, RowId1, this->SColId, perm.data(), &nrhs, iparm, &msglvl, &ddum, &ddum, &error);
 
 		free(RowId1); RowId1 = NULL;
 		free(valc); valc = NULL;
@@ -4313,12 +3986,17 @@ public:
 		free(this->bd_node2);
 		free(this->bd_edge);
 		free(this->stackCdtMark);
-		free(this->markEdge);
-		free(this->markCell);
+		if (!this->meshArraysShared) {
+			free(this->markEdge);
+			free(this->markCell);
+			free(this->sig);
+			free(this->markNode);
+			free(this->SRowId);
+			free(this->SColId);
+			free(this->Sval);
+		}
 		free(this->cdtNumNode);
-		free(this->sig);
 		free(this->conductor);
-		free(this->markNode);
 		free(this->exciteCdtLayer);
 		free(this->patch);
 		free(this->bound);
@@ -4367,11 +4045,7 @@ public:
 		free(this->v0d2avalo);
 		free(this->yd);
 		delete[] this->Vh;
-		free(this->SRowId);
-		free(this->SColId);
-		free(this->Sval);
 		free(this->y);
-		free(this->J);
 		free(this->v0csJ);
 		free(this->Y);
 	}
@@ -4380,7 +4054,7 @@ public:
 
 
 
-int meshAndMark(fdtdMesh* sys, unordered_map<double, int> &xi, unordered_map<double, int> &yi, unordered_map<double, int> &zi, unordered_set<double> *portCoorx, unordered_set<double> *portCoory);
+int meshAndMark(fdtdMesh* sys, unordered_map<double, int> &xi, unordered_map<double, int> &yi, unordered_map<double, int> &zi, unordered_set<double> *portCoorx, unordered_set<double> *portCoory, bool planOnly = false);
 int compute_edgelink(fdtdMesh *sys, myint eno, myint &node1, myint &node2);
 int parameterConstruction(fdtdMesh* sys, unordered_map<double, int> xi, unordered_map<double, int> yi, unordered_map<double, int> zi);
 void freePara(fdtdMesh *sys);
@@ -4388,7 +4062,6 @@ int matrixConstruction(fdtdMesh *sys);
 int portSet(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<double, int> yi, unordered_map<double, int> zi);
 int mklMatrixMulti(fdtdMesh *sys, int &leng_A, int *aRowId, int *aColId, double *aval, int arow, int acol, int *bRowId, int *bColId, double *bval, int mark);
 // The first is read row by row, and the second one is read column by column
-int COO2CSR(vector<int>& rowId, vector<int>& ColId, vector<double>& val);
 int mvMulti(vector<int> aRowId, vector<int> aColId, vector<double> aval, vector<int>& bRowId, vector<int>& bColId, vector<double>& bval, double *index_val, int size);
 int nodeAdd(int *index, int size, int total_size, fdtdMesh *sys, int &v0d2num, int &leng_v0d2, int mark);
 int nodeAddLarger(int *index, int size, int total_size, fdtdMesh *sys, int &num, int &leng, int *RowId, int *ColId, double *Val);
@@ -4402,16 +4075,14 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
 int yParaGenerator(fdtdMesh *sys);
 int solveV0dSystem(fdtdMesh *sys, double *dRhs, double *y0d, int leng_v0d1);
 int pardisoSolve(fdtdMesh *sys, double *rhs, double *solution, int leng_v0d1);
-int COO2CSR_malloc(myint *rowId, myint *ColId, double *val, myint totalnum, myint leng, myint *rowId1);
 int generateStiff(fdtdMesh *sys);
 int merge_v0d1(fdtdMesh *sys, double block1_x, double block1_y, double block2_x, double block2_y, double block3_x, double block3_y, myint &v0d1num, myint &leng_v0d1, myint &v0d1anum, myint &leng_v0d1a, myint *map, double sideLen);
 int merge_v0c(fdtdMesh *sys, double block_x, double block_y, double block2_x, double block2_y, myint &v0cnum, myint &leng_v0c, myint &v0canum, myint &leng_v0ca, myint *map);
 int setsideLen(int node, double sideLen, int *markLayerNode, int *markProSide, fdtdMesh *sys);
 int generateStiff(fdtdMesh *sys);
-int mklMatrixMulti_nt(fdtdMesh *sys, myint &leng_A, myint *aRowId, myint *aColId, double *aval, myint arow, myint acol, myint *bRowId, myint *bColId, double *bval);
 int find_Vh(fdtdMesh *sys, lapack_complex_double *u0, lapack_complex_double *u0a, int sourcePort);
 int matrix_multi(char operation, lapack_complex_double *a, myint arow, myint acol, lapack_complex_double *b, myint brow, myint bcol, lapack_complex_double *tmp3);
 int reference(fdtdMesh *sys, int freqNo, myint *RowId, myint *ColId, double *val);
 int plotTime(fdtdMesh *sys, int sourcePort, double *u0d, double *u0c);
 int avg_length(fdtdMesh *sys, int iz, int iy, int ix, double &lx, double &ly, double &lz);
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -18,6 +18,7 @@ int find_Vh(fdtdMesh *sys, lapack_complex_double *u0, lapack_complex_double *u0a
     double eps2 = 1.e-2;    // wavelength error tolerance
     double *rsc = (double*)calloc((sys->N_edge - sys->bden), sizeof(double));
     double *xr = (double*)calloc((sys->N_edge - sys->bden) * 3, sizeof(double));
+    fdtdStiffStencil stencil(sys->N_cell_x, sys->N_cell_y, sys->N_cell_z, sys->xn, sys->yn, sys->zn, sys->mapEdgeR, sys->N_edge - sys->bden);    // S*x without storing S
     myint start;
     myint index;
     int l = 0;
@@ -88,22 +89,12 @@ int find_Vh(fdtdMesh *sys, lapack_complex_double *u0, lapack_complex_double *u0a
         }
 
         // central difference
-        index = 0;
         nn = 0;
-        while (index < sys->leng_S){
-            start = sys->SRowId[index];
-            while (index < sys->leng_S && sys->SRowId[index] == start){
-                xr[2 * (sys->N_edge - sys->bden) + sys->SRowId[index]] += sys->Sval[index] * xr[1 * (sys->N_edge - sys->bden) + sys->SColId[index]] * (-2) * pow(dt, 2);
-                index++;
-            }
-            if (sys->markEdge[sys->mapEdgeR[start]] != 0){
-                xr[2 * (sys->N_edge - sys->bden) + start] += -rsc[start] * 2 * pow(dt, 2) + dt * SIGMA * xr[start] - 2 * sys->stackEpsn[(sys->mapEdgeR[start] + sys->N_edge_v) / (sys->N_edge_v + sys->N_edge_s)] * EPSILON0 * xr[start] + 4 * sys->stackEpsn[(sys->mapEdgeR[start] + sys->N_edge_v) / (sys->N_edge_v + sys->N_edge_s)] * EPSILON0 * xr[1 * (sys->N_edge - sys->bden) + start];
-                xr[2 * (sys->N_edge - sys->bden) + start] /= (2 * sys->stackEpsn[(sys->mapEdgeR[start] + sys->N_edge_v) / (sys->N_edge_v + sys->N_edge_s)] * EPSILON0 + dt * SIGMA);
-            }
-            else {
-                xr[2 * (sys->N_edge - sys->bden) + start] += -rsc[start] * 2 * pow(dt, 2) - 2 * sys->stackEpsn[(sys->mapEdgeR[start] + sys->N_edge_v) / (sys->N_edge_v + sys->N_edge_s)] * EPSILON0 * xr[start] + 4 * sys->stackEpsn[(sys->mapEdgeR[start] + sys->N_edge_v) / (sys->N_edge_v + sys->N_edge_s)] * EPSILON0 * xr[1 * (sys->N_edge - sys->bden) + start];
-                xr[2 * (sys->N_edge - sys->bden) + start] /= (2 * sys->stackEpsn[(sys->mapEdgeR[start] + sys->N_edge_v) / (sys->N_edge_v + sys->N_edge_s)] * EPSILON0);
-            }
+        stencil.multiply(&xr[1 * (sys->N_edge - sys->bden)], &xr[2 * (sys->N_edge - sys->bden)]);    // S*x_n
+        for (start = 0; start < sys->N_edge - sys->bden; start++){
+            xr[2 * (sys->N_edge - sys->bden) + start] *= (-2) * pow(dt, 2);
+            xr[2 * (sys->N_edge - sys->bden) + start] += -rsc[start] * 2 * pow(dt, 2) + dt * sys->sig[start] * xr[start] - 2 * sys->eps[start] * xr[start] + 4 * sys->eps[start] * xr[1 * (sys->N_edge - sys->bden) + start];
+            xr[2 * (sys->N_edge - sys->bden) + start] /= (2 * sys->eps[start] + dt * sys->sig[start]);
             nn += xr[1 * (sys->N_edge - sys->bden) + start] * xr[1 * (sys->N_edge - sys->bden) + start];
         }
         nn = sqrt(nn);
@@ -124,22 +115,10 @@ int find_Vh(fdtdMesh *sys, lapack_complex_double *u0, lapack_complex_double *u0a
             Cr = (double*)calloc(l * l, sizeof(double));
             D_sigr = (double*)calloc(l * l, sizeof(double));
             D_epsr = (double*)calloc(l * l, sizeof(double));
-            index = 0;
-            
-            while (index < sys->leng_S){
-                start = sys->SRowId[index];
-                while (index < sys->leng_S && sys->SRowId[index] == start){
-                    temp[0][sys->SRowId[index]] += sys->Sval[index] * U0[U0_i - 1][sys->SColId[index]];
-                    index++;
-                }
-                if (sys->markEdge[sys->mapEdgeR[start]] != 0) {
-                    temp1[0][start] = sqrt(SIGMA) * U0[U0_i - 1][start];
-                    temp2[0][start] = sqrt(sys->stackEpsn[(sys->mapEdgeR[start] + sys->N_edge_v) / (sys->N_edge_v + sys->N_edge_s)] * EPSILON0) * U0[U0_i - 1][start];
-                }
-                else {
-                    temp1[0][start] = 0;
-                    temp2[0][start] = sqrt(sys->stackEpsn[(sys->mapEdgeR[start] + sys->N_edge_v) / (sys->N_edge_v + sys->N_edge_s)] * EPSILON0) * U0[U0_i - 1][start];
-                }
+            stencil.multiply(U0[U0_i - 1].data(), temp[0].data());
+            for (start = 0; start < sys->N_edge - sys->bden; start++){
+                temp1[0][start] = sqrt(sys->sig[start]) * U0[U0_i - 1][start];
+                temp2[0][start] = sqrt(sys->eps[start]) * U0[U0_i - 1][start];
             }
             for (myint inde = 0; inde < l; inde++){
                 Cr_p.push_back(Cr_base);
@@ -341,23 +320,10 @@ int find_Vh(fdtdMesh *sys, lapack_complex_double *u0, lapack_complex_double *u0a
             Cr = (double*)calloc(U0_i * U0_i, sizeof(double));
             D_sigr = (double*)calloc(U0_i * U0_i, sizeof(double));
             D_epsr = (double*)calloc(U0_i * U0_i, sizeof(double));
-            index = 0;
-            
-            while (index < sys->leng_S){
-                start = sys->SRowId[index];
-
-                while (index < sys->leng_S && sys->SRowId[index] == start){
-                    temp[(U0_i - 1)][sys->SRowId[index]] += sys->Sval[index] * U0[(U0_i - 1)][sys->SColId[index]];
-                    index++;
-                }
-                if (sys->markEdge[sys->mapEdgeR[start]] != 0) {
-                    temp1[(U0_i - 1)][start] = sqrt(SIGMA) * U0[U0_i - 1][start];
-                    temp2[(U0_i - 1)][start] = sqrt(sys->stackEpsn[(sys->mapEdgeR[start] + sys->N_edge_v) / (sys->N_edge_v + sys->N_edge_s)] * EPSILON0) * U0[U0_i - 1][start];
-                }
-                else {
-                    temp1[(U0_i - 1)][start] = 0;
-                    temp2[(U0_i - 1)][start] = sqrt(sys->stackEpsn[(sys->mapEdgeR[start] + sys->N_edge_v) / (sys->N_edge_v + sys->N_edge_s)] * EPSILON0) * U0[U0_i - 1][start];
-                }
+            stencil.multiply(U0[U0_i - 1].data(), temp[U0_i - 1].data());
+            for (start = 0; start < sys->N_edge - sys->bden; start++){
+                temp1[(U0_i - 1)][start] = sqrt(sys->sig[start]) * U0[U0_i - 1][start];
+                temp2[(U0_i - 1)][start] = sqrt(sys->eps[start]) * U0[U0_i - 1][start];
             }
             index = U0_i - 1;
             Cr_p.push_back(Cr_base);
@@ -5,566 +5,75 @@ using namespace std::complex_literals;
 
 int generateStiff(fdtdMesh *sys){
 
-    myint Senum, leng_Se;    
-    myint Shnum, leng_Sh;    
-    myint *SeRowId, *SeColId;
-    double *Seval;
-    myint *ShRowId, *ShColId;
-    double *Shval;
-    myint indx, indy, indz;
-
-
-    SeRowId = (myint*)malloc((sys->N_patch) * 4 * sizeof(myint));
-    SeColId = (myint*)malloc((sys->N_patch) * 4 * sizeof(myint));
-    Seval = (double*)malloc((sys->N_patch) * 4 * sizeof(double));
-    ShRowId = (myint*)malloc((sys->N_patch) * 4 * sizeof(myint));
-    ShColId = (myint*)malloc((sys->N_patch) * 4 * sizeof(myint));
-    Shval = (double*)malloc((sys->N_patch) * 4 * sizeof(double));
-    Senum = 0;
-    Shnum = 0;
-    leng_Se = 0;
-    leng_Sh = 0;
-
-
-    /* Generate Se */
-    /* the lowest cell layer doesn't contain the lowest plane */
-
-    /* the middle layers */
-    for (indz = 1; indz < sys->N_cell_z; indz++) {
-        for (indx = 1; indx <= sys->N_cell_x; indx++) {
-            for (indy = 1; indy <= sys->N_cell_y; indy++) {
-                SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = -1 / (sys->xn[indx] - sys->xn[indx - 1]);
-                Senum++;
-
-                SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + indx*sys->N_cell_y + indy - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = 1 / (sys->xn[indx] - sys->xn[indx - 1]);
-                Senum++;
-
-                SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = 1 / (sys->yn[indy] - sys->yn[indy - 1]);
-                Senum++;
-
-                SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y * (sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy + 1 - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = -1 / (sys->yn[indy] - sys->yn[indy - 1]);
-                Senum++;
-                leng_Se++;
-
-                SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = 1 / (sys->zn[indz] - sys->zn[indz - 1]);
-                Senum++;
-
-                SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = -1 / (sys->yn[indy] - sys->yn[indy - 1]);
-                Senum++;
-
-                SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1 + 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = 1 / (sys->yn[indy] - sys->yn[indy - 1]);
-                Senum++;
-
-                SeRowId[Senum] = indz * (sys->N_edge_s + sys->N_edge_v) + (indx - 1) * sys->N_cell_y + indy - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = -1 / (sys->zn[indz] - sys->zn[indz - 1]);
-                Senum++;
-                leng_Se++;
-
-                SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = -1 / (sys->zn[indz] - sys->zn[indz - 1]);
-                Senum++;
-
-                SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = 1 / (sys->xn[indx] - sys->xn[indx - 1]);
-                Senum++;
-
-                SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + indx*(sys->N_cell_y + 1) + indy - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = -1 / (sys->xn[indx] - sys->xn[indx - 1]);
-                Senum++;
-
-                SeRowId[Senum] = indz * (sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y * (sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-                SeColId[Senum] = leng_Se;
-                Seval[Senum] = 1 / (sys->zn[indz] - sys->zn[indz - 1]);
-                Senum++;
-                leng_Se++;
-            }
-        }
-    }
+    /******************* Explanations to matrices here *******************/
+    // matrix           size (variables in code)            format
+    //
+    // Se               N_e*N_h                             curl of E on each patch (circulation / patch area)
+    // Sh               N_e*N_h                             dual curl back to each edge (divided by averaged widths)
+    // S = Sh*Se.T/mu   N_e*N_e, then truncate with BC      (sys.SRowId, sys.SColId, sys.Sval), rows and columns ascending
+    //
+    // Each row of S is built straight from the grid spacings (fdtdStiffStencil::rowEntries) without forming Se and Sh.
+    // Row counts are known before filling, so S is allocated once at its final size and the rows are filled in parallel.
+    /******************* End of matrix explanation *******************/
 
-    /* the toppest layer doesn't contain the upper plane */
-    indz = sys->N_cell_z;
-    for (indx = 1; indx <= sys->N_cell_x; indx++) {
-        for (indy = 1; indy <= sys->N_cell_y; indy++) {
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->xn[indx] - sys->xn[indx - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + indx*sys->N_cell_y + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->xn[indx] - sys->xn[indx - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->yn[indy] - sys->yn[indy - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y * (sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy + 1 - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->yn[indy] - sys->yn[indy - 1]);
-            Senum++;
-            leng_Se++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->zn[indz] - sys->zn[indz - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->yn[indy] - sys->yn[indy - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1 + 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->yn[indy] - sys->yn[indy - 1]);
-            Senum++;
-
-            SeRowId[Senum] = indz * (sys->N_edge_s + sys->N_edge_v) + (indx - 1) * sys->N_cell_y + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->zn[indz] - sys->zn[indz - 1]);
-            Senum++;
-            leng_Se++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->zn[indz] - sys->zn[indz - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->xn[indx] - sys->xn[indx - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + indx*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->xn[indx] - sys->xn[indx - 1]);
-            Senum++;
-
-            SeRowId[Senum] = indz * (sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y * (sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->zn[indz] - sys->zn[indz - 1]);
-            Senum++;
-            leng_Se++;
-
-            SeRowId[Senum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->xn[indx] - sys->xn[indx - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + indx*sys->N_cell_y + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->xn[indx] - sys->xn[indx - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->yn[indy] - sys->yn[indy - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y * (sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy + 1 - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->yn[indy] - sys->yn[indy - 1]);
-            Senum++;
-            leng_Se++;
-        }
-    }
+    myint N_edge_rmPEC = sys->N_edge - sys->bden;
+    fdtdStiffStencil stencil(sys->N_cell_x, sys->N_cell_y, sys->N_cell_z, sys->xn, sys->yn, sys->zn, sys->mapEdgeR, N_edge_rmPEC);
 
-    /* the rightmost yz plane */
-    indx = sys->N_cell_x + 1;
-    
-    for (indz = 1; indz <= sys->N_cell_z; indz++) {
-        for (indy = 1; indy <= sys->N_cell_y; indy++) {
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->zn[indz] - sys->zn[indz - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->yn[indy] - sys->yn[indy - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy + 1 - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->yn[indy] - sys->yn[indy - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->zn[indz] - sys->zn[indz - 1]);
-            Senum++;
-            leng_Se++;
-        }
+    /* Count the nonzeros of each row left after PEC removal */
+    myint *SRowStart = (myint*)malloc((N_edge_rmPEC + 1) * sizeof(myint));
+    if (SRowStart == NULL) {
+        cerr << "Unable to allocate row pointers of S" << endl;
+        return 1;
     }
-
-    /* the farthest xz plane */
-    indy = sys->N_cell_y + 1;
-    for (indz = 1; indz <= sys->N_cell_z; indz++) {
-        for (indx = 1; indx <= sys->N_cell_x; indx++) {
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->zn[indz] - sys->zn[indz - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->xn[indx] - sys->xn[indx - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + indx*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = -1 / (sys->xn[indx] - sys->xn[indx - 1]);
-            Senum++;
-
-            SeRowId[Senum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            SeColId[Senum] = leng_Se;
-            Seval[Senum] = 1 / (sys->zn[indz] - sys->zn[indz - 1]);
-            Senum++;
-            leng_Se++;
-        }
-    }
-    /* End of the generation of Se */
-
-
-    /* Generate Sh */
-    double *dxa = (double*)malloc((sys->N_cell_x + 1) * sizeof(double));
-    double *dya = (double*)malloc((sys->N_cell_y + 1) * sizeof(double));
-    double *dza = (double*)malloc((sys->N_cell_z + 1) * sizeof(double));
-    dxa[0] = sys->xn[1] - sys->xn[0];
-    dya[0] = sys->yn[1] - sys->yn[0];
-    dza[0] = sys->zn[1] - sys->zn[0];
-    dxa[sys->N_cell_x] = sys->xn[sys->N_cell_x] - sys->xn[sys->N_cell_x - 1];
-    dya[sys->N_cell_y] = sys->yn[sys->N_cell_y] - sys->yn[sys->N_cell_y - 1];
-    dza[sys->N_cell_z] = sys->zn[sys->N_cell_z] - sys->zn[sys->N_cell_z - 1];
-    for (int i = 1; i < sys->N_cell_x; i++) {
-        dxa[i] = (sys->xn[i + 1] - sys->xn[i - 1]) / 2;
-    }
-    for (int i = 1; i < sys->N_cell_y; i++) {
-        dya[i] = (sys->yn[i + 1] - sys->yn[i - 1]) / 2;
-    }
-    for (int i = 1; i < sys->N_cell_z; i++) {
-        dza[i] = (sys->zn[i + 1] - sys->zn[i - 1]) / 2;
-    }
-
-
-    /* the middle layers */
-    for (indz = 1; indz < sys->N_cell_z; indz++) {
-        for (indx = 1; indx <= sys->N_cell_x; indx++) {
-            for (indy = 1; indy <= sys->N_cell_y; indy++) {
-                ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = -dza[indz - 1] / (dxa[indx - 1] * dza[indz - 1]);
-                Shnum++;
-
-                ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + indx*sys->N_cell_y + indy - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = dza[indz - 1] / (dxa[indx] * dza[indz - 1]);
-                Shnum++;
-
-                ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = dza[indz - 1] / (dza[indz - 1] * dya[indy - 1]);
-                Shnum++;
-
-                ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y * (sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy + 1 - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = -dza[indz - 1] / (dza[indz - 1] * dya[indy]);
-                Shnum++;
-                leng_Sh++;
-
-                ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = dxa[indx - 1] / (dxa[indx - 1] * dza[indz - 1]);
-                Shnum++;
-
-                ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = -dxa[indx - 1] / (dxa[indx - 1] * dya[indy - 1]);
-                Shnum++;
-
-                ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1 + 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = dxa[indx - 1] / (dxa[indx - 1] * dya[indy]);
-                Shnum++;
-
-                ShRowId[Shnum] = indz * (sys->N_edge_s + sys->N_edge_v) + (indx - 1) * sys->N_cell_y + indy - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = -dxa[indx - 1] / (dxa[indx - 1] * dza[indz]);
-                Shnum++;
-                leng_Sh++;
-
-                ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = -dya[indy - 1] / (dza[indz - 1] * dya[indy - 1]);
-                Shnum++;
-
-
-                ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = dya[indy - 1] / (dxa[indx - 1] * dya[indy - 1]);
-                Shnum++;
-
-                ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + indx*(sys->N_cell_y + 1) + indy - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = -dya[indy - 1] / (dya[indy - 1] * dxa[indx]);
-                Shnum++;
-
-                ShRowId[Shnum] = indz * (sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y * (sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-                ShColId[Shnum] = leng_Sh;
-                Shval[Shnum] = dya[indy - 1] / (dya[indy - 1] * dza[indz]);
-                Shnum++;
-                leng_Sh++;
+    SRowStart[0] = 0;
+#pragma omp parallel for schedule(static)
+    for (myint indi = 0; indi < N_edge_rmPEC; indi++) {
+        myint cols[13];
+        double vals[13];
+        int n = stencil.rowEntries(sys->mapEdgeR[indi], cols, vals);
+        myint count = 0;
+        for (int k = 0; k < n; k++) {
+            if (sys->mapEdge[cols[k]] >= 0) {    // column is not a PEC edge
+                count++;
             }
         }
+        SRowStart[indi + 1] = count;
     }
-
-    /* the topmost layer doesn't contain the upper plane */
-    indz = sys->N_cell_z;
-    for (indx = 1; indx <= sys->N_cell_x; indx++) {
-        for (indy = 1; indy <= sys->N_cell_y; indy++) {
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dza[indz - 1] / (dza[indz - 1] * dxa[indx - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + indx*sys->N_cell_y + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dza[indz - 1] / (dza[indz - 1] * dxa[indx]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dza[indz - 1] / (dza[indz - 1] * dya[indy - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y * (sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy + 1 - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dza[indz - 1] / (dza[indz - 1] * dya[indy]);
-            Shnum++;
-            leng_Sh++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dxa[indx - 1] / (dxa[indx - 1] * dza[indz - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dxa[indx - 1] / (dxa[indx - 1] * dya[indy - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1 + 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dxa[indx - 1] / (dxa[indx - 1] * dya[indy]);
-            Shnum++;
-
-            ShRowId[Shnum] = indz * (sys->N_edge_s + sys->N_edge_v) + (indx - 1) * sys->N_cell_y + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dxa[indx - 1] / (dxa[indx - 1] * dza[indz]);
-            Shnum++;
-            leng_Sh++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dya[indy - 1] / (dza[indz - 1] * dya[indy - 1]);
-            Shnum++;
-
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dya[indy - 1] / (dxa[indx - 1] * dya[indy - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + indx*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dya[indy - 1] / (dya[indy - 1] * dxa[indx]);
-            Shnum++;
-
-            ShRowId[Shnum] = indz * (sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y * (sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dya[indy - 1] / (dya[indy - 1] * dza[indz]);
-            Shnum++;
-            leng_Sh++;
-
-            ShRowId[Shnum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dza[indz - 1] / (dza[indz - 1] * dxa[indx - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + indx*sys->N_cell_y + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dza[indz - 1] / (dza[indz - 1] * dxa[indx]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dza[indz - 1] / (dza[indz - 1] * dya[indy - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y * (sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy + 1 - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dza[indz - 1] / (dza[indz - 1] * dya[indy]);
-            Shnum++;
-            leng_Sh++;
-        }
+    for (myint indi = 0; indi < N_edge_rmPEC; indi++) {
+        SRowStart[indi + 1] += SRowStart[indi];
     }
-
-    /* the rightmost yz plane */
-    indx = sys->N_cell_x + 1;
-    for (indz = 1; indz <= sys->N_cell_z; indz++) {
-        for (indy = 1; indy <= sys->N_cell_y; indy++) {
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dxa[indx - 1] / (dxa[indx - 1] * dza[indz - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dxa[indx - 1] / (dxa[indx - 1] * dya[indy - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy + 1 - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dxa[indx - 1] / (dxa[indx - 1] * dya[indy]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + (indx - 1)*sys->N_cell_y + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dxa[indx - 1] / (dxa[indx - 1] * dza[indz]);
-            Shnum++;
-            leng_Sh++;
-        }
+    sys->leng_S = SRowStart[N_edge_rmPEC];
+
+    /* Fill the rows; layers grow along z so consecutive rows belong to the same z-slab */
+    sys->SRowId = (myint*)malloc(sys->leng_S * sizeof(myint));
+    sys->SColId = (myint*)malloc(sys->leng_S * sizeof(myint));
+    sys->Sval = (double*)malloc(sys->leng_S * sizeof(double));
+    if (sys->SRowId == NULL || sys->SColId == NULL || sys->Sval == NULL) {
+        cerr << "Unable to allocate " << sys->leng_S << " nonzeros of S" << endl;
+        free(SRowStart);
+        return 1;
     }
-
-    /* the farthest xz plane */
-    indy = sys->N_cell_y + 1;
-    for (indz = 1; indz <= sys->N_cell_z; indz++) {
-        for (indx = 1; indx <= sys->N_cell_x; indx++) {
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dya[indy - 1] / (dya[indy - 1] * dza[indz - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dya[indy - 1] / (dya[indy - 1] * dxa[indx - 1]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz - 1)*(sys->N_edge_s + sys->N_edge_v) + sys->N_edge_s + indx*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = -dya[indy - 1] / (dya[indy - 1] * dxa[indx]);
-            Shnum++;
-
-            ShRowId[Shnum] = (indz)*(sys->N_edge_s + sys->N_edge_v) + sys->N_cell_y*(sys->N_cell_x + 1) + (indx - 1)*(sys->N_cell_y + 1) + indy - 1;
-            ShColId[Shnum] = leng_Sh;
-            Shval[Shnum] = dya[indy - 1] / (dya[indy - 1] * dza[indz]);
-            Shnum++;
-            leng_Sh++;
+#pragma omp parallel for schedule(static)
+    for (myint indi = 0; indi < N_edge_rmPEC; indi++) {
+        myint cols[13];
+        double vals[13];
+        int n = stencil.rowEntries(sys->mapEdgeR[indi], cols, vals);
+        myint pos = SRowStart[indi];
+        for (int k = 0; k < n; k++) {
+            myint col = sys->mapEdge[cols[k]];
+            if (col >= 0) {    // mapEdge keeps the order of the original edges, so the columns stay ascending
+                sys->SRowId[pos] = indi;
+                sys->SColId[pos] = col;
+                sys->Sval[pos] = vals[k];
+                pos++;
+            }
         }
     }
-    /* End of the generation of Sh */
-    /*for (int indi = 0; indi < Shnum; indi++) {
-        cout << ShRowId[indi] << " " << ShColId[indi] << " " << Shval[indi] << endl;
-    }*/
-    /* Multiply Sh and Se */
-    
-    /******************* Explanations to matrices here *******************/
-    // matrix           size (variables in code)            COO format (*rows, *cols, *vals)
-    //
-    // Sh               N_e*N_h (sys.N_edge*leng_Sh)        (ShRowId, ShColId, Shval)
-    // Se               N_e*N_h (sys.N_edge*leng_Se)        (SeRowId, SeColId, Seval)
-    // S = Sh*Se.T/mu   N_e*N_e (sys.N_edge*sys.N_edge)     (sys.SRowId, sys.SColId, sys.Sval)
-    //
-    /******************* In function "COO2CSR_malloc" for Se & Sh *******************/
-    // matrix                                               CSR format (*rows, *cols, *vals)
-    //
-    // a = Sh.T                                             (ShColId, ShRowIdn, Shvaln)
-    // b = Se.T                                             (SeColId, SeRowIdn, Sevaln)
-    //
-    /******************* End of matrix explanation *******************/
-
-
-    myint *ShColIdo, *SeColIdo, *ShRowIdn, *SeRowIdn;
-    double *Shvaln, *Sevaln;
-    myint ind;
-    int status;
-    SeColIdo = (myint*)malloc(Senum * sizeof(myint));
-    SeRowIdn = (myint*)malloc(Senum * sizeof(myint));
-    Sevaln = (double*)malloc(Senum * sizeof(double));
-    for (ind = 0; ind < Senum; ind++) {
-        SeColIdo[ind] = SeColId[ind];
-        SeRowIdn[ind] = SeRowId[ind];
-        Sevaln[ind] = Seval[ind];
-    }
-    free(SeRowId); SeRowId = NULL;
-    free(Seval); Seval = NULL;
-    free(SeColId); SeColId = (myint*)malloc((leng_Se + 1) * sizeof(myint));
-    status = COO2CSR_malloc(SeColIdo, SeRowIdn, Sevaln, Senum, leng_Se, SeColId);
-
-
-    ShColIdo = (myint*)malloc(Shnum * sizeof(myint));
-    ShRowIdn = (myint*)malloc(Shnum * sizeof(myint));
-    Shvaln = (double*)malloc(Shnum * sizeof(double));
-    for (ind = 0; ind < Shnum; ind++) {
-        ShColIdo[ind] = ShColId[ind];
-        ShRowIdn[ind] = ShRowId[ind];
-        Shvaln[ind] = Shval[ind];
-    }
-    free(ShRowId); ShRowId = NULL;
-    free(Shval); Shval = NULL;
-    free(ShColId); ShColId = (myint*)malloc((leng_Sh + 1) * sizeof(myint));
-    status = COO2CSR_malloc(ShColIdo, ShRowIdn, Shvaln, Shnum, leng_Sh, ShColId);
-
-
-    /* generate the matrix (-w^2*D_eps+iw*D_sig+S) */
-    status = mklMatrixMulti_nt(sys, sys->leng_S, ShRowIdn, ShColId, Shvaln, sys->N_edge, leng_Se, SeRowIdn, SeColId, Sevaln);    // matrix multiplication first matrix keep the same second matrix transpose
-  
-    //cout << "Length of S is " << sys->leng_S << endl;
-    //cout << "S generation is done!\n";
-
-
-    free(dxa); dxa = NULL;
-    free(dya); dya = NULL;
-    free(dza); dza = NULL;
-    free(SeRowId); SeRowId = NULL;
-    free(SeColId); SeColId = NULL;
-    free(SeColIdo); SeColIdo = NULL;
-    free(Seval); Seval = NULL;
-    free(ShRowId); ShRowId = NULL;
-    free(ShColId); ShColId = NULL;
-    free(ShColIdo); ShColIdo = NULL;
-    free(Shval); Shval = NULL;
-
-    /*for (int indi = 0; indi < sys->numPorts; indi++) {
-        for (int indj = 0; indj < sys->numPorts; indj++) {
-            cout << Yr[indi * sys->numPorts + indj].real() << " " << Yr[indi * sys->numPorts + indj].imag() << endl;
-        }
-    }*/
 
+    free(SRowStart); SRowStart = NULL;
     return 0;
 }
 
-
 int reference(fdtdMesh *sys, int freqNo, myint *RowId, myint *ColId, double *val){
 
     double freq = sys->freqNo2freq(freqNo);
@@ -575,22 +84,25 @@ int reference(fdtdMesh *sys, int freqNo, myint *RowId, myint *ColId, double *val
     int k = 0;
     complex<double> *valc;
     valc = (complex<double>*)calloc(sys->leng_S, sizeof(complex<double>));
-    complex<double> *J;
-    J = (complex<double>*)calloc((sys->N_edge - sys->bden) * sys->numPorts, sizeof(complex<double>));
     int indz, indy, temp;
     int sourcePort;
 
+    /* J of every source port is nonzero only at its port edges, and Construct_Z_V0_Vh() reads xr only at the edges of
+    every port. So perm marks all port edges, and PARDISO takes sparse right-hand sides and computes only those
+    components of xr. Only source ports are excited, response-only ports just mark where xr is read. */
+    myint N_source = sys->sourcePorts.size();
+    vector<sparseExcitation> portCurrents(N_source);
+    vector<myint> perm(size, 0);
     for (sourcePort = 0; sourcePort < sys->numPorts; sourcePort++) {
-        for (int sourcePortSide = 0; sourcePortSide < sys->portCoor[sourcePort].multiplicity; sourcePortSide++) {
-            for (int inde = 0; inde < sys->portCoor[sourcePort].portEdge[sourcePortSide].size(); inde++){
-                J[sourcePort * (sys->N_edge - sys->bden) + sys->mapEdge[sys->portCoor[sourcePort].portEdge[sourcePortSide][inde]]] = 
-                    0. - (1i) * (double) (sys->portCoor[sourcePort].portDirection[sourcePortSide]) * freq * 2. * M_PI;
-                //cout << "SourcePort " << sourcePort << " sourcePortSide " << sourcePortSide << " is " << sys->portCoor[sourcePort].portEdge[sourcePortSide][inde] << endl;
-                //cout << "SourcePort " << sourcePort << " sourcePortSide " << sourcePortSide << " is " << sys->portCoor[sourcePort].portDirection[sourcePortSide] << endl;
-
-            }
+        sparseExcitation portCurrent;
+        sys->setPortCurrent(sourcePort, portCurrent);
+        for (auto e : portCurrent.edge) {
+            perm[sys->mapEdge[e]] = 1;
         }
     }
+    for (indi = 0; indi < N_source; indi++) {
+        sys->setPortCurrent(sys->sourcePorts[indi], portCurrents[indi]);
+    }
     
     /* Used in plasma2D for upper and lower excitation */
     /*myint current_edge = sys->portEdge[sourcePort][indi - 1] + (sys->N_edge_s + sys->N_edge_v);
@@ -617,14 +129,8 @@ int reference(fdtdMesh *sys, int freqNo, myint *RowId, myint *ColId, double *val
         while (indi < nnz && RowId[indi] == start) {
             valc[indi] += val[indi]; // val[indi] is real
             if (RowId[indi] == ColId[indi]){
-                if (sys->markEdge[sys->mapEdgeR[RowId[indi]]] != 0) {
-                    complex<double> addedPart(-(2. * M_PI * freq) * sys->stackEpsn[(sys->mapEdgeR[RowId[indi]] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0, SIGMA);
-                    valc[indi] += (2. * M_PI * freq) * addedPart;
-                }
-                else {
-                    complex<double> addedPart(-(2. * M_PI * freq) * sys->stackEpsn[(sys->mapEdgeR[RowId[indi]] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0, 0);
-                    valc[indi] += (2. * M_PI * freq) * addedPart;
-                }
+                complex<double> addedPart(-(2. * M_PI * freq) * sys->eps[RowId[indi]], sys->sig[RowId[indi]]);    // -w*D_eps+i*D_sig
+                valc[indi] += (2. * M_PI * freq) * addedPart;
             }
             //out << valc[indi].real() << " " << valc[indi].imag() << endl;
             count++;
@@ -636,7 +142,7 @@ int reference(fdtdMesh *sys, int freqNo, myint *RowId, myint *ColId, double *val
     //out.close();
     //cout << "(-w^2*D_eps+iw*D_sig+S) is generated!\n" << endl;
     myint mtype = 13;    /* Real complex unsymmetric matrix */
-    myint nrhs = sys->numPorts;    /* Number of right hand sides */
+    myint nrhs;    /* Number of right hand sides */
     void *pt[64];
 
     /* Pardiso control parameters */
@@ -644,7 +150,6 @@ int reference(fdtdMesh *sys, int freqNo, myint *RowId, myint *ColId, double *val
     myint maxfct, mnum, phase, error, msglvl, solver;
     double dparm[64];
     int v0csin;
-    myint perm;
 
     /* Auxiliary variables */
     char *var;
@@ -654,32 +159,55 @@ int reference(fdtdMesh *sys, int freqNo, myint *RowId, myint *ColId, double *val
     error = 0;
     maxfct = 1;
     mnum = 1;
-    phase = 13;
+    phase = 12;
 
     pardisoinit(pt, &mtype, iparm);
-    iparm[38] = 1;
+    iparm[38] = 0;          // no low rank update, which would read perm as changed entries
     iparm[34] = 1;          // 0-based indexing
+    iparm[30] = 1;          // sparse right-hand sides, only the perm-marked components of xr are computed
     iparm[3] = 0;           /* No iterative-direct algorithm */
     //iparm[3] = 2;         // CGS iteration for symmetric positive definite matrices replaces the computation of LLT
     //iparm[59] = 2;        // out of core version to solve very large problem
     //iparm[10] = 0;        /* Use nonsymmetric permutation and scaling MPS */
 
     //cout << "Begin to solve (-w^2*D_eps+iwD_sig+S)x=-iwJ\n";
-    complex<double> *xr;
-    complex<double> * ddum;
-    xr = (complex<double>*)calloc((sys->N_edge - sys->bden) * sys->numPorts, sizeof(complex<double>));
-
-    pardiso(pt, &maxfct, &mnum, &mtype, &phase, &size, valc, RowId1, ColId, &perm, &nrhs, iparm, &msglvl, J, xr, &error);
+    complex<double> ddum;
+    nrhs = 1;
+    pardiso(pt, &maxfct, &mnum, &mtype, &phase, &size, valc, RowId1, ColId, perm.data(), &nrhs, iparm, &msglvl, &ddum, &ddum, &error);
     if (error != 0) {
-        printf("\nERROR during numerical factorization: %d", error);
+        cerr << "\nERROR during numerical factorization: " << error << endl;
         exit(2);
     }
-    
-    for (indi = 0; indi < sourcePort; indi++)
-        sys->Construct_Z_V0_Vh(&xr[indi * (sys->N_edge - sys->bden)], freqNo, indi);
+
+    /* Solve REFERENCE_PORT_BATCH source ports at a time, so J and xr hold that many vectors instead of one per port */
+    myint N_batch = min((myint)REFERENCE_PORT_BATCH, N_source);
+    vector<complex<double>> J(size * N_batch), xr(size * N_batch);
+    phase = 33;
+    for (myint firstPort = 0; firstPort < N_source; firstPort += N_batch) {
+        nrhs = min(N_source - firstPort, N_batch);
+        for (indi = 0; indi < nrhs; indi++) {
+            const sparseExcitation &portCurrent = portCurrents[firstPort + indi];
+            for (size_t inde = 0; inde < portCurrent.size(); inde++) {
+                J[indi * size + sys->mapEdge[portCurrent.edge[inde]]] = 0. - (1i) * portCurrent.val[inde] * freq * 2. * M_PI;
+            }
+        }
+        pardiso(pt, &maxfct, &mnum, &mtype, &phase, &size, valc, RowId1, ColId, perm.data(), &nrhs, iparm, &msglvl, J.data(), xr.data(), &error);
+        if (error != 0) {
+            cerr << "\nERROR during solution: " << error << endl;
+            exit(2);
+        }
+
+        for (indi = 0; indi < nrhs; indi++) {
+            sys->Construct_Z_V0_Vh(&xr[indi * size], freqNo, sys->sourcePorts[firstPort + indi]);
+            const sparseExcitation &portCurrent = portCurrents[firstPort + indi];
+            for (size_t inde = 0; inde < portCurrent.size(); inde++) {
+                J[indi * size + sys->mapEdge[portCurrent.edge[inde]]] = 0.;
+            }
+        }
+    }
 
     phase = -1;     // Release internal memory
-    pardiso(pt, &maxfct, &mnum, &mtype, &phase, &size, &ddum, RowId1, ColId, &perm, &nrhs, iparm, &msglvl, &ddum, &ddum, &error);
+    pardiso(pt, &maxfct, &mnum, &mtype, &phase, &size, &ddum, RowId1, ColId, perm.data(), &nrhs, iparm, &msglvl, &ddum, &ddum, &error);
 
     /*cout << "The entire norm of xr is ";
     double total_norm = 0;
@@ -691,10 +219,8 @@ int reference(fdtdMesh *sys, int freqNo, myint *RowId, myint *ColId, double *val
     
 
 
-    free(xr); xr = NULL;    
     free(RowId1); RowId1 = NULL;
     free(valc); valc = NULL;
-    free(J); J = NULL;
     return 0;
 }
 
@@ -868,117 +394,6 @@ int plotTime(fdtdMesh *sys, int sourcePort, int sourcePortSide, double *u0d, dou
 }
 
 
-int COO2CSR_malloc(myint *rowId, myint *ColId, double *val, myint totalnum, myint leng, myint *rowId1) {    // totalnum is the total number of entries, leng is the row number
-    int indi = 0, indk = 0;
-    int *rowId2;
-    int count = 0, start = 0;
-
-    rowId2 = (int*)malloc((leng + 1) * sizeof(int));
-    rowId2[indk] = 0;
-    indk++; // Start with an increment
-    while (indi < totalnum) {
-        start = rowId[indi];
-        while (indi < totalnum && rowId[indi] == start) {
-            count++;
-            indi++;
-        }
-        rowId2[indk] = (count);
-        indk++;
-    }
-
-    for (indi = 0; indi <= leng; indi++) {
-        rowId1[indi] = rowId2[indi];
-    }
-
-    free(rowId2); rowId2 = NULL;
-    return 0;
-}
-
-int mklMatrixMulti_nt(fdtdMesh *sys, myint &leng_A, myint *aRowId, myint *aColId, double *aval, myint arow, myint acol, myint *bRowId, myint *bColId, double *bval) {
-    
-    /******************* Explanations to matrices here *******************/
-    // matrix           size~rows*cols~(variables in code)  CSR format (*rows, *cols, *vals)
-    //
-    // a = Sh.T         N_h*N_e (acol*arow)                 (aColId, aRowId, aval)
-    // b = Se.T         N_h*N_e (acol*arow)                 (bColId, bRowId, bval)
-    // A = a.T*b        N_e*N_e (ARows*ACols)               (~, AcolId, Aval)
-    //
-    // matrix           size                                COO format (*rows, *cols, *vals)
-    //
-    // S = Sh*Se.T/mu   N_e*N_e, then truncate with BC      (sys.SRowId, sys.SColId, sys.Sval)
-    //
-    /******************* End of matrix explanation *******************/
-    sparse_status_t s0;
-    sparse_matrix_t a;
-    sparse_index_base_t indexing1 = SPARSE_INDEX_BASE_ZERO;
-    myint row, col;
-    myint *cols, *cole, *rowi;
-    double *val;
-    MKL_INT *AcolId;
-    double *Aval;
-    myint k;
-    s0 = mkl_sparse_d_create_csr(&a, SPARSE_INDEX_BASE_ZERO, acol, arow, &aColId[0], &aColId[1], aRowId, aval);
-
-    sparse_matrix_t b;
-    s0 = mkl_sparse_d_create_csr(&b, SPARSE_INDEX_BASE_ZERO, acol, arow, &bColId[0], &bColId[1], bRowId, bval);
-
-    sparse_matrix_t A;
-    s0 = mkl_sparse_spmm(SPARSE_OPERATION_TRANSPOSE, a, b, &A);
-    sparse_index_base_t indexing = SPARSE_INDEX_BASE_ZERO;
-    myint ARows, ACols;
-    MKL_INT *ArowStart, *ArowEnd;
-
-    s0 = mkl_sparse_d_export_csr(A, &indexing, &ARows, &ACols, &ArowStart, &ArowEnd, &AcolId, &Aval);
-    leng_A = ArowEnd[ARows - 1];    // how many non-zeros are in S
-
-    sys->SRowId = (myint*)malloc(leng_A * sizeof(myint));
-    sys->SColId = (myint*)malloc(leng_A * sizeof(myint));
-    sys->Sval = (double*)calloc(leng_A, sizeof(double));
-    myint count, num, j;
-    j = 0;
-    vector<pair<myint, double>> col_val;
-    for (myint i = 0; i < leng_A; i++) {
-        col_val.push_back(make_pair(AcolId[i], Aval[i]));
-    }
-    ofstream out;
-    //out.open("S.txt", std::ofstream::out | std::ofstream::trunc);
-
-    // Generate S matrix in COO format and Remove {e} at PEC BC. Layer growth along z
-    for (myint i = 0; i < ARows; i++){
-        if (sys->lbde.find(i) != sys->lbde.end() || sys->ubde.find(i) != sys->ubde.end()){   // if this row number is among the upper or lower boundary edges
-            continue;
-        }
-        num = ArowEnd[i] - ArowStart[i];
-        count = 0;
-        vector<pair<myint, double>> v(col_val.begin() + ArowStart[i], col_val.begin() + ArowEnd[i]);
-        sort(v.begin(), v.end());
-
-        while (count < num){
-            if (sys->lbde.find(v[count].first) != sys->lbde.end() || sys->ubde.find(v[count].first) != sys->ubde.end()) {   // if this column number is among the upper or lower boundary edges
-                count++;
-                continue;
-            }
-            sys->SRowId[j] = sys->mapEdge[i];
-            sys->SColId[j] = sys->mapEdge[v[count].first];
-            sys->Sval[j] = v[count].second / MU;
-            //out << sys->SRowId[j] << " " << sys->SColId[j] << " ";
-            //out << sys->Sval[j] << endl;
-
-            j++;
-            count++;
-        }
-        v.clear();
-    }
-
-    //out.close();
-    leng_A = j;
-
-    mkl_sparse_destroy(a);
-    mkl_sparse_destroy(b);
-    mkl_sparse_destroy(A);
-    return 0;
-}
-
 int matrix_multi_cd(char operation, lapack_complex_double *a, myint arow, myint acol, double *b, myint brow, myint bcol, lapack_complex_double *tmp3) {    // complex multiply double
     /* operation = 'T' is first matrix conjugate transpose, operation = 'N' is first matrix non-conjugate-transpose*/
     if (operation == 'T') {
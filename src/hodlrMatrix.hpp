@@ -0,0 +1,329 @@
+#ifndef GDS2PARA_HODLR_MATRIX_H_
+#define GDS2PARA_HODLR_MATRIX_H_
+
+#include "fdtd.hpp"
+#include "matrixTypeDef.hpp"
+
+#define HODLR_LEAF_SIZE (256)   // diagonal blocks up to this size are kept dense
+#define HODLR_MIN_SIZE (2048)   // smaller matrices are not worth compressing, use the dense operations
+#define HODLR_ACA_TOL (1e-12)   // off-diagonal blocks are truncated at this fraction of the largest entry of the matrix
+
+// Hierarchically off-diagonal low-rank (HODLR) format of a square matrix
+/* The matrix is halved recursively by index. The diagonal blocks at the leaves are dense, and the 2
+off-diagonal blocks of each node are kept as U * Vt from a cross approximation. A node whose off-diagonal blocks
+need more rank than U and Vt save over the dense block is kept dense as a leaf instead:
+
+        A = | A11          U[0]*Vt[0] |   = D + Ublk * Vtblk
+            | U[1]*Vt[1]   A22        |
+
+Solves use the Woodbury identity at each node,
+        inv(A) = inv(D) - Z * inv(K) * Vtblk * inv(D),   Z = inv(D) * Ublk,   K = I + Vtblk * Z,
+where inv(D) is applied by the 2 children, so the factorization costs O(N*r^2*log^2(N)). */
+class hodlrFormatOfMatrix {
+public:
+    myint N_rows;                       // = N_cols
+
+    // Compress the dense square matrix A
+    hodlrFormatOfMatrix(const denseFormatOfMatrix &A, double relTol = HODLR_ACA_TOL) {
+        if (A.N_rows != A.N_cols) {
+            cout << "Failure, only square matrix can be compressed to HODLR!" << endl;
+            exit(2);
+        }
+        this->N_rows = A.N_rows;
+
+        double maxAbs = 0.0;
+        for (const auto &val : A.vals) {
+            maxAbs = max(maxAbs, abs(val));
+        }
+        this->buildNode(A, 0, A.N_rows, relTol * maxAbs);
+    }
+
+    // C -= A (this) dot B
+    void minusDot(const denseFormatOfMatrix &B, denseFormatOfMatrix *C) const {
+        if (this->N_rows != B.N_rows || C->N_rows != this->N_rows || C->N_cols != B.N_cols) {
+            cout << "Failure to dot multiply matrices, dimensions not match!" << endl;
+            exit(2);
+        }
+        this->multiplyNode(0, { -1.0, 0.0 }, B.vals.data(), B.N_rows, C->vals.data(), C->N_rows, B.N_cols);
+    }
+
+    // C = A (this) dot B
+    denseFormatOfMatrix dot(const denseFormatOfMatrix &B) const {
+        if (this->N_rows != B.N_rows) {
+            cout << "Failure to dot multiply matrices, dimensions not match!" << endl;
+            exit(2);
+        }
+        denseFormatOfMatrix C(this->N_rows, B.N_cols);
+        this->multiplyNode(0, { 1.0, 0.0 }, B.vals.data(), B.N_rows, C.vals.data(), C.N_rows, B.N_cols);
+        return C;
+    }
+
+    // B = A (this) \ B = inv(A) dot B in place, A is factorized at the first call
+    void backslashInPlace(denseFormatOfMatrix *B) {
+        if (this->N_rows != B->N_rows) {
+            cout << "Failure to backslash matrices, dimensions not match!" << endl;
+            exit(2);
+        }
+        if (!this->factorized) {
+            this->factorizeNode(0);
+            this->factorized = true;
+        }
+        this->solveNode(0, B->vals.data(), B->N_rows, B->N_cols);
+    }
+
+    // C = A (this) \ B = inv(A) dot B
+    denseFormatOfMatrix backslash(const denseFormatOfMatrix &B) {
+        denseFormatOfMatrix C = B;
+        this->backslashInPlace(&C);
+        return C;
+    }
+
+    // Num of complex numbers stored by the compressed matrix (without factors)
+    myint storedSize() const {
+        myint size = 0;
+        for (const auto &node : this->nodes) {
+            size += node.dense.size() + node.U[0].size() + node.Vt[0].size() + node.U[1].size() + node.Vt[1].size();
+        }
+        return size;
+    }
+
+private:
+    struct hodlrNode {
+        myint start = 0;                        // first row (col) of this diagonal block
+        myint size = 0;
+        myint child[2] = { -1, -1 };            // node index of A11 and A22, -1 at a leaf
+        vector<complex<double>> dense;          // leaf: the block, column-major
+        vector<complex<double>> lu;             // leaf: LU factors of dense
+        vector<lapack_int> ipiv;
+        myint rank[2] = { 0, 0 };               // rank of A12 (0) and A21 (1)
+        vector<complex<double>> U[2];           // A12 = U[0]*Vt[0], A21 = U[1]*Vt[1], column-major
+        vector<complex<double>> Vt[2];
+        vector<complex<double>> Z[2];           // inv(A11)*U[0] and inv(A22)*U[1]
+        vector<complex<double>> K;              // LU factors of K, size (rank[0] + rank[1])^2
+        vector<lapack_int> ipivK;
+    };
+
+    myint buildNode(const denseFormatOfMatrix &A, myint start, myint size, double absTol) {
+        myint id = this->nodes.size();
+        this->nodes.push_back(hodlrNode());
+        this->nodes[id].start = start;
+        this->nodes[id].size = size;
+
+        if (size <= HODLR_LEAF_SIZE) {
+            this->setLeaf(A, id);
+            return id;
+        }
+
+        myint n1 = size / 2, n2 = size - n1;
+        hodlrNode node;
+        node.rank[0] = compressBlock(A, start, start + n1, n1, n2, absTol, node.U[0], node.Vt[0]);
+        if (node.rank[0] >= 0) {
+            node.rank[1] = compressBlock(A, start + n1, start, n2, n1, absTol, node.U[1], node.Vt[1]);
+        }
+        if (node.rank[0] < 0 || node.rank[1] < 0) {
+            this->setLeaf(A, id);   // incompressible, so the dense block is smaller than its low-rank form
+            return id;
+        }
+        node.child[0] = this->buildNode(A, start, n1, absTol);
+        node.child[1] = this->buildNode(A, start + n1, n2, absTol);
+        node.start = start;
+        node.size = size;
+        this->nodes[id] = move(node);
+        return id;
+    }
+
+    // Keep the diagonal block of node id dense
+    void setLeaf(const denseFormatOfMatrix &A, myint id) {
+        myint start = this->nodes[id].start, size = this->nodes[id].size;
+        vector<complex<double>> &dense = this->nodes[id].dense;
+        dense.resize(size * size);
+        for (myint j_col = 0; j_col < size; j_col++) {
+            for (myint i_row = 0; i_row < size; i_row++) {
+                dense[j_col * size + i_row] = A.vals[(j_col + start) * A.N_rows + i_row + start];
+            }
+        }
+    }
+
+    // Cross approximation with full pivoting of A(rowStart ~ +m, colStart ~ +n) = U * Vt, returns the rank
+    /* The rank is capped at m*n/(m+n), past which U and Vt hold more than the block itself. A block not converged by
+    then returns -1 with U and Vt empty, which also bounds the pivot searches at O(m*n) per rank. */
+    static myint compressBlock(const denseFormatOfMatrix &A, myint rowStart, myint colStart, myint m, myint n, double absTol,
+        vector<complex<double>> &U, vector<complex<double>> &Vt) {
+        vector<complex<double>> R(m * n);       // residual of the block, column-major
+        for (myint j_col = 0; j_col < n; j_col++) {
+            for (myint i_row = 0; i_row < m; i_row++) {
+                R[j_col * m + i_row] = A.vals[(j_col + colStart) * A.N_rows + i_row + rowStart];
+            }
+        }
+
+        vector<complex<double>> vRows;          // rows of Vt one after another
+        U.clear();
+        Vt.clear();
+        myint maxRank = m * n / (m + n);
+        myint rank = 0;
+        while (true) {
+            myint pivot = 0;
+            for (myint ind = 1; ind < m * n; ind++) {
+                if (abs(R[ind]) > abs(R[pivot])) {
+                    pivot = ind;
+                }
+            }
+            if (abs(R[pivot]) <= absTol) {
+                break;
+            }
+            if (rank == maxRank) {
+                U.clear();
+                return -1;
+            }
+            myint ip = pivot % m, jp = pivot / m;
+
+            // Take out the cross R(:, jp) * R(ip, :) / R(ip, jp)
+            complex<double> pivotVal = R[pivot];
+            U.insert(U.end(), R.begin() + jp * m, R.begin() + (jp + 1) * m);
+            const complex<double> *u = U.data() + rank * m;
+            for (myint j_col = 0; j_col < n; j_col++) {
+                vRows.push_back(R[j_col * m + ip] / pivotVal);
+            }
+            const complex<double> *v = vRows.data() + rank * n;
+#pragma omp parallel for schedule(static)
+            for (myint j_col = 0; j_col < n; j_col++) {
+                for (myint i_row = 0; i_row < m; i_row++) {
+                    R[j_col * m + i_row] -= u[i_row] * v[j_col];
+                }
+            }
+            rank++;
+        }
+
+        Vt.resize(rank * n);
+        for (myint l = 0; l < rank; l++) {
+            for (myint j_col = 0; j_col < n; j_col++) {
+                Vt[j_col * rank + l] = vRows[l * n + j_col];
+            }
+        }
+        return rank;
+    }
+
+    // C = alpha * A * B + beta * C, all column-major with leading dimensions
+    static void gemm(myint m, myint n, myint k, complex<double> alpha, const complex<double> *A, myint ldA,
+        const complex<double> *B, myint ldB, complex<double> beta, complex<double> *C, myint ldC) {
+        if (m == 0 || n == 0 || k == 0) {
+            return;
+        }
+        cblas_zgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, m, n, k, &alpha, A, ldA, B, ldB, &beta, C, ldC);
+    }
+
+    // Y += alpha * A(node) * X, X and Y point at the first row of this node
+    void multiplyNode(myint id, complex<double> alpha, const complex<double> *X, myint ldX, complex<double> *Y, myint ldY, myint nrhs) const {
+        const hodlrNode &node = this->nodes[id];
+        complex<double> one(1.0, 0.0), zero(0.0, 0.0);
+        if (node.child[0] < 0) {
+            gemm(node.size, nrhs, node.size, alpha, node.dense.data(), node.size, X, ldX, one, Y, ldY);
+            return;
+        }
+
+        myint n1 = this->nodes[node.child[0]].size;
+        myint n2 = node.size - n1;
+        this->multiplyNode(node.child[0], alpha, X, ldX, Y, ldY, nrhs);
+        this->multiplyNode(node.child[1], alpha, X + n1, ldX, Y + n1, ldY, nrhs);
+
+        vector<complex<double>> T(max(node.rank[0], node.rank[1]) * nrhs);
+        gemm(node.rank[0], nrhs, n2, one, node.Vt[0].data(), node.rank[0], X + n1, ldX, zero, T.data(), node.rank[0]);
+        gemm(n1, nrhs, node.rank[0], alpha, node.U[0].data(), n1, T.data(), node.rank[0], one, Y, ldY);
+        gemm(node.rank[1], nrhs, n1, one, node.Vt[1].data(), node.rank[1], X, ldX, zero, T.data(), node.rank[1]);
+        gemm(n2, nrhs, node.rank[1], alpha, node.U[1].data(), n2, T.data(), node.rank[1], one, Y + n1, ldY);
+    }
+
+    // Factorize the leaves and K of every node, children first
+    void factorizeNode(myint id) {
+        hodlrNode &node = this->nodes[id];
+        if (node.child[0] < 0) {
+            node.lu = node.dense;
+            node.ipiv.resize(node.size);
+            lapack_int info = LAPACKE_zgetrf(LAPACK_COL_MAJOR, node.size, node.size,
+                reinterpret_cast<MKL_Complex16*>(node.lu.data()), node.size, node.ipiv.data());
+            if (info != 0) {
+                cout << "Issue on LU factorization of a HODLR leaf, LAPACKE_?getrf returns: " << info << endl;
+                exit(2);
+            }
+            return;
+        }
+
+        this->factorizeNode(node.child[0]);
+        this->factorizeNode(node.child[1]);
+
+        myint n1 = this->nodes[node.child[0]].size;
+        myint n2 = node.size - n1;
+        myint r0 = node.rank[0], r1 = node.rank[1], r = r0 + r1;
+        node.Z[0] = node.U[0];
+        this->solveNode(node.child[0], node.Z[0].data(), n1, r0);
+        node.Z[1] = node.U[1];
+        this->solveNode(node.child[1], node.Z[1].data(), n2, r1);
+        if (r == 0) {
+            return;
+        }
+
+        // K = I + | 0          Vt[0]*Z[1] |
+        //         | Vt[1]*Z[0] 0          |
+        complex<double> one(1.0, 0.0), zero(0.0, 0.0);
+        node.K.assign(r * r, zero);
+        for (myint ind = 0; ind < r; ind++) {
+            node.K[ind * r + ind] = one;
+        }
+        gemm(r0, r1, n2, one, node.Vt[0].data(), r0, node.Z[1].data(), n2, zero, node.K.data() + r0 * r, r);
+        gemm(r1, r0, n1, one, node.Vt[1].data(), r1, node.Z[0].data(), n1, zero, node.K.data() + r0, r);
+        node.ipivK.resize(r);
+        lapack_int info = LAPACKE_zgetrf(LAPACK_COL_MAJOR, r, r, reinterpret_cast<MKL_Complex16*>(node.K.data()), r, node.ipivK.data());
+        if (info != 0) {
+            cout << "Issue on LU factorization of a HODLR node, LAPACKE_?getrf returns: " << info << endl;
+            exit(2);
+        }
+    }
+
+    // X = inv(A(node)) * X in place, X points at the first row of this node
+    void solveNode(myint id, complex<double> *X, myint ldX, myint nrhs) const {
+        const hodlrNode &node = this->nodes[id];
+        if (nrhs == 0) {
+            return;
+        }
+        if (node.child[0] < 0) {
+            lapack_int info = LAPACKE_zgetrs(LAPACK_COL_MAJOR, 'N', node.size, nrhs,
+                reinterpret_cast<const MKL_Complex16*>(node.lu.data()), node.size, node.ipiv.data(),
+                reinterpret_cast<MKL_Complex16*>(X), ldX);
+            if (info != 0) {
+                cout << "Issue on solving a HODLR leaf, LAPACKE_?getrs returns: " << info << endl;
+                exit(2);
+            }
+            return;
+        }
+
+        // Y = inv(D) * X
+        myint n1 = this->nodes[node.child[0]].size;
+        myint n2 = node.size - n1;
+        this->solveNode(node.child[0], X, ldX, nrhs);
+        this->solveNode(node.child[1], X + n1, ldX, nrhs);
+        myint r0 = node.rank[0], r1 = node.rank[1], r = r0 + r1;
+        if (r == 0) {
+            return;
+        }
+
+        // X = Y - Z * inv(K) * Vtblk * Y
+        complex<double> one(1.0, 0.0), zero(0.0, 0.0), minusOne(-1.0, 0.0);
+        vector<complex<double>> T(r * nrhs);
+        gemm(r0, nrhs, n2, one, node.Vt[0].data(), r0, X + n1, ldX, zero, T.data(), r);
+        gemm(r1, nrhs, n1, one, node.Vt[1].data(), r1, X, ldX, zero, T.data() + r0, r);
+        lapack_int info = LAPACKE_zgetrs(LAPACK_COL_MAJOR, 'N', r, nrhs,
+            reinterpret_cast<const MKL_Complex16*>(node.K.data()), r, node.ipivK.data(),
+            reinterpret_cast<MKL_Complex16*>(T.data()), r);
+        if (info != 0) {
+            cout << "Issue on solving a HODLR node, LAPACKE_?getrs returns: " << info << endl;
+            exit(2);
+        }
+        gemm(n1, nrhs, r0, minusOne, node.Z[0].data(), n1, T.data(), r, one, X, ldX);
+        gemm(n2, nrhs, r1, minusOne, node.Z[1].data(), n2, T.data() + r0, r, one, X + n1, ldX);
+    }
+
+    vector<hodlrNode> nodes;                    // nodes[0] is the whole matrix
+    bool factorized = false;
+};
+
+#endif
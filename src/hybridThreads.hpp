@@ -0,0 +1,164 @@
+#ifndef GDS2PARA_HYBRID_THREADS_H_
+#define GDS2PARA_HYBRID_THREADS_H_
+
+#include <sched.h>
+#include <unistd.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "fdtd.hpp"
+
+#define THREADS_PER_RANK_ENV "GDS2PARA_THREADS" // threads of each MPI rank for OpenMP regions and MKL, default the cores of the node shared evenly by its ranks
+#define PIN_THREADS_ENV "GDS2PARA_PIN"          // "core" pins each thread to one core of the rank's block, "rank" binds all threads to the block, "none" (default) leaves placement to the OS
+
+// Threads per MPI rank and their placement on the cores of the node, set once before meshing
+/* The ranks on one node split its cores into contiguous blocks in local rank order, so rank r owns cores
+[r * threads, (r + 1) * threads). After MPI_Init() the local rank and the number of ranks on the node come from
+MPI_Comm_split_type(), which every launcher agrees on, and constructing the class is then collective. Before it they
+are read from the launcher environment, and if the number of ranks on the node is unknown the threads are not pinned,
+as overlapping blocks would be worse than the OS placement. Without the OpenMP build (make OPENMP=1) every rank keeps
+one thread, but pinning still applies to it. */
+class hybridThreads {
+public:
+    hybridThreads() {
+        bool localKnown = true;
+        int mpiStarted = 0;
+        MPI_Initialized(&mpiStarted);
+        if (mpiStarted) {
+            MPI_Comm nodeComm;
+            MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &nodeComm);
+            MPI_Comm_rank(nodeComm, &this->localRank);
+            MPI_Comm_size(nodeComm, &this->localRanks);
+            MPI_Comm_free(&nodeComm);
+        }
+        else {
+            this->localRank = envInt({ "OMPI_COMM_WORLD_LOCAL_RANK", "MPI_LOCALRANKID", "SLURM_LOCALID" }, 0);
+            this->localRanks = envInt({ "OMPI_COMM_WORLD_LOCAL_SIZE", "MPI_LOCALNRANKS", "SLURM_NTASKS_PER_NODE" }, 0);
+            if (this->localRanks < 1) {
+                localKnown = false;
+                this->localRanks = 1;
+            }
+        }
+        this->nodeCores = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+        this->threads = envInt({ THREADS_PER_RANK_ENV }, max(1, this->nodeCores / this->localRanks));
+        if (this->threads < 1) {
+            cerr << THREADS_PER_RANK_ENV << " must be a positive integer. Defaulting to 1 thread per rank." << endl;
+            this->threads = 1;
+        }
+        const char *pin = getenv(PIN_THREADS_ENV);
+        this->pin = (pin == NULL) ? "none" : pin;
+        if (this->pin != "none" && this->pin != "core" && this->pin != "rank") {
+            cerr << PIN_THREADS_ENV << " must be \"none\", \"core\" or \"rank\". Defaulting to \"none\"." << endl;
+            this->pin = "none";
+        }
+        if (!localKnown && this->pin != "none") {
+            cerr << "The number of MPI ranks on this node is unknown, so " << PIN_THREADS_ENV << " is ignored and threads are not pinned." << endl;
+            this->pin = "none";
+        }
+        this->firstCore = (this->localRank * this->threads) % this->nodeCores;
+    }
+
+    // Set the thread counts of OpenMP and MKL and pin the threads
+    void apply() const {
+#ifdef _OPENMP
+        omp_set_num_threads(this->threads);
+#endif
+        mkl_set_num_threads(this->threads);
+        if (this->pin == "none") {
+            return;
+        }
+#ifdef _OPENMP
+#pragma omp parallel
+        this->pinThread(omp_get_thread_num());  // the OpenMP pool is reused by later regions and by threaded MKL
+#else
+        this->pinThread(0);
+#endif
+    }
+
+    void print() const {
+        cout << "Local rank " << this->localRank << " of " << this->localRanks << " runs " << this->threads
+            << " threads on cores " << this->firstCore << "-" << this->firstCore + this->threads - 1
+            << " of " << this->nodeCores << " (pinning " << this->pin << ")" << endl;
+#ifndef _OPENMP
+        if (this->threads > 1) {
+            cout << "Built without OpenMP, so only 1 thread is used. Rebuild with \"make OPENMP=1\" for threaded MKL." << endl;
+        }
+#endif
+    }
+
+private:
+    static int envInt(const vector<const char*> &names, int fallback) {
+        for (auto name : names) {
+            const char *value = getenv(name);
+            if (value != NULL && *value != '\0') {
+                return atoi(value);
+            }
+        }
+        return fallback;
+    }
+
+    void pinThread(int thread) const {
+        cpu_set_t cores;
+        CPU_ZERO(&cores);
+        if (this->pin == "core") {
+            CPU_SET((this->firstCore + thread % this->threads) % this->nodeCores, &cores);
+        }
+        else {
+            for (int core = 0; core < this->threads; core++) {
+                CPU_SET((this->firstCore + core) % this->nodeCores, &cores);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &cores) != 0) {
+            cerr << "Unable to pin thread " << thread << " of local rank " << this->localRank << endl;
+        }
+    }
+
+    int localRank;      // rank index among the ranks on this node
+    int localRanks;     // num of ranks on this node
+    int nodeCores;      // num of online cores of this node
+    int threads;        // threads of this rank
+    int firstCore;      // first core of this rank's block
+    string pin;         // "none", "core" or "rank"
+};
+
+// calloc() whose pages are first touched by the threads of a static schedule
+/* Linux places a page on the NUMA node of the thread that first writes it. calloc() of a large array returns untouched
+zero pages that a serial loop would then place on one node, so the array is zeroed here by the same static
+partition the parallel loops over it use. Free with free(). */
+template <typename T>
+T *firstTouchCalloc(myint n) {
+    T *data = (T*)malloc(n * sizeof(T));
+    if (data == NULL) {
+        return NULL;
+    }
+#pragma omp parallel for schedule(static)
+    for (myint ind = 0; ind < n; ind++) {
+        data[ind] = T();
+    }
+    return data;
+}
+
+// memcpy() of src, or zeroing if src is NULL, whose pages are first touched by the threads of a static schedule
+/* For memory not allocated by firstTouchCalloc(), such as an MPI shared window. Dividing the bytes of an array
+statically divides its elements at the same places, so each page lands on the node of the thread that uses it. */
+inline void firstTouchCopy(void *dst, const void *src, size_t bytes) {
+    char *dstBytes = (char*)dst;
+    const char *srcBytes = (const char*)src;
+    long long N_bytes = bytes;
+    if (srcBytes == NULL) {
+#pragma omp parallel for schedule(static)
+        for (long long ind = 0; ind < N_bytes; ind++) {
+            dstBytes[ind] = 0;
+        }
+    }
+    else {
+#pragma omp parallel for schedule(static)
+        for (long long ind = 0; ind < N_bytes; ind++) {
+            dstBytes[ind] = srcBytes[ind];
+        }
+    }
+}
+
+#endif
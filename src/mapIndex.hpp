@@ -3,6 +3,160 @@
 
 #include "fdtd.hpp"
 
+// Yee's grid sizes and PEC removal that the {e} index permutations are closed-form in
+struct edgeGrid {
+    myint Nx = 0, Ny = 0, Nz = 0;
+    myint lowerPEC = 0, upperPEC = 0;   // 1 if all Ex & Ey at z=zmin (z=zmax) are removed as PEC, else 0
+
+    // Grow along Z: {e} = {ey,ex, | ez}.T at each layer
+    myint n_surfEy_growZ = 0, n_surfEyEx = 0, n_layerE_growZ = 0;
+    // Grow along Y: {e} = {ex,ez, | ey}.T at each layer, without and with PEC removal
+    myint n_surfEx_growY = 0, n_surfExEz = 0, n_layerE_growY = 0;
+    myint n_surfEx_growY_rmPEC = 0, n_surfExEz_rmPEC = 0, n_layerE_growY_rmPEC = 0;
+
+    edgeGrid() {}
+    edgeGrid(myint Nx, myint Ny, myint Nz, myint lowerPEC, myint upperPEC) {
+        this->Nx = Nx;
+        this->Ny = Ny;
+        this->Nz = Nz;
+        this->lowerPEC = lowerPEC;
+        this->upperPEC = upperPEC;
+        this->n_surfEy_growZ = Ny*(Nx + 1);
+        this->n_surfEyEx = this->n_surfEy_growZ + Nx*(Ny + 1);
+        this->n_layerE_growZ = this->n_surfEyEx + (Nx + 1)*(Ny + 1);
+        this->n_surfEx_growY = Nx*(Nz + 1);
+        this->n_surfExEz = this->n_surfEx_growY + Nz*(Nx + 1);
+        this->n_layerE_growY = this->n_surfExEz + (Nx + 1)*(Nz + 1);
+        this->n_surfEx_growY_rmPEC = this->n_surfEx_growY - (lowerPEC + upperPEC)*Nx;
+        this->n_surfExEz_rmPEC = this->n_surfExEz - (lowerPEC + upperPEC)*Nx;
+        this->n_layerE_growY_rmPEC = this->n_layerE_growY - (lowerPEC + upperPEC)*(2*Nx + 1);
+    }
+
+    bool isPECz(myint iz) const {
+        return (this->lowerPEC && iz == 0) || (this->upperPEC && iz == this->Nz);
+    }
+
+    // (growZ, no PEC removal) -> (growY, no PEC removal)
+    myint z2y(myint eInd) const {
+        myint iz = eInd / this->n_layerE_growZ, r = eInd % this->n_layerE_growZ;
+        if (r < this->n_surfEy_growZ) {         // Ey
+            return (r % this->Ny)*this->n_layerE_growY + this->n_surfExEz + iz*(this->Nx + 1) + r / this->Ny;
+        }
+        if (r < this->n_surfEyEx) {             // Ex
+            r -= this->n_surfEy_growZ;
+            return (r % (this->Ny + 1))*this->n_layerE_growY + iz*this->Nx + r / (this->Ny + 1);
+        }
+        r -= this->n_surfEyEx;                  // Ez
+        return (r % (this->Ny + 1))*this->n_layerE_growY + this->n_surfEx_growY + iz*(this->Nx + 1) + r / (this->Ny + 1);
+    }
+
+    // (growY, no PEC removal) -> (growZ, no PEC removal)
+    myint y2z(myint eInd) const {
+        myint iy = eInd / this->n_layerE_growY, r = eInd % this->n_layerE_growY;
+        if (r < this->n_surfEx_growY) {         // Ex
+            return (r / this->Nx)*this->n_layerE_growZ + this->n_surfEy_growZ + (r % this->Nx)*(this->Ny + 1) + iy;
+        }
+        if (r < this->n_surfExEz) {             // Ez
+            r -= this->n_surfEx_growY;
+            return (r / (this->Nx + 1))*this->n_layerE_growZ + this->n_surfEyEx + (r % (this->Nx + 1))*(this->Ny + 1) + iy;
+        }
+        r -= this->n_surfExEz;                  // Ey
+        return (r / (this->Nx + 1))*this->n_layerE_growZ + (r % (this->Nx + 1))*this->Ny + iy;
+    }
+
+    // (growY, no PEC removal) -> (growY, removed PEC), -1 for PEC edges
+    myint y2rmPEC(myint eInd) const {
+        myint iy = eInd / this->n_layerE_growY, r = eInd % this->n_layerE_growY;
+        myint layerStart = iy*this->n_layerE_growY_rmPEC;
+        if (r < this->n_surfEx_growY) {         // Ex
+            return this->isPECz(r / this->Nx) ? -1 : layerStart + r - this->lowerPEC*this->Nx;
+        }
+        if (r < this->n_surfExEz) {             // Ez
+            return layerStart + r - (this->lowerPEC + this->upperPEC)*this->Nx;
+        }
+        r -= this->n_surfExEz;                  // Ey
+        return this->isPECz(r / (this->Nx + 1)) ? -1 : layerStart + this->n_surfExEz_rmPEC + r - this->lowerPEC*(this->Nx + 1);
+    }
+
+    // (growY, removed PEC) -> (growY, no PEC removal)
+    myint rmPEC2y(myint eInd) const {
+        myint iy = eInd / this->n_layerE_growY_rmPEC, r = eInd % this->n_layerE_growY_rmPEC;
+        myint layerStart = iy*this->n_layerE_growY;
+        if (r < this->n_surfEx_growY_rmPEC) {   // Ex
+            return layerStart + r + this->lowerPEC*this->Nx;
+        }
+        if (r < this->n_surfExEz_rmPEC) {       // Ez
+            return layerStart + r + (this->lowerPEC + this->upperPEC)*this->Nx;
+        }
+        return layerStart + this->n_surfExEz + r - this->n_surfExEz_rmPEC + this->lowerPEC*(this->Nx + 1);  // Ey
+    }
+
+    // (growZ, removed PEC) -> (growZ, no PEC removal), i.e. sys.mapEdgeR when the whole PEC surfaces are removed
+    myint rmPECz2z(myint eInd) const {
+        return eInd + this->lowerPEC*this->n_surfEyEx;
+    }
+
+    // (growZ, no PEC removal) -> (growZ, removed PEC), -1 for PEC edges
+    myint z2rmPECz(myint eInd) const {
+        myint iz = eInd / this->n_layerE_growZ, r = eInd % this->n_layerE_growZ;
+        if (r < this->n_surfEyEx && this->isPECz(iz)) {
+            return -1;
+        }
+        return eInd - this->lowerPEC*this->n_surfEyEx;
+    }
+};
+
+// One {e} index map, map[oldInd] = newInd, computed from edgeGrid or looked up in a table for irregular PEC removal
+class edgeIndexMap {
+public:
+    enum mapKind { Z2Y, Y2Z, Y2RMPEC, RMPEC2Y, RMPEC_Z2Y, RMPEC_Y2Z };
+
+    edgeIndexMap(mapKind kind) {
+        this->kind = kind;
+    }
+
+    // Use the closed form on grid
+    void setArithmetic(const edgeGrid &grid, myint N) {
+        this->grid = grid;
+        this->N = N;
+        vector<myint>().swap(this->table);
+    }
+
+    // Use an explicit table, for PEC edges not covering whole z=zmin or z=zmax surfaces
+    void setTable(vector<myint> &&table) {
+        this->N = table.size();
+        this->table = move(table);
+    }
+
+    myint operator[](myint eInd) const {
+        if (!this->table.empty()) {
+            return this->table[eInd];
+        }
+        switch (this->kind) {
+        case Z2Y:       return this->grid.z2y(eInd);
+        case Y2Z:       return this->grid.y2z(eInd);
+        case Y2RMPEC:   return this->grid.y2rmPEC(eInd);
+        case RMPEC2Y:   return this->grid.rmPEC2y(eInd);
+        case RMPEC_Z2Y: return this->grid.y2rmPEC(this->grid.z2y(this->grid.rmPECz2z(eInd)));
+        default:        return this->grid.z2rmPECz(this->grid.y2z(this->grid.rmPEC2y(eInd)));
+        }
+    }
+
+    myint size() const {
+        return this->N;
+    }
+
+    bool isTable() const {
+        return !this->table.empty();
+    }
+
+private:
+    mapKind kind;
+    edgeGrid grid;
+    myint N = 0;                        // num of old indices, 0 if not set yet
+    vector<myint> table;                // irregular cases only
+};
+
 class mapIndex {
 public:
     // num of bricks Nx*Ny*Nz
@@ -15,22 +169,18 @@ public:
     myint N_surfExEz_rmPEC;             // number of {e}_surface at one surface e.g. 0s, mode (growY, removed PEC)
     myint N_volEy_rmPEC;                // number of {e}_volume at one layer, e.g. 0v, mode (growY, removed PEC)
 
-    // Upper PEC edge indices (z=zmax) and lower PEC edge indices (z=zmin), index mode (growY, no PEC removal)
-    unordered_set<myint> edges_upperPEC;
-    unordered_set<myint> edges_lowerPEC;
+    // maps, each used as eInd_map_?2?[oldInd] = newInd
+    edgeIndexMap eInd_map_z2y{edgeIndexMap::Z2Y};               // map {e} index: (growZ, no PEC removal) -> (growY, no PEC removal)
+    edgeIndexMap eInd_map_y2z{edgeIndexMap::Y2Z};               // map {e} index: (growY, no PEC removal) -> (growZ, no PEC removal)
 
-    // maps
-    vector<myint> eInd_map_z2y;         // map {e} index: (growZ, no PEC removal) -> (growY, no PEC removal)
-    vector<myint> eInd_map_y2z;         // map {e} index: (growY, no PEC removal) -> (growZ, no PEC removal)
-
-    vector<myint> eInd_map_y2rmPEC;     // map {e} index: (growY, no PEC removal) -> (growY, removed PEC)
-    vector<myint> eInd_map_rmPEC2y;     // map {e} index: (growY, removed PEC) -> (growY, no PEC removal)
+    edgeIndexMap eInd_map_y2rmPEC{edgeIndexMap::Y2RMPEC};       // map {e} index: (growY, no PEC removal) -> (growY, removed PEC)
+    edgeIndexMap eInd_map_rmPEC2y{edgeIndexMap::RMPEC2Y};       // map {e} index: (growY, removed PEC) -> (growY, no PEC removal)
 
     // sys.mapEdge;                     // map {e} index: (growZ, no PEC removal) -> (growZ, removed PEC)
     // sys.mapEdgeR;                    // map {e} index: (growZ, removed PEC) -> (growZ, no PEC removal)
 
-    vector<myint> eInd_map_rmPEC_z2y;   // map {e} index: (growZ, removed PEC) -> (growY, removed PEC)
-    vector<myint> eInd_map_rmPEC_y2z;   // map {e} index: (growY, removed PEC) -> (growZ, removed PEC)
+    edgeIndexMap eInd_map_rmPEC_z2y{edgeIndexMap::RMPEC_Z2Y};   // map {e} index: (growZ, removed PEC) -> (growY, removed PEC)
+    edgeIndexMap eInd_map_rmPEC_y2z{edgeIndexMap::RMPEC_Y2Z};   // map {e} index: (growY, removed PEC) -> (growZ, removed PEC)
 
     // Constructor
     mapIndex(myint Nx, myint Ny, myint Nz) {
@@ -41,20 +191,24 @@ public:
         this->N_totEdges = Nx*(Ny + 1)*(Nz + 1) + (Nx + 1)*Ny*(Nz + 1) + (Nx + 1)*(Ny + 1)*Nz;
 
         // For different PEC BCs
+        myint lowerPEC = 0, upperPEC = 0;
         this->N_edgesAtPEC = 0;
         this->N_surfExEz_rmPEC = Nx*(Nz + 1) + Nz*(Nx + 1);
         this->N_volEy_rmPEC = (Nx + 1)*(Nz + 1);
 #ifdef LOWER_BOUNDARY_PEC
+        lowerPEC = 1;
         this->N_edgesAtPEC += Nx*(Ny + 1) + (Nx + 1)*Ny;    // add num of Ex & Ey at PEC surface
         this->N_surfExEz_rmPEC -= Nx;                       // remove Ex at PEC
         this->N_volEy_rmPEC -= (Nx + 1);                    // remove Ey at PEC
 #endif
 #ifdef UPPER_BOUNDARY_PEC
+        upperPEC = 1;
         this->N_edgesAtPEC += Nx*(Ny + 1) + (Nx + 1)*Ny;    // add num of Ex & Ey at PEC surface
         this->N_surfExEz_rmPEC -= Nx;                       // remove Ex at PEC
         this->N_volEy_rmPEC -= (Nx + 1);                    // remove Ey at PEC
 #endif
         this->N_totEdges_rmPEC = this->N_totEdges - this->N_edgesAtPEC;
+        this->grid = edgeGrid(Nx, Ny, Nz, lowerPEC, upperPEC);
     }
 
     // Set global {e} index map between mode (growZ, no PEC removal) and mode (growY, no PEC removal)
@@ -69,78 +223,28 @@ public:
 
         Results: 
             - 2 index maps are stored in attributes "eInd_map_z2y" and "eInd_map_y2z"
-            - Each map is a vector of size N_e, eInd_map_?2?[oldInd] = newInd
+            - Each map is used as eInd_map_?2?[oldInd] = newInd, computed on the fly without any table
 
         Yee's grid is used, with E at edge center and H at face center. Outmost
         boundaries are all E edges. Removal of {e} due to PEC BC has not been considered. */
 
-        // Num of surface or volumetric unknown e at each layer
-        myint Nx = this->Nx;
-        myint Ny = this->Ny;
-        myint Nz = this->Nz;
-
-        myint n_surfEy_growZ = Ny*(Nx + 1);
-        myint n_surfEyEx = n_surfEy_growZ + Nx*(Ny + 1);
-        myint n_volEz = (Nx + 1)*(Ny + 1);
-        myint n_layerE_growZ = n_surfEyEx + n_volEz;
-
-        myint n_surfEx_growY = Nx*(Nz + 1);
-        myint n_surfExEz = n_surfEx_growY + Nz*(Nx + 1);
-        myint n_volEy = (Nx + 1)*(Nz + 1);
-        myint n_layerE_growY = n_surfExEz + n_volEy;
-
-        myint N_tot_E = n_surfEyEx*(Nz + 1) + n_volEz*Nz;
-
         // y - x - z ordering
         // Grow along Z : {e} = { ey,ex, | ez }.T, y->x frist all y for each x then all x
         // Grow along Y : {e} = { ex,ez, | ey }.T, x->z frist all x for each z then all z
-
-        // Map Grow Z to Grow Y
-        this->eInd_map_z2y.reserve(N_tot_E);
-        this->eInd_map_z2y.assign(N_tot_E, -1);
-
-        for (myint iz = 0; iz < Nz + 1; iz++) {     // Map the edges along y direction, Ey
-            for (myint iy = 0; iy < Ny; iy++) {
-                for (myint ix = 0; ix < Nx + 1; ix++) {
-                    this->eInd_map_z2y[iz*n_layerE_growZ + ix*(Ny)+iy] =
-                        iy*n_layerE_growY + n_surfExEz + iz*(Nx + 1) + ix;
-                }
-            }
-        }
-        for (myint iz = 0; iz < Nz + 1; iz++) {     // Map the edges along x direction, Ex
-            for (myint iy = 0; iy < Ny + 1; iy++) {
-                for (myint ix = 0; ix < Nx; ix++) {
-                    this->eInd_map_z2y[iz*n_layerE_growZ + n_surfEy_growZ + ix*(Ny + 1) + iy] =
-                        iy*n_layerE_growY + iz*(Nx)+ix;
-                }
-            }
-        }
-        for (myint iz = 0; iz < Nz; iz++) {         // Map the edges along z direction, Ez
-            for (myint iy = 0; iy < Ny + 1; iy++) {
-                for (myint ix = 0; ix < Nx + 1; ix++) {
-                    this->eInd_map_z2y[iz*n_layerE_growZ + n_surfEyEx + ix*(Ny + 1) + iy] =
-                        iy*n_layerE_growY + n_surfEx_growY + iz*(Nx + 1) + ix;
-                }
-            }
-        }
-
-        // Map Grow Y to Grow Z
-        this->eInd_map_y2z.reserve(N_tot_E);
-        this->eInd_map_y2z.assign(N_tot_E, -1);
-        for (myint id = 0; id < N_tot_E; id++) {
-            this->eInd_map_y2z[this->eInd_map_z2y[id]] = id;
-        }
+        // Both maps are closed-form in (Nx, Ny, Nz), see edgeGrid::z2y() and edgeGrid::y2z()
+        this->eInd_map_z2y.setArithmetic(this->grid, this->N_totEdges);
+        this->eInd_map_y2z.setArithmetic(this->grid, this->N_totEdges);
     }
 
     // Set global {e} index map between mode (growY, no PEC removal) and (growY, removed PEC)
-    void setEdgeMap_growYremovePEC(const set<myint> &ubde, const set<myint> &lbde, myint bden) {
+    void setEdgeMap_growYremovePEC(const indexRangeSet &ubde, const indexRangeSet &lbde, myint bden) {
     /*  Inputs:
             - ubde = sys.ubde: upper PEC edge indices (z=zmax) with index mode (growZ, no PEC removal)
             - lbde = sys.lbde: lower PEC edge indices (z=zmin) with index mode (growZ, no PEC removal)
             - bden = sys.bden: number of PEC edges that was counted at meshing stage
         Results:
-            - PEC edge indices of mode (growY, no PEC removal) stored in attributes "edges_upperPEC" & "edges_lowerPEC"
-            - 2 index maps are stored in attributes "eInd_map_y2rmPEC" and "eInd_map_rmPEC2y"       */
+            - 2 index maps are stored in attributes "eInd_map_y2rmPEC" and "eInd_map_rmPEC2y", which are tabulated
+              only if the PEC edges are not the whole Ex & Ey surfaces at z=zmin and z=zmax       */
 
         if (this->eInd_map_z2y.size() == 0) {
             cout << "Failure! Run function setEdgeMap_growZgrowY() first." << endl;
@@ -152,35 +256,39 @@ public:
             exit(2);
         }
 
-        // Map the PEC edge indices from (growZ, no PEC removal) to (growY, no PEC removal)
+        // Whole Ex & Ey surfaces at z=zmin and z=zmax (as set by LOWER_BOUNDARY_PEC and UPPER_BOUNDARY_PEC) are closed-form
+        myint N_surfPEC = this->grid.n_surfEyEx;
+        myint upperSurfStart = this->Nz*this->grid.n_layerE_growZ;
+        bool lowerIsSurf = lbde.isRange(0, this->grid.lowerPEC*N_surfPEC);
+        bool upperIsSurf = ubde.isRange(upperSurfStart, upperSurfStart + this->grid.upperPEC*N_surfPEC);
+        if (lowerIsSurf && upperIsSurf) {
+            this->eInd_map_y2rmPEC.setArithmetic(this->grid, this->N_totEdges);
+            this->eInd_map_rmPEC2y.setArithmetic(this->grid, this->N_totEdges - this->N_edgesAtPEC);
+            return;
+        }
+
+        // Otherwise mark the PEC edges in mode (growY, no PEC removal) and tabulate both maps
+        vector<myint> map_y2rmPEC(this->N_totEdges, 0);
         for (auto eInd_growZ : ubde) {
-            myint eInd_growY = this->eInd_map_z2y[eInd_growZ];
-            this->edges_upperPEC.insert(eInd_growY);
+            map_y2rmPEC[this->eInd_map_z2y[eInd_growZ]] = -1;
         }
         for (auto eInd_growZ : lbde) {
-            myint eInd_growY = this->eInd_map_z2y[eInd_growZ];
-            this->edges_lowerPEC.insert(eInd_growY);
+            map_y2rmPEC[this->eInd_map_z2y[eInd_growZ]] = -1;
         }
+        vector<myint> map_rmPEC2y(this->N_totEdges - this->N_edgesAtPEC, -1);
 
-        // Map mode (growY, no PEC removal) and (growY, removed PEC)
-        this->eInd_map_y2rmPEC.reserve(this->N_totEdges);
-        this->eInd_map_y2rmPEC.assign(this->N_totEdges, -1);        // removed PEC edges will be mapped to index -1
-        this->eInd_map_rmPEC2y.reserve(this->N_totEdges - this->N_edgesAtPEC);
-        this->eInd_map_rmPEC2y.assign(this->N_totEdges - this->N_edgesAtPEC, -1);
-        
         myint count_edgesAtPEC = 0;                                 // number of identified PEC edges
         for (myint eInd = 0; eInd < this->N_totEdges; eInd++) {     // from smallest edge index in mode (growY, no PEC removal)
-            bool edgeIsAtUpperPEC = this->edges_upperPEC.find(eInd) != this->edges_upperPEC.end();
-            bool edgeIsAtLowerPEC = this->edges_lowerPEC.find(eInd) != this->edges_lowerPEC.end();
-            if (edgeIsAtUpperPEC || edgeIsAtLowerPEC) {             // if this edge is at upper or lower PEC boundary
+            if (map_y2rmPEC[eInd] < 0) {                            // if this edge is at upper or lower PEC boundary, mapped to index -1
                 count_edgesAtPEC++;
             }
             else {
-                this->eInd_map_y2rmPEC[eInd] = eInd - count_edgesAtPEC;
-                this->eInd_map_rmPEC2y[eInd - count_edgesAtPEC] = eInd;
+                map_y2rmPEC[eInd] = eInd - count_edgesAtPEC;
+                map_rmPEC2y[eInd - count_edgesAtPEC] = eInd;
             }
         }
-
+        this->eInd_map_y2rmPEC.setTable(move(map_y2rmPEC));
+        this->eInd_map_rmPEC2y.setTable(move(map_rmPEC2y));
     }
 
     // Set global {e} index map between mode (growZ, removed PEC) and (growY, removed PEC)
@@ -188,7 +296,8 @@ public:
     /*  Inputs:
             - eInd_map_rmPEC2z = sys.mapEdgeR: map {e} index from (growZ, removed PEC) to (growZ, no PEC removal)
         Results:
-            - 2 index maps are stored in attributes "eInd_map_rmPEC_z2y" and "eInd_map_rmPEC_y2z"       */
+            - 2 index maps are stored in attributes "eInd_map_rmPEC_z2y" and "eInd_map_rmPEC_y2z", which are
+              tabulated only if eInd_map_rmPEC2z is not the shift past the removed z=zmin surface       */
 
         if (this->eInd_map_y2rmPEC.size() == 0) {
             cout << "Failure! Run function setEdgeMap_growYremovePEC first." << endl;
@@ -197,18 +306,27 @@ public:
 
         // Map mode (growZ, removed PEC) and (growY, removed PEC)
         myint N_edgesNotAtPEC = this->N_totEdges - this->N_edgesAtPEC;
-        this->eInd_map_rmPEC_z2y.reserve(N_edgesNotAtPEC);
-        this->eInd_map_rmPEC_z2y.assign(N_edgesNotAtPEC, -1);
-        this->eInd_map_rmPEC_y2z.reserve(N_edgesNotAtPEC);
-        this->eInd_map_rmPEC_y2z.assign(N_edgesNotAtPEC, -1);
+        bool mapEdgeRIsShift = !this->eInd_map_y2rmPEC.isTable();
+        for (myint eInd_rmPECz = 0; eInd_rmPECz < N_edgesNotAtPEC && mapEdgeRIsShift; eInd_rmPECz++) {
+            mapEdgeRIsShift = (eInd_map_rmPEC2z[eInd_rmPECz] == this->grid.rmPECz2z(eInd_rmPECz));
+        }
+        if (mapEdgeRIsShift) {
+            this->eInd_map_rmPEC_z2y.setArithmetic(this->grid, N_edgesNotAtPEC);
+            this->eInd_map_rmPEC_y2z.setArithmetic(this->grid, N_edgesNotAtPEC);
+            return;
+        }
 
+        vector<myint> map_rmPEC_z2y(N_edgesNotAtPEC, -1);
+        vector<myint> map_rmPEC_y2z(N_edgesNotAtPEC, -1);
         for (myint eInd_rmPECz = 0; eInd_rmPECz < N_edgesNotAtPEC; eInd_rmPECz++) { // (growZ, removed PEC)
             myint eInd_z = eInd_map_rmPEC2z[eInd_rmPECz];                           // -> (growZ, no PEC removal)
             myint eInd_y = this->eInd_map_z2y[eInd_z];                              // -> (growY, no PEC removal)
             myint eInd_rmPECy = this->eInd_map_y2rmPEC[eInd_y];                     // -> (growY, removed PEC)
-            this->eInd_map_rmPEC_z2y[eInd_rmPECz] = eInd_rmPECy;                    // (growZ, removed PEC) -> (growY, removed PEC)
-            this->eInd_map_rmPEC_y2z[eInd_rmPECy] = eInd_rmPECz;                    // (growY, removed PEC) -> (growZ, removed PEC)
+            map_rmPEC_z2y[eInd_rmPECz] = eInd_rmPECy;                               // (growZ, removed PEC) -> (growY, removed PEC)
+            map_rmPEC_y2z[eInd_rmPECy] = eInd_rmPECz;                               // (growY, removed PEC) -> (growZ, removed PEC)
         }
+        this->eInd_map_rmPEC_z2y.setTable(move(map_rmPEC_z2y));
+        this->eInd_map_rmPEC_y2z.setTable(move(map_rmPEC_y2z));
     }
 
     // Map a (Block_rowId, Block_colId) pair to one unique Block index
@@ -248,6 +366,9 @@ public:
 
         return BlockId;
     }
+
+private:
+    edgeGrid grid;
 };
 
 
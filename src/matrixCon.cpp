@@ -1,7 +1,10 @@
 //#include "stdafx.h"
 #include <ctime>
 #include "fdtd.hpp"
+#include "matrixTypeDef.hpp"
 #include "hypreSolver.h"
+#include "conductorBlockSolver.hpp"
+#include "scratchArena.hpp"
 
 
 static bool comp(pair<double, int> a, pair<double, int> b) {
@@ -56,40 +59,17 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
     cout << "Length of V0d1a is " << leng_v0d1a << ", and number of non-zeros in V0d1a is " << v0d1anum << endl;
     cout << "V0d is generated!" << endl;
 
-    /* Generate Ad = V0da1'*D_eps*V0d */
-    sys->generateAd(map, v0d1num, v0d1anum, leng_v0d1, leng_Ad);
-
-
-
-
-    sys->v0d1valo = (double*)malloc(v0d1num * sizeof(double));
-    for (indi = 0; indi < v0d1num; indi++) {
-        sys->v0d1valo[indi] = sys->v0d1val[indi];
-    }
-    for (indi = 0; indi < v0d1num; indi++) {    // compute sqrt(D_eps)*V0d1
-        sys->v0d1val[indi] *= sqrt(sys->stackEpsn[(sys->v0d1RowId[indi] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0);
-    }
-    sys->v0d1avalo = (double*)malloc(v0d1anum * sizeof(double));
-    for (indi = 0; indi < v0d1anum; indi++) {
-        sys->v0d1avalo[indi] = sys->v0d1aval[indi];
-    }
-    for (indi = 0; indi < v0d1anum; indi++) {
-        sys->v0d1aval[indi] *= sqrt(sys->stackEpsn[(sys->v0d1RowId[indi] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0);
-    }
-
-
+    /* V0d1 is generated column by column, so its COO entries are already in the CSR order of V0d1^T */
     myint leng_v0d = leng_v0d1;
-    sys->v0d1ColIdo = (myint*)malloc(v0d1num * sizeof(myint));
-    for (indi = 0; indi < v0d1num; indi++) {
-        sys->v0d1ColIdo[indi] = sys->v0d1ColId[indi];
-    }
-    free(sys->v0d1ColId); sys->v0d1ColId = (myint*)malloc((leng_v0d1 + 1) * sizeof(myint));
-    status = COO2CSR_malloc(sys->v0d1ColIdo, sys->v0d1RowId, sys->v0d1val, v0d1num, leng_v0d1, sys->v0d1ColId);
+    myint *v0d1RowPtr = (myint*)malloc((leng_v0d1 + 1) * sizeof(myint));
+    status = countCooRowsToCsr(v0d1num, leng_v0d1, [sys](myint k) { return sys->v0d1ColId[k]; }, v0d1RowPtr);
     if (status != 0) {
         return status;
     }
-    free(sys->v0d1val); sys->v0d1val = NULL;
-    free(sys->v0d1ColIdo); sys->v0d1ColIdo = NULL;
+    free(sys->v0d1ColId); sys->v0d1ColId = v0d1RowPtr;
+
+    /* Generate Ad = V0da1'*D_eps*V0d */
+    sys->generateAd(map, leng_v0d1, leng_Ad);
 
     /*sys->v0d1aColIdo = (myint*)malloc(v0d1anum * sizeof(myint));
     for (indi = 0; indi < v0d1anum; indi++)
@@ -98,7 +78,6 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
     status = COO2CSR_malloc(sys->v0d1aColIdo, sys->v0d1aRowId, sys->v0d1aval, v0d1anum, leng_v0d1a, sys->v0d1aColId);
     if (status != 0)
     return status;*/
-    free(sys->v0d1aval); sys->v0d1aval = NULL;
 
     //cout << "Number of NNZ in V0d1 is " << v0d1num << endl;
 
@@ -106,11 +85,11 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
 
     /* V0d^T's csr form handle for MKL */
     sparse_matrix_t V0dt;
-    s = mkl_sparse_d_create_csr(&V0dt, SPARSE_INDEX_BASE_ZERO, leng_v0d1, sys->N_edge, &sys->v0d1ColId[0], &sys->v0d1ColId[1], sys->v0d1RowId, sys->v0d1valo);
+    s = mkl_sparse_d_create_csr(&V0dt, SPARSE_INDEX_BASE_ZERO, leng_v0d1, sys->N_edge, &sys->v0d1ColId[0], &sys->v0d1ColId[1], sys->v0d1RowId, sys->v0d1val);
 
     /* V0da^T's csr form handle for MKL */
     sparse_matrix_t V0dat;
-    s = mkl_sparse_d_create_csr(&V0dat, SPARSE_INDEX_BASE_ZERO, leng_v0d1, sys->N_edge, &sys->v0d1ColId[0], &sys->v0d1ColId[1], sys->v0d1RowId, sys->v0d1avalo);
+    s = mkl_sparse_d_create_csr(&V0dat, SPARSE_INDEX_BASE_ZERO, leng_v0d1, sys->N_edge, &sys->v0d1ColId[0], &sys->v0d1ColId[1], sys->v0d1RowId, sys->v0d1aval);
 
 #ifdef V0_new_schema
     double * drhs = new double[leng_v0d1 * leng_v0d2];
@@ -119,10 +98,6 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
     delete[] drhs;
 #endif
 
-    int *argc;
-    char ***argv;
-    MPI_Init(argc, argv);
-
     //status = setHYPREMatrix(sys->AdRowId, sys->AdColId, sys->Adval, leng_v0d1, ad, parcsr_ad);
     /* End */
 
@@ -171,19 +146,29 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
     cout << sys->acu_cnno[indi] << " ";
     }
     cout << endl;*/
+    /* V0c is generated column by column, so its COO entries are already in the CSR order of V0c^T */
+    myint *v0cRowPtr = (myint*)malloc((leng_v0c + 1) * sizeof(myint));
+    status = countCooRowsToCsr(v0cnum, leng_v0c, [sys](myint k) { return sys->v0cColId[k]; }, v0cRowPtr);
+    if (status != 0) {
+        return status;
+    }
+    free(sys->v0cColId); sys->v0cColId = v0cRowPtr;
+
     t1 = clock();
-    sys->generateAc(map, v0cnum, v0canum, leng_v0c, leng_Ac);
+    sys->generateAc(map, leng_v0c, leng_Ac);
 
 #ifdef PRINT_VERBOSE_TIMING
     cout << "Time to generate Ac is " << (clock() - t1) * 1.0 / CLOCKS_PER_SEC << " s" << endl;
     cout << "Number of non-zeros in Ac is " << leng_Ac << endl;
 #endif
     
-    free(sys->markNode); sys->markNode = NULL;
-
-    for (indi = 0; indi < sys->numCdt; indi++) {
-        free(sys->conductor[indi].node); sys->conductor[indi].node = NULL;
+    if (!sys->meshArraysShared) {    // shared arrays stay until meshShare frees its window
+        free(sys->markNode);
+        for (indi = 0; indi < sys->numCdt; indi++) {
+            free(sys->conductor[indi].node);
+        }
     }
+    sys->markNode = NULL;
     free(sys->conductor); sys->conductor = NULL;
     /*  trial of first set HYPRE matrix Ac */
     //HYPRE_IJMatrix ac;
@@ -192,35 +177,6 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
     /* End */
 
 
-    sys->v0cvalo = (double*)malloc(v0cnum * sizeof(double));
-    for (indi = 0; indi < v0cnum; indi++)
-        sys->v0cvalo[indi] = sys->v0cval[indi];    // v0cvalo is the v0c values without D_sig
-    for (indi = 0; indi < v0cnum; indi++) {
-        if (sys->markEdge[sys->v0cRowId[indi]] != 0) {
-            sys->v0cval[indi] *= sqrt(SIGMA);       // Compute the sparse form of D_sig*V0c
-        }
-    }
-    sys->v0cavalo = (double*)malloc(v0canum * sizeof(double));
-    for (indi = 0; indi < v0canum; indi++)
-        sys->v0cavalo[indi] = sys->v0caval[indi];
-    for (indi = 0; indi < v0canum; indi++) {
-        if (sys->markEdge[sys->v0cRowId[indi]] != 0) {
-            sys->v0caval[indi] *= sqrt(SIGMA);
-        }
-    }
-
-    sys->v0cColIdo = (myint*)malloc(v0cnum * sizeof(myint));
-    for (indi = 0; indi < v0cnum; indi++) {
-        sys->v0cColIdo[indi] = sys->v0cColId[indi];
-    }
-    free(sys->v0cColId); sys->v0cColId = (myint*)malloc((leng_v0c + 1) * sizeof(myint));
-    status = COO2CSR_malloc(sys->v0cColIdo, sys->v0cRowId, sys->v0cval, v0cnum, leng_v0c, sys->v0cColId);
-    if (status != 0) {
-        return status;
-    }
-    free(sys->v0cColIdo); sys->v0cColIdo = NULL;
-    free(sys->v0cval); sys->v0cval = NULL;
-
     /*sys->v0caColIdo = (myint*)malloc(v0canum * sizeof(myint));
     for (indi = 0; indi < v0canum; indi++)
     sys->v0caColIdo[indi] = sys->v0caColId[indi];
@@ -229,7 +185,6 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
     if (status != 0)
     return status;
     free(sys->v0caColIdo); sys->v0caColIdo = NULL;*/
-    free(sys->v0caval); sys->v0caval = NULL;
 
 
     //status = mklMatrixMulti(sys, leng_Ac, sys->v0caRowId, sys->v0caColId, sys->v0caval, sys->N_edge, leng_v0c, sys->v0cRowId, sys->v0cColId, sys->v0cval, 2);
@@ -310,11 +265,11 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
 
     /* V0ca^T's csr form handle for MKL */
     sparse_matrix_t V0cat;
-    s = mkl_sparse_d_create_csr(&V0cat, SPARSE_INDEX_BASE_ZERO, leng_v0c, sys->N_edge, &sys->v0cColId[0], &sys->v0cColId[1], sys->v0cRowId, sys->v0cavalo);
+    s = mkl_sparse_d_create_csr(&V0cat, SPARSE_INDEX_BASE_ZERO, leng_v0c, sys->N_edge, &sys->v0cColId[0], &sys->v0cColId[1], sys->v0cRowId, sys->v0caval);
 
     /* V0c^T's csr form handle for MKL */
     sparse_matrix_t V0ct;
-    s = mkl_sparse_d_create_csr(&V0ct, SPARSE_INDEX_BASE_ZERO, leng_v0c, sys->N_edge, &sys->v0cColId[0], &sys->v0cColId[1], sys->v0cRowId, sys->v0cvalo);
+    s = mkl_sparse_d_create_csr(&V0ct, SPARSE_INDEX_BASE_ZERO, leng_v0c, sys->N_edge, &sys->v0cColId[0], &sys->v0cColId[1], sys->v0cRowId, sys->v0cval);
 
 
     lapack_complex_double *tmp;
@@ -359,29 +314,44 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
     //}
 #endif
 
-    /* HYPRE solves for each port are messy */
-    for (sourcePort = 0; sourcePort < sys->numPorts; sourcePort++) {
+#ifdef GENERATE_V0_SOLUTION
+    /* Ac is block diagonal by conductor, so factorize its blocks once for all the source ports */
+    conductorBlockSolver acSolver;
+    bool acBlocksFactorized = (acSolver.factorize(sys, leng_v0c) == 0);
+    if (!acBlocksFactorized) {
+        cout << "Ac is solved as a whole by HYPRE" << endl;
+    }
+
+    /* Port currents are nonzero only at port edges, so only those rows of V0da and V0ca enter V0da'*J and V0ca'*J */
+    vector<myint> portEdges;
+    for (int indSource = 0; indSource < sys->sourcePorts.size(); indSource++) {
+        sys->setPortCurrent(sys->sourcePorts[indSource], sys->J);
+        portEdges.insert(portEdges.end(), sys->J.edge.begin(), sys->J.edge.end());
+    }
+    edgeRowsOfCsc v0daPortRows(sys->v0d1ColId, sys->v0d1RowId, sys->v0d1aval, leng_v0d1, portEdges);
+    edgeRowsOfCsc v0caPortRows(sys->v0cColId, sys->v0cRowId, sys->v0caval, leng_v0c, portEdges);
+#endif
+
+    /* Temporaries of the port and frequency loops are sized once and reused */
+    scratchArena arena;
+
+    /* HYPRE solves for each source port are messy, response-only ports are never excited */
+    for (int indSource = 0; indSource < sys->sourcePorts.size(); indSource++) {
+        sourcePort = sys->sourcePorts[indSource];
         //cout << "Port direction for port " << sourcePort << " is " << sys->portCoor[sourcePort].portDirection[0] << endl;
 #ifdef GENERATE_V0_SOLUTION
         t1 = clock();
-        sys->J = (double*)calloc(sys->N_edge, sizeof(double));
-        for (int sourcePortSide = 0; sourcePortSide < sys->portCoor[sourcePort].multiplicity; sourcePortSide++) {
-            for (int indEdge = 0; indEdge < sys->portCoor[sourcePort].portEdge[sourcePortSide].size(); indEdge++) {
-                /* Set current density for all edges within sides in port to prepare solver */
-                //cout << " port #" << sourcePort + 1 << ", side #" << sourcePortSide + 1 << ", edge #" << sys->portCoor[sourcePort].portEdge[sourcePortSide][indEdge] << ": J = " << sys->portCoor[sourcePort].portDirection[sourcePortSide] << " A/m^2" << endl;
-                sys->J[sys->portCoor[sourcePort].portEdge[sourcePortSide][indEdge]] = sys->portCoor[sourcePort].portDirection[sourcePortSide];
-            }
-        }
+        sys->setPortCurrent(sourcePort, sys->J);    // current density for all edges within sides in port to prepare solver
 
 
-        v0daJ = (double*)calloc(leng_v0d1, sizeof(double));
-        y0d = (double*)calloc(leng_v0d1, sizeof(double));
+        v0daJ = arena.buffer<double>("v0daJ", leng_v0d1);    // set by multiplyTranspose()
+        y0d = arena.zeros<double>("y0d", leng_v0d1);
 
         alpha = 1;
         beta = 0;
         descr.type = SPARSE_MATRIX_TYPE_GENERAL;
 
-        s = mkl_sparse_d_mv(SPARSE_OPERATION_NON_TRANSPOSE, alpha, V0dat, descr, sys->J, beta, v0daJ);
+        v0daPortRows.multiplyTranspose(sys->J, v0daJ);
         for (indi = 0; indi < leng_v0d1; indi++) {
             v0daJ[indi] *= -1.0;
         }
@@ -401,9 +371,9 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
         for (indi = 0; indi < leng_v0d1; indi++) {
             y0d[indi] /= (2 * M_PI * sys->freqStart * sys->freqUnit);    // y0d is imaginary
         }
-        ydt = (double*)calloc(sys->N_edge, sizeof(double));
-        ydat = (double*)calloc(sys->N_edge, sizeof(double));
-        yd1 = (double*)malloc(sys->N_edge * sizeof(double));
+        ydt = arena.buffer<double>("ydt", sys->N_edge);    // overwritten by mkl_sparse_d_mv with beta = 0
+        ydat = arena.buffer<double>("ydat", sys->N_edge);
+        yd1 = arena.buffer<double>("yd1", sys->N_edge);
 
         alpha = 1;
         beta = 0;
@@ -411,8 +381,8 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
         s = mkl_sparse_d_mv(SPARSE_OPERATION_TRANSPOSE, alpha, V0dt, descr, y0d, beta, ydt);    // -V0d*(D_eps0\(V0da'*rsc))
         s = mkl_sparse_d_mv(SPARSE_OPERATION_TRANSPOSE, alpha, V0dat, descr, y0d, beta, ydat);    // -V0da*(D_eps0\(V0da'*rsc))
         
-        u0 = (lapack_complex_double*)calloc((sys->N_edge - sys->bden) * 2, sizeof(lapack_complex_double));
-        u0a = (lapack_complex_double*)calloc((sys->N_edge - sys->bden) * 2, sizeof(lapack_complex_double));
+        u0 = arena.zeros<lapack_complex_double>("u0", (sys->N_edge - sys->bden) * 2);
+        u0a = arena.zeros<lapack_complex_double>("u0a", (sys->N_edge - sys->bden) * 2);
         nn = 0;
         nna = 0;
         for (indi = 0; indi < sys->N_edge; indi++) {
@@ -427,19 +397,19 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
         }
 
         /* Compute C right hand side */
-        y0c = (double*)calloc(leng_v0c, sizeof(double));
-        v0caJ = (double*)calloc(leng_v0c, sizeof(double));
+        y0c = arena.zeros<double>("y0c", leng_v0c);
+        v0caJ = arena.buffer<double>("v0caJ", leng_v0c);
 
         alpha = 1;
         beta = 0;
         descr.type = SPARSE_MATRIX_TYPE_GENERAL;
-        s = mkl_sparse_d_mv(SPARSE_OPERATION_NON_TRANSPOSE, alpha, V0cat, descr, sys->J, beta, v0caJ);
+        v0caPortRows.multiplyTranspose(sys->J, v0caJ);
         // myint count_non = 0; // This is not used later in the function but was used for printing earlier
         for (indi = 0; indi < leng_v0c; indi++) {
             v0caJ[indi] *= -1.0;
         }
 
-        crhs = (double*)calloc(leng_v0c, sizeof(double));
+        crhs = arena.buffer<double>("crhs", leng_v0c);
         for (indi = 0; indi < sys->N_edge; indi++) {
             yd1[indi] = ydt[indi];
             ydt[indi] *= -1.0 * (2 * M_PI*sys->freqStart * sys->freqUnit) * sys->stackEpsn[(indi + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0;
@@ -449,8 +419,6 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
         beta = 0;
         descr.type = SPARSE_MATRIX_TYPE_GENERAL;
         s = mkl_sparse_d_mv(SPARSE_OPERATION_NON_TRANSPOSE, alpha, V0cat, descr, ydt, beta, crhs);
-        free(ydt); ydt = NULL;
-        free(ydat); ydat = NULL;
 
         double v0caJn, crhsn;
         v0caJn = 0;
@@ -462,65 +430,25 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
         }
         v0caJn = sqrt(v0caJn);
         crhsn = sqrt(crhsn);
-        free(crhs); crhs = NULL;
 
 
         //cout << "Time between the first and the second HYPRE is " << (clock() - t1) * 1.0 / CLOCKS_PER_SEC << " s" << endl;
         /*solve c system block by block*/
-
-        for (indi = 1; indi <= 1; indi++) {
-#ifndef SKIP_PARDISO
-            //pardisoSolve_c(sys, &v0caJ[sys->acu_cnno[indi - 1]], &y0c[sys->acu_cnno[indi - 1]], sys->acu_cnno[indi - 1], sys->acu_cnno[indi] - 1, sys->cindex[indi - 1] + 1, sys->cindex[indi]);
-#endif
-
-            //a = (double*)malloc((sys->cindex[indi] - sys->cindex[indi - 1]) * sizeof(double));
-            //ia = (int*)malloc((sys->cindex[indi] - sys->cindex[indi - 1]) * sizeof(int));
-            //ja = (int*)malloc((sys->cindex[indi] - sys->cindex[indi - 1]) * sizeof(int));
-            //crhss = (double*)malloc((sys->acu_cnno[indi] - sys->acu_cnno[indi - 1]) * sizeof(double));
-            //y0cs = (double*)calloc((sys->acu_cnno[indi] - sys->acu_cnno[indi - 1]), sizeof(double));
-
-            //for (indj = sys->acu_cnno[indi - 1]; indj <= sys->acu_cnno[indi] - 1; indj++) {
-            //    crhss[indj - sys->acu_cnno[indi - 1]] = v0caJ[indj];
-            //}
-            //for (indj = sys->cindex[indi - 1] + 1; indj <= sys->cindex[indi]; indj++) {
-            //    a[indj - sys->cindex[indi - 1] - 1] = sys->Acval[indj];
-            //    ia[indj - sys->cindex[indi - 1] - 1] = sys->AcRowId[indj] - sys->AcRowId[sys->cindex[indi - 1] + 1];
-            //    ja[indj - sys->cindex[indi - 1] - 1] = sys->AcColId[indj] - sys->AcColId[sys->cindex[indi - 1] + 1];
-            //    //cout << a[indj - sys->cindex[indi - 1] - 1] << " " << ia[indj - sys->cindex[indi - 1] - 1] << " " << ja[indj - sys->cindex[indi - 1] - 1] << endl;
-            //}
-
-            //status = hypreSolve(sys, ia, ja, a, (sys->cindex[indi] - sys->cindex[indi - 1]), crhss, (sys->acu_cnno[indi] - sys->acu_cnno[indi - 1]), y0cs);
-
-            //for (indj = sys->acu_cnno[indi - 1]; indj <= sys->acu_cnno[indi] - 1; indj++) {
-            //    y0c[indj] = y0cs[indj - sys->acu_cnno[indi - 1]];
-            //}
-            //if (sys->acu_cnno[indi] - sys->acu_cnno[indi - 1] > 100000) {
-            //    outfile1.open("Ac.txt", std::ofstream::out | std::ofstream::trunc);
-            //    for (indj = 0; indj < sys->cindex[indi] - sys->cindex[indi - 1]; indj++) {
-            //        outfile1 << sys->AcRowId[indi] + 1 << " " << sys->AcColId[indi] + 1 << " " << sys->Acval[indi] << endl;
-            //    }
-            //    outfile1.close();
-            //}
-            //free(a); a = NULL;
-            //free(ia); ia = NULL;
-            //free(ja); ja = NULL;
-            //free(crhss); crhss = NULL;
-            //free(y0cs); y0cs = NULL;
-
-            //status = hypreSolve(sys, ac, parcsr_ac, leng_Ac, v0caJ, leng_v0c, y0c);
+        if (acBlocksFactorized) {
+            status = acSolver.solve(v0caJ, y0c);
+        }
+        else {
             status = hypreSolve(sys, sys->AcRowId, sys->AcColId, sys->Acval, leng_Ac, v0caJ, leng_v0c, y0c);
-
         }
-        
-        free(v0caJ); v0caJ = NULL;
+
 
 
         /* V0cy0c */
-        yc = (double*)calloc(sys->N_edge, sizeof(double));
-        yca = (double*)calloc(sys->N_edge, sizeof(double));
-        yccp = (double*)malloc(sys->N_edge * sizeof(double));
-        dRhs2 = (double*)calloc(leng_v0d1, sizeof(double));
-        y0d2 = (double*)calloc(leng_v0d1, sizeof(double));
+        yc = arena.buffer<double>("yc", sys->N_edge);    // overwritten by mkl_sparse_d_mv with beta = 0
+        yca = arena.buffer<double>("yca", sys->N_edge);
+        yccp = arena.buffer<double>("yccp", sys->N_edge);
+        dRhs2 = arena.buffer<double>("dRhs2", leng_v0d1);
+        y0d2 = arena.zeros<double>("y0d2", leng_v0d1);
 
         alpha = 1;
         beta = 0;
@@ -528,7 +456,6 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
         s = mkl_sparse_d_mv(SPARSE_OPERATION_TRANSPOSE, alpha, V0ct, descr, y0c, beta, yc);
         s = mkl_sparse_d_mv(SPARSE_OPERATION_TRANSPOSE, alpha, V0cat, descr, y0c, beta, yca);
 
-        free(y0c); y0c = NULL;
 
         for (indi = 0; indi < sys->N_edge; indi++) {
             yccp[indi] = -yc[indi] * sys->stackEpsn[(indi + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0;
@@ -538,21 +465,18 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
         beta = 0;
         descr.type = SPARSE_MATRIX_TYPE_GENERAL;
         s = mkl_sparse_d_mv(SPARSE_OPERATION_NON_TRANSPOSE, alpha, V0dat, descr, yccp, beta, dRhs2);
-        free(yccp); yccp = NULL;
 
         
         status = hypreSolve(sys, sys->AdRowId, sys->AdColId, sys->Adval, leng_Ad, dRhs2, leng_v0d1, y0d2);
-        free(dRhs2); dRhs2 = NULL;
 
-        yd2 = (double*)calloc(sys->N_edge, sizeof(double));
-        yd2a = (double*)calloc(sys->N_edge, sizeof(double));
+        yd2 = arena.buffer<double>("yd2", sys->N_edge);    // overwritten by mkl_sparse_d_mv with beta = 0
+        yd2a = arena.buffer<double>("yd2a", sys->N_edge);
 
         alpha = 1;
         beta = 0;
         descr.type = SPARSE_MATRIX_TYPE_GENERAL;
         s = mkl_sparse_d_mv(SPARSE_OPERATION_TRANSPOSE, alpha, V0dt, descr, y0d2, beta, yd2);
         s = mkl_sparse_d_mv(SPARSE_OPERATION_TRANSPOSE, alpha, V0dat, descr, y0d2, beta, yd2a);
-        free(y0d2); y0d2 = NULL;
         nn = 0;
         nna = 0;
         for (indi = 0; indi < sys->N_edge; indi++) {
@@ -567,21 +491,16 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
             u0a[sys->N_edge - sys->bden + indi].real = (yd2a[sys->mapEdgeR[indi]] + yca[sys->mapEdgeR[indi]]) / nna;    // u0ca
         }
         
-        yd = (complex<double>*)malloc(sys->N_edge * sizeof(complex<double>));
+        yd = arena.buffer<complex<double>>("yd", sys->N_edge);
         for (int id = 0; id < sys->N_edge; id++) {
             yd[id] = yd2[id] - (1i)*(yd1[id]);
         }
 
-        free(yd2); yd2 = NULL;
-        free(yd1); yd1 = NULL;
-        free(yd2a); yd2a = NULL;
-        free(yca); yca = NULL;
 
         //sys->y = (complex<double>*)malloc(sys->N_edge*sizeof(complex<double>));
         for (indi = 0; indi < sys->N_edge; indi++) {
             yd[indi] += yc[indi];
         }
-        free(yc); yc = NULL;
         
         
         /*out.open("U0.txt", std::ofstream::out | std::ofstream::trunc);
@@ -620,40 +539,28 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
             
 
             // Vh = Vh - u0*((u0a'*A*u0)\(u0a'*A*Vh))
-            lapack_complex_double* V_re2 = (lapack_complex_double*)malloc((sys->N_edge - sys->bden) * sys->leng_Vh * sizeof(lapack_complex_double));
+            // V_re2, m_new and then tmp take turns in the "VhWork" buffer, so with Vh and sys->Vh at most three Vh-sized arrays are live
+            lapack_complex_double* V_re2 = arena.buffer<lapack_complex_double>("VhWork", (sys->N_edge - sys->bden) * sys->leng_Vh);
             for (myint inde = 0; inde < sys->N_edge - sys->bden; inde++) {    // A*Vh
                 for (myint inde2 = 0; inde2 < sys->leng_Vh; inde2++) {
-                    if (sys->markEdge[sys->mapEdgeR[inde]] != 0) {    // if this edge is inside the conductor
-                        V_re2[inde2 * (sys->N_edge - sys->bden) + inde].real = sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].real * (-freq * freq * 4 * pow(M_PI, 2)) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0
-                            - 2 * M_PI * freq * sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].imag * SIGMA;
-                        V_re2[inde2 * (sys->N_edge - sys->bden) + inde].imag = sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].real * (freq * 2 * M_PI) * SIGMA
-                            - sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].imag * (freq * freq * 4 * pow(M_PI, 2)) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0;
-                    }
-                    else {
-                        V_re2[inde2 * (sys->N_edge - sys->bden) + inde].real = sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].real * (-freq * freq * 4 * pow(M_PI, 2)) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0;
-                        V_re2[inde2 * (sys->N_edge - sys->bden) + inde].imag = -sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].imag * (freq * freq * 4 * pow(M_PI, 2)) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0;
-                    }
+                    V_re2[inde2 * (sys->N_edge - sys->bden) + inde].real = sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].real * (-freq * freq * 4 * pow(M_PI, 2)) * sys->eps[inde]
+                        - 2 * M_PI * freq * sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].imag * sys->sig[inde];
+                    V_re2[inde2 * (sys->N_edge - sys->bden) + inde].imag = sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].real * (freq * 2 * M_PI) * sys->sig[inde]
+                        - sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].imag * (freq * freq * 4 * pow(M_PI, 2)) * sys->eps[inde];
                 }
             }
            
             
             lapack_complex_double *y_re = (lapack_complex_double*)calloc(2 * sys->leng_Vh, sizeof(lapack_complex_double));    // u0a'*A*Vh
             status = matrix_multi('T', u0a, (sys->N_edge - sys->bden), 2, V_re2, (sys->N_edge - sys->bden), sys->leng_Vh, y_re);
-            free(V_re2); V_re2 = NULL;
             
-            lapack_complex_double *tmp3 = (lapack_complex_double*)calloc((sys->N_edge - sys->bden) * 2, sizeof(lapack_complex_double));
+            lapack_complex_double *tmp3 = arena.buffer<lapack_complex_double>("tmp3", (sys->N_edge - sys->bden) * 2);    // fully set below
             for (myint inde = 0; inde < sys->N_edge - sys->bden; inde++) {    // A*u0
                 for (myint inde2 = 0; inde2 < 2; inde2++) {
-                    if (sys->markEdge[sys->mapEdgeR[inde]] != 0) {
-                        tmp3[inde2 * (sys->N_edge - sys->bden) + inde].real = u0[inde2 * (sys->N_edge - sys->bden) + inde].real * (-freq * freq * 4 * pow(M_PI, 2)) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0
-                            - 2 * M_PI * freq * u0[inde2 * (sys->N_edge - sys->bden) + inde].imag * SIGMA;
-                        tmp3[inde2 * (sys->N_edge - sys->bden) + inde].imag = u0[inde2 * (sys->N_edge - sys->bden) + inde].real * (freq * 2 * M_PI) * SIGMA
-                            - u0[inde2 * (sys->N_edge - sys->bden) + inde].imag * (freq * freq * 4 * pow(M_PI, 2)) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0;
-                    }
-                    else {
-                        tmp3[inde2 * (sys->N_edge - sys->bden) + inde].real = u0[inde2 * (sys->N_edge - sys->bden) + inde].real * (-freq * freq * 4 * pow(M_PI, 2)) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0;
-                        tmp3[inde2 * (sys->N_edge - sys->bden) + inde].imag = -u0[inde2 * (sys->N_edge - sys->bden) + inde].imag * (freq * freq * 4 * pow(M_PI, 2)) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0;
-                    }
+                    tmp3[inde2 * (sys->N_edge - sys->bden) + inde].real = u0[inde2 * (sys->N_edge - sys->bden) + inde].real * (-freq * freq * 4 * pow(M_PI, 2)) * sys->eps[inde]
+                        - 2 * M_PI * freq * u0[inde2 * (sys->N_edge - sys->bden) + inde].imag * sys->sig[inde];
+                    tmp3[inde2 * (sys->N_edge - sys->bden) + inde].imag = u0[inde2 * (sys->N_edge - sys->bden) + inde].real * (freq * 2 * M_PI) * sys->sig[inde]
+                        - u0[inde2 * (sys->N_edge - sys->bden) + inde].imag * (freq * freq * 4 * pow(M_PI, 2)) * sys->eps[inde];
                 }
             }
             
@@ -671,51 +578,34 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
             info = LAPACKE_zcgesv(LAPACK_COL_MAJOR, 2, sys->leng_Vh, tmp4, 2, ipiv, y_re, 2, y_new, 2, &iter);    // (u0a'*A*u0)\(u0a'*A*V_re)
             free(ipiv); ipiv = NULL;
             free(y_re); y_re = NULL;
-            free(tmp3); tmp3 = NULL;
             free(tmp4); tmp4 = NULL;
             
-            lapack_complex_double *m_new = (lapack_complex_double*)calloc((sys->N_edge - sys->bden) * sys->leng_Vh, sizeof(lapack_complex_double));
+            lapack_complex_double *m_new = arena.zeros<lapack_complex_double>("VhWork", (sys->N_edge - sys->bden) * sys->leng_Vh);    // V_re2 is no longer needed
             status = matrix_multi('N', u0, (sys->N_edge - sys->bden), 2, y_new, 2, sys->leng_Vh, m_new);    // u0*((u0a'*A*u0)\(u0a'*A*V_re))
             free(y_new); y_new = NULL;
-            lapack_complex_double* Vh = (lapack_complex_double*)calloc((sys->N_edge - sys->bden) * (sys->leng_Vh), sizeof(lapack_complex_double));
+            lapack_complex_double* Vh = arena.buffer<lapack_complex_double>("Vh", (sys->N_edge - sys->bden) * (sys->leng_Vh));    // fully set below
             for (myint inde = 0; inde < sys->N_edge - sys->bden; inde++) {
                 for (myint inde2 = 0; inde2 < sys->leng_Vh; inde2++) {
                     Vh[inde2 * (sys->N_edge - sys->bden) + inde].real = sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].real - m_new[inde2 * (sys->N_edge - sys->bden) + inde].real;
                     Vh[inde2 * (sys->N_edge - sys->bden) + inde].imag = sys->Vh[inde2 * (sys->N_edge - sys->bden) + inde].imag - m_new[inde2 * (sys->N_edge - sys->bden) + inde].imag;
                 }
             }
-            free(m_new); m_new = NULL;
             
             
             // Vh'*(A+C)*Vh
             int inde;
             myint start;
-            tmp = (lapack_complex_double*)calloc((sys->N_edge - sys->bden) * sys->leng_Vh, sizeof(lapack_complex_double));
+            tmp = arena.zeros<lapack_complex_double>("VhWork", (sys->N_edge - sys->bden) * sys->leng_Vh);    // m_new is no longer needed
+            fdtdStiffStencil stencil(sys->N_cell_x, sys->N_cell_y, sys->N_cell_z, sys->xn, sys->yn, sys->zn, sys->mapEdgeR, sys->N_edge - sys->bden);
             for (myint j = 0; j < sys->leng_Vh; j++){    // calculate (A+C)*V_re1
-                inde = 0;
-                while (inde < sys->leng_S){
-                    start = sys->SRowId[inde];
-                    while (inde < sys->leng_S && sys->SRowId[inde] == start){
-
-                        tmp[j * (sys->N_edge - sys->bden) + sys->SRowId[inde]].real += sys->Sval[inde] * Vh[j * (sys->N_edge - sys->bden) + sys->SColId[inde]].real;
-                        tmp[j * (sys->N_edge - sys->bden) + sys->SRowId[inde]].imag += sys->Sval[inde] * Vh[j * (sys->N_edge - sys->bden) + sys->SColId[inde]].imag;
-
-
-                        inde++;
-                    }
-                }
+                stencil.multiply(&Vh[j * (sys->N_edge - sys->bden)].real, &tmp[j * (sys->N_edge - sys->bden)].real, 2);    // S is real, so apply it to the real and imaginary parts
+                stencil.multiply(&Vh[j * (sys->N_edge - sys->bden)].imag, &tmp[j * (sys->N_edge - sys->bden)].imag, 2);
 
                 for (inde = 0; inde < sys->N_edge - sys->bden; inde++){
-                    if (sys->markEdge[sys->mapEdgeR[inde]] != 0){
-                        tmp[j * (sys->N_edge - sys->bden) + inde].real += -pow(freq * 2 * M_PI, 2) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0 * Vh[j * (sys->N_edge - sys->bden) + inde].real
-                            - freq * 2 * M_PI * SIGMA * Vh[j * (sys->N_edge - sys->bden) + inde].imag;
-                        tmp[j * (sys->N_edge - sys->bden) + inde].imag += -pow(freq * 2 * M_PI, 2) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0 * Vh[j * (sys->N_edge - sys->bden) + inde].imag
-                            + freq * 2 * M_PI * SIGMA * Vh[j * (sys->N_edge - sys->bden) + inde].real;
-                    }
-                    else {
-                        tmp[j * (sys->N_edge - sys->bden) + inde].real += -pow(freq * 2 * M_PI, 2) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0 * Vh[j * (sys->N_edge - sys->bden) + inde].real;
-                        tmp[j * (sys->N_edge - sys->bden) + inde].imag += -pow(freq * 2 * M_PI, 2) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0 * Vh[j * (sys->N_edge - sys->bden) + inde].imag;
-                    }
+                    tmp[j * (sys->N_edge - sys->bden) + inde].real += -pow(freq * 2 * M_PI, 2) * sys->eps[inde] * Vh[j * (sys->N_edge - sys->bden) + inde].real
+                        - freq * 2 * M_PI * sys->sig[inde] * Vh[j * (sys->N_edge - sys->bden) + inde].imag;
+                    tmp[j * (sys->N_edge - sys->bden) + inde].imag += -pow(freq * 2 * M_PI, 2) * sys->eps[inde] * Vh[j * (sys->N_edge - sys->bden) + inde].imag
+                        + freq * 2 * M_PI * sys->sig[inde] * Vh[j * (sys->N_edge - sys->bden) + inde].real;
                 }
             }
 
@@ -724,29 +614,19 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
             status = matrix_multi('T', Vh, (sys->N_edge - sys->bden), sys->leng_Vh, tmp, (sys->N_edge - sys->bden), sys->leng_Vh, m_h);    // V_re1'*(A+C)*V_re1
             
             rhs_h = (lapack_complex_double*)calloc(sys->leng_Vh * 1, sizeof(lapack_complex_double));
-            J = (lapack_complex_double*)calloc(sys->N_edge - sys->bden, sizeof(lapack_complex_double));
-            for (inde = 0; inde < sys->N_edge; inde++){
-                if (sys->J[inde] != 0) {
-                    J[sys->mapEdge[inde]].imag = -1 * freq * 2 * M_PI;
-                }
+            J = arena.zeros<lapack_complex_double>("J", sys->N_edge - sys->bden);
+            for (size_t indEdge = 0; indEdge < sys->J.size(); indEdge++){
+                J[sys->mapEdge[sys->J.edge[indEdge]]].imag = -1 * freq * 2 * M_PI;
             }
             
             status = matrix_multi('T', Vh, (sys->N_edge - sys->bden), sys->leng_Vh, J, (sys->N_edge - sys->bden), 1, rhs_h);    // -1i*omega*V_re1'*J
-            free(J); J = NULL;
             
 
             /* V_re1'*A*u */
-            free(tmp);
-            tmp = (lapack_complex_double*)calloc((sys->N_edge - sys->bden), sizeof(lapack_complex_double));
+            tmp = arena.zeros<lapack_complex_double>("VhWork", (sys->N_edge - sys->bden));    // the Vh-sized tmp is no longer needed
             for (inde = 0; inde < sys->N_edge - sys->bden; inde++){
-                if (sys->markEdge[sys->mapEdgeR[inde]] != 0){
-                    tmp[inde].real = -pow(freq * 2 * M_PI, 2) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0 * yd[sys->mapEdgeR[inde]].real() - freq * 2 * M_PI * SIGMA * yd[sys->mapEdgeR[inde]].imag() * sys->freqStart * sys->freqUnit / freq;
-                    tmp[inde].imag = freq * 2 * M_PI * SIGMA * yd[sys->mapEdgeR[inde]].real() - pow(freq * 2 * M_PI, 2) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0 * yd[sys->mapEdgeR[inde]].imag() * sys->freqStart * sys->freqUnit / freq;
-                }
-                else {
-                    tmp[inde].real = -pow(freq * 2 * M_PI, 2) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0 * yd[sys->mapEdgeR[inde]].real();
-                    tmp[inde].imag = -pow(freq * 2 * M_PI, 2) * sys->stackEpsn[(sys->mapEdgeR[inde] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0 * yd[sys->mapEdgeR[inde]].imag() * sys->freqStart * sys->freqUnit / freq;
-                }
+                tmp[inde].real = -pow(freq * 2 * M_PI, 2) * sys->eps[inde] * yd[sys->mapEdgeR[inde]].real() - freq * 2 * M_PI * sys->sig[inde] * yd[sys->mapEdgeR[inde]].imag() * sys->freqStart * sys->freqUnit / freq;
+                tmp[inde].imag = freq * 2 * M_PI * sys->sig[inde] * yd[sys->mapEdgeR[inde]].real() - pow(freq * 2 * M_PI, 2) * sys->eps[inde] * yd[sys->mapEdgeR[inde]].imag() * sys->freqStart * sys->freqUnit / freq;
             }
             rhs_h0 = (lapack_complex_double*)calloc(sys->leng_Vh, sizeof(lapack_complex_double));
             status = matrix_multi('T', Vh, sys->N_edge - sys->bden, sys->leng_Vh, tmp, sys->N_edge - sys->bden, 1, rhs_h0);    // V_re1'*A*u
@@ -755,7 +635,6 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
                 rhs_h[inde].imag = rhs_h[inde].imag - rhs_h0[inde].imag;
             }
             free(rhs_h0); rhs_h0 = NULL;
-            free(tmp); tmp = NULL;
 
 
             ipiv = (lapack_int*)malloc(sys->leng_Vh * sizeof(lapack_int));
@@ -763,18 +642,17 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
             free(ipiv); ipiv = NULL;
             free(m_h); m_h = NULL;
 
-            y_h = (lapack_complex_double*)calloc((sys->N_edge - sys->bden), sizeof(lapack_complex_double));
+            y_h = arena.zeros<lapack_complex_double>("y_h", (sys->N_edge - sys->bden));
             status = matrix_multi('N', Vh, (sys->N_edge - sys->bden), sys->leng_Vh, rhs_h, sys->leng_Vh, 1, y_h);
             
-            final_x = (complex<double>*)malloc((sys->N_edge - sys->bden) * sizeof(complex<double>));
+            final_x = arena.buffer<complex<double>>("final_x", (sys->N_edge - sys->bden));
             for (inde = 0; inde < sys->N_edge - sys->bden; inde++){
                 final_x[inde] = yd[sys->mapEdgeR[inde]].real() + y_h[inde].real + 1i * (yd[sys->mapEdgeR[inde]].imag() *sys->freqStart * sys->freqUnit / freq + y_h[inde].imag);
             }
 
-            free(y_h); y_h = NULL;
             free(rhs_h); rhs_h = NULL;
             
-            xr = (complex<double>*)calloc(sys->N_edge - sys->bden, sizeof(complex<double>));
+            xr = arena.zeros<complex<double>>("xr", sys->N_edge - sys->bden);
             
             sys->reference1(indi, sourcePort, xr);
             
@@ -795,18 +673,13 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
             cout << "Freq " << freq << " the y0 total error is " << err0 / total_norm << endl;
             cout << "Freq " << freq << " the total error is " << err / total_norm << endl;
           
-            free(final_x); final_x = NULL;
-            free(Vh); Vh = NULL;
-            free(xr); xr = NULL;
+
         }
         free(sys->Vh); sys->Vh = NULL;
-        free(u0); u0 = NULL;
-        free(u0a); u0a = NULL;
 #endif
 
 #ifdef GENERATE_V0_SOLUTION
-        free(yd); yd = NULL;
-        free(sys->J); sys->J = NULL;
+        sys->J.clear();
         
 #endif
 
@@ -818,7 +691,6 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
         //free(sys->y); sys->y = NULL;
         xcol++;
     }
-    MPI_Finalize();
 
 #ifndef SKIP_STIFF_REFERENCE
     /*  Generate the reference results and S parameters in .citi file for different frequencies with multiple right hand side */
@@ -870,23 +742,19 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
     free(sys->v0d1RowId); sys->v0d1RowId = NULL;
     free(sys->v0d1ColId); sys->v0d1ColId = NULL;
     //free(sys->v0d1ColIdo); sys->v0d1ColIdo = NULL;
-    //free(sys->v0d1val); sys->v0d1val = NULL;
-    free(sys->v0d1valo); sys->v0d1valo = NULL;
+    free(sys->v0d1val); sys->v0d1val = NULL;
     //free(sys->v0d1aRowId); sys->v0d1aRowId = NULL;
     //free(sys->v0d1aColId); sys->v0d1aColId = NULL;
     //free(sys->v0d1aColIdo); sys->v0d1aColIdo = NULL;
-    //free(sys->v0d1aval); sys->v0d1aval = NULL;
-    free(sys->v0d1avalo); sys->v0d1avalo = NULL;
+    free(sys->v0d1aval); sys->v0d1aval = NULL;
     free(sys->v0cRowId);  sys->v0cRowId = NULL;
     free(sys->v0cColId);  sys->v0cColId = NULL;
     //free(sys->v0cColIdo); sys->v0cColIdo = NULL;
-    //free(sys->v0cval); sys->v0cval = NULL;
-    free(sys->v0cvalo); sys->v0cvalo = NULL;
+    free(sys->v0cval); sys->v0cval = NULL;
     //free(sys->v0caRowId); sys->v0caRowId = NULL;
     //free(sys->v0caColId); sys->v0caColId = NULL;
     //free(sys->v0caColIdo); sys->v0caColIdo = NULL;
-    //free(sys->v0caval); sys->v0caval = NULL;
-    free(sys->v0cavalo); sys->v0cavalo = NULL;
+    free(sys->v0caval); sys->v0caval = NULL;
     free(sys->AcRowId); sys->AcRowId = NULL;
     free(sys->AcColId); sys->AcColId = NULL;
     free(sys->Acval); sys->Acval = NULL;
@@ -906,86 +774,6 @@ int paraGenerator(fdtdMesh *sys, unordered_map<double, int> xi, unordered_map<do
     return 0;
 }
 
-#ifndef SKIP_PARDISO
-int pardisoSolve_c(fdtdMesh *sys, double *rhs, double *solution, int nodestart, int nodeend, int indstart, int indend) {
-
-    /*solve Ac system block by block*/
-    int leng = nodeend - nodestart + 1;
-    int status;
-    double *a = (double*)malloc((indend - indstart + 1) * sizeof(double));
-    int *ia = (int*)malloc((indend - indstart + 1) * sizeof(int));
-    int *ja = (int*)malloc((indend - indstart + 1) * sizeof(int));
-
-    for (int indi = 0; indi < (indend - indstart + 1); indi++) {
-        a[indi] = sys->Acval[indstart + indi];
-        ia[indi] = sys->AcRowId[indstart + indi] - sys->AcRowId[indstart];
-        ja[indi] = sys->AcColId[indstart + indi] - sys->AcColId[indstart];
-    }
-
-    /* use pardiso to solve */
-    {
-        int *ia1 = (int*)malloc((leng + 1) * sizeof(int));
-        /* status = COO2CSR_malloc(ia, ja, a, indstart - indend + 1, leng, ia1);
-        if (status != 0)
-        return status;*/
-        int count = 0;
-        int indi = 0;
-        int k = 0;
-        int start;
-        ia1[k] = 0;
-        k++;
-        while (indi < (indend - indstart + 1)) {
-            start = ia[indi];
-            while (indi < (indend - indstart + 1) && ia[indi] == start) {
-                count++;
-                indi++;
-            }
-            ia1[k] = (count);
-            k++;
-        }
-
-        void *pt[64];
-        int mtype;
-        int iparm[64];
-        double dparm[64];
-        int maxfct, mnum, phase, error, solver;
-        int num_process;   //number of processors
-        int v0csin;
-        int perm;
-        int nrhs = 1;
-        int msglvl = 0;    //print statistical information
-
-        mtype = 11;    // real and not symmetric
-        solver = 0;
-        error = 0;
-        maxfct = 1;    //maximum number of numerical factorizations
-        mnum = 1;    //which factorization to use
-        phase = 13;    //analysis
-
-        pardisoinit(pt, &mtype, iparm);
-        nrhs = 1;
-        iparm[38] = 1;
-        iparm[34] = 1;    //0-based indexing
-
-        pardiso(pt, &maxfct, &mnum, &mtype, &phase, &leng, a, ia1, ja, &perm, &nrhs, iparm, &msglvl, rhs, solution, &error);
-        free(ia1); ia1 = NULL;
-    }
-
-    /* use HYPRE to solve */
-    /*{
-    status = hypreSolve(sys, ia, ja, a, indend - indstart + 1, rhs, leng, solution);
-    }*/
-
-
-    free(a); a = NULL;
-    free(ia); ia = NULL;
-    free(ja); ja = NULL;
-
-
-
-    return 0;
-}
-#endif
 
 
 //int mklMatrixMulti(fdtdMesh *sys, int &leng_A, int *aRowId, int *aColId, double *aval, int arow, int acol, int *bRowId, int *bColId, double *bval, int mark) {
@@ -1079,128 +867,6 @@ int pardisoSolve_c(fdtdMesh *sys, double *rhs, double *solution, int nodestart,
 //}
 
 
-int matrixMul(vector<int> aRowId, vector<int> aColId, vector<double> aval, vector<int> bRowId, vector<int> bColId, vector<double> bval, vector<int> &cRowId, vector<int> &cColId, vector<double> &cval) {
-    //the first matrix is row by row, the second matrix is column by column
-
-    int i = 0, j = 0;
-    int flaga, flagb, k;
-    int starta;
-    double sum;
-
-    flaga = aRowId[0];
-    flagb = bColId[0];
-    starta = 0;
-    sum = 0;
-    while (i < aRowId.size()) {
-        while (j < bColId.size() && bColId[j] == flagb && i < aRowId.size() && aRowId[i] == flaga) {
-            if (aColId[i] == bRowId[j]) {
-                sum += aval[i] * bval[j];
-                j++;
-                i++;
-            }
-            else if (aColId[i] < bRowId[j]) {
-                i++;
-            }
-            else if (aColId[i] > bRowId[j]) {
-                j++;
-            }
-        }
-        if (sum != 0) {
-            cRowId.push_back(flaga);
-            cColId.push_back(flagb);
-            cval.push_back(sum);
-            sum = 0;
-        }
-        if (i == aRowId.size()) {
-            if (j == bColId.size())
-                break;
-            else{
-                i = starta;
-                while (bColId[j] == flagb) {
-                    j++;
-                    if (j == bColId.size()) {
-                        while (i < aRowId.size() && aRowId[i] == flaga) {
-                            i++;
-                        }
-                        starta = i;
-                        if (i == aRowId.size())    //run all of the datas
-                            break;
-                        flaga = aRowId[i];
-                        j = 0;
-                        break;
-                    }
-                }
-                flagb = bColId[j];
-                continue;
-            }
-        }
-        if (j == bColId.size()) {
-            while (i < aRowId.size() && aRowId[i] == flaga) {
-                i++;
-            }
-            starta = i;
-            if (i == aRowId.size())    //run all of the datas
-                break;
-            flaga = aRowId[i];
-            j = 0;
-        }
-        else{
-            if (bColId[j] != flagb && aRowId[i] != flaga) {
-                flagb = bColId[j];
-                i = starta;
-            }
-            else if (bColId[j] != flagb) {
-                flagb = bColId[j];
-                i = starta;
-            }
-            else if (aRowId[i] != flaga) {
-                i = starta;
-                while (bColId[j] == flagb) {
-                    j++;
-                    if (j == bColId.size()) {
-                        while (i < aRowId.size() && aRowId[i] == flaga) {
-                            i++;
-                        }
-                        starta = i;
-                        if (i == aRowId.size())    //run all of the datas
-                            break;
-                        flaga = aRowId[i];
-                        j = 0;
-                        break;
-                    }
-                }
-                flagb = bColId[j];
-            }
-
-        }
-    }
-
-    return 0;
-}
-
-int COO2CSR(vector<int> &rowId, vector<int> &ColId, vector<double> &val) {
-    int i;
-    vector<int> rowId2;
-    int count, start;
-
-    rowId2.push_back(0);
-    count = 0;
-    i = 0;
-    while (i < rowId.size()) {
-        start = rowId[i];
-        while (i < rowId.size() && rowId[i] == start) {
-            count++;
-            i++;
-        }
-        rowId2.push_back(count);
-    }
-
-    rowId.clear();
-    rowId = rowId2;
-    return 0;
-}
-
-
 #ifndef SKIP_PARDISO
 int solveV0dSystem(fdtdMesh *sys, double *dRhs, double *y0d, int leng_v0d1) {
 
@@ -10,10 +10,46 @@ typedef struct {
     complex<double> val;
 }onennzType;                            // store the row-col-val of one nnz element
 typedef vector<onennzType> BlockType;   // store rows-cols-vals of all nnzs inside each block matrix
-bool ascendByRowIndThenByColInd(const onennzType& nnz1, const onennzType& nnz2) {
+inline bool ascendByRowIndThenByColInd(const onennzType& nnz1, const onennzType& nnz2) {
     return tie(nnz1.row_ind, nnz1.col_ind) < tie(nnz2.row_ind, nnz2.col_ind);
 }                                       // operator for sorting nnz by row_ind first then by col_ind
 
+// Fill the CSR row pointers of a COO matrix by a parallel counting pass over its row indices
+template <typename RowOf>
+int countCooRowsToCsr(myint N_nnz, myint N_rows, RowOf rowOf, myint *rowPtr) {
+    /* Inputs:
+        N_nnz:      num of COO entries, in any order;
+        N_rows:     num of rows of the matrix;
+        rowOf(k):   row index of the k-th COO entry.
+    Output:
+        rowPtr:     N_rows + 1 CSR row pointers, rowPtr[N_rows] = N_nnz.
+    Returns nonzero if a row index is out of range. */
+
+    int status = 0;
+    for (myint row = 0; row <= N_rows; row++) {
+        rowPtr[row] = 0;
+    }
+#pragma omp parallel for schedule(static)
+    for (myint k = 0; k < N_nnz; k++) {
+        myint row = rowOf(k);
+        if (row < 0 || row >= N_rows) {
+#pragma omp atomic write
+            status = 1;
+            continue;
+        }
+#pragma omp atomic
+        rowPtr[row + 1]++;
+    }
+    if (status != 0) {
+        cerr << "COO row index out of range when converting to CSR!" << endl;
+        return status;
+    }
+    for (myint row = 0; row < N_rows; row++) {
+        rowPtr[row + 1] += rowPtr[row];
+    }
+    return 0;
+}
+
 // 0-based column-major dense format of a matrix stored col by col in 1-D vector
 class denseFormatOfMatrix {
 public:
@@ -55,99 +91,110 @@ public:
         }
     }
 
-    // Copy this->vals to a MKL_Complex16 type memory
-    void copyToMKL_Complex16(MKL_Complex16 *ptr) const {
-        /* Input: a pointer to assigned MKL_Complex16 memory of size this->matrixSize */
-        for (myint ind = 0; ind < this->matrixSize; ind++) {
-            ptr[ind].real = this->vals[ind].real();
-            ptr[ind].imag = this->vals[ind].imag();
-        }
+    // this->vals seen as MKL_Complex16, which has the same layout as complex<double> (real, imag)
+    MKL_Complex16 *mklData() {
+        return reinterpret_cast<MKL_Complex16*>(this->vals.data());
     }
-
-    // Copy this->vals from a MKL_Complex16 type memory
-    void copyFromMKL_Complex16(MKL_Complex16 *ptr) {
-        /* Input: a pointer to assigned MKL_Complex16 memory of size this->matrixSize */
-        for (myint ind = 0; ind < this->matrixSize; ind++) {
-            this->vals[ind] = { ptr[ind].real , ptr[ind].imag };
-        }
+    const MKL_Complex16 *mklData() const {
+        return reinterpret_cast<const MKL_Complex16*>(this->vals.data());
     }
 
-    // C = A (this) + B
-    denseFormatOfMatrix add(const denseFormatOfMatrix &B) const {
-        if (this->N_rows != B.N_rows && this->N_cols != B.N_cols) {
+    // A (this) += B
+    void addInPlace(const denseFormatOfMatrix &B) {
+        if (this->N_rows != B.N_rows || this->N_cols != B.N_cols) {
             cout << "Failure to add matrices, dimensions not match!" << endl;
             exit(2);
         }
-
-        denseFormatOfMatrix C(this->N_rows, this->N_cols);
         for (myint ind = 0; ind < this->matrixSize; ind++) {
-            C.vals[ind] = this->vals[ind] + B.vals[ind];
+            this->vals[ind] += B.vals[ind];
         }
-        return C;
     }
 
-    // C = A (this) - B
-    denseFormatOfMatrix minus(const denseFormatOfMatrix &B) {
-        if (this->N_rows != B.N_rows && this->N_cols != B.N_cols) {
+    // A (this) -= B
+    void minusInPlace(const denseFormatOfMatrix &B) {
+        if (this->N_rows != B.N_rows || this->N_cols != B.N_cols) {
             cout << "Failure to minus matrice, dimensions not match!" << endl;
             exit(2);
         }
-
-        denseFormatOfMatrix C(this->N_rows, this->N_cols);
         for (myint ind = 0; ind < this->matrixSize; ind++) {
-            C.vals[ind] = this->vals[ind] - B.vals[ind];
+            this->vals[ind] -= B.vals[ind];
+        }
+    }
+
+    // A (this) *= scalar
+    void multiplyScalarInPlace(double scalar) {
+        for (auto &val : this->vals) {
+            val *= scalar;
         }
+    }
+
+    // C = A (this) + B
+    denseFormatOfMatrix add(const denseFormatOfMatrix &B) const {
+        denseFormatOfMatrix C = *this;
+        C.addInPlace(B);
+        return C;
+    }
+
+    // C = A (this) - B
+    denseFormatOfMatrix minus(const denseFormatOfMatrix &B) const {
+        denseFormatOfMatrix C = *this;
+        C.minusInPlace(B);
         return C;
     }
 
     // C = A (this) * scalar
-    denseFormatOfMatrix multiplyScalar(double scalar) {
-        denseFormatOfMatrix C(this->N_rows, this->N_cols);
-        for (myint ind = 0; ind < this->matrixSize; ind++) {
-            C.vals[ind] = this->vals[ind] * scalar;
-        }
+    denseFormatOfMatrix multiplyScalar(double scalar) const {
+        denseFormatOfMatrix C = *this;
+        C.multiplyScalarInPlace(scalar);
         return C;
     }
 
-    // C = A (this) dot B (matrix-matrix dot multiply, not element-wise multiply)
-    denseFormatOfMatrix dot(const denseFormatOfMatrix &B) {
-        if (this->N_cols != B.N_rows) {
+    // C (this) = beta * C + alpha * A dot B in a single zgemm
+    void addDot(complex<double> alpha, const denseFormatOfMatrix &A, const denseFormatOfMatrix &B, complex<double> beta) {
+        if (A.N_cols != B.N_rows || this->N_rows != A.N_rows || this->N_cols != B.N_cols) {
             cout << "Failure to dot multiply matrices, dimensions not match!" << endl;
             exit(2);
         }
 
-        // Use mkl cblas_?gemm (C := alpha*op(A)*op(B) + beta*C) to get C=A*B
-        denseFormatOfMatrix C(this->N_rows, B.N_cols);
-        complex<double> alpha(1.0, 0.0);
-        complex<double> beta(0.0, 0.0);
+        // Use mkl cblas_?gemm (C := alpha*op(A)*op(B) + beta*C)
         cblas_zgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
-            this->N_rows, B.N_cols, this->N_cols,       // matrix dimensions ~ m, n, k
-            &alpha,                                     // alpha = 1
-            this->vals.data(), this->N_rows,            // A
-            B.vals.data(), this->N_cols,                // B
-            &beta,                                      // beta = 0
-            C.vals.data(), this->N_rows);               // C
+            A.N_rows, B.N_cols, A.N_cols,               // matrix dimensions ~ m, n, k
+            &alpha,
+            A.vals.data(), A.N_rows,                    // A
+            B.vals.data(), B.N_rows,                    // B
+            &beta,
+            this->vals.data(), this->N_rows);           // C
+    }
+
+    // C (this) -= A dot B
+    void minusDot(const denseFormatOfMatrix &A, const denseFormatOfMatrix &B) {
+        this->addDot({ -1.0, 0.0 }, A, B, { 1.0, 0.0 });
+    }
+
+    // C = A (this) dot B (matrix-matrix dot multiply, not element-wise multiply)
+    denseFormatOfMatrix dot(const denseFormatOfMatrix &B) const {
+        denseFormatOfMatrix C(this->N_rows, B.N_cols);
+        C.addDot({ 1.0, 0.0 }, *this, B, { 0.0, 0.0 });
         return C;
     }
 
-    // C = A (this) \ B = inv(A) dot B
-    denseFormatOfMatrix backslash(const denseFormatOfMatrix &B) {
+    // B = A (this) \ B = inv(A) dot B, solved in place of B. A is kept, its LU factors are in a scratch copy
+    void backslashInPlace(denseFormatOfMatrix *B) const {
         if (this->N_rows != this->N_cols) {
             cout << "Failure, matrix is not invertable!" << endl;
             exit(2);
         }
-        if (this->N_cols != B.N_rows) {
+        if (this->N_cols != B->N_rows) {
             cout << "Failure to backslash matrices, dimensions not match!" << endl;
             exit(2);
         }
 
         // Compute the LU factorization of a general m-by-n matrix A (this) and store in A_LU
-        vector<MKL_Complex16> A_LU(this->matrixSize);
-        this->copyToMKL_Complex16(A_LU.data());         // copy matrix A to a MKL_Complex16 type A_LU
-        vector<myint> ipiv(this->N_rows);
+        denseFormatOfMatrix A_LU = *this;
+        vector<lapack_int> ipiv(this->N_rows);
         lapack_int info = LAPACKE_zgetrf(LAPACK_COL_MAJOR,
             this->N_rows, this->N_cols,                 // matrix dimensions ~ m, n
-            A_LU.data(),                                // matrix A
+            A_LU.mklData(),                             // matrix A
             this->N_rows,
             ipiv.data()                                 // pivot indices
         );
@@ -156,49 +203,30 @@ public:
             exit(2);
         }
 
-        // Solve C = A_LU \ B with LAPACKE_?getrs
-        vector<MKL_Complex16> C_mklComplex(B.matrixSize);
-        B.copyToMKL_Complex16(C_mklComplex.data());     // copy matrix B to a MKL_Complex16 type C_mklComplex
+        // Solve B = A_LU \ B with LAPACKE_?getrs
         info = LAPACKE_zgetrs(LAPACK_COL_MAJOR, 'N',
-            B.N_rows, B.N_cols,                         // n & nrhs
-            A_LU.data(), B.N_rows,                      // A_LU
+            B->N_rows, B->N_cols,                       // n & nrhs
+            A_LU.mklData(), B->N_rows,                  // A_LU
             ipiv.data(),                                // pivot indices of A_LU
-            C_mklComplex.data(), B.N_rows               // C (copied B) will be overwritten by the solution matrix
+            B->mklData(), B->N_rows                     // B will be overwritten by the solution matrix
         );
         if (info != 0) {
             cout << "Issue on mkl backslash, LAPACKE_?getrs returns: " << info << endl;
             exit(2);
         }
+    }
 
-        //// Refines the solution C = A_LU \ B and estimate its error (Error < 1e-12, negligible at this step)
-        //vector<MKL_Complex16> A_mklComplex(this->matrixSize);
-        //this->copyToMKL_Complex16(A_mklComplex.data()); // copy matrix A to a MKL_Complex16 type A_mklComplex
-        //vector<MKL_Complex16> B_mklComplex(B.matrixSize);
-        //B.copyToMKL_Complex16(B_mklComplex.data());     // copy matrix B to a MKL_Complex16 type B_mklComplex
-        //vector<double> ferr(B.N_cols, 0.0), berr(B.N_cols, 0.0);
-        //info = LAPACKE_zgerfs(LAPACK_COL_MAJOR, 'N',
-        //    B.N_rows, B.N_cols,                         // n & nrhs
-        //    A_mklComplex.data(), B.N_rows,              // original A in MKL_Complex16 type
-        //    A_LU.data(), B.N_rows,                      // A_LU
-        //    ipiv.data(),                                // pivot indices of A_LU
-        //    B_mklComplex.data(), B.N_rows,              // B
-        //    C_mklComplex.data(), B.N_rows,              // C
-        //    ferr.data(), berr.data()                    // forward and backward errors for each solution vector
-        //);
-        //if (info != 0) {
-        //    cout << "Issue on backlash refinement, LAPACKE_?gerfs returns: " << info << endl;
-        //    exit(2);
-        //}
-
-        // Store the solution at denseFormatOfMatrix
-        denseFormatOfMatrix C(B.N_rows, B.N_cols);
-        C.copyFromMKL_Complex16(C_mklComplex.data());   // copy C.vals (complex<double>) from MKL_Complex16
-
+    // C = A (this) \ B = inv(A) dot B
+    denseFormatOfMatrix backslash(const denseFormatOfMatrix &B) const {
+        denseFormatOfMatrix C = B;
+        this->backslashInPlace(&C);
         return C;
     }
 };
 
 // 0-based row-major 3-array CSR format of a matrix
+/* Owns its arrays and the MKL inspector-executor handle built on them, so it can only be moved.
+The handle points at rows/cols/vals directly and stays valid across moves. */
 class csrFormatOfMatrix {
 public:
     // matrix information
@@ -224,45 +252,107 @@ public:
         this->vals.assign(N_nnz, { 0.0, 0.0 });
     }
 
-    // Copy this->vals to a MKL_Complex16 type memory
-    void copyToMKL_Complex16(MKL_Complex16 *ptr) const {
-        /* Input: a pointer to assigned MKL_Complex16 memory of size this->N_nnz */
-        for (myint ind = 0; ind < this->N_nnz; ind++) {
-            ptr[ind].real = this->vals[ind].real();
-            ptr[ind].imag = this->vals[ind].imag();
+    // Constructor from BlockType (COO)
+    csrFormatOfMatrix(myint N_rows, myint N_cols, const BlockType &block) : csrFormatOfMatrix(N_rows, N_cols, (myint)block.size()) {
+        /* Counting sort of the COO entries by row, then each (short) row is sorted by col index.
+        The input needs no ordering but must not hold duplicated (row, col) entries. */
+
+        if (countCooRowsToCsr(this->N_nnz, N_rows, [&block](myint k) { return block[k].row_ind; }, this->rows.data()) != 0) {
+            exit(2);
+        }
+
+        // Scatter every nnz into a free slot of its row
+        vector<myint> nextSlot(this->rows.begin(), this->rows.end() - 1);
+#pragma omp parallel for schedule(static)
+        for (myint k = 0; k < this->N_nnz; k++) {
+            myint slot;
+#pragma omp atomic capture
+            slot = nextSlot[block[k].row_ind]++;
+            this->cols[slot] = block[k].col_ind;
+            this->vals[slot] = block[k].val;
+        }
+
+        // Insertion sort by col index within each row
+#pragma omp parallel for schedule(static)
+        for (myint row = 0; row < N_rows; row++) {
+            for (myint k = this->rows[row] + 1; k < this->rows[row + 1]; k++) {
+                myint col = this->cols[k];
+                complex<double> val = this->vals[k];
+                myint l = k - 1;
+                while (l >= this->rows[row] && this->cols[l] > col) {
+                    this->cols[l + 1] = this->cols[l];
+                    this->vals[l + 1] = this->vals[l];
+                    l--;
+                }
+                this->cols[l + 1] = col;
+                this->vals[l + 1] = val;
+            }
         }
     }
 
-    // Convert BlockType (COO) to CSR
-    void convertBlockTypeToCsr(const BlockType &block) {
-        /* This function convert BlockType (COO) to CSR format.
-        The input BlockType must have been sorted by row index first then col index
-        within each row. All in increasing order. */
+    csrFormatOfMatrix(const csrFormatOfMatrix &) = delete;
+    csrFormatOfMatrix &operator=(const csrFormatOfMatrix &) = delete;
 
-        // The first index of rows is always 0 and the last is always N_nnz
-        this->rows[0] = 0;
-        this->rows[this->N_rows] = block.size();
+    csrFormatOfMatrix(csrFormatOfMatrix &&other) noexcept
+        : N_rows(other.N_rows), N_cols(other.N_cols), N_nnz(other.N_nnz),
+        rows(move(other.rows)), cols(move(other.cols)), vals(move(other.vals)), handle(other.handle) {
+        other.handle = nullptr;
+    }
 
-        myint nnz_ind = 0;
-        myint thisRow_ind = 0;
-        for (const auto &onennz : block) {
+    csrFormatOfMatrix &operator=(csrFormatOfMatrix &&other) noexcept {
+        if (this != &other) {
+            this->releaseMklHandle();
+            this->N_rows = other.N_rows;
+            this->N_cols = other.N_cols;
+            this->N_nnz = other.N_nnz;
+            this->rows = move(other.rows);
+            this->cols = move(other.cols);
+            this->vals = move(other.vals);
+            this->handle = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
 
-            // cols and vals are direct copy of the tuple for every nnz
-            this->cols[nnz_ind] = onennz.col_ind;
-            this->vals[nnz_ind] = onennz.val;
+    // Destructor
+    ~csrFormatOfMatrix() {
+        this->releaseMklHandle();
+    }
 
-            // When saw nnz at a new row
-            while (thisRow_ind < onennz.row_ind) {
-                thisRow_ind++;
-                this->rows[thisRow_ind] = nnz_ind;
+    // MKL CSR handle on this matrix, created at first use and kept until destruction
+    const sparse_matrix_t *mklHandle() {
+        if (this->handle == nullptr) {
+            sparse_status_t returnStatus = mkl_sparse_z_create_csr(&this->handle, SPARSE_INDEX_BASE_ZERO, this->N_rows, this->N_cols,
+                this->rows.data(), this->rows.data() + 1, this->cols.data(), (MKL_Complex16*)this->vals.data());
+            if (returnStatus != SPARSE_STATUS_SUCCESS) {
+                cout << "ERROR! Return from mkl_sparse_z_create_csr is: " << returnStatus << endl;
+                exit(2);
             }
+        }
+        return &this->handle;
+    }
 
-            nnz_ind++;
+    // Free the MKL handle (the CSR arrays are kept)
+    void releaseMklHandle() {
+        if (this->handle != nullptr) {
+            mkl_sparse_destroy(this->handle);
+            this->handle = nullptr;
+        }
+    }
 
-            // Extrame case: when the last few rows are all blank
-            while (nnz_ind == block.size() && thisRow_ind < this->N_rows - 1) {
-                thisRow_ind++;
-                this->rows[thisRow_ind] = nnz_ind;
+    // Scale all nnz values in place
+    void multiplyScalarInPlace(double scalar) {
+        for (auto &val : this->vals) {
+            val *= scalar;
+        }
+    }
+
+    // Write this matrix into the dense matrix, with its col 0 at col colOffset of dense
+    void copyToDense(denseFormatOfMatrix *dense, myint colOffset) const {
+#pragma omp parallel for schedule(static)
+        for (myint row = 0; row < this->N_rows; row++) {
+            for (myint k = this->rows[row]; k < this->rows[row + 1]; k++) {
+                dense->vals[(this->cols[k] + colOffset) * dense->N_rows + row] = this->vals[k];
             }
         }
     }
@@ -307,6 +397,9 @@ public:
 
         return denseD0sD1s;
     }
+
+private:
+    sparse_matrix_t handle = nullptr;   // MKL CSR handle on rows/cols/vals, nullptr until mklHandle()
 };
 
 #endif
\ No newline at end of file
@@ -1,8 +1,9 @@
 //#include "stdafx.h"
 #include "fdtd.hpp"
+#include "hybridThreads.hpp"
 
 
-int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<double, int> &yi, unordered_map<double, int> &zi, unordered_set<double> *portCoorx, unordered_set<double> *portCoory)
+int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<double, int> &yi, unordered_map<double, int> &zi, unordered_set<double> *portCoorx, unordered_set<double> *portCoory, bool planOnly)
 {
     int lyr;
     myint indi = 0, indj = 0, indk = 0;
@@ -13,8 +14,10 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
 
     /* Generate the mesh nodes based on conductorIn information */
     myint numNode = 0;
-    double disMinx = MINDISFRACX * fmin((sys->ylim2 - sys->ylim1), (sys->xlim2 - sys->xlim1)); // Minimum discretization (m) retained in x-direction after node merging is fraction of smaller of x-extent or y-extent
-    double disMiny = MINDISFRACY * fmin((sys->ylim2 - sys->ylim1), (sys->xlim2 - sys->xlim1)); // Minimum discretization (m) retained in y-direction after node merging is fraction of smaller of x-extent or y-extent
+    const fdtdMeshPolicy &policy = sys->meshPolicy;
+    double disMinx = policy.minDisFracX * fmin((sys->ylim2 - sys->ylim1), (sys->xlim2 - sys->xlim1)); // Minimum discretization (m) retained in x-direction after node merging is fraction of smaller of x-extent or y-extent
+    double disMiny = policy.minDisFracY * fmin((sys->ylim2 - sys->ylim1), (sys->xlim2 - sys->xlim1)); // Minimum discretization (m) retained in y-direction after node merging is fraction of smaller of x-extent or y-extent
+    double locMin, locMax; // Minimum and maximum discretization at a grid line after grading by distance from ports (m)
     for (indi = 0; indi < sys->numCdtRow; indi++) {
         numNode += sys->conductorIn[indi].numVert;
     }
@@ -43,6 +46,7 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
         }
     }
 
+    vector<double> portLinesX, portLinesY; // Port coordinates that the mesh density is graded around
     for (indi = 0; indi < sys->numPorts; indi++) {
         vector<double> x1coord = sys->portCoor[indi].x1;
         vector<double> y1coord = sys->portCoor[indi].y1;
@@ -56,6 +60,10 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
             yOrigOld.push_back(y2coord[indk]);
             indj++; // Increase for each point in area pair defining area port side
         }
+        portLinesX.insert(portLinesX.end(), x1coord.begin(), x1coord.end());
+        portLinesX.insert(portLinesX.end(), x2coord.begin(), x2coord.end());
+        portLinesY.insert(portLinesY.end(), y1coord.begin(), y1coord.end());
+        portLinesY.insert(portLinesY.end(), y2coord.begin(), y2coord.end());
     }
 
     indj = 0;
@@ -84,12 +92,13 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     xmin = xOrigOld[0];
     xmax = xOrigOld[numOrigOldXY - 1];
 
-    double disMaxx = MAXDISFRACX * (sys->xlim2 - sys->xlim1); // Maximum discretization distance in x-direction is fraction of x-extent
+    double disMaxx = policy.maxDisFracX * (sys->xlim2 - sys->xlim1); // Maximum discretization distance in x-direction is fraction of x-extent (smallest value, used near ports)
 
     myint xMaxInd = (myint)((xmax - xmin) / disMaxx); // Cast to myint after floating-point division
     
     for (indi = 1; indi < numOrigOldXY; indi++) {
-        if (abs(xOrigOld[indi] - xOrigOld[indi - 1]) > disMinx) {
+        locMin = disMinx * policy.gradeScale(xOrigOld[indi], portLinesX, sys->xlim2 - sys->xlim1);
+        if (abs(xOrigOld[indi] - xOrigOld[indi - 1]) > locMin) {
             sys->nx++;
         }
     }
@@ -99,20 +108,23 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     indj = 0;
     sys->nx = 1;
     for (indi = 1; indi < numOrigOldXY; indi++) {
-        if (abs(xOrigOld[indi] - temp) > disMinx && abs(xOrigOld[indi] - temp) <= disMaxx) {
+        locMin = disMinx * policy.gradeScale(xOrigOld[indi], portLinesX, sys->xlim2 - sys->xlim1);
+        locMax = disMaxx * policy.gradeScale(temp, portLinesX, sys->xlim2 - sys->xlim1);
+        if (abs(xOrigOld[indi] - temp) > locMin && abs(xOrigOld[indi] - temp) <= locMax) {
             indj++;
             xn[indj] = xOrigOld[indi]; // Save coordinate for nodes to keep if in discretization retention range
             temp = xn[indj];
             sys->nx++;
         }
-        else if (abs(xOrigOld[indi] - temp) > disMinx && abs(xOrigOld[indi] - temp) > disMaxx) {
-            while (abs(xOrigOld[indi] - temp) > disMaxx) {
+        else if (abs(xOrigOld[indi] - temp) > locMin && abs(xOrigOld[indi] - temp) > locMax) {
+            while (abs(xOrigOld[indi] - temp) > locMax) {
                 indj++;
-                xn[indj] = xn[indj - 1] + disMaxx; // Save coordinates of all nodes past maximum discretization at intervals of the maximum discretization past the previous coordinate
+                xn[indj] = xn[indj - 1] + locMax; // Save coordinates of all nodes past maximum discretization at intervals of the maximum discretization past the previous coordinate
                 temp = xn[indj];
                 sys->nx++;
+                locMax = disMaxx * policy.gradeScale(temp, portLinesX, sys->xlim2 - sys->xlim1);
             }
-            if (abs(xOrigOld[indi] - temp) > disMinx) { // Check original coordinate against new temp coordinate
+            if (abs(xOrigOld[indi] - temp) > locMin) { // Check original coordinate against new temp coordinate
                 sys->nx++;
                 temp = xOrigOld[indi];
             }
@@ -134,7 +146,7 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     double first, second;
     temp = xn[0];
     for (indi = 1; indi <= countx; indi++) {    // Set the discretization length around port to be equal
-        if (abs(xn[indi] - temp) > disMinx) {
+        if (abs(xn[indi] - temp) > disMinx * policy.gradeScale(xn[indi], portLinesX, sys->xlim2 - sys->xlim1)) {
             indj++;
             temp = xn[indi];
             //sys->xnu[indj] = xn[indi];
@@ -153,11 +165,12 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     sys->ny = 1;
     ymin = yOrigOld[0];
     ymax = yOrigOld[numOrigOldXY - 1];
-    double disMaxy = MAXDISFRACY * (sys->ylim2 - sys->ylim1); // Maximum discretization distance in y-direction is fraction of y-extent
+    double disMaxy = policy.maxDisFracY * (sys->ylim2 - sys->ylim1); // Maximum discretization distance in y-direction is fraction of y-extent (smallest value, used near ports)
     myint yMaxInd = (myint)((ymax - ymin) / disMaxy); // Cast to myint after floating-point division
     
     for (indi = 1; indi < numOrigOldXY; indi++) {
-        if (abs(yOrigOld[indi] - yOrigOld[indi - 1]) > disMiny) {
+        locMin = disMiny * policy.gradeScale(yOrigOld[indi], portLinesY, sys->ylim2 - sys->ylim1);
+        if (abs(yOrigOld[indi] - yOrigOld[indi - 1]) > locMin) {
             sys->ny++;
         }
     }
@@ -167,20 +180,23 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     sys->ny = 1;
     temp = yn[0];
     for (indi = 1; indi < numOrigOldXY; indi++) {
-        if (abs(yOrigOld[indi] - temp) > disMiny && abs(yOrigOld[indi] - temp) <= disMaxy) {
+        locMin = disMiny * policy.gradeScale(yOrigOld[indi], portLinesY, sys->ylim2 - sys->ylim1);
+        locMax = disMaxy * policy.gradeScale(temp, portLinesY, sys->ylim2 - sys->ylim1);
+        if (abs(yOrigOld[indi] - temp) > locMin && abs(yOrigOld[indi] - temp) <= locMax) {
             indj++;
             yn[indj] = yOrigOld[indi];
             temp = yn[indj];
             sys->ny++;
         }
-        else if (abs(yOrigOld[indi] - temp) > disMiny && abs(yOrigOld[indi] - temp) > disMaxy) {
-            while (abs(yOrigOld[indi] - temp) > disMaxy) {
+        else if (abs(yOrigOld[indi] - temp) > locMin && abs(yOrigOld[indi] - temp) > locMax) {
+            while (abs(yOrigOld[indi] - temp) > locMax) {
                 indj++;
-                yn[indj] = yn[indj - 1] + disMaxy;
+                yn[indj] = yn[indj - 1] + locMax;
                 temp = yn[indj];
                 sys->ny++;
+                locMax = disMaxy * policy.gradeScale(temp, portLinesY, sys->ylim2 - sys->ylim1);
             }
-            if (abs(yOrigOld[indi] - temp) > disMiny) {
+            if (abs(yOrigOld[indi] - temp) > locMin) {
                 sys->ny++;
                 temp = yOrigOld[indi];
             }
@@ -203,7 +219,7 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     temp = yn[0];
     for (indi = 1; indi <= county; indi++) {    // Set the discretization length around port to be equal
         
-        if (abs(yn[indi] - temp) > disMiny) {
+        if (abs(yn[indi] - temp) > disMiny * policy.gradeScale(yn[indi], portLinesY, sys->ylim2 - sys->ylim1)) {
             indj++;
             temp = yn[indi];
             //sys->ynu[indj] = yn[indi];
@@ -222,7 +238,7 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     /* Discretize domain in the z-direction */
     sort(zOrigOld.begin(), zOrigOld.end());
     sys->nz = 1;
-    double disMinz = minLayerDist * MINDISFRACZ; // Minimum discretization retained in z-direction after node merging is fraction of smallest distance between layers
+    double disMinz = minLayerDist * policy.minDisFracZ; // Minimum discretization retained in z-direction after node merging is fraction of smallest distance between layers
     //double disMaxz = minLayerDist / MAXDISLAYERZ; // Maximum discretization distance in z-direction is fraction of closest distance between layers
     double *zn = (double*)calloc(2 * sys->numStack + 6 * numPortSides, sizeof(double));
     
@@ -246,7 +262,7 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     temp = sys->xn[0];
     //xi[sys->xn[0]] = indj;
     for (indi = 1; indi <= countx; indi++) {    // Set the discretization length around port to be equal
-        if (abs(xn[indi] - temp) > disMinx) {
+        if (abs(xn[indi] - temp) > disMinx * policy.gradeScale(xn[indi], portLinesX, sys->xlim2 - sys->xlim1)) {
             indj++;
             sys->xn[indj] = xn[indi];
             temp = sys->xn[indj];
@@ -268,7 +284,7 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     yi[sys->yn[0]] = indj;
     for (indi = 1; indi <= county; indi++) {    // Set the discretization length around port to be equal
 
-        if (abs(yn[indi] - temp) > disMiny) {
+        if (abs(yn[indi] - temp) > disMiny * policy.gradeScale(yn[indi], portLinesY, sys->ylim2 - sys->ylim1)) {
             indj++;
             sys->yn[indj] = yn[indi];
             temp = sys->yn[indj];
@@ -370,6 +386,23 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
 
     /***********************************************************************************************/
 
+    /* Predict problem size from the grid line counts before any mesh-sized allocation */
+    fdtdMeshSize meshSize(sys->nx, sys->ny, sys->nz, sys->numPorts, sys->nfreq);
+    meshSize.print();
+    if (planOnly) {    // mesh-only planning mode stops after line generation
+        return 0;
+    }
+    if (policy.memLimitGB > 0. && meshSize.totalBytes > policy.memLimitGB * 1.e9) {
+        cerr << "Predicted memory of " << meshSize.totalBytes / 1.e9 << " GB exceeds memLimitGB = " << policy.memLimitGB << " GB. Coarsen the MESH section of the simulation input file. Aborting now." << endl;
+        return 1;
+    }
+#ifndef LARGE_SYSTEM
+    if (meshSize.nnzS > INT_MAX) {    // 32-bit index build: every edge index and nonzero count must stay below 2^31
+        cerr << "The mesh has " << meshSize.N_edge << " edges, too many for 32-bit indices. Rebuild without INDEX32=1." << endl;
+        return 1;
+    }
+#endif
+
     /* Save counts of the final discretization */
     sys->N_cell_x = sys->nx - (myint)1;
     sys->N_cell_y = sys->ny - (myint)1;
@@ -386,8 +419,8 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     sys->N_patch_v = (sys->N_cell_x + 1)*sys->N_cell_y + (sys->N_cell_y + 1)*sys->N_cell_x;
     sys->N_patch = sys->N_patch_s*(sys->N_cell_z + 1) + sys->N_patch_v*sys->N_cell_z;
 
-    sys->markEdge = (myint*)calloc(sys->N_edge, sizeof(myint));   // Mark which conductor index given edge is inside
-    sys->markNode = (myint*)calloc(sys->N_node, sizeof(myint));   // Mark which conductor index given node is inside
+    sys->markEdge = firstTouchCalloc<mycdt>(sys->N_edge);   // Mark which conductor index given edge is inside
+    sys->markNode = firstTouchCalloc<mycdt>(sys->N_node);   // Mark which conductor index given node is inside
 
 #ifdef PRINT_VERBOSE_TIMING
     cout << "The time to read and assign x, y, z coordinates is " << (clock() - tt) * 1.0 / CLOCKS_PER_SEC << " s" << endl;
@@ -446,18 +479,18 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     /* Assign markers to nodes and edges beyond included conductors. No need for this */
 #ifdef LOWER_BOUNDARY_PEC
     for (indi = 0; indi < sys->N_edge_s; indi++) {    // the lower PEC plane
-        sys->markEdge[indi] = sys->numCdtRow + (myint)1;
+        sys->markEdge[indi] = (mycdt)(sys->numCdtRow + 1);
     }
     for (indi = 0; indi < sys->N_node_s; indi++) {
-        sys->markNode[indi] = (myint)1;
+        sys->markNode[indi] = (mycdt)1;
     }
 #endif
 #ifdef UPPER_BOUNDARY_PEC
     for (indi = sys->N_edge - sys->N_edge_s; indi < sys->N_edge; indi++) {    // the upper PEC plane
-        sys->markEdge[indi] = sys->numCdtRow + (myint)2;
+        sys->markEdge[indi] = (mycdt)(sys->numCdtRow + 2);
     }
     for (indi = sys->N_node - sys->N_node_s; indi < sys->N_node; indi++) {
-        sys->markNode[indi] = (myint)1;
+        sys->markNode[indi] = (mycdt)1;
     }
 #endif
 
@@ -657,9 +690,9 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     //}
 
     /* Implement breadth-first search (BFS) */
-    myint *visited;
+    mycdt *visited;    // conductor color of each node
     unordered_set<int> base;
-    visited = (myint*)calloc(sys->N_node, sizeof(myint));
+    visited = (mycdt*)calloc(sys->N_node, sizeof(mycdt));
     myint count = (myint)0;
     queue<myint> qu;
 
@@ -917,28 +950,12 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
     cout << "cond2condIn is set sucessfully!" << endl;
 
 #ifdef LOWER_BOUNDARY_PEC
-    for (int i = 0; i < sys->N_edge_s; i++) {
-        if (sys->lbde.find(i) == sys->lbde.end()) {
-            sys->lbde.insert(i);
-        }
-    }
-    for (int i = 0; i < sys->N_node_s; i++) {
-        if (sys->lbdn.find(i) == sys->lbdn.end()) {
-            sys->lbdn.insert(i);
-        }
-    }
+    sys->lbde.insertRange(0, sys->N_edge_s);
+    sys->lbdn.insertRange(0, sys->N_node_s);
 #endif
 #ifdef UPPER_BOUNDARY_PEC
-    for (int i = sys->N_edge - sys->N_edge_s; i < sys->N_edge; i++) {
-        if (sys->ubde.find(i) == sys->ubde.end()) {
-            sys->ubde.insert(i);
-        }
-    }
-    for (int i = sys->N_node - sys->N_node_s; i < sys->N_node; i++) {
-        if (sys->ubdn.find(i) == sys->ubdn.end()) {
-            sys->ubdn.insert(i);
-        }
-    }
+    sys->ubde.insertRange(sys->N_edge - sys->N_edge_s, sys->N_edge);
+    sys->ubdn.insertRange(sys->N_node - sys->N_node_s, sys->N_node);
 #endif
     sys->bden = sys->lbde.size() + sys->ubde.size();    // the boundary edge number
     sys->setMapEdge();   // map the original edge to the new edge # with upper and lower boundaries
@@ -986,7 +1003,7 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
 #ifndef SKIP_MARK_CELL
     vector<int> aa;
     vector<double> bb;
-    sys->markCell = (myint*)calloc(sys->N_cell_x * sys->N_cell_y * sys->N_cell_z, sizeof(myint));
+    sys->markCell = (mycdt*)calloc(sys->N_cell_x * sys->N_cell_y * sys->N_cell_z, sizeof(mycdt));
     for (indi = 0; indi < sys->N_edge; indi++)
     {
         sys->edgeCell.push_back(aa);
@@ -1076,7 +1093,7 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
                 }
 
                 if (mark == 1) {
-                    sys->markCell[cell] = (myint)1;
+                    sys->markCell[cell] = (mycdt)1;
                 }
             }
         }
@@ -1088,54 +1105,39 @@ int meshAndMark(fdtdMesh *sys, unordered_map<double, int> &xi, unordered_map<dou
 
 int matrixConstruction(fdtdMesh *sys) {
 
-    myint indi = 0, indj = 0;
-    //cout << sys->stackEpsn.size() << endl;
-    /* construct D_eps */
-    /*sys->eps.reserve(sys->N_edge);
-    for (indi = 0; indi < sys->N_edge; indi++) {
-        if (indi < sys->N_edge_s) {
-            sys->eps.at(indi) = sys->stackEpsn[0] * EPSILON0;
-        }
-        else {
-            sys->eps.at(indi) = sys->stackEpsn[(indi - sys->N_edge_s) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0;
-        }
-    }*/
+    myint N_edge_rmPEC = sys->N_edge - sys->bden;    // edges left after PEC removal, indexed as in the stiffness matrix
 
-    /* construct D_sig */
-    /*sys->sig = (double*)calloc(sys->N_edge, sizeof(double));
-    double area, b;
-    for (indi = 0; indi < sys->N_edge; indi++) {
-        if (sys->markEdge[indi] != 0) {
-#ifndef SKIP_MARK_CELL
-            area = 0;
-            b = 0;
-            for (indj = 0; indj < sys->edgeCell[indi].size(); indj++) {
-                area += (double)sys->markCell[sys->edgeCell[indi][indj]] * sys->edgeCellArea[indi][indj];
-                b += sys->edgeCellArea[indi][indj];
-            }
-            sys->sig[indi] = area / b * SIGMA;
-#else
+    /* construct D_eps and D_sig once so the solvers read flat arrays instead of recomputing the layer of each edge */
+    sys->eps.assign(N_edge_rmPEC, 0.);
+    free(sys->sig);
+    sys->sig = firstTouchCalloc<double>(N_edge_rmPEC);
+    if (sys->sig == NULL) {
+        cerr << "Unable to allocate D_sig for " << N_edge_rmPEC << " edges" << endl;
+        return 1;
+    }
+#pragma omp parallel for schedule(static)
+    for (myint indi = 0; indi < N_edge_rmPEC; indi++) {
+        myint eno = sys->mapEdgeR[indi];
+        sys->eps[indi] = sys->stackEpsn[(eno + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0;
+        if (sys->markEdge[eno] != 0) {    // edge inside a conductor
             sys->sig[indi] = SIGMA;
-#endif
         }
-    }*/
+    }
+
+#ifdef PRINT_EPS_SIG
     ofstream out;
     out.open("eps.txt", std::ofstream::out | std::ofstream::trunc);
-    for (indi = 0; indi < sys->N_edge - sys->bden; indi++){
-        out << std::setprecision(std::numeric_limits<double>::digits10 + 1) << sys->stackEpsn[(sys->mapEdgeR[indi] + sys->N_edge_v) / (sys->N_edge_s + sys->N_edge_v)] * EPSILON0 << endl;
+    for (myint indi = 0; indi < N_edge_rmPEC; indi++){
+        out << std::setprecision(std::numeric_limits<double>::digits10 + 1) << sys->eps[indi] << endl;
     }
     out.close();
 
     out.open("sig.txt", std::ofstream::out | std::ofstream::trunc);
-    for (indi = 0; indi < sys->N_edge - sys->bden; indi++){
-        if (sys->markEdge[sys->mapEdgeR[indi]] != 0){
-            out << std::setprecision(std::numeric_limits<double>::digits10 + 1) << SIGMA << endl;
-        }
-        else{
-            out << 0 << endl;
-        }
+    for (myint indi = 0; indi < N_edge_rmPEC; indi++){
+        out << std::setprecision(std::numeric_limits<double>::digits10 + 1) << sys->sig[indi] << endl;
     }
     out.close();
+#endif
 
     sys->edgeCell.clear();
     sys->edgeCellArea.clear();
@@ -1906,14 +1908,8 @@ void fdtdMesh::print()
     {
         this->portCoor[indPort].print();
     }
-    if (this->J == nullptr)
-    {
-        cout << " Current source array exists (" << (this->J != nullptr) << ")" << endl;
-    }
-    else
-    {
-        cout << " Current source array has size " << NELEMENT(this->J) << endl;
-    }
+    cout << " " << this->sourcePorts.size() << " of the ports are excited" << endl;
+    cout << " Current source has " << this->J.size() << " nonzero edges" << endl;
     cout << " Current V0c,s^T*I information:" << endl;
     cout << "  v0csJ array exists (" << (this->v0csJ != nullptr) << ")" << endl;
     cout << "  Y array exists (" << (this->Y != nullptr) << ")" << endl;
@@ -0,0 +1,382 @@
+#ifndef GDS2PARA_MESH_SHARE_H_
+#define GDS2PARA_MESH_SHARE_H_
+
+#include <mpi.h>
+#include <type_traits>
+
+#include "fdtd.hpp"
+#include "hybridThreads.hpp"
+
+#define MESH_SHARE_CHUNK_BYTES ((size_t)1 << 30)    // largest single MPI_Bcast, counts are int
+
+// MPI for the lifetime of one simulation, initialized before meshing and finalized after every window is freed
+class mpiSession {
+public:
+    mpiSession(int *argc, char ***argv) {
+#ifdef _OPENMP
+        int threadSupport;
+        MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &threadSupport);    // OpenMP regions never call MPI, only the master thread does
+#else
+        MPI_Init(argc, argv);
+#endif
+    }
+    mpiSession(const mpiSession &) = delete;
+    mpiSession &operator=(const mpiSession &) = delete;
+    ~mpiSession() {
+        MPI_Finalize();
+    }
+};
+
+// Flat byte image of the small members of fdtdMesh, packed by the building rank and unpacked by the others
+class meshImage {
+public:
+    vector<char> bytes;
+
+    template <typename T>
+    void put(const T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values are copied byte by byte");
+        const char *p = (const char*)&value;
+        this->bytes.insert(this->bytes.end(), p, p + sizeof(T));
+    }
+    template <typename T>
+    void putArray(const T *data, myint n) {
+        if (n > 0) {
+            const char *p = (const char*)data;
+            this->bytes.insert(this->bytes.end(), p, p + n * sizeof(T));
+        }
+    }
+    template <typename T>
+    void putVector(const vector<T> &vec) {
+        this->put((myint)vec.size());
+        this->putArray(vec.data(), vec.size());
+    }
+    void putVector(const vector<bool> &vec) {
+        this->put((myint)vec.size());
+        for (bool b : vec) {
+            this->put((char)b);
+        }
+    }
+    void putVector(const vector<string> &vec) {
+        this->put((myint)vec.size());
+        for (const string &s : vec) {
+            this->put((myint)s.size());
+            this->putArray(s.data(), s.size());
+        }
+    }
+    void putRangeSet(const indexRangeSet &set) {
+        this->putVector(set.rangeList());
+    }
+
+    template <typename T>
+    T get() {
+        T value;
+        memcpy((void*)&value, &this->bytes[this->pos], sizeof(T));
+        this->pos += sizeof(T);
+        return value;
+    }
+    template <typename T>
+    void getArray(T *data, myint n) {
+        if (n > 0) {
+            memcpy((void*)data, &this->bytes[this->pos], n * sizeof(T));
+            this->pos += n * sizeof(T);
+        }
+    }
+    template <typename T>
+    void getVector(vector<T> &vec) {
+        vec.resize(this->get<myint>());
+        this->getArray(vec.data(), vec.size());
+    }
+    void getVector(vector<bool> &vec) {
+        vec.resize(this->get<myint>());
+        for (size_t ind = 0; ind < vec.size(); ind++) {
+            vec[ind] = (this->get<char>() != 0);
+        }
+    }
+    void getVector(vector<string> &vec) {
+        vec.resize(this->get<myint>());
+        for (string &s : vec) {
+            s.resize(this->get<myint>());
+            this->getArray(&s[0], s.size());
+        }
+    }
+    void getRangeSet(indexRangeSet &set) {
+        vector<pair<myint, myint>> ranges;
+        this->getVector(ranges);
+        set.clear();
+        for (const auto &range : ranges) {
+            set.insertRange(range.first, range.second);
+        }
+    }
+
+private:
+    size_t pos = 0;     // read position
+};
+
+// One mesh per job, shared read-only by all MPI ranks
+/* World rank 0 reads the design and runs meshAndMark(), matrixConstruction(), portSet() and generateStiff() alone.
+publish() then hands the result to every rank in two parts:
+    - the small members (sizes, grid lines, stack, ports, D_eps) are broadcast as one meshImage and copied by each rank
+    - the mesh-sized arrays (markEdge, markNode, markCell, mapEdge, mapEdgeR, D_sig, conductor nodes, S) are placed in
+      one MPI-3 shared-memory window per node, filled by the node's first rank, and only pointed to by the others
+So a node holds one copy of the big arrays whatever its rank count, and the mesh is generated once per job. The arrays
+must not be written or freed after publish(), which fdtdMesh::meshArraysShared guards. */
+class meshShare {
+public:
+    meshShare() {
+        MPI_Comm_rank(MPI_COMM_WORLD, &this->worldRank);
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, this->worldRank, MPI_INFO_NULL, &this->nodeComm);
+        MPI_Comm_rank(this->nodeComm, &this->nodeRank);
+        MPI_Comm_split(MPI_COMM_WORLD, (this->nodeRank == 0) ? 0 : MPI_UNDEFINED, this->worldRank, &this->leaderComm);  // world rank 0 is leader 0
+    }
+
+    meshShare(const meshShare &) = delete;
+    meshShare &operator=(const meshShare &) = delete;
+
+    ~meshShare() {
+        if (this->win != MPI_WIN_NULL) {
+            MPI_Win_free(&this->win);
+        }
+        if (this->leaderComm != MPI_COMM_NULL) {
+            MPI_Comm_free(&this->leaderComm);
+        }
+        MPI_Comm_free(&this->nodeComm);
+    }
+
+    // The rank that reads the design, builds the mesh and writes the output files
+    bool isBuilder() const {
+        return this->worldRank == 0;
+    }
+
+    // Collective over all ranks. Builder's status is returned everywhere, nothing is shared unless it is 0
+    int publish(fdtdMesh *sys, int status) {
+        MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (status != 0) {
+            return status;
+        }
+
+        // Small members, by value
+        meshImage image;
+        if (this->isBuilder()) {
+            this->packSmall(*sys, image);
+        }
+        long long imageBytes = image.bytes.size();    // fixed width for MPI_LONG_LONG, myint is int under INDEX32
+        MPI_Bcast(&imageBytes, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+        image.bytes.resize(imageBytes);
+        bcastBytes(image.bytes.data(), imageBytes, MPI_COMM_WORLD);
+        if (!this->isBuilder()) {
+            this->unpackSmall(*sys, image);
+        }
+
+        // Mesh-sized arrays, one copy per node
+        vector<sharedArray> arrays = this->sharedArrays(sys);
+        size_t totalBytes = 0;
+        for (auto &a : arrays) {
+            a.offset = totalBytes;
+            totalBytes += (a.bytes + 63) / 64 * 64;    // cache-line aligned
+        }
+        char *base;
+        MPI_Win_allocate_shared((this->nodeRank == 0) ? totalBytes : 0, 1, MPI_INFO_NULL, this->nodeComm, &base, &this->win);
+        MPI_Aint nodeBytes;
+        int dispUnit;
+        MPI_Win_shared_query(this->win, 0, &nodeBytes, &dispUnit, &base);
+        MPI_Win_fence(0, this->win);
+
+        // Each leader writes the window first with the static schedule of the engines, so the pages of every array are
+        // spread over the NUMA nodes as firstTouchCalloc() spreads them. The other leaders zero theirs before receiving.
+        if (this->nodeRank == 0 && !this->isBuilder()) {
+            for (auto &a : arrays) {
+                firstTouchCopy(base + a.offset, NULL, a.bytes);
+            }
+        }
+        if (this->isBuilder()) {
+            for (auto &a : arrays) {
+                if (a.bytes > 0) {
+                    firstTouchCopy(base + a.offset, *a.data, a.bytes);
+                }
+                if (a.newed) {
+                    delete[] (myint*)*a.data;
+                }
+                else {
+                    free(*a.data);
+                }
+            }
+            for (myint indCdt = 0; indCdt < sys->numCdt; indCdt++) {
+                free(sys->conductor[indCdt].node);
+            }
+        }
+        if (this->leaderComm != MPI_COMM_NULL) {
+            bcastBytes(base, totalBytes, this->leaderComm);
+        }
+        MPI_Win_fence(0, this->win);
+
+        for (auto &a : arrays) {
+            *a.data = (a.bytes > 0) ? base + a.offset : NULL;
+        }
+        myint *cdtNode = this->cdtNode;
+        for (myint indCdt = 0; indCdt < sys->numCdt; indCdt++) {
+            sys->conductor[indCdt].node = cdtNode;
+            cdtNode += sys->cdtNumNode[indCdt];
+        }
+        sys->meshArraysShared = true;
+
+        if (this->isBuilder()) {
+            int N_rank, N_node = 0;
+            MPI_Comm_size(MPI_COMM_WORLD, &N_rank);
+            MPI_Comm_size(this->leaderComm, &N_node);
+            cout << "Mesh shared by " << N_rank << " ranks on " << N_node << " nodes (" << imageBytes / 1.e6
+                << " MB copied per rank, " << totalBytes / 1.e6 << " MB shared per node)" << endl;
+        }
+        return 0;
+    }
+
+private:
+    struct sharedArray {
+        void **data;    // member of fdtdMesh pointing to the array
+        size_t bytes;
+        size_t offset;  // in the window
+        bool newed;     // allocated by new myint[] instead of malloc()
+    };
+
+    // The arrays placed in the window, sizes known on every rank once the small members are unpacked
+    vector<sharedArray> sharedArrays(fdtdMesh *sys) {
+        myint N_edge_rmPEC = sys->N_edge - sys->bden;
+        myint N_cell = (this->hasMarkCell) ? sys->N_cell_x * sys->N_cell_y * sys->N_cell_z : 0;
+        myint N_S = (this->hasS) ? sys->leng_S : 0;
+        myint N_cdtNode = 0;
+        for (myint indCdt = 0; indCdt < sys->numCdt; indCdt++) {
+            N_cdtNode += sys->cdtNumNode[indCdt];
+        }
+        return {
+            { (void**)&sys->markEdge, sys->N_edge * sizeof(mycdt), 0, false },
+            { (void**)&sys->markNode, sys->N_node * sizeof(mycdt), 0, false },
+            { (void**)&sys->markCell, N_cell * sizeof(mycdt), 0, false },
+            { (void**)&sys->mapEdge, sys->N_edge * sizeof(myint), 0, true },
+            { (void**)&sys->mapEdgeR, N_edge_rmPEC * sizeof(myint), 0, true },
+            { (void**)&sys->sig, N_edge_rmPEC * sizeof(double), 0, false },
+            { (void**)&this->cdtNode, N_cdtNode * sizeof(myint), 0, false },
+            { (void**)&sys->SRowId, N_S * sizeof(myint), 0, false },
+            { (void**)&sys->SColId, N_S * sizeof(myint), 0, false },
+            { (void**)&sys->Sval, N_S * sizeof(double), 0, false },
+        };
+    }
+
+    void packSmall(fdtdMesh &sys, meshImage &image) {
+        // Conductor nodes go to the window as one array, the builder gathers them before publish() moves the arrays
+        myint N_cdtNode = 0;
+        for (myint indCdt = 0; indCdt < sys.numCdt; indCdt++) {
+            N_cdtNode += sys.cdtNumNode[indCdt];
+        }
+        this->cdtNode = (myint*)malloc(N_cdtNode * sizeof(myint));
+        myint *cdtNode = this->cdtNode;
+        for (myint indCdt = 0; indCdt < sys.numCdt; indCdt++) {
+            memcpy(cdtNode, sys.conductor[indCdt].node, sys.cdtNumNode[indCdt] * sizeof(myint));
+            cdtNode += sys.cdtNumNode[indCdt];
+        }
+        this->hasMarkCell = (sys.markCell != NULL);
+        this->hasS = (sys.SRowId != NULL);
+
+        image.put(sys.lengthUnit); image.put(sys.outedge); image.put(sys.inedge);
+        image.put(sys.freqUnit); image.put(sys.freqStart); image.put(sys.freqEnd); image.put(sys.nfreq); image.put(sys.freqScale);
+        image.put(sys.meshPolicy);
+        image.put(sys.nx); image.put(sys.ny); image.put(sys.nz);
+        image.put(sys.N_cell_x); image.put(sys.N_cell_y); image.put(sys.N_cell_z);
+        image.put(sys.xlim1); image.put(sys.xlim2); image.put(sys.ylim1); image.put(sys.ylim2); image.put(sys.zlim1); image.put(sys.zlim2);
+        image.put(sys.N_edge); image.put(sys.N_edge_s); image.put(sys.N_edge_v);
+        image.put(sys.N_node); image.put(sys.N_node_s);
+        image.put(sys.N_patch); image.put(sys.N_patch_s); image.put(sys.N_patch_v);
+        image.put(sys.bden); image.put(sys.numStack); image.put(sys.numCdtRow); image.put(sys.numCdt);
+        image.put(sys.leng_S); image.put(sys.numPorts);
+        image.put(this->hasMarkCell); image.put(this->hasS);
+
+        image.putArray(sys.xn, sys.nx); image.putArray(sys.yn, sys.ny); image.putArray(sys.zn, sys.nz);
+        myint N_stackCdtMark = (sys.stackCdtMark != NULL) ? sys.numStack : 0;
+        image.put(N_stackCdtMark);
+        image.putArray(sys.stackCdtMark, N_stackCdtMark);
+        image.putArray(sys.cdtNumNode, sys.numCdt);
+        for (myint indCdt = 0; indCdt < sys.numCdt; indCdt++) {
+            image.put(sys.conductor[indCdt].markPort); image.put(sys.conductor[indCdt].portind); image.put(sys.conductor[indCdt].cdtNodeind);
+        }
+
+        image.putVector(sys.stackEps); image.putVector(sys.stackSig); image.putVector(sys.stackBegCoor); image.putVector(sys.stackEndCoor);
+        image.putVector(sys.stackName); image.putVector(sys.eps); image.putVector(sys.stackEpsn); image.putVector(sys.stackSign);
+        image.putVector(sys.markProSide);
+        image.putVector(vector<int>(sys.cond2condIn.begin(), sys.cond2condIn.end()));
+        image.putRangeSet(sys.ubde); image.putRangeSet(sys.lbde); image.putRangeSet(sys.ubdn); image.putRangeSet(sys.lbdn);
+        image.putVector(sys.sourcePorts);
+        for (int indPort = 0; indPort < sys.numPorts; indPort++) {
+            const fdtdPort &port = sys.portCoor[indPort];
+            image.put(port.multiplicity);
+            image.putVector(port.x1); image.putVector(port.x2); image.putVector(port.y1); image.putVector(port.y2); image.putVector(port.z1); image.putVector(port.z2);
+            image.putVector(port.portCnd); image.putVector(port.portArea); image.putVector(port.portDirection);
+            image.put((myint)port.portEdge.size());
+            for (const auto &side : port.portEdge) {
+                image.putVector(side);
+            }
+        }
+    }
+
+    void unpackSmall(fdtdMesh &sys, meshImage &image) {
+        sys.lengthUnit = image.get<double>(); sys.outedge = image.get<myint>(); sys.inedge = image.get<myint>();
+        sys.freqUnit = image.get<double>(); sys.freqStart = image.get<double>(); sys.freqEnd = image.get<double>(); sys.nfreq = image.get<int>(); sys.freqScale = image.get<int>();
+        sys.meshPolicy = image.get<fdtdMeshPolicy>();
+        sys.nx = image.get<myint>(); sys.ny = image.get<myint>(); sys.nz = image.get<myint>();
+        sys.N_cell_x = image.get<myint>(); sys.N_cell_y = image.get<myint>(); sys.N_cell_z = image.get<myint>();
+        sys.xlim1 = image.get<double>(); sys.xlim2 = image.get<double>(); sys.ylim1 = image.get<double>(); sys.ylim2 = image.get<double>(); sys.zlim1 = image.get<double>(); sys.zlim2 = image.get<double>();
+        sys.N_edge = image.get<myint>(); sys.N_edge_s = image.get<myint>(); sys.N_edge_v = image.get<myint>();
+        sys.N_node = image.get<myint>(); sys.N_node_s = image.get<myint>();
+        sys.N_patch = image.get<myint>(); sys.N_patch_s = image.get<myint>(); sys.N_patch_v = image.get<myint>();
+        sys.bden = image.get<int>(); sys.numStack = image.get<int>(); sys.numCdtRow = image.get<myint>(); sys.numCdt = image.get<myint>();
+        sys.leng_S = image.get<myint>(); sys.numPorts = image.get<int>();
+        this->hasMarkCell = image.get<bool>(); this->hasS = image.get<bool>();
+
+        sys.xn = (double*)malloc(sys.nx * sizeof(double)); image.getArray(sys.xn, sys.nx);
+        sys.yn = (double*)malloc(sys.ny * sizeof(double)); image.getArray(sys.yn, sys.ny);
+        sys.zn = (double*)malloc(sys.nz * sizeof(double)); image.getArray(sys.zn, sys.nz);
+        myint N_stackCdtMark = image.get<myint>();
+        if (N_stackCdtMark > 0) {
+            sys.stackCdtMark = (double*)malloc(N_stackCdtMark * sizeof(double)); image.getArray(sys.stackCdtMark, N_stackCdtMark);
+        }
+        sys.cdtNumNode = (myint*)malloc(sys.numCdt * sizeof(myint)); image.getArray(sys.cdtNumNode, sys.numCdt);
+        sys.conductor = (fdtdCdt*)calloc(sys.numCdt, sizeof(fdtdCdt));
+        for (myint indCdt = 0; indCdt < sys.numCdt; indCdt++) {
+            sys.conductor[indCdt].markPort = image.get<int>(); sys.conductor[indCdt].portind = image.get<int>(); sys.conductor[indCdt].cdtNodeind = image.get<myint>();
+        }
+
+        image.getVector(sys.stackEps); image.getVector(sys.stackSig); image.getVector(sys.stackBegCoor); image.getVector(sys.stackEndCoor);
+        image.getVector(sys.stackName); image.getVector(sys.eps); image.getVector(sys.stackEpsn); image.getVector(sys.stackSign);
+        image.getVector(sys.markProSide);
+        vector<int> cond2condIn;
+        image.getVector(cond2condIn);
+        sys.cond2condIn = unordered_set<int>(cond2condIn.begin(), cond2condIn.end());
+        image.getRangeSet(sys.ubde); image.getRangeSet(sys.lbde); image.getRangeSet(sys.ubdn); image.getRangeSet(sys.lbdn);
+        image.getVector(sys.sourcePorts);
+        sys.portCoor.assign(sys.numPorts, fdtdPort());
+        for (int indPort = 0; indPort < sys.numPorts; indPort++) {
+            fdtdPort &port = sys.portCoor[indPort];
+            port.multiplicity = image.get<int>();
+            image.getVector(port.x1); image.getVector(port.x2); image.getVector(port.y1); image.getVector(port.y2); image.getVector(port.z1); image.getVector(port.z2);
+            image.getVector(port.portCnd); image.getVector(port.portArea); image.getVector(port.portDirection);
+            port.portEdge.resize(image.get<myint>());
+            for (auto &side : port.portEdge) {
+                image.getVector(side);
+            }
+        }
+    }
+
+    static void bcastBytes(char *data, size_t bytes, MPI_Comm comm) {
+        for (size_t offset = 0; offset < bytes; offset += MESH_SHARE_CHUNK_BYTES) {
+            MPI_Bcast(data + offset, (int)min(MESH_SHARE_CHUNK_BYTES, bytes - offset), MPI_BYTE, 0, comm);
+        }
+    }
+
+    int worldRank = 0;
+    int nodeRank = 0;
+    MPI_Comm nodeComm = MPI_COMM_NULL;     // ranks sharing memory with this one
+    MPI_Comm leaderComm = MPI_COMM_NULL;   // first rank of every node, NULL on the others
+    MPI_Win win = MPI_WIN_NULL;            // this node's copy of the mesh-sized arrays
+    myint *cdtNode = NULL;                 // nodes of all conductors back to back, in the window after publish()
+    bool hasMarkCell = false;              // markCell and S are only present if meshAndMark() and generateStiff() kept them
+    bool hasS = false;
+};
+
+#endif
@@ -0,0 +1,286 @@
+/**
+* @file   parasiticExtractor.cpp
+* @date   18 October 2026
+* @brief  Reentrant in-process parasitic extraction, the library form of the simulate (-s) mode
+*/
+
+#include <ctime>
+#include "parasiticExtractor.hpp"
+#include "layeredFdtd.hpp"
+
+parasiticExtractor::parasiticExtractor()
+{
+    this->solved = false;
+}
+
+parasiticExtractor::~parasiticExtractor()
+{
+    this->resetMesh();
+}
+
+bool parasiticExtractor::loadDesign(const std::string &gdsFile)
+{
+    int worldRank;
+    int adbIsGood = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &worldRank);
+    if (worldRank == 0)    // the builder of meshShare is the only rank reading the design
+    {
+        this->adb = AsciiDataBase();
+        this->adb.setFileName(gdsFile);
+        GdsParser::GdsReader adbReader(this->adb);
+        adbIsGood = adbReader(gdsFile.c_str());
+        if (adbIsGood)
+        {
+            vector<size_t> indCellPrint = {}; // { adb.getNumCell() - 1 };
+            this->adb.print(indCellPrint);
+            cout << "GDSII file read" << endl;
+        }
+        else
+        {
+            cerr << "Unable to read in GDSII file" << endl;
+        }
+    }
+    MPI_Bcast(&adbIsGood, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    return adbIsGood != 0;
+}
+
+bool parasiticExtractor::loadSimInput(const std::string &simFile)
+{
+    SolverDataBase newSdb; // readSimInput() appends to the layers, so read into an empty database
+    if (!newSdb.readSimInput(simFile))
+    {
+        cerr << "Unable to read in simulation input file" << endl;
+        return false;
+    }
+    this->sdb = newSdb;
+    cout << "Simulation input file read" << endl;
+    return true;
+}
+
+void parasiticExtractor::setStack(const vector<Layer> &layers)
+{
+    this->sdb.setLayers(layers);
+}
+
+void parasiticExtractor::setPorts(const vector<Port> &ports)
+{
+    Parasitics newPara = this->sdb.getParasitics();
+    newPara.setPorts(ports);
+    this->sdb.setParasitics(newPara);
+}
+
+void parasiticExtractor::setSourcePorts(const vector<std::string> &names)
+{
+    SimSettings newSettings = this->sdb.getSimSettings();
+    newSettings.setSourcePorts(names);
+    this->sdb.setSimSettings(newSettings);
+}
+
+void parasiticExtractor::setSimSettings(const SimSettings &settings)
+{
+    this->sdb.setSimSettings(settings);
+}
+
+int parasiticExtractor::mesh(const std::string &cellName)
+{
+    this->resetMesh();
+    this->solved = false;
+    this->share.reset(new meshShare());
+    this->sys.reset(new fdtdMesh());
+
+    // Only the builder meshes, the other ranks wait in publish()
+    int status = 0;
+    if (this->share->isBuilder())
+    {
+        status = this->buildMesh(cellName);
+    }
+    status = this->share->publish(this->sys.get(), status);
+    if (status != 0)
+    {
+        this->resetMesh();
+        return status;
+    }
+
+    // Cell name to every rank
+    int nameLength = this->cellName.size();
+    MPI_Bcast(&nameLength, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    this->cellName.resize(nameLength);
+    MPI_Bcast(&this->cellName[0], nameLength, MPI_CHAR, 0, MPI_COMM_WORLD);
+    return 0;
+}
+
+int parasiticExtractor::solve()
+{
+    if (!this->sys)
+    {
+        cerr << "Nothing to solve, mesh() must succeed before each solve()" << endl;
+        return 1;
+    }
+    fdtdMesh *sys = this->sys.get();
+
+    // Write object sys to files
+#ifndef SKIP_LAYERED_FD
+    if (this->share->isBuilder())
+    {
+        WriteSysToFile(*sys);
+    }
+#endif
+
+    // Parameter generation
+    clock_t t6 = clock();
+    int status;
+#ifndef SKIP_LAYERED_FD     // Run layered Finite-Difference solver
+    cout << endl << endl << "Results from Layered Finite-Difference Solver: " << endl;
+    status = solveE_Zpara_layered(sys);
+#else                       // Run VoVh solver
+    cout << endl << endl << "Results from V0Vh Solver: " << endl;
+    status = paraGenerator(sys, this->xi, this->yi, this->zi);
+#endif
+    if (status == 0)
+    {
+        cout << "paraGenerator Success!" << endl;
+        cout << "paraGenerator time is " << (clock() - t6) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
+
+        // Network parameter storage
+        Parasitics newPara = this->sdb.getParasitics(); // Start with outdated parastics to update
+        newPara.setAllExcited((int)sys->sourcePorts.size() == sys->numPorts); // A SOURCE block subset leaves the Z-parameters incomplete
+        newPara.saveNetworkParam('Z', this->sdb.getSimSettings().getFreqsHertz(), sys->x); // Save the Z-parameters in fdtdMesh to Parasitics class
+        this->sdb.setParasitics(newPara);
+        this->solved = true;
+    }
+    else
+    {
+        cerr << "paraGenerator Fail!" << endl;
+    }
+
+    // The solver frees parts of the mesh as it goes, so the mesh cannot be solved again
+    this->resetMesh();
+    return status;
+}
+
+bool parasiticExtractor::getParameters(char param, Parasitics *para) const
+{
+    if (!this->solved)
+    {
+        cerr << "No network parameters yet, solve() has not succeeded since the last mesh()" << endl;
+        return false;
+    }
+    Parasitics newPara = this->sdb.getParasitics();
+    if (param != newPara.getParamType())
+    {
+        if (!newPara.isAllExcited())
+        {
+            cerr << "Only the SOURCE ports were excited, so only Z-parameters can be returned" << endl;
+            return false;
+        }
+        newPara.convertParam(param);
+    }
+    *para = newPara;
+    return true;
+}
+
+SolverDataBase parasiticExtractor::getSolverData() const
+{
+    return this->sdb;
+}
+
+std::string parasiticExtractor::getCellName() const
+{
+    return this->cellName;
+}
+
+// Builder only: the steps of the simulate (-s) mode from the design to the stiffness matrix
+int parasiticExtractor::buildMesh(const std::string &cellName)
+{
+    int status = 0;
+    fdtdMesh *sys = this->sys.get();
+
+    if (this->adb.getNumCell() == 0)
+    {
+        cerr << "No design loaded, loadDesign() must succeed before mesh()" << endl;
+        return 1;
+    }
+    this->cellName = cellName.empty() ? this->adb.getCell(this->adb.getNumCell() - 1).getCellName() : cellName;
+    if (this->adb.locateCell(this->cellName) == this->adb.getNumCell())
+    {
+        cerr << "Cell " << this->cellName << " is not in the design" << endl;
+        return 1;
+    }
+
+    // Append information so far to fdtdMesh
+    unordered_set<double> portCoorx, portCoory;
+    this->adb.setNumCdtIn(0); // saveToMesh() counts the conductor rows on the database, so restart the count for each mesh
+    this->adb.saveToMesh(this->cellName, { 0., 0. }, strans(), sys, this->sdb.findLayerIgnore()); // Recursively save GDSII conductor information to sys
+    if (!this->sdb.convertToFDTDMesh(sys, this->adb.getNumCdtIn(), &portCoorx, &portCoory)) // Save simulation input information to sys
+    {
+        return 1;
+    }
+
+    // Mesh the domain and mark conductors
+    clock_t t2 = clock();
+    status = meshAndMark(sys, this->xi, this->yi, this->zi, &portCoorx, &portCoory);
+    if (status == 0)
+    {
+        cout << "meshAndMark Success!" << endl;
+        cout << "meshAndMark time is " << (clock() - t2) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
+    }
+    else
+    {
+        cerr << "meshAndMark Fail!" << endl;
+        return status;
+    }
+
+    // Set D_eps and D_sig
+    clock_t t3 = clock();
+    status = matrixConstruction(sys);
+    if (status == 0)
+    {
+        cout << "matrixConstruction Success!" << endl;
+        cout << "matrixConstruction time is " << (clock() - t3) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
+    }
+    else {
+        cerr << "matrixConstruction Fail!" << endl;
+        return status;
+    }
+
+    // Set port
+    clock_t t4 = clock();
+    status = portSet(sys, this->xi, this->yi, this->zi);
+    if (status == 0)
+    {
+        cout << "portSet Success!" << endl;
+        cout << "portSet time is " << (clock() - t4) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
+    }
+    else
+    {
+        cerr << "portSet Fail!" << endl;
+        return status;
+    }
+
+    // Generate Stiffness Matrix (only the direct solvers and the Vh reference need S assembled, the V0Vh solver applies it matrix-free)
+#if !defined(SKIP_GENERATE_STIFF) && (!defined(SKIP_LAYERED_FD) || !defined(SKIP_STIFF_REFERENCE) || !defined(SKIP_VH))
+    clock_t t5 = clock();
+    status = generateStiff(sys);
+    if (status == 0)
+    {
+        cout << "generateStiff Success!" << endl;
+        cout << "generateStiff time is " << (clock() - t5) * 1.0 / CLOCKS_PER_SEC << " s" << endl << endl;
+    }
+    else
+    {
+        cerr << "generateStiff Fail!" << endl;
+        return status;
+    }
+#endif
+    return 0;
+}
+
+// Drop the current mesh before its window, collective like meshShare::~meshShare()
+void parasiticExtractor::resetMesh()
+{
+    this->sys.reset();
+    this->share.reset();
+    this->xi.clear();
+    this->yi.clear();
+    this->zi.clear();
+}
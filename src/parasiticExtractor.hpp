@@ -0,0 +1,79 @@
+#ifndef GDS2PARA_PARASITIC_EXTRACTOR_H_
+#define GDS2PARA_PARASITIC_EXTRACTOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "limboint.hpp"
+#include "solnoutclass.hpp"
+#include "meshShare.hpp"
+
+// In-process parasitic extraction, the library form of the simulate (-s) mode
+/* One extractor keeps the parsed GDSII design and the simulation input, so a flow extracting many cells parses the
+design once and then repeats setStack() / setPorts() / mesh() / solve() per cell in the same process:
+    parasiticExtractor ex;
+    ex.loadDesign("chip.gds");
+    ex.loadSimInput("chip.sim_input");
+    for (const string &cell : cells) {
+        ex.setPorts(portsOf(cell));
+        if (ex.mesh(cell) == 0 && ex.solve() == 0) {
+            Parasitics Z;
+            ex.getParameters('Z', &Z);
+        }
+    }
+MPI must be initialized by the caller before the first call and finalized only after the extractor is destroyed. The
+extractor never calls MPI_Init() or MPI_Finalize(). loadDesign(), mesh(), solve() and the destructor are collective over
+MPI_COMM_WORLD. The design is parsed and meshed on world rank 0 only and shared with the other ranks as in meshShare,
+so every rank must make the same calls in the same order. All return codes and results agree on every rank. */
+class parasiticExtractor {
+public:
+    parasiticExtractor();
+    parasiticExtractor(const parasiticExtractor &) = delete;
+    parasiticExtractor &operator=(const parasiticExtractor &) = delete;
+    ~parasiticExtractor();
+
+    // Parse a GDSII file, replacing any design loaded before. Return false on every rank if it cannot be read
+    bool loadDesign(const std::string &gdsFile);
+
+    // Read stack, ports, frequencies and mesh policy from a sim_input file. Return false if it cannot be read
+    bool loadSimInput(const std::string &simFile);
+
+    // Replace parts of the simulation input, taking effect at the next mesh()
+    void setStack(const vector<Layer> &layers);
+    void setPorts(const vector<Port> &ports);
+    void setSourcePorts(const vector<std::string> &names);    // empty excites every port, a strict subset only supports 'Z' output
+    void setSimSettings(const SimSettings &settings);
+
+    // Mesh a cell of the design (top cell if empty) with the current simulation input. Return 0 if succeed
+    int mesh(const std::string &cellName = "");
+
+    // Solve the last mesh for the Z-parameters at every frequency. Return 0 if succeed
+    /* The solver consumes the mesh, so each solve() needs its own mesh() before it. */
+    int solve();
+
+    // Network parameters of the last solve(), 'Z' (impedance), 'Y' (admittance) or 'S' (scattering)
+    /* Return false if there is no solve() since the last mesh(), or if 'Y' or 'S' is asked after a SOURCE subset run,
+    whose incomplete Z-parameters cannot be inverted. */
+    bool getParameters(char param, Parasitics *para) const;
+
+    // Simulation input and results in the form the output writers (dumpXyce(), dumpSPEF(), ...) take
+    SolverDataBase getSolverData() const;
+
+    // Name of the cell meshed last
+    std::string getCellName() const;
+
+private:
+    int buildMesh(const std::string &cellName);
+    void resetMesh();
+
+    AsciiDataBase adb;                   // design, filled on world rank 0 only
+    SolverDataBase sdb;                  // simulation input and, after solve(), the Z-parameters
+    std::string cellName;
+    std::unique_ptr<meshShare> share;    // window of the current mesh, outlives sys
+    std::unique_ptr<fdtdMesh> sys;       // current mesh, NULL once solve() has used it
+    unordered_map<double, int> xi, yi, zi;
+    bool solved;
+};
+
+#endif
@@ -3,16 +3,22 @@
 
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <string>
 
 #include "fdtd.hpp"
 #include "matrixTypeDef.hpp"
 #include "mapIndex.hpp"
+#include "hodlrMatrix.hpp"
+#include "surfBlockStore.hpp"
 //#define DEBUG_SOLVE_REORDERED_S   // debug mode: directly solve the entire reordered S (growZ, rmPEC)
+//#define DENSE_VOLUME_ELIMINATION  // eliminate e_vol with dense D0s, D1s instead of the Schur complement from PARDISO
+//#define DENSE_SURFACE_CASCADE     // cascade surface blocks with dense LU and gemm only, no HODLR compression
+#define LAYER_MATCH_TOL (1e-12)     // relative difference up to which nnz values of 2 layers are taken as identical
 
 // Compute y = alpha * A * x + beta * y and store computed dense matrix in y
 int csrMultiplyDense(const sparse_matrix_t *csrA_mklHandle,     // mkl handle of csr A
-    myint N_rows_x, complex<double> *xval,     // x,y ~ dense matrix stored in continuous memory array 
+    myint N_rows_x, const complex<double> *xval,     // x,y ~ dense matrix stored in continuous memory array
     denseFormatOfMatrix *y) {
     /* see doc: https://software.intel.com/en-us/onemkl-developer-reference-c-mkl-sparse-mm
     Example:
@@ -25,50 +31,39 @@ int csrMultiplyDense(const sparse_matrix_t *csrA_mklHandle,     // mkl handle of
     struct matrix_descr descrA;             // Descriptor of main sparse matrix properties
     descrA.type = SPARSE_MATRIX_TYPE_GENERAL;
 
-    vector<MKL_Complex16> yval_mklComplex(y->matrixSize);
-    y->copyToMKL_Complex16(yval_mklComplex.data());
-    myint x_matrixSize = N_rows_x * y->N_rows;
-    vector<MKL_Complex16> xval_mklComplex(x_matrixSize);
-    for (myint ind = 0; ind < x_matrixSize; ind++) {
-        xval_mklComplex[ind].real = xval[ind].real();
-        xval_mklComplex[ind].imag = xval[ind].imag();
-    }
-
-    // Compute y = alpha * A * x + beta * y
+    // Compute y = alpha * A * x + beta * y, x and y are handed to MKL as they are (same layout as MKL_Complex16)
     sparse_status_t returnStatus = mkl_sparse_z_mm(SPARSE_OPERATION_NON_TRANSPOSE,
         alpha,                              // alpha = -1.0
         *csrA_mklHandle,                    // A
         descrA,
         SPARSE_LAYOUT_COLUMN_MAJOR,         // Describes the storage scheme for the dense matrix
-        xval_mklComplex.data(),
+        reinterpret_cast<const MKL_Complex16*>(xval),
         y->N_cols,
         N_rows_x,
         beta,                               // beta = 1.0
-        yval_mklComplex.data(),             // Pointer to the memory array used by the vector to store its owned elements
+        y->mklData(),                       // Pointer to the memory array used by the vector to store its owned elements
         y->N_rows);
     if (returnStatus != SPARSE_STATUS_SUCCESS) {
         cout << "ERROR! Return from mkl_sparse_z_mm is: " << returnStatus << endl;
         exit(2);
     }
 
-    y->copyFromMKL_Complex16(yval_mklComplex.data());
-
     return 0;
 }
 
-int eliminateVolumE(const vector<BlockType> &layerS, myint N_surfE, myint N_volE, denseFormatOfMatrix *preducedS) {
+int eliminateVolumE(csrFormatOfMatrix *layerS, myint N_surfE, myint N_volE, denseFormatOfMatrix *preducedS) {
     /* This function eliminates e_vol from whole S matrix (all layers coupled) and obtain the
     2*2 block matrix related only to e_surf at single layer.
 
     Inputs:
-        layerS: a vector containing 9 blocks of the whole matrix S, ~ within one layer
+        layerS: pointing to the 9 CSR blocks of the whole matrix S within one layer
         N_surfE: number of {e}_surface at one surface, e.g. 0s
         N_volE: number of {e}_volume at one layer, e.g. 0v
     Output:
         preducedS: pointing to memory of a vector storing 4 reduced dense blocks as {C11, C12, C21, C22}
 
     Each isolated layer here contains 2 surfaces and 1 middle volume e, namely 0s-0v-1s. 
-    A symbolic form is (each number represents the blockId in vector<BlockType>):
+    A symbolic form is (each number represents the blockId in layerS):
                 
                  0s  0v  1s                                    0s  1s
     layerS =   | 0   1   2 |    0s      ==>     reducedS =   | 0'  1'|    0s
@@ -89,59 +84,130 @@ int eliminateVolumE(const vector<BlockType> &layerS, myint N_surfE, myint N_volE
         Then the relation is: 
             C11 = B11 - B12*D0s,    C12 = B13 - B12*D1s
             C21 = B31 - B32*D0s,    C22 = B33 - B32*D1s
+
+    Which is the Schur complement of B22 in layerS. By default the 9 blocks are put back into one sparse
+    matrix and PARDISO factorizes only its volume part, returning {C11, C12, C21, C22} directly, so the
+    dense N_volE*(2*N_surfE) blocks [B21, B23] and [D0s, D1s] are never formed.
     */
-    
+
+#ifndef DENSE_VOLUME_ELIMINATION
+    if (N_volE == 0) {                                          // no volume {e}, nothing to eliminate
+        layerS[0].copyToDense(preducedS, 0);
+        layerS[2].copyToDense(preducedS + 1, 0);
+        layerS[6].copyToDense(preducedS + 2, 0);
+        layerS[8].copyToDense(preducedS + 3, 0);
+        return 0;
+    }
+
+    // Assemble the layer matrix in CSR, ordered as 0s-0v-1s. Blocks are row-sorted, so each row is the
+    // rows of the 3 blocks in this block row one after another
+    myint N_layerE = 2 * N_surfE + N_volE;
+    myint blockRowStart[4] = { 0, N_surfE, N_surfE + N_volE, N_layerE };    // also the col offsets of the 3 block cols
+    vector<myint> layerRows(N_layerE + 1, 0);
+    for (myint B_row = 0; B_row < 3; B_row++) {
+        for (myint row = 0; row < blockRowStart[B_row + 1] - blockRowStart[B_row]; row++) {
+            myint N_nnzRow = 0;
+            for (myint B_col = 0; B_col < 3; B_col++) {
+                const csrFormatOfMatrix &block = layerS[B_row * 3 + B_col];
+                N_nnzRow += block.rows[row + 1] - block.rows[row];
+            }
+            layerRows[blockRowStart[B_row] + row + 1] = N_nnzRow;
+        }
+    }
+    for (myint row = 0; row < N_layerE; row++) {
+        layerRows[row + 1] += layerRows[row];
+    }
+    vector<myint> layerCols(layerRows[N_layerE]);
+    vector<complex<double>> layerVals(layerRows[N_layerE]);
+    for (myint B_row = 0; B_row < 3; B_row++) {
+        for (myint row = 0; row < blockRowStart[B_row + 1] - blockRowStart[B_row]; row++) {
+            myint ind = layerRows[blockRowStart[B_row] + row];
+            for (myint B_col = 0; B_col < 3; B_col++) {
+                const csrFormatOfMatrix &block = layerS[B_row * 3 + B_col];
+                for (myint k = block.rows[row]; k < block.rows[row + 1]; k++) {
+                    layerCols[ind] = block.cols[k] + blockRowStart[B_col];
+                    layerVals[ind] = block.vals[k];
+                    ind++;
+                }
+            }
+        }
+    }
+
+    // Surface {e} (0s and 1s) are the rows kept in the Schur complement
+    vector<MKL_INT> perm(N_layerE, 0);
+    for (myint row = 0; row < N_surfE; row++) {
+        perm[row] = 1;
+        perm[blockRowStart[2] + row] = 1;
+    }
+
+    // Pardiso parameters, see https://software.intel.com/en-us/mkl-developer-reference-c-pardiso
+    MKL_INT maxfct = 1;
+    MKL_INT mnum = 1;
+    MKL_INT mtype = 13;                 /* Complex and nonsymmetric matrix */
+    MKL_INT phase = 12;                 /* Analysis and factorization of the volume part only */
+    MKL_INT nrhs = 1;
+    MKL_INT msglvl = 0;                 /* If msglvl=1, print statistical information */
+    MKL_INT error = 0;
+
+    void *pt[64];
+    myint iparm[64];
+    pardisoinit(pt, &mtype, iparm);
+    iparm[34] = 1;         /* 0-based indexing */
+    iparm[35] = 1;         /* Return the Schur complement on rows with perm = 1 as a dense row-major matrix in x */
+
+    myint N_schur = 2 * N_surfE;
+    vector<complex<double>> schurS(N_schur * N_schur);      // {C11, C12; C21, C22}, row-major
+    complex<double> ddum;               /* Complex<double> dummy */
+    pardiso(pt, &maxfct, &mnum, &mtype, &phase, &N_layerE, layerVals.data(), layerRows.data(), layerCols.data(),
+        perm.data(), &nrhs, iparm, &msglvl, &ddum, schurS.data(), &error);
+    if (error != 0) {
+        cerr << "\nERROR during PARDISO Schur complement: " << error << endl;
+        exit(2);
+    }
+
+    // Release internal memory
+    phase = -1;
+    pardiso(pt, &maxfct, &mnum, &mtype, &phase, &N_layerE, &ddum, layerRows.data(), layerCols.data(),
+        perm.data(), &nrhs, iparm, &msglvl, &ddum, &ddum, &error);
+
+    // Split the row-major Schur complement into the 4 column-major dense blocks
+    for (myint i_block = 0; i_block < 4; i_block++) {
+        myint rowShift = (i_block / 2) * N_surfE;
+        myint colShift = (i_block % 2) * N_surfE;
+        for (myint j_col = 0; j_col < N_surfE; j_col++) {
+            for (myint i_row = 0; i_row < N_surfE; i_row++) {
+                preducedS[i_block].vals[j_col * N_surfE + i_row] = schurS[(i_row + rowShift) * N_schur + j_col + colShift];
+            }
+        }
+    }
+    return 0;
+#else
     // Combine B21 and B23 in order to be sloved in one Pardiso run.
-    BlockType vB21B23(layerS[3]);
-    BlockType vB23_newColInd(layerS[5]);
-    for (auto &nnz : vB23_newColInd) {
-        nnz.col_ind += N_surfE;
-    }   // shift the col index of COO B23 in order to combine [B21, B23] correctly
-    move(vB23_newColInd.begin(), vB23_newColInd.end(), back_inserter(vB21B23));
     denseFormatOfMatrix denseB21B23(N_volE, 2 * N_surfE);       // combined dense [B21, B23]
-    denseB21B23.convertBlockTypeToDense(vB21B23);
-    vB21B23.clear();
+    layerS[3].copyToDense(&denseB21B23, 0);
+    layerS[5].copyToDense(&denseB21B23, N_surfE);               // shift the col index of B23 to combine [B21, B23]
 
     // Solve D0s = inv(B22)*B21, D1s = inv(B22)*B23 in Pardiso
-    csrFormatOfMatrix csrB22(N_volE, N_volE, layerS[4].size()); // CSR B22
-    csrB22.convertBlockTypeToCsr(layerS[4]);
     denseFormatOfMatrix denseD0sD1s = 
-        csrB22.backslashDense(denseB21B23);                     // combined dense [D0s, D1s]
+        layerS[4].backslashDense(denseB21B23);                  // combined dense [D0s, D1s]
     
     /*denseB21B23.writeToFile("blockB21B23.txt");
     denseD0sD1s.writeToFile("blockD.txt");*/
 
     //denseB21B23.~denseFormatOfMatrix();                         // free combined dense [B21, B23]
 
-    // Convert B12, B32 to mkl internal CSR matrix handles
-    sparse_matrix_t csrB12_mklHandle, csrB32_mklHandle;
-    csrFormatOfMatrix csrB12(N_surfE, N_volE, layerS[1].size());
-    csrB12.convertBlockTypeToCsr(layerS[1]);
-    vector<MKL_Complex16> csrB12vals_mklCompl(csrB12.N_nnz);
-    csrB12.copyToMKL_Complex16(csrB12vals_mklCompl.data());
-    mkl_sparse_z_create_csr(&csrB12_mklHandle, SPARSE_INDEX_BASE_ZERO, csrB12.N_rows, csrB12.N_cols,
-        csrB12.rows.data(), csrB12.rows.data() + 1, csrB12.cols.data(), csrB12vals_mklCompl.data());
-    csrFormatOfMatrix csrB32(N_surfE, N_volE, layerS[7].size());
-    csrB32.convertBlockTypeToCsr(layerS[7]);
-    vector<MKL_Complex16> csrB32vals_mklCompl(csrB32.N_nnz);
-    csrB32.copyToMKL_Complex16(csrB32vals_mklCompl.data());
-    mkl_sparse_z_create_csr(&csrB32_mklHandle, SPARSE_INDEX_BASE_ZERO, csrB32.N_rows, csrB32.N_cols,
-        csrB32.rows.data(), csrB32.rows.data() + 1, csrB32.cols.data(), csrB32vals_mklCompl.data());
-
     // Solve reducedS blocks C11 = B11 - B12*D0s, C12 = B13 - B12*D1s
-    preducedS->convertBlockTypeToDense(layerS[0]);              // dense B11 & dense C11
-    csrMultiplyDense(&csrB12_mklHandle, denseD0sD1s.N_rows, denseD0sD1s.vals.data(), preducedS);
+    layerS[0].copyToDense(preducedS, 0);                        // dense B11 & dense C11
+    csrMultiplyDense(layerS[1].mklHandle(), denseD0sD1s.N_rows, denseD0sD1s.vals.data(), preducedS);
     myint matrixSizeD0s = N_volE * N_surfE;
-    (preducedS + 1)->convertBlockTypeToDense(layerS[2]);        // dense B13 & dense C12
-    csrMultiplyDense(&csrB12_mklHandle, denseD0sD1s.N_rows, denseD0sD1s.vals.data() + matrixSizeD0s, preducedS + 1);
-    mkl_sparse_destroy(csrB12_mklHandle);                       // free mkl CSR B12 handle
+    layerS[2].copyToDense(preducedS + 1, 0);                    // dense B13 & dense C12
+    csrMultiplyDense(layerS[1].mklHandle(), denseD0sD1s.N_rows, denseD0sD1s.vals.data() + matrixSizeD0s, preducedS + 1);
 
     // Solve reducedS blocks C21 = B31 - B32*D0s, C22 = B33 - B32*D1s
-    (preducedS + 2)->convertBlockTypeToDense(layerS[6]);        // dense B31 & dense C21
-    csrMultiplyDense(&csrB32_mklHandle, denseD0sD1s.N_rows, denseD0sD1s.vals.data(), preducedS + 2);
-    (preducedS + 3)->convertBlockTypeToDense(layerS[8]);        // dense B33 & dense C22
-    csrMultiplyDense(&csrB32_mklHandle, denseD0sD1s.N_rows, denseD0sD1s.vals.data() + matrixSizeD0s, preducedS + 3);
-    mkl_sparse_destroy(csrB32_mklHandle);                       // free mkl CSR B32 handle
+    layerS[6].copyToDense(preducedS + 2, 0);                    // dense B31 & dense C21
+    csrMultiplyDense(layerS[7].mklHandle(), denseD0sD1s.N_rows, denseD0sD1s.vals.data(), preducedS + 2);
+    layerS[8].copyToDense(preducedS + 3, 0);                    // dense B33 & dense C22
+    csrMultiplyDense(layerS[7].mklHandle(), denseD0sD1s.N_rows, denseD0sD1s.vals.data() + matrixSizeD0s, preducedS + 3);
 
     /*preducedS->writeToFile("block_C0.txt");
     (preducedS + 1)->writeToFile("block_C1.txt");
@@ -150,6 +216,116 @@ int eliminateVolumE(const vector<BlockType> &layerS, myint N_surfE, myint N_volE
 
     //denseD0sD1s.~denseFormatOfMatrix();                         // free combined dense [D0s, D1s]
     return 0;
+#endif
+}
+
+// A dense surface block used as left operand of dot and backslash, through its HODLR compression when large
+class surfBlockOperator {
+public:
+    surfBlockOperator(const denseFormatOfMatrix &A) : A(A) {
+#ifndef DENSE_SURFACE_CASCADE
+        if (A.N_rows >= HODLR_MIN_SIZE && A.N_rows == A.N_cols) {
+            this->compressedA.reset(new hodlrFormatOfMatrix(A));
+        }
+#endif
+    }
+
+    // C -= A * B
+    void minusDot(const denseFormatOfMatrix &B, denseFormatOfMatrix *C) {
+        if (this->compressedA) {
+            this->compressedA->minusDot(B, C);
+        }
+        else {
+            C->minusDot(this->A, B);
+        }
+    }
+
+    // B = A \ B in place, the compressed A is factorized once for all calls
+    void backslashInPlace(denseFormatOfMatrix *B) {
+        if (this->compressedA) {
+            this->compressedA->backslashInPlace(B);
+        }
+        else {
+            this->A.backslashInPlace(B);
+        }
+    }
+
+private:
+    const denseFormatOfMatrix &A;
+    unique_ptr<hodlrFormatOfMatrix> compressedA;
+};
+
+// Cascade 2 adjacent layers (surfaces a-b and b-c) into the 4 blocks of surfaces a-c
+vector<denseFormatOfMatrix> cascadeTwoLayers(const vector<denseFormatOfMatrix> &thisLayer, const vector<denseFormatOfMatrix> &nextLayer) {
+    /* Cascade the middle surface ({e}_b) between 2 layers
+         For example:
+            |C11     C12          | {e}_a
+            |C21   C22+C11'   C12'| {e}_b       , where  4 Cij at thisLayer
+            |        C21'     C22'| {e}_c                4 Cij' at nextLayer
+            To cascade the middle surface {e}_b, the precedures are:
+                1) tempC22 = C22+C11'
+                2) tempD21 = tempC22\C21, tempD12 = tempC22\C12'
+                3) cascaded 4 blocks:
+                    cascaded C11 = C11 - C12*tempD21,  cascaded C12 = 0 - C12*tempD12
+                    cascaded C21 =  0 - C21'*tempD21,  cascaded C22 = C22' - C21'*tempD12
+    thisLayer and nextLayer may be the same layer (when squaring). */
+
+    denseFormatOfMatrix tempC22 = thisLayer[3].add(nextLayer[0]);
+    surfBlockOperator opC22(tempC22);                           // each operator is compressed once, used twice
+    denseFormatOfMatrix tempD21 = thisLayer[2];
+    opC22.backslashInPlace(&tempD21);
+    denseFormatOfMatrix tempD12 = nextLayer[1];
+    opC22.backslashInPlace(&tempD12);
+    surfBlockOperator opC12(thisLayer[1]);
+    surfBlockOperator opNextC21(nextLayer[2]);
+
+    // Each cascaded block is one fused C -= A*B on its start value
+    myint N_surfE = tempC22.N_rows;
+    vector<denseFormatOfMatrix> cascadedLayer;
+    cascadedLayer.reserve(4);
+    cascadedLayer.push_back(thisLayer[0]);
+    cascadedLayer.emplace_back(N_surfE, N_surfE);
+    cascadedLayer.emplace_back(N_surfE, N_surfE);
+    cascadedLayer.push_back(nextLayer[3]);
+    opC12.minusDot(tempD21, &cascadedLayer[0]);
+    opC12.minusDot(tempD12, &cascadedLayer[1]);
+    opNextC21.minusDot(tempD21, &cascadedLayer[2]);
+    opNextC21.minusDot(tempD12, &cascadedLayer[3]);
+    return cascadedLayer;
+}
+
+// Cascade layers firstLayer ~ lastLayer - 1 into the 4 blocks of surfaces firstLayer and lastLayer
+vector<denseFormatOfMatrix> cascadeLayerRange(const surfBlockStore &surfSurfBlocks, const vector<myint> &layerClass,
+    myint firstLayer, myint lastLayer) {
+    /* Layer i_layer has its 4 blocks at surfSurfBlocks.get(layerClass[i_layer]). A run of k identical layers is cascaded
+    by repeated squaring (L, L^2, L^4, ...), which takes about 2*log2(k) cascades instead of k - 1.
+    The blocks of the next run are prefetched while this run is cascaded. */
+    vector<denseFormatOfMatrix> cascadedLayers;                 // empty until the first run is cascaded
+    myint runStart = firstLayer;
+    while (runStart < lastLayer) {
+        myint runEnd = runStart + 1;
+        while (runEnd < lastLayer && layerClass[runEnd] == layerClass[runStart]) {
+            runEnd++;
+        }
+
+        vector<denseFormatOfMatrix> run;                        // L^k of this run
+        vector<denseFormatOfMatrix> power = surfSurfBlocks.get(layerClass[runStart]);
+        if (runEnd < lastLayer) {
+            surfSurfBlocks.prefetch(layerClass[runEnd]);
+        }
+        for (myint k = runEnd - runStart; k > 0; k >>= 1) {
+            if (k & 1) {
+                run = run.empty() ? power : cascadeTwoLayers(run, power);
+            }
+            if (k > 1) {
+                power = cascadeTwoLayers(power, power);
+            }
+        }
+
+        cascadedLayers = cascadedLayers.empty() ? move(run) : cascadeTwoLayers(cascadedLayers, run);
+        runStart = runEnd;
+    }
+    return cascadedLayers;
 }
 
 // Reconstruct blocks stored in portportBlocks (or surfSurfBlocks) to S matrix in 1-D dense format
@@ -170,54 +346,24 @@ denseFormatOfMatrix reconstructBlocksToDense(const vector<vector<denseFormatOfMa
     myint N_layers = portportBlocks.size();
     myint N_rows_S = N_rows_perBlock * (N_layers + 1);
     denseFormatOfMatrix cascadedS(N_rows_S, N_rows_S);
-    denseFormatOfMatrix tempD(N_rows_perBlock, N_rows_perBlock);
 
-    for (myint i_layer = 0; i_layer < N_layers; i_layer++) {
+    // Add a block to cascadedS at block row blockRow and block col blockCol
+    auto addBlockAt = [&](const denseFormatOfMatrix &block, myint blockRow, myint blockCol) {
         for (myint j_col = 0; j_col < N_rows_perBlock; j_col++) {
+            complex<double> *colInS = cascadedS.vals.data() + (j_col + blockCol * N_rows_perBlock) * N_rows_S + blockRow * N_rows_perBlock;
+            const complex<double> *colInBlock = block.vals.data() + j_col * N_rows_perBlock;
             for (myint i_row = 0; i_row < N_rows_perBlock; i_row++) {
-                myint ind_inBolck = j_col * N_rows_perBlock + i_row;
-
-                // Upper triangular blocks Di i+1
-                myint ind_inS_upperTri = (j_col + (i_layer+1) * N_rows_perBlock)* N_rows_S + i_row + i_layer * N_rows_perBlock;
-                cascadedS.vals[ind_inS_upperTri] = portportBlocks[i_layer][1].vals[ind_inBolck];
-                
-                // Lower triangular blocks Di i-1
-                myint ind_inS_lowerTri = (j_col + i_layer * N_rows_perBlock)* N_rows_S + i_row + (i_layer + 1) * N_rows_perBlock;
-                cascadedS.vals[ind_inS_lowerTri] = portportBlocks[i_layer][2].vals[ind_inBolck];
+                colInS[i_row] += colInBlock[i_row];
             }
         }
-    }
-
-    // First diagonal block
-    tempD = portportBlocks[0][0];
-    for (myint j_col = 0; j_col < N_rows_perBlock; j_col++) {
-        for (myint i_row = 0; i_row < N_rows_perBlock; i_row++) {
-            myint ind_inBolck = j_col * N_rows_perBlock + i_row;
-            myint ind_inS = j_col * N_rows_S + i_row;
-            cascadedS.vals[ind_inS] = tempD.vals[ind_inBolck];
-        }
-    }
+    };
 
-    // Last diagonal block
-    tempD = portportBlocks[N_layers - 1][3];
-    for (myint j_col = 0; j_col < N_rows_perBlock; j_col++) {
-        for (myint i_row = 0; i_row < N_rows_perBlock; i_row++) {
-            myint ind_inBolck = j_col * N_rows_perBlock + i_row;
-            myint ind_inS = (j_col + N_layers * N_rows_perBlock)* N_rows_S + i_row + N_layers * N_rows_perBlock;
-            cascadedS.vals[ind_inS] = tempD.vals[ind_inBolck];
-        }
-    }
-    
-    // The overlapped diagonal blocks (D22 and next D11')
-    for (myint i_layer = 1; i_layer < N_layers; i_layer++) {
-        tempD = portportBlocks[i_layer - 1][3].add(portportBlocks[i_layer][0]);
-        for (myint j_col = 0; j_col < N_rows_perBlock; j_col++) {
-            for (myint i_row = 0; i_row < N_rows_perBlock; i_row++) {
-                myint ind_inBolck = j_col * N_rows_perBlock + i_row;
-                myint ind_inS = (j_col + i_layer * N_rows_perBlock)* N_rows_S + i_row + i_layer * N_rows_perBlock;
-                cascadedS.vals[ind_inS] = tempD.vals[ind_inBolck];
-            }
-        }
+    // Each layer adds its 4 blocks, the overlapped diagonal blocks get D22 and next D11' summed in place
+    for (myint i_layer = 0; i_layer < N_layers; i_layer++) {
+        addBlockAt(portportBlocks[i_layer][0], i_layer, i_layer);
+        addBlockAt(portportBlocks[i_layer][1], i_layer, i_layer + 1);      // upper triangular blocks Di i+1
+        addBlockAt(portportBlocks[i_layer][2], i_layer + 1, i_layer);      // lower triangular blocks Di i-1
+        addBlockAt(portportBlocks[i_layer][3], i_layer + 1, i_layer + 1);
     }
     return cascadedS;
 }
@@ -239,7 +385,7 @@ vector<myint> findSurfLocationOfPort(fdtdMesh *psys) {
         returned surfLocationOfPort = { 0, 2 }      */
 
     vector<myint> surfLocationOfPort;
-    double dyErrorUpperBound = (psys->yn[1] - psys->yn[0]) * MINDISFRACY; // used to compare two equal y coordinates
+    double dyErrorUpperBound = (psys->yn[1] - psys->yn[0]) * psys->meshPolicy.minDisFracY; // used to compare two equal y coordinates
 
     for (myint sourcePort = 0; sourcePort < psys->numPorts; sourcePort++) {
         double y_thisPort = psys->portCoor[sourcePort].y1[0];
@@ -268,21 +414,211 @@ vector<myint> findSurfLocationOfPort(fdtdMesh *psys) {
     return surfLocationOfPort;
 }
 
-denseFormatOfMatrix cascadeMatrixS(fdtdMesh *psys, double omegaHz, const mapIndex &indexMap) {
-    /* This function cascades original S matrix in COO format to a dense matrix with only port surfaces left.
+// Blocks of S at every layer (growY, removed PEC), partitioned and converted to CSR once for all frequencies
+class layeredBlocksOfS {
+public:
+    myint N_surfE;                          // num of {e} at one surface, after removing PEC
+    myint N_volE;                           // num of {e} in the volume of one layer, after removing PEC
+    myint N_layers;
+    vector<csrFormatOfMatrix> csrBlocks;    // 8 * N_layers + 1 blocks of S, numbered as in mapIndex::mapBlockRowColToBlockInd()
+    vector<myint> layerClass;               // first layer with the same 9 blocks as each layer, at every frequency
+
+    // Partition ShSe/mu into blocks. Only the diagonal depends on frequency and is set by setFrequency()
+    layeredBlocksOfS(fdtdMesh *psys, const mapIndex &indexMap) {
+        /* Inputs:
+            - matrix ShSe/mu:
+                    (psys->SRowId, psys->SColId, psys->Sval) ~ COO format, index mode (growZ, removed PEC)
+                    psys->leng_S: number of nnz in ShSe/mu. Note that nnz at PEC has already been removed
+            - indexMap: contains maps between different index modes    */
+
+        // Num of {e} at each surface or each layer, index mode (growY, removed PEC)
+        this->N_surfE = indexMap.N_surfExEz_rmPEC;
+        this->N_volE = indexMap.N_volEy_rmPEC;
+        this->N_layers = psys->N_cell_y;
+        myint n_surfExEz = this->N_surfE;
+        myint n_layerE_growY = this->N_surfE + this->N_volE;
+        myint N_layers = this->N_layers;
+
+        // Determine the block id of each nnz element of S and store in corresponding block matrix
+        vector< BlockType > Blocks(8 * N_layers + 1);       // store all bolck matrices of S in a 2D vector
+        this->diagNnzs.assign(Blocks.size(), {});
+        for (myint i_nnz = 0; i_nnz < psys->leng_S; i_nnz++) {
+            // (rowId, colId, val) of this nnz element in ShSe/mu, index mode (growZ, removed PEC)
+            myint nnzS_rowId_rmPECz = psys->SRowId[i_nnz];
+            myint nnzS_colId_rmPECz = psys->SColId[i_nnz];
+
+            // Map row and col index from (growZ, removed PEC) to (growY, removed PEC)
+            myint nnzS_rowId = indexMap.eInd_map_rmPEC_z2y[nnzS_rowId_rmPECz];
+            myint nnzS_colId = indexMap.eInd_map_rmPEC_z2y[nnzS_colId_rmPECz];
+
+            // Determine which block this nnz is at
+            myint B_rowId = nnzS_rowId / n_layerE_growY * 2 + (nnzS_rowId % n_layerE_growY) / n_surfExEz;
+            myint B_colId = nnzS_colId / n_layerE_growY * 2 + (nnzS_colId % n_layerE_growY) / n_surfExEz;
+            myint BlockId = indexMap.mapBlockRowColToBlockInd(B_rowId, B_colId);
+
+            // Shift the start row index and col index to be 0 inside each block
+            myint nnzS_rowId_inBlock = nnzS_rowId - (B_rowId / 2) * n_layerE_growY - (B_rowId % 2) * n_surfExEz;
+            myint nnzS_colId_inBlock = nnzS_colId - (B_colId / 2) * n_layerE_growY - (B_colId % 2) * n_surfExEz;
+
+            // Store this nnz at corresponding block matrix
+            Blocks[BlockId].push_back({ nnzS_rowId_inBlock, nnzS_colId_inBlock, psys->Sval[i_nnz] });
+
+            // Diagonal nnz will get "-w^2*eps+iw*sig" added, its slot in the CSR block is found below
+            if (nnzS_rowId == nnzS_colId) {
+                this->diagNnzs[BlockId].push_back({ nnzS_rowId_inBlock, { 0.0, 0.0 }, psys->eps[nnzS_rowId_rmPECz], psys->sig[nnzS_rowId_rmPECz] });
+            }
+        }
+
+        // Convert each COO block to CSR once (counting sort by row, no global sort)
+        this->csrBlocks.reserve(Blocks.size());
+        for (myint BlockId = 0; BlockId < Blocks.size(); BlockId++) {
+            myint idInLayer = BlockId % 8;          // 0 ~ 8 as in eliminateVolumE(), block 8 is block 0 of next layer
+            myint N_blockRows = (idInLayer >= 3 && idInLayer <= 5) ? this->N_volE : this->N_surfE;
+            myint N_blockCols = (idInLayer % 3 == 1) ? this->N_volE : this->N_surfE;
+            this->csrBlocks.push_back(csrFormatOfMatrix(N_blockRows, N_blockCols, Blocks[BlockId]));
+            BlockType().swap(Blocks[BlockId]);      // free this COO block right away
+        }
+        Blocks.clear();
+
+        // Half the value of overlapped ns-ns blocks between adjcent two layers
+        /* The partitioned blocks no longer mean physical curl-curl opeartor, but mamatically, this is doable to
+        cascade block matrix S. Any partition works like C = aC' + bC''. C = C' + C' makes codeing easier.*/
+        for (myint nsns_BlockId = 8; nsns_BlockId < 8 * N_layers; nsns_BlockId += 8) {
+            this->csrBlocks[nsns_BlockId].multiplyScalarInPlace(0.5);
+            for (auto &diag : this->diagNnzs[nsns_BlockId]) {
+                diag.eps *= 0.5;
+                diag.sig *= 0.5;
+            }
+        }
+
+        // Locate each diagonal nnz in its CSR row and keep its frequency independent value ShSe/mu
+#pragma omp parallel for schedule(dynamic, 1)
+        for (myint BlockId = 0; BlockId < (myint)this->csrBlocks.size(); BlockId++) {
+            const csrFormatOfMatrix &block = this->csrBlocks[BlockId];
+            for (auto &diag : this->diagNnzs[BlockId]) {
+                myint row = diag.slot;
+                diag.slot = lower_bound(block.cols.begin() + block.rows[row], block.cols.begin() + block.rows[row + 1], row) - block.cols.begin();
+                diag.val = block.vals[diag.slot];
+            }
+            sort(this->diagNnzs[BlockId].begin(), this->diagNnzs[BlockId].end(),
+                [](const diagNnz &a, const diagNnz &b) { return a.slot < b.slot; });
+        }
+
+        this->findIdenticalLayers();
+    }
+
+    // Set the diagonal of all blocks to ShSe/mu - w^2*D_eps + iw*D_sig at this frequency
+    void setFrequency(double omegaHz) {
+#pragma omp parallel for schedule(dynamic, 1)
+        for (myint BlockId = 0; BlockId < (myint)this->csrBlocks.size(); BlockId++) {
+            csrFormatOfMatrix &block = this->csrBlocks[BlockId];
+            for (const auto &diag : this->diagNnzs[BlockId]) {
+                complex<double> epsi_sigma = { -omegaHz*omegaHz*diag.eps, omegaHz*diag.sig };
+                block.vals[diag.slot] = diag.val + epsi_sigma;
+            }
+            block.releaseMklHandle();           // values changed, the handle is rebuilt at next use
+        }
+    }
+
+private:
+    // Group the layers whose 9 blocks have the same pattern and values, so their eliminations are shared
+    void findIdenticalLayers() {
+        vector<size_t> patternHash(this->N_layers);
+#pragma omp parallel for schedule(dynamic, 1)
+        for (myint i_layer = 0; i_layer < this->N_layers; i_layer++) {
+            patternHash[i_layer] = this->hashLayerPattern(i_layer);
+        }
+
+        unordered_map<size_t, vector<myint>> classesOfPattern;    // hash of block patterns -> first layers of the classes with it
+        myint N_classes = 0;
+        this->layerClass.resize(this->N_layers);
+        for (myint i_layer = 0; i_layer < this->N_layers; i_layer++) {
+            vector<myint> &classes = classesOfPattern[patternHash[i_layer]];
+            this->layerClass[i_layer] = i_layer;
+            for (myint firstLayer : classes) {
+                if (this->sameLayer(firstLayer, i_layer)) {
+                    this->layerClass[i_layer] = firstLayer;
+                    break;
+                }
+            }
+            if (this->layerClass[i_layer] == i_layer) {
+                classes.push_back(i_layer);
+                N_classes++;
+            }
+        }
+        cout << "The " << this->N_layers << " layers of S have " << N_classes << " distinct blocks to eliminate" << endl;
+    }
+
+    // Hash of the sizes and CSR patterns of the 9 blocks of a layer
+    size_t hashLayerPattern(myint i_layer) const {
+        size_t seed = 0;
+        auto combine = [&seed](myint value) {
+            seed ^= hash<myint>()(value) + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+        };
+        for (myint BlockId = 8 * i_layer; BlockId <= 8 * i_layer + 8; BlockId++) {
+            const csrFormatOfMatrix &block = this->csrBlocks[BlockId];
+            combine(block.N_rows);
+            combine(block.N_nnz);
+            for (myint row : block.rows) {
+                combine(row);
+            }
+            for (myint col : block.cols) {
+                combine(col);
+            }
+        }
+        return seed;
+    }
+
+    // Whether 2 layers have the same 9 blocks, with values (ShSe/mu, D_eps and D_sig) equal up to LAYER_MATCH_TOL
+    bool sameLayer(myint i_layer, myint j_layer) const {
+        auto close = [](complex<double> a, complex<double> b) {
+            return abs(a - b) <= LAYER_MATCH_TOL * max(abs(a), abs(b));
+        };
+        for (myint i_block = 0; i_block <= 8; i_block++) {
+            const csrFormatOfMatrix &blockI = this->csrBlocks[8 * i_layer + i_block];
+            const csrFormatOfMatrix &blockJ = this->csrBlocks[8 * j_layer + i_block];
+            if (blockI.N_rows != blockJ.N_rows || blockI.N_cols != blockJ.N_cols || blockI.rows != blockJ.rows || blockI.cols != blockJ.cols) {
+                return false;
+            }
+            for (myint k = 0; k < blockI.N_nnz; k++) {
+                if (!close(blockI.vals[k], blockJ.vals[k])) {
+                    return false;
+                }
+            }
+
+            const vector<diagNnz> &diagI = this->diagNnzs[8 * i_layer + i_block];
+            const vector<diagNnz> &diagJ = this->diagNnzs[8 * j_layer + i_block];
+            if (diagI.size() != diagJ.size()) {
+                return false;
+            }
+            for (size_t k = 0; k < diagI.size(); k++) {
+                if (diagI[k].slot != diagJ[k].slot || !close(diagI[k].val, diagJ[k].val)
+                    || !close(diagI[k].eps, diagJ[k].eps) || !close(diagI[k].sig, diagJ[k].sig)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    struct diagNnz {
+        myint slot;                         // position in csrBlocks[BlockId].vals (row index inside block while building)
+        complex<double> val;                // ShSe/mu at this nnz
+        double eps;                         // D_eps and D_sig of this edge, halved with the overlapped ns-ns blocks
+        double sig;
+    };
+    vector<vector<diagNnz>> diagNnzs;       // diagonal nnzs of each block, only blocks on the diagonal of S have them
+};
+
+denseFormatOfMatrix cascadeMatrixS(fdtdMesh *psys, double omegaHz, const mapIndex &indexMap, layeredBlocksOfS &blocksS) {
+    /* This function cascades the blocks of S matrix to a dense matrix with only port surfaces left.
     Inputs:
         - omegaHz (w): objective angular frequency in unit Hz
-        - matrix ShSe/mu:
-                (psys->SRowId, psys->SColId, psys->Sval) ~ COO format, index mode (growZ, removed PEC)
-                psys->leng_S: number of nnz in ShSe/mu. Note that nnz at PEC has already been removed
         - indexMap: contains maps between different index modes
+        - blocksS: blocks of ShSe/mu built once by layeredBlocksOfS, their diagonal is overwritten for this frequency
     Return:
         - cascadedS: matrix "(-w^2*D_eps+iw*D_sig+ShSe/mu)" with only {e}_portSurf left    */
 
-    // Num of {e} at each surface or each layer, index mode (growY, removed PEC)
-    myint n_surfExEz            = indexMap.N_surfExEz_rmPEC;
-    myint n_volEy               = indexMap.N_volEy_rmPEC;
-    myint n_layerE_growY        = n_surfExEz + n_volEy;
     myint N_layers              = psys->N_cell_y;       // num of layers
 
 #ifdef DEBUG_SOLVE_REORDERED_S
@@ -300,15 +636,7 @@ denseFormatOfMatrix cascadeMatrixS(fdtdMesh *psys, double omegaHz, const mapInde
 
         // For diagonal nnz, add "-w^2*eps+iw*sig" to psys->Sval (ShSe/mu)
         if (nnzS_rowId == nnzS_colId) {     // if at diagonal
-            myint nnzS_rowId_growZ = psys->mapEdgeR[nnzS_rowId_rmPECz];
-            myint layerInd_alongZ = (nnzS_rowId_growZ + psys->N_edge_v) / (psys->N_edge_s + psys->N_edge_v);
-            double epsi_thisnnz = psys->stackEpsn[layerInd_alongZ] * EPSILON0;
-            double sigma_thisnnz = 0;
-            if (psys->markEdge[nnzS_rowId_growZ] != 0) {
-                sigma_thisnnz = SIGMA;
-            }   // if inside a conductor 
-
-            complex<double> epsi_sigma = { -omegaHz*omegaHz*epsi_thisnnz, omegaHz*sigma_thisnnz };
+            complex<double> epsi_sigma = { -omegaHz*omegaHz*psys->eps[nnzS_rowId_rmPECz], omegaHz*psys->sig[nnzS_rowId_rmPECz] };
             cascadedS_val += epsi_sigma;    // -w^2*D_eps+iw*D_sig+ShSe/mu
         }
         coo_reorderedS.push_back({ nnzS_rowId, nnzS_colId, cascadedS_val });
@@ -323,9 +651,7 @@ denseFormatOfMatrix cascadeMatrixS(fdtdMesh *psys, double omegaHz, const mapInde
     }
     file_obj.close();
 
-    //csrFormatOfMatrix csrS_reordered(indexMap.N_totEdges_rmPEC, indexMap.N_totEdges_rmPEC, psys->leng_S);
-    //sort(coo_reorderedS.begin(), coo_reorderedS.end(), ascendByRowIndThenByColInd);
-    //csrS_reordered.convertBlockTypeToCsr(coo_reorderedS);
+    //csrFormatOfMatrix csrS_reordered(indexMap.N_totEdges_rmPEC, indexMap.N_totEdges_rmPEC, coo_reorderedS);
     //return csrS_reordered;
     denseFormatOfMatrix denseS_reordered(indexMap.N_totEdges_rmPEC, indexMap.N_totEdges_rmPEC);
     denseS_reordered.convertBlockTypeToDense(coo_reorderedS);
@@ -333,181 +659,113 @@ denseFormatOfMatrix cascadeMatrixS(fdtdMesh *psys, double omegaHz, const mapInde
 
 #endif
 
-    // Determine the block id of each nnz element of S and store in corresponding block matrix
-    vector< BlockType > Blocks(8 * N_layers + 1);       // store all bolck matrices of S in a 2D vector
-    for (myint i_nnz = 0; i_nnz < psys->leng_S; i_nnz++) {
-        // (rowId, colId, val) of this nnz element in ShSe/mu, index mode (growZ, removed PEC)
-        myint nnzS_rowId_rmPECz = psys->SRowId[i_nnz];
-        myint nnzS_colId_rmPECz = psys->SColId[i_nnz];
-        complex<double> cascadedS_val = psys->Sval[i_nnz];
-
-        // Map row and col index from (growZ, removed PEC) to (growY, removed PEC)
-        myint nnzS_rowId = indexMap.eInd_map_rmPEC_z2y[nnzS_rowId_rmPECz];
-        myint nnzS_colId = indexMap.eInd_map_rmPEC_z2y[nnzS_colId_rmPECz];
-
-        // For diagonal nnz, add "-w^2*eps+iw*sig" to psys->Sval (ShSe/mu)
-        if (nnzS_rowId == nnzS_colId) {     // if at diagonal
-            myint nnzS_rowId_growZ = psys->mapEdgeR[nnzS_rowId_rmPECz];
-            myint layerInd_alongZ = (nnzS_rowId_growZ + psys->N_edge_v) / (psys->N_edge_s + psys->N_edge_v);
-            double epsi_thisnnz = psys->stackEpsn[layerInd_alongZ] * EPSILON0;
-            double sigma_thisnnz = 0;
-            if (psys->markEdge[nnzS_rowId_growZ] != 0) {
-                sigma_thisnnz = SIGMA;
-            }   // if inside a conductor 
-
-            complex<double> epsi_sigma = { -omegaHz*omegaHz*epsi_thisnnz, omegaHz*sigma_thisnnz };
-            cascadedS_val += epsi_sigma;    // -w^2*D_eps+iw*D_sig+ShSe/mu
-        }
-
-        // Determine which block this nnz is at
-        myint B_rowId = nnzS_rowId / n_layerE_growY * 2 + (nnzS_rowId % n_layerE_growY) / n_surfExEz;
-        myint B_colId = nnzS_colId / n_layerE_growY * 2 + (nnzS_colId % n_layerE_growY) / n_surfExEz;
-        myint BlockId = indexMap.mapBlockRowColToBlockInd(B_rowId, B_colId);
-
-        // Shift the start row index and col index to be 0 inside each block
-        myint nnzS_rowId_inBlock = nnzS_rowId - (B_rowId / 2) * n_layerE_growY - (B_rowId % 2) * n_surfExEz;
-        myint nnzS_colId_inBlock = nnzS_colId - (B_colId / 2) * n_layerE_growY - (B_colId % 2) * n_surfExEz;
-
-        // Store this nnz at corresponding block matrix
-        Blocks[BlockId].push_back({ nnzS_rowId_inBlock, nnzS_colId_inBlock, cascadedS_val });
-    }
-
-    //// Free original matrix S to save memory
-    //free(psys->SRowId);
-    //free(psys->SColId);
-    //free(psys->Sval);
+    // Put this frequency on the diagonal of the blocks of S
+    blocksS.setFrequency(omegaHz);
 
     /******************** Start Cascading Matrix S from Blocks ***************************/
-    // Tell the size of sparse block matrices after removing edges at PEC
-    myint N_surfE = indexMap.N_surfExEz_rmPEC;
-    myint N_volE = indexMap.N_volEy_rmPEC;
-
-    // Sort nnzs in each block matrix by row index first then by col index
-    /* The purpose is to allow easy convert from COO to CSR format*/
-    for (auto &block : Blocks) {
-        sort(block.begin(), block.end(), ascendByRowIndThenByColInd);
-    }
-
-    /*ofstream file_obj;
-    for (int i_block = 0; i_block < Blocks.size(); i_block++) {
-        string filename = "block_B" + to_string(i_block) + ".txt";
-        file_obj.open(filename, ios::out);
-        file_obj << "rowInd  colInd  val.real val.imag \n";
-        for (const auto &nnz : Blocks[i_block]) {
-            file_obj << nnz.row_ind << ' ' << nnz.col_ind << ' ' << nnz.val.real() << ' ' << nnz.val.imag() << endl;
-        }
-        file_obj.close();
-    }*/
-    
-
-    // Half the value of overlapped ns-ns blocks between adjcent two layers
-    /* The partitioned blocks no longer mean physical curl-curl opeartor, but mamatically, this is doable to
-    cascade block matrix S. Any partition works like C = aC' + bC''. C = C' + C' makes codeing easier.*/
-    for (myint nsns_BlockId = 8; nsns_BlockId < 8 * N_layers; nsns_BlockId += 8) {
-        for (auto &nnz : Blocks[nsns_BlockId]) {
-            nnz.val *= 0.5;
-        }
-    }
+    myint N_surfE = blocksS.N_surfE;
+    myint N_volE = blocksS.N_volE;
+    vector<csrFormatOfMatrix> &csrBlocks = blocksS.csrBlocks;
 
     // Eliminate e_volume at each layer and store 4 reduced dense blocks of each layer
-    vector<vector<denseFormatOfMatrix>> surfSurfBlocks(N_layers);   // N_layers*4 dense blocks
+    /* Layers are independent: layer i_layer only reads blocks 8 * i_layer ~ 8 * i_layer + 8, and the shared
+    block 8 * i_layer + 8 is only copied out by both layers. MKL runs sequentially inside each layer's thread.
+    A layer identical to an earlier one (layerClass) reuses its blocks and is not eliminated again. */
+    const vector<myint> &layerClass = blocksS.layerClass;
+    myint N_distinctLayers = 0;
     for (myint i_layer = 0; i_layer < N_layers; i_layer++) {
+        N_distinctLayers += (layerClass[i_layer] == i_layer);
+    }
+    surfBlockStore surfSurfBlocks(N_layers, N_surfE, N_distinctLayers);     // N_layers*4 dense blocks, only at layerClass[i_layer] == i_layer
+#pragma omp parallel for schedule(dynamic, 1)
+    for (myint i_layer = 0; i_layer < N_layers; i_layer++) {
+        if (layerClass[i_layer] != i_layer) {
+            continue;
+        }
+
         // Init and allocate memory for 4 dense blocks of each layer
-        surfSurfBlocks[i_layer].reserve(4);
+        vector<denseFormatOfMatrix> layerBlocks;
+        layerBlocks.reserve(4);
         for (myint i_block = 0; i_block < 4; i_block++) {           
-            surfSurfBlocks[i_layer].push_back(denseFormatOfMatrix(N_surfE, N_surfE));
+            layerBlocks.push_back(denseFormatOfMatrix(N_surfE, N_surfE));
         }
 
-        // From 9 blocks at this layer to 4, surfSurfBlocks[i_layer] = {C11, C12, C21, C22}
-        vector<BlockType> layerS(Blocks.begin() + 8 * i_layer, Blocks.begin() + 8 * i_layer + 9);
-        eliminateVolumE(layerS, N_surfE, N_volE, surfSurfBlocks[i_layer].data());
-        layerS.clear();
-    }
-    Blocks.clear();     // free blocks of original whole matrix S to save memory
+        // From 9 blocks at this layer to 4, layerBlocks = {C11, C12, C21, C22}
+        eliminateVolumE(csrBlocks.data() + 8 * i_layer, N_surfE, N_volE, layerBlocks.data());
+        surfSurfBlocks.put(i_layer, move(layerBlocks));
+    }   // csrBlocks are kept for the next frequency
 
     // Cascade surf-surf blocks and only keep layers where ports are
     vector<myint> surfLocationOfPort = findSurfLocationOfPort(psys);
-    
-    /* Each layer: surfSurfBlocks[i_layer] = {C11, C12, C21, C22} */
-
-    // Left -> first port: cascaded C22' = C22 - C21*inv(C11)*C12
-    for (myint i_layer = 0; i_layer < surfLocationOfPort.front(); i_layer++) {
-        surfSurfBlocks[i_layer][3] = surfSurfBlocks[i_layer][3].minus(
-            surfSurfBlocks[i_layer][2].dot(surfSurfBlocks[i_layer][0].backslash(surfSurfBlocks[i_layer][1])));
-
-        if (i_layer != N_layers) {  // if not reaching the right most layer
-            // Add cascaded C22' at this layer to C11 at next layer
-            surfSurfBlocks[i_layer + 1][0] = surfSurfBlocks[i_layer + 1][0].add(surfSurfBlocks[i_layer][3]);
+    myint N_ports = surfLocationOfPort.size();
+    myint firstPortSurf = surfLocationOfPort.front();
+    myint lastPortSurf = surfLocationOfPort.back();
+
+    /* Each layer: surfSurfBlocks.get(i_layer) = {C11, C12, C21, C22}
+    The layers left to the first port and right to the last port are cascaded into one 4-block layer each, whose
+    outer surfaces are then eliminated. They are independent and run at the same time:
+        Left -> first port: cascaded C22' = C22 - C21*inv(C11)*C12, added to C11 at the first port surface
+        Right -> last port: cascaded C11' = C11 - C12*inv(C22)*C21, added to C22 at the last port surface   */
+    vector<denseFormatOfMatrix> leftOfPorts, rightOfPorts;      // the cascaded C22' and C11', empty if no such layers
+#pragma omp parallel sections
+    {
+#pragma omp section
+        {
+            if (firstPortSurf > 0) {
+                vector<denseFormatOfMatrix> leftLayers = cascadeLayerRange(surfSurfBlocks, layerClass, 0, firstPortSurf);
+                surfBlockOperator(leftLayers[0]).backslashInPlace(&leftLayers[1]);
+                surfBlockOperator(leftLayers[2]).minusDot(leftLayers[1], &leftLayers[3]);
+                leftOfPorts.push_back(move(leftLayers[3]));
+            }
+        }
+#pragma omp section
+        {
+            if (lastPortSurf < N_layers) {
+                vector<denseFormatOfMatrix> rightLayers = cascadeLayerRange(surfSurfBlocks, layerClass, lastPortSurf, N_layers);
+                surfBlockOperator(rightLayers[3]).backslashInPlace(&rightLayers[2]);
+                surfBlockOperator(rightLayers[1]).minusDot(rightLayers[2], &rightLayers[0]);
+                rightOfPorts.push_back(move(rightLayers[0]));
+            }
         }
     }
 
-    // Right -> last port: cascaded C11' = C11 - C12*inv(C22)*C21
-    for (myint i_layer = N_layers-1; i_layer >= surfLocationOfPort.back(); i_layer--) {
-        surfSurfBlocks[i_layer][0] = surfSurfBlocks[i_layer][0].minus(
-            surfSurfBlocks[i_layer][1].dot(surfSurfBlocks[i_layer][3].backslash(surfSurfBlocks[i_layer][2])));
-
-        if (i_layer != 0) {         // if not reaching the left most layer
-            // Add cascaded C11' at this layer to C22 at previous layer
-            surfSurfBlocks[i_layer - 1][3] = surfSurfBlocks[i_layer - 1][3].add(surfSurfBlocks[i_layer][0]);
+    // When only one port, return the sum of both sides at its surface
+    if (N_ports == 1) {
+        if (leftOfPorts.empty()) {
+            return rightOfPorts[0];
         }
+        if (rightOfPorts.empty()) {
+            return leftOfPorts[0];
+        }
+        leftOfPorts[0].addInPlace(rightOfPorts[0]);
+        return leftOfPorts[0];
     }
 
     // Middle: 
-    /* For the middle, cascaded the middle surface ({e}_midLayer) between 2 layers
-         For example:
-            |C11     C12          | {e}_thisPortLayer
-            |C21   C22+C11'   C12'| {e}_midLayer       , where  4 Cij at thisPortLayer
-            |        C21'     C22'| {e}_midLayer+1              4 Cij' at the midLayer
-            To cascade the middle surface {e}_midLayer, the precedures are:
-                1) tempC22 = C22+C11'
-                2) tempD21 = tempC22\C21, tempD12 = tempC22\C12'
-                3) cascaded 4 blocks still store in Cij at thisPortLayer:
-                    cascaded C11 = C11 - C12*tempD21,  cascaded C12 = 0 - C12*tempD12
-                    cascaded C21 =  0 - C21'*tempD21,  cascaded C22 = C22' - C21'*tempD12
-      
-      Then, the cascaded 4 blocks for each port (index 0 <= i_port < N_ports-1, except last port) will be stored in corresponding layer.
+    /* The layers between 2 adjacent ports are cascaded into 4 blocks for each port (index 0 <= i_port < N_ports-1,
+    except last port):
             let: thisPortLayer = surfLocationOfPort[i_port];
                  nextPortLayer = surfLocationOfPort[i_port + 1];
-            i_port's 4 blocks are stored in:
-                 surfSurfBlocks[thisPortLayer] = {D11, D12, D21, D22}
-            next port's 4 blocks are stored in:
-                 surfSurfBlocks[nextPortLayer] = {D11', D12', D21', D22'}
+            i_port's 4 blocks are cascaded from layers thisPortLayer ~ nextPortLayer - 1:
+                 portportBlocks[i_port] = {D11, D12, D21, D22}
             To reconstruct cascaded S matrix, we need to organize above cascaded blocks as
                 |D11     D12          | {e}_thisPort
                 |D21   D22+D11'   D12'| {e}_nextPort
                 |        D21'     D22'| {e}_nextnextPort
-    */
-    denseFormatOfMatrix tempC22(N_surfE, N_surfE);              // tempC22 = C22+C11'
-    denseFormatOfMatrix tempD21(N_surfE, N_surfE);              // tempD21 = tempC22\C21
-    denseFormatOfMatrix tempD12(N_surfE, N_surfE);              // tempD12 = tempC22\C12'
-    for (myint i_port = 0; i_port < surfLocationOfPort.size() - 1; i_port++) {                  // all the intervals between ports
-        myint thisPortLayer = surfLocationOfPort[i_port];       // surface index and layer index of this port (i_port)
-        myint nextPortLayer = surfLocationOfPort[i_port + 1];   // surface index and layer index of next port
-        for (myint i_midLayer = thisPortLayer + 1; i_midLayer < nextPortLayer; i_midLayer++) {    // all middle layers between 2 ports
-            tempC22 = surfSurfBlocks[thisPortLayer][3].add(surfSurfBlocks[i_midLayer][0]);
-            tempD21 = tempC22.backslash(surfSurfBlocks[thisPortLayer][2]);
-            tempD12 = tempC22.backslash(surfSurfBlocks[i_midLayer][1]);
-            surfSurfBlocks[thisPortLayer][0] = surfSurfBlocks[thisPortLayer][0].minus(
-                surfSurfBlocks[thisPortLayer][1].dot(tempD21));
-            surfSurfBlocks[thisPortLayer][1] = surfSurfBlocks[thisPortLayer][1].dot(tempD12).multiplyScalar(-1.0);
-            surfSurfBlocks[thisPortLayer][2] = surfSurfBlocks[i_midLayer][2].dot(tempD21).multiplyScalar(-1.0);
-            surfSurfBlocks[thisPortLayer][3] = surfSurfBlocks[i_midLayer][3].minus(
-                surfSurfBlocks[i_midLayer][2].dot(tempD12));
-        }
+    Each interval only reads surfSurfBlocks, so all the intervals are cascaded in parallel. */
+    vector<vector<denseFormatOfMatrix>> portportBlocks(N_ports-1);   // (N_ports-1)*4 dense blocks
+#pragma omp parallel for schedule(dynamic, 1)
+    for (myint i_port = 0; i_port < N_ports - 1; i_port++) {           // all the intervals between ports
+        portportBlocks[i_port] = cascadeLayerRange(surfSurfBlocks, layerClass, surfLocationOfPort[i_port], surfLocationOfPort[i_port + 1]);
     }
-    
-    // Collect all cascaded blocks only related to port surfaces
-    myint N_ports = surfLocationOfPort.size();
-    if (N_ports == 1) {     // when only one port, return the block C11
-        myint thisPortLayer = surfLocationOfPort[0];
-        return surfSurfBlocks[thisPortLayer][0];
+
+    // Layers outside the ports only add to the first and last diagonal blocks
+    if (!leftOfPorts.empty()) {
+        portportBlocks.front()[0].addInPlace(leftOfPorts[0]);
     }
-    vector<vector<denseFormatOfMatrix>> portportBlocks(N_ports-1);   // (N_ports-1)*4 dense blocks
-    for (myint i_port = 0; i_port < N_ports - 1; i_port++) {
-        myint thisPortLayer = surfLocationOfPort[i_port];
-        portportBlocks[i_port] = surfSurfBlocks[thisPortLayer];
+    if (!rightOfPorts.empty()) {
+        portportBlocks.back()[3].addInPlace(rightOfPorts[0]);
     }
-    surfSurfBlocks.clear(); // free surf-surf blocks 
 
     return reconstructBlocksToDense(portportBlocks);
 }
@@ -530,9 +788,9 @@ vector<double> calAllFreqPointsHz(const fdtdMesh &sys) {
     return vFreqHz;
 }
 
-// Assign source current density (-iw{j}) for every port excitation, index mode (growY, removed PEC, cascaded)
+// Assign source current density (-iw{j}) for every source port excitation, index mode (growY, removed PEC, cascaded)
 denseFormatOfMatrix assignRhsJForAllPorts(fdtdMesh *psys, double omegaHz, const mapIndex &indexMap) {
-    /* -iw{j} for each port is stored continusly in denseFormatOfMatrix (col by col)
+    /* -iw{j} for each source port psys->sourcePorts[indSource] is stored continusly in denseFormatOfMatrix (col by col)
     
     - step 1: get psys->portCoor[sourcePort].portEdge[sourcePortSide][], which stored the global edge index under
               mode (growZ, no PEC removal) of all excitation current lines when excited at port index "sourcePort"
@@ -541,14 +799,16 @@ denseFormatOfMatrix assignRhsJForAllPorts(fdtdMesh *psys, double omegaHz, const
 
     // Map -iw{j} at at edges from (growZ, no PEC removal) to (growY, removed PEC)
     myint N_edgesNotAtPEC = indexMap.N_totEdges - indexMap.N_edgesAtPEC;                        // num of edges not at PEC
-    denseFormatOfMatrix RhsJ_SI(N_edgesNotAtPEC, psys->numPorts);                               // store -iw{j} of (growY, removed PEC)
-    for (myint sourcePort = 0; sourcePort < psys->numPorts; sourcePort++) {
+    myint N_source = psys->sourcePorts.size();                                                  // num of excitations (columns)
+    denseFormatOfMatrix RhsJ_SI(N_edgesNotAtPEC, N_source);                                     // store -iw{j} of (growY, removed PEC)
+    for (myint indSource = 0; indSource < N_source; indSource++) {
+        myint sourcePort = psys->sourcePorts[indSource];
         for (myint sourcePortSide = 0; sourcePortSide < psys->portCoor[sourcePort].multiplicity; sourcePortSide++) {
             for (myint inde = 0; inde < psys->portCoor[sourcePort].portEdge[sourcePortSide].size(); inde++) {
                 myint ind_j_growZ = psys->portCoor[sourcePort].portEdge[sourcePortSide][inde];  // j edge index (growZ, no PEC removal)
                 myint ind_j_growY = indexMap.eInd_map_z2y[ind_j_growZ];                         // -> (growY, no PEC removal)
                 myint ind_j_growYrmPEC = indexMap.eInd_map_y2rmPEC[ind_j_growY];                // -> (growY, removed PEC)
-                ind_j_growYrmPEC += sourcePort * N_edgesNotAtPEC;                               // index shifted by port number
+                ind_j_growYrmPEC += indSource * N_edgesNotAtPEC;                                // index shifted by excitation number
                 RhsJ_SI.vals[ind_j_growYrmPEC] = { 0.0, -1.0 * omegaHz * (psys->portCoor[sourcePort].portDirection[sourcePortSide]) };
             }
         }
@@ -562,18 +822,18 @@ denseFormatOfMatrix assignRhsJForAllPorts(fdtdMesh *psys, double omegaHz, const
     myint N_surfExEz = indexMap.N_surfExEz_rmPEC;                               // number of edges at one surface
     myint n_volEy = indexMap.N_volEy_rmPEC;                                     // number of volume edges in one layer
     myint N_allCascadedEdges = psys->numPorts * N_surfExEz;                     // number of all edges in kept surfaces
-    denseFormatOfMatrix cascadedRhsJ_SI(N_allCascadedEdges, psys->numPorts);    // -iw{j} only at port surfaces
+    denseFormatOfMatrix cascadedRhsJ_SI(N_allCascadedEdges, N_source);         // -iw{j} only at port surfaces
     vector<myint> surfLocationOfPort = findSurfLocationOfPort(psys);
-    for (myint excitedPort = 0; excitedPort < psys->numPorts; excitedPort++) {
+    for (myint indSource = 0; indSource < N_source; indSource++) {
         for (myint ind_thisPort = 0; ind_thisPort < psys->numPorts; ind_thisPort++) {           // for each kept port surface
             for (myint j_ind = 0; j_ind < N_surfExEz; j_ind++) {    // for all e at this surface, index starting from 0
                 // Cascaded index = indJ at this surface + shift by previous port surfaces + shift by previous port excitation
-                myint indJ_cascaded = j_ind + ind_thisPort * N_surfExEz + excitedPort * N_allCascadedEdges;
+                myint indJ_cascaded = j_ind + ind_thisPort * N_surfExEz + indSource * N_allCascadedEdges;
 
                 // For original noncascaded index
                 myint surfInd_thisPort = surfLocationOfPort[ind_thisPort];
                 myint shift_surfvol = surfInd_thisPort * (N_surfExEz + n_volEy);    // index shift from all surf-vol {e} before this surface
-                myint indJ_noncasc = j_ind + shift_surfvol + excitedPort * N_edgesNotAtPEC;
+                myint indJ_noncasc = j_ind + shift_surfvol + indSource * N_edgesNotAtPEC;
 
                 cascadedRhsJ_SI.vals[indJ_cascaded] = RhsJ_SI.vals[indJ_noncasc];
             }   
@@ -584,11 +844,11 @@ denseFormatOfMatrix assignRhsJForAllPorts(fdtdMesh *psys, double omegaHz, const
 }
 
 // Reconstruct {e} (growZ, removed PEC) from {e} at index mode (growY, removed PEC, cascaded)
-denseFormatOfMatrix reconstruct_e(fdtdMesh *psys, const mapIndex &indexMap, const denseFormatOfMatrix &cascadedeField_SI, double excitedPort) {
+denseFormatOfMatrix reconstruct_e(fdtdMesh *psys, const mapIndex &indexMap, const denseFormatOfMatrix &cascadedeField_SI, myint indSource) {
     /*  Inputs:
             - indexMap: contains maps between different index modes
-            - cascadedeField_SI: of size N_allCascadedEdges * psys->numPorts, mode (growY, removed PEC, cascaded)
-            - excitedPort: excited port index
+            - cascadedeField_SI: of size N_allCascadedEdges * psys->sourcePorts.size(), mode (growY, removed PEC, cascaded)
+            - indSource: excitation index, the excited port is psys->sourcePorts[indSource]
         Return:
             - eField_oneExcit: of size (psys->N_edge - psys->bden) * 1, mode (growZ, removed PEC)    */
 
@@ -598,12 +858,12 @@ denseFormatOfMatrix reconstruct_e(fdtdMesh *psys, const mapIndex &indexMap, cons
     myint N_edgesNotAtPEC = psys->N_edge - psys->bden;                          // num of all edges after removing PEC
     vector<myint> surfLocationOfPort = findSurfLocationOfPort(psys);            // surf index of the port's location
 
-    // Reconstruct {e} solution when excited at port index "excitedPort"
+    // Reconstruct {e} solution when excited at port index psys->sourcePorts[indSource]
     denseFormatOfMatrix eField_oneExcit(N_edgesNotAtPEC, 1);
     for (myint ind_thisPort = 0; ind_thisPort < psys->numPorts; ind_thisPort++) {           // for each kept port surface
         for (myint e_ind = 0; e_ind < N_surfExEz; e_ind++) {    // for all e at this surface, index starting from 0
             // Cascaded index = e_ind at this surface + shift by previous port surfaces + shift by previous port excitation
-            myint eInd_cascaded = e_ind + ind_thisPort * N_surfExEz + excitedPort * N_allCascadedEdges;
+            myint eInd_cascaded = e_ind + ind_thisPort * N_surfExEz + indSource * N_allCascadedEdges;
 
             // For original noncascaded index, mode (growZ, removed PEC)
             myint surfInd_thisPort = surfLocationOfPort[ind_thisPort];
@@ -619,7 +879,7 @@ denseFormatOfMatrix reconstruct_e(fdtdMesh *psys, const mapIndex &indexMap, cons
 
 #ifdef DEBUG_SOLVE_REORDERED_S
     for (myint e_ind = 0; e_ind < N_allCascadedEdges; e_ind++) {
-        myint eInd_cascaded = e_ind + excitedPort * N_allCascadedEdges;
+        myint eInd_cascaded = e_ind + indSource * N_allCascadedEdges;
 
         myint eInd_growY = indexMap.eInd_map_rmPEC2y[e_ind];                // Step 1: -> index at (growY, no PEC removal)
         myint eInd_growZ = indexMap.eInd_map_y2z[eInd_growY];               // Step 2: map (growY, no PEC removal) to (growZ, no PEC removal)
@@ -645,21 +905,24 @@ int solveE_Zpara_layered(fdtdMesh *psys) {
     indexMap.setEdgeMap_growYremovePEC(psys->ubde, psys->lbde, psys->bden);
     indexMap.setEdgeMap_rmPEC_growZgrowY(psys->mapEdgeR);
 
+    // Partition S into layer blocks once, only their diagonal changes with frequency
+    layeredBlocksOfS blocksS(psys, indexMap);
+
     vector<double> vFreqHz = calAllFreqPointsHz(*psys);
     for (int indFreq = 0; indFreq < vFreqHz.size(); indFreq++) {    // for each computed freq point
         double omegaHz = 2.0 * M_PI * vFreqHz[indFreq];
 
         // Cascaded system matrix (-w^2*D_eps+iw*D_sig+ShSe/mu)
-        denseFormatOfMatrix cascadedS = cascadeMatrixS(psys, omegaHz, indexMap);
+        denseFormatOfMatrix cascadedS = cascadeMatrixS(psys, omegaHz, indexMap, blocksS);
 
-        // Cascaded -iwJ and {e}. All excitations at each port are solved together
-        denseFormatOfMatrix cascadedRhsJ_SI = assignRhsJForAllPorts(psys, omegaHz, indexMap);   // -iw{j} in unit (A * m^-2 / s)
-        denseFormatOfMatrix cascadedeField_SI = cascadedS.backslash(cascadedRhsJ_SI);           // {e} in unit (V/m)
+        // Cascaded -iwJ and {e}. The excitations at all source ports are solved together
+        denseFormatOfMatrix cascadedeField_SI = assignRhsJForAllPorts(psys, omegaHz, indexMap); // -iw{j} in unit (A * m^-2 / s)
+        cascadedS.backslashInPlace(&cascadedeField_SI);                                         // -> {e} in unit (V/m)
 
-        // For each port excitation, reconstruct {e} and solve Z-parameters
-        for (myint excitedPort = 0; excitedPort < psys->numPorts; excitedPort++) {
-            denseFormatOfMatrix eField_oneExcit = reconstruct_e(psys, indexMap, cascadedeField_SI, excitedPort);
-            psys->Construct_Z_V0_Vh(eField_oneExcit.vals.data(), indFreq, excitedPort);
+        // For each source port excitation, reconstruct {e} and solve Z-parameters at all ports
+        for (myint indSource = 0; indSource < psys->sourcePorts.size(); indSource++) {
+            denseFormatOfMatrix eField_oneExcit = reconstruct_e(psys, indexMap, cascadedeField_SI, indSource);
+            psys->Construct_Z_V0_Vh(eField_oneExcit.vals.data(), indFreq, psys->sourcePorts[indSource]);
         }
     }
 
@@ -0,0 +1,41 @@
+#ifndef GDS2PARA_SCRATCH_ARENA_H_
+#define GDS2PARA_SCRATCH_ARENA_H_
+
+#include "fdtd.hpp"
+
+// Named work buffers of one worker, sized on first use and reused by every later port and frequency
+/* A buffer only grows, so after the first iteration no temporary is allocated, page-faulted or returned to the heap
+again. Buffers stay valid until the same name is asked for again or the arena is destroyed, so temporaries whose
+lifetimes do not overlap can share one name and one allocation. One arena must not be shared by threads running at the
+same time. */
+class scratchArena {
+public:
+    scratchArena() {}
+    scratchArena(const scratchArena &) = delete;
+    scratchArena &operator=(const scratchArena &) = delete;
+
+    // Buffer of n T's with unspecified contents, for outputs that are fully overwritten
+    template <typename T>
+    T *buffer(const string &name, size_t n) {
+        vector<complex<double>> &storage = this->buffers[name];
+        size_t N_units = (n * sizeof(T) + sizeof(complex<double>) - 1) / sizeof(complex<double>);  // 16-byte units keep any T aligned
+        if (storage.size() < N_units) {
+            vector<complex<double>>().swap(storage);
+            storage.resize(N_units);
+        }
+        return reinterpret_cast<T*>(storage.data());
+    }
+
+    // Buffer of n T's set to zero, in place of calloc
+    template <typename T>
+    T *zeros(const string &name, size_t n) {
+        T *data = this->buffer<T>(name, n);
+        memset((void*)data, 0, n * sizeof(T));
+        return data;
+    }
+
+private:
+    unordered_map<string, vector<complex<double>>> buffers;
+};
+
+#endif
@@ -418,6 +418,8 @@ class SimSettings
     double freqScale;      // Frequency scaling (0. for logarithmic [preferred], 1. for linear, otherwise undefined)
     size_t nFreq;          // Number of frequencies in simulation
     vector<double> freqs;  // List of frequencies (linear or logarithmic [preferred] spacing)
+    fdtdMeshPolicy meshPolicy; // Mesh-density policy (defaults unless MESH block given)
+    vector<std::string> sourcePorts; // Names of the ports to excite (all ports unless SOURCE block given)
   public:
     // Default constructor
     SimSettings()
@@ -428,6 +430,8 @@ class SimSettings
         this->freqScale = 0.;
         this->nFreq = 0;
         this->freqs = {};
+        this->meshPolicy = fdtdMeshPolicy();
+        this->sourcePorts = {};
     }
 
     // Parametrized constructor
@@ -512,6 +516,18 @@ class SimSettings
         return propFreqs;
     }
 
+    // Get mesh-density policy
+    fdtdMeshPolicy getMeshPolicy() const
+    {
+        return this->meshPolicy;
+    }
+
+    // Get names of the ports to excite (empty for all ports)
+    vector<std::string> getSourcePorts() const
+    {
+        return this->sourcePorts;
+    }
+
     // Set length unit (m)
     void setLengthUnit(double lengthUnit)
     {
@@ -567,6 +583,19 @@ class SimSettings
         this->nFreq = freqs.size();
     }
 
+    // Set mesh-density policy
+    void setMeshPolicy(fdtdMeshPolicy meshPolicy)
+    {
+        this->meshPolicy = meshPolicy;
+    }
+
+    // Set names of the ports to excite (empty for all ports)
+    // A strict subset leaves the Z-parameter columns of the other ports at zero, so only Z-parameter output is supported
+    void setSourcePorts(vector<std::string> sourcePorts)
+    {
+        this->sourcePorts = sourcePorts;
+    }
+
     // Print the simulation settings
     void print() const
     {
@@ -589,6 +618,20 @@ class SimSettings
                 indi++;
             }
         }
+        (this->meshPolicy).print();
+        if ((this->sourcePorts).empty())
+        {
+            cout << "  Every port is excited" << endl;
+        }
+        else
+        {
+            cout << "  Ports excited (" << (this->sourcePorts).size() << "):";
+            for (size_t indi = 0; indi < (this->sourcePorts).size(); indi++)
+            {
+                cout << " " << (this->sourcePorts)[indi];
+            }
+            cout << endl;
+        }
     }
 
     // Destructor
@@ -1044,6 +1087,7 @@ class Parasitics
     vector<double> freqs;    // List of frequencies for network parameter matrix states (Hz)
     char param;              // Interpretation of network parameters
     vector<cdMat> matParam;  // Network parameter matrix at each frequency
+    bool allExcited;         // Whether every port was excited, so the network parameter matrix is complete and invertible
   public:
     // Default constructor
     Parasitics()
@@ -1056,6 +1100,7 @@ class Parasitics
         this->freqs = vector<double>();
         this->param = 'S'; // Default to S-parameters
         this->matParam = vector<cdMat>();
+        this->allExcited = true;
     }
 
     // Parametrized constructor for nodal admittance matrices (circuit construction)
@@ -1068,6 +1113,7 @@ class Parasitics
         this->freqs = freqs;
         this->param = 'Y';
         this->matParam = vector<cdMat>();
+        this->allExcited = true;
     }
 
     // Parametrized constructor for network parameters (port interactions)
@@ -1092,6 +1138,7 @@ class Parasitics
             cerr << "Number of frequencies (" << freqs.size() << ") and number of network parameter matrix states (" << matParam.size() << ") do not match. Taking no action." << endl;
         }
         this->matParam = matParam;
+        this->allExcited = true;
     }
 
     // Get number of ports
@@ -1137,6 +1184,12 @@ class Parasitics
         return this->matParam;
     }
 
+    // Get whether every port was excited (false after a SOURCE block subset, leaving only the Z-parameters usable)
+    bool isAllExcited() const
+    {
+        return this->allExcited;
+    }
+
     // Set vector of port information
     void setPorts(vector<Port> ports)
     {
@@ -1181,6 +1234,12 @@ class Parasitics
         }
     }
 
+    // Set whether every port was excited
+    void setAllExcited(bool allExcited)
+    {
+        this->allExcited = allExcited;
+    }
+
     // Set network parameter matrix
     void setParamMatrix(vector<cdMat> matParam)
     {
@@ -1448,13 +1507,27 @@ class Parasitics
         this->setFreqs(freqs);
 
         // Generate nodal admittance matrices
-        this->computeYBusFromParam(0); // Draw circuit based on the lowest frequency present
+        if (this->allExcited)
+        {
+            this->computeYBusFromParam(0); // Draw circuit based on the lowest frequency present
+        }
+        else
+        {
+            cout << "Notice: Only the SOURCE ports were excited, so no circuit is drawn from the incomplete " << param << "-parameters." << endl;
+        }
     }
 
     // Convert existing network parameters to different type
     // ('S' = scattering, 'Y' = admittance, 'Z' = impedance)
     void convertParam(char newParam)
     {
+        // Every conversion inverts a matrix, which the columns left at zero by a SOURCE block subset make singular
+        if (!this->allExcited && (newParam != this->param))
+        {
+            cerr << "Only the SOURCE ports were excited, so the " << this->param << "-parameters cannot be converted to " << newParam << "-parameters. Taking no action." << endl;
+            return;
+        }
+
         // Orignally had admittance parameters
         if (this->param == 'Y')
         {
@@ -1679,6 +1752,12 @@ class Parasitics
     // Compute nodal admittance matrices from network parameters at a certain frequency
     void computeYBusFromParam(size_t indFreq)
     {
+        if (!this->allExcited)
+        {
+            cerr << "Only the SOURCE ports were excited, so the nodal admittance matrices cannot be found from the " << this->param << "-parameters. Taking no action." << endl;
+            return;
+        }
+
         // Need to get Y-parameters temporarily
         const int nPorts = (const int)this->getNPort();
         cdMat matY;
@@ -2094,6 +2173,13 @@ class Parasitics
         std::string time(timeStr);                                                    // Formatted time to string parametrized constructor
         size_t numPort = this->getNPort();                                            // Number of ports
 
+        // The circuit elements need the complete network parameters
+        if (!this->allExcited)
+        {
+            cerr << "Only the SOURCE ports were excited, so no Xyce subcircuit can be written. Excite every port or write Z-parameters instead." << endl;
+            return false;
+        }
+
         // Attempt to open file
         ofstream xyceFile(outXyceFile.c_str());
         if (xyceFile.is_open())
@@ -5868,6 +5954,101 @@ struct SolverDataBase
                     // Propagate port list to parasitics data structure now
                     this->para = Parasitics(ports, dMat(numPort, numPort), dMat(numPort, numPort), (this->settings).getFreqsHertz());
                 }
+                // Handle optional mesh-density policy
+                else if (fileLine.compare(0, 4, "MESH") == 0)
+                {
+                    // Move down one line, skipping comments
+                    getline(inputFile, fileLine);
+                    while ((fileLine.compare(0, 1, "#") == 0) && !(inputFile.eof()))
+                    {
+                        getline(inputFile, fileLine);
+                    }
+
+                    // Read each "name = value" line until the block ends, keeping defaults for names not given
+                    fdtdMeshPolicy policy = (this->settings).getMeshPolicy();
+                    while (fileLine.length() >= 3)
+                    {
+                        std::string policyLine = fileLine.substr(0, fileLine.find(" #")); // Drop in-line comment
+                        size_t indEqual = policyLine.find('=');
+                        std::string policyName = policyLine.substr(0, indEqual);
+                        std::string policyText = (indEqual < string::npos) ? policyLine.substr(indEqual + 1) : "";
+                        policyName.erase(policyName.find_last_not_of(" \t\r") + 1);
+                        policyName.erase(0, policyName.find_first_not_of(" \t"));
+                        double policyValue;
+                        size_t indValueEnd = 0; // Characters of policyText used by stod()
+                        try
+                        {
+                            policyValue = stod(policyText, &indValueEnd);
+                        }
+                        catch (const std::exception &)
+                        {
+                            indValueEnd = string::npos; // No number where the value should be
+                        }
+                        if (indEqual == string::npos || policyName.empty() || indValueEnd == string::npos || policyText.find_first_not_of(" \t\r", indValueEnd) < string::npos)
+                        {
+                            cerr << "Mesh policy line \"" << fileLine << "\" must be \"name = value\" with a numeric value" << endl;
+                            inputFile.close();
+                            return false;
+                        }
+                        int policyStatus = policy.setByName(policyName, policyValue);
+                        if (policyStatus == 1)
+                        {
+                            cerr << "Unknown mesh policy setting \"" << policyName << "\" is ignored." << endl;
+                        }
+                        else if (policyStatus != 0)
+                        {
+                            inputFile.close();
+                            return false;
+                        }
+                        if (inputFile.eof())
+                        {
+                            break;
+                        }
+
+                        // Move down one line in mesh block, skipping comments
+                        getline(inputFile, fileLine);
+                        while ((fileLine.compare(0, 1, "#") == 0) && !(inputFile.eof()))
+                        {
+                            getline(inputFile, fileLine);
+                        }
+                    }
+                    (this->settings).setMeshPolicy(policy);
+                }
+                // Handle optional list of excited ports
+                else if (fileLine.compare(0, 6, "SOURCE") == 0)
+                {
+                    // Move down one line, skipping comments
+                    getline(inputFile, fileLine);
+                    while ((fileLine.compare(0, 1, "#") == 0) && !(inputFile.eof()))
+                    {
+                        getline(inputFile, fileLine);
+                    }
+
+                    // Read one port name per line until the block ends
+                    vector<std::string> sourcePorts;
+                    while (true)
+                    {
+                        std::string portName = fileLine.substr(0, fileLine.find(" #")); // Drop in-line comment
+                        size_t indStart = portName.find_first_not_of(" \t\r");
+                        if (indStart == string::npos)
+                        {
+                            break; // Blank line ends the block
+                        }
+                        sourcePorts.push_back(portName.substr(indStart, portName.find_last_not_of(" \t\r") - indStart + 1));
+                        if (inputFile.eof())
+                        {
+                            break;
+                        }
+
+                        // Move down one line in source block, skipping comments
+                        getline(inputFile, fileLine);
+                        while ((fileLine.compare(0, 1, "#") == 0) && !(inputFile.eof()))
+                        {
+                            getline(inputFile, fileLine);
+                        }
+                    }
+                    (this->settings).setSourcePorts(sourcePorts);
+                }
 
                 // Keep reading new lines in file
                 getline(inputFile, fileLine);
@@ -5875,6 +6056,12 @@ struct SolverDataBase
 
             // Close file
             inputFile.close();
+
+            // A misspelled source port would silently change which ports are excited
+            if (!this->checkSourcePorts())
+            {
+                return false;
+            }
             return true;
         }
         else
@@ -5884,8 +6071,40 @@ struct SolverDataBase
         }
     }
 
+    // Check that every source port is in the port list
+    bool checkSourcePorts() const
+    {
+        vector<std::string> sourceNames = (this->settings).getSourcePorts();
+        for (size_t indi = 0; indi < sourceNames.size(); indi++)
+        {
+            if ((this->para).locatePortName(sourceNames[indi]) == (this->para).getNPort())
+            {
+                cerr << "Source port \"" << sourceNames[indi] << "\" in the SOURCE block is not in the port list" << endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Check whether every port is excited (no SOURCE block, or one naming every port)
+    bool excitesAllPorts() const
+    {
+        vector<std::string> sourceNames = (this->settings).getSourcePorts();
+        vector<bool> isSource((this->para).getNPort(), sourceNames.empty());
+        for (size_t indi = 0; indi < sourceNames.size(); indi++)
+        {
+            size_t indPort = (this->para).locatePortName(sourceNames[indi]);
+            if (indPort < isSource.size())
+            {
+                isSource[indPort] = true;
+            }
+        }
+        return (find(isSource.begin(), isSource.end(), false) == isSource.end());
+    }
+
     // Convert to fdtdMesh
-    void convertToFDTDMesh(fdtdMesh *data, int numCdtRow, unordered_set<double> *portCoorx, unordered_set<double> *portCoory)
+    /* Return false if a source port is not in the port list. */
+    bool convertToFDTDMesh(fdtdMesh *data, int numCdtRow, unordered_set<double> *portCoorx, unordered_set<double> *portCoory)
     {
         // Use the sole argument
         data->numCdtRow = numCdtRow;
@@ -5903,6 +6122,7 @@ struct SolverDataBase
         data->ylim2 = (this->settings).getLimits()[3];
         data->zlim1 = (this->settings).getLimits()[4];
         data->zlim2 = (this->settings).getLimits()[5];
+        data->meshPolicy = (this->settings).getMeshPolicy();
 
         // Use layer stack-up information to set fields
         vector<Layer> physicalLayers = this->getValidLayers(); // Work with only physically valid layers
@@ -5975,6 +6195,27 @@ struct SolverDataBase
                 portCoory->insert(thisPort.getCoord()[1]);
             }
         }
+
+        // Excite only the ports named in the SOURCE block, or every port without one
+        if (!this->checkSourcePorts())
+        {
+            return false;
+        }
+        vector<std::string> sourceNames = (this->settings).getSourcePorts();
+        vector<bool> isSource(data->numPorts, sourceNames.empty());
+        for (size_t indi = 0; indi < sourceNames.size(); indi++)
+        {
+            isSource[(this->para).locatePortName(sourceNames[indi])] = true;
+        }
+        data->sourcePorts.clear();
+        for (size_t indi = 0; indi < data->numPorts; indi++)
+        {
+            if (isSource[indi])
+            {
+                data->sourcePorts.push_back(indi);
+            }
+        }
+        return true;
     }
 
     // Print the solver database
@@ -6001,6 +6242,13 @@ struct SolverDataBase
     // Dump the solver database to SPEF file
     bool dumpSPEF()
     {
+        // The circuit elements need the complete network parameters
+        if (!(this->para).isAllExcited())
+        {
+            cerr << "Only the SOURCE ports were excited, so no SPEF file can be written. Excite every port or write Z-parameters instead." << endl;
+            return false;
+        }
+
         // Attempt to open output file
         ofstream spefFile((this->outSPEF).c_str());
 
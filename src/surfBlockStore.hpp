@@ -0,0 +1,159 @@
+#ifndef GDS2PARA_SURF_BLOCK_STORE_H_
+#define GDS2PARA_SURF_BLOCK_STORE_H_
+
+#include <atomic>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "fdtd.hpp"
+#include "matrixTypeDef.hpp"
+
+#ifndef LAYERED_RAM_BUDGET_GB
+#define LAYERED_RAM_BUDGET_GB (0)   // surface blocks of all layers above this size (GB) are kept in a memory-mapped scratch file, 0 for no limit
+#endif
+#define RAM_BUDGET_ENV "GDS2PARA_RAM_BUDGET_GB" // overrides LAYERED_RAM_BUDGET_GB at run time
+
+// The 4 reduced dense blocks {C11, C12, C21, C22} of every layer, kept in memory or spilled to a scratch file
+/* When the blocks of all stored layers fit in the budget (GDS2PARA_RAM_BUDGET_GB, else LAYERED_RAM_BUDGET_GB) they
+stay in memory. Otherwise each stored layer is written to its own page-aligned slot of an unlinked scratch file in
+$TMPDIR (/tmp if unset) mapped with mmap, so the OS pages them out under pressure. Readers stream the layers back in cascade order and prefetch() the next one, whose read-ahead then runs
+while the current layer is cascaded. */
+class surfBlockStore {
+public:
+    surfBlockStore(myint N_layers, myint N_surfE, myint N_storedLayers) {
+        /* Inputs:
+            N_layers:       layer index range of put() and get()
+            N_surfE:        num of rows (= cols) of each block
+            N_storedLayers: num of layers that will be put(), to check the budget and size the scratch file */
+        this->N_surfE = N_surfE;
+        myint blockSize = N_surfE * N_surfE;
+        size_t layerBytes = 4 * blockSize * sizeof(complex<double>);
+        double storedGB = (double)layerBytes * N_storedLayers / (1024. * 1024. * 1024.);
+        double budgetGB = ramBudgetGB();
+        if (budgetGB <= 0 || storedGB <= budgetGB) {
+            this->residentBlocks.resize(N_layers);
+            return;
+        }
+
+        size_t pageBytes = sysconf(_SC_PAGESIZE);
+        this->slotBytes = (layerBytes + pageBytes - 1) / pageBytes * pageBytes;
+        this->N_slots = N_storedLayers;
+        this->fileBytes = this->slotBytes * N_storedLayers;
+        this->slotOfLayer.assign(N_layers, -1);
+        const char *tmpDir = getenv("TMPDIR");
+        string filePath = string((tmpDir == NULL || *tmpDir == '\0') ? "/tmp" : tmpDir) + "/gds2paraSurfBlocks_XXXXXX";
+        vector<char> fileName(filePath.begin(), filePath.end());
+        fileName.push_back('\0');
+        this->fd = mkstemp(fileName.data());
+        if (this->fd < 0) {
+            cerr << "Failed to create the scratch file " << filePath << " for layer blocks!" << endl;
+            exit(2);
+        }
+        unlink(fileName.data());                    // removed from disk once closed
+        if (ftruncate(this->fd, this->fileBytes) != 0) {
+            cerr << "Failed to size the scratch file for layer blocks to " << this->fileBytes << " bytes!" << endl;
+            exit(2);
+        }
+        void *mapped = mmap(NULL, this->fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+        if (mapped == MAP_FAILED) {
+            cerr << "Failed to map the scratch file for layer blocks!" << endl;
+            exit(2);
+        }
+        this->mapped = (char*)mapped;
+        cout << "Layer blocks (" << storedGB << " GB) exceed the RAM budget of " << budgetGB
+            << " GB and are kept in the memory-mapped scratch file " << fileName.data() << endl;
+    }
+
+    surfBlockStore(const surfBlockStore &) = delete;
+    surfBlockStore &operator=(const surfBlockStore &) = delete;
+
+    ~surfBlockStore() {
+        if (this->mapped != nullptr) {
+            munmap(this->mapped, this->fileBytes);
+        }
+        if (this->fd >= 0) {
+            close(this->fd);
+        }
+    }
+
+    // Store the 4 blocks of layer i_layer, thread-safe for different layers
+    void put(myint i_layer, vector<denseFormatOfMatrix> &&blocks) {
+        if (this->mapped == nullptr) {
+            this->residentBlocks[i_layer] = move(blocks);
+            return;
+        }
+        myint i_slot = this->nextSlot++;
+        if (i_slot >= this->N_slots) {
+            cerr << "More layers stored than the " << this->N_slots << " slots of the scratch file for layer blocks!" << endl;
+            exit(2);
+        }
+        this->slotOfLayer[i_layer] = i_slot;
+        complex<double> *slot = this->slotOf(i_layer);
+        myint blockSize = this->N_surfE * this->N_surfE;
+        for (myint i_block = 0; i_block < 4; i_block++) {
+            memcpy(slot + i_block * blockSize, blocks[i_block].vals.data(), blockSize * sizeof(complex<double>));
+        }
+        blocks.clear();
+        msync(slot, this->slotBytes, MS_ASYNC);     // start writing back so the pages can be dropped
+    }
+
+    // Copy of the 4 blocks of layer i_layer
+    vector<denseFormatOfMatrix> get(myint i_layer) const {
+        if (this->mapped == nullptr) {
+            return this->residentBlocks[i_layer];
+        }
+        const complex<double> *slot = this->slotOf(i_layer);
+        myint blockSize = this->N_surfE * this->N_surfE;
+        vector<denseFormatOfMatrix> blocks;
+        blocks.reserve(4);
+        for (myint i_block = 0; i_block < 4; i_block++) {
+            blocks.emplace_back(this->N_surfE, this->N_surfE);
+            memcpy(blocks[i_block].vals.data(), slot + i_block * blockSize, blockSize * sizeof(complex<double>));
+        }
+        return blocks;
+    }
+
+    // Start reading layer i_layer back from the scratch file ahead of get()
+    void prefetch(myint i_layer) const {
+        if (this->mapped != nullptr) {
+            madvise(this->slotOf(i_layer), this->slotBytes, MADV_WILLNEED);
+        }
+    }
+
+private:
+    // GDS2PARA_RAM_BUDGET_GB if set, else LAYERED_RAM_BUDGET_GB
+    static double ramBudgetGB() {
+        const char *value = getenv(RAM_BUDGET_ENV);
+        if (value == NULL || *value == '\0') {
+            return LAYERED_RAM_BUDGET_GB;
+        }
+        char *valueEnd;
+        double budgetGB = strtod(value, &valueEnd);
+        if (*valueEnd != '\0' || budgetGB < 0) {
+            cerr << RAM_BUDGET_ENV << " must be a non-negative number of GB. Defaulting to " << LAYERED_RAM_BUDGET_GB << "." << endl;
+            return LAYERED_RAM_BUDGET_GB;
+        }
+        return budgetGB;
+    }
+
+    complex<double> *slotOf(myint i_layer) const {
+        if (this->slotOfLayer[i_layer] < 0) {
+            cerr << "Layer " << i_layer << " was never stored in the scratch file for layer blocks!" << endl;
+            exit(2);
+        }
+        return (complex<double>*)(this->mapped + this->slotOfLayer[i_layer] * this->slotBytes);
+    }
+
+    myint N_surfE = 0;
+    vector<vector<denseFormatOfMatrix>> residentBlocks; // in memory mode
+    int fd = -1;                                        // scratch file mode
+    char *mapped = nullptr;
+    size_t slotBytes = 0;                               // page-aligned bytes per layer
+    size_t fileBytes = 0;
+    myint N_slots = 0;                                  // num of stored layers the file has room for
+    atomic<myint> nextSlot{ 0 };                        // next free slot, taken by put() in any thread
+    vector<myint> slotOfLayer;                          // slot of each layer, -1 if not stored
+};
+
+#endif
@@ -88,6 +88,11 @@ void WriteSysToFile(const fdtdMesh &sys) {
 		file_obj << i << endl;
 	file_obj.close();
 
+	file_obj.open("../temp_sysInfoIO/sys_vec_sourcePorts.txt", ios::out);
+	for (const auto& i : sys.sourcePorts)
+		file_obj << i << endl;
+	file_obj.close();
+
 	// Write sys.portCoor. Every object of class fdtdPort takes n lines, being one element of vector portCoor
 	// output format: multiplicity ~ 1st line; x1 ~ 2nd line; ... someattri ~ n-th line.
 	file_obj.open("../temp_sysInfoIO/sys_vec_portCoor.txt", ios::out);
@@ -196,6 +201,7 @@ double* Read1LineToDoublePtr(ifstream &file_obj) {
 // Read object sys from files
 void ReadSysFromFile(fdtdMesh *psys) {
 	double doubVecValue;
+	int intVecValue;
 	int num_line = 0;
 	string strVecValue, line;
 
@@ -256,6 +262,16 @@ void ReadSysFromFile(fdtdMesh *psys) {
 	}
 	file_obj.close();
 
+	file_obj.open("temp_sysInfoIO/sys_vec_sourcePorts.txt", ios::in);
+	while (file_obj >> intVecValue) {
+		psys->sourcePorts.push_back(intVecValue);
+	}
+	file_obj.close();
+	if (psys->sourcePorts.empty()) {	// files written before source ports existed excite every port
+		for (int i = 0; i < psys->numPorts; i++)
+			psys->sourcePorts.push_back(i);
+	}
+
 	// Read sys.portCoor. Every object of class fdtdPort takes n lines, being one element of vector portCoor
 	// Input format: multiplicity ~ 1st line; x1 ~ 2nd line; ... someattri ~ n-th line.
 	file_obj.open("temp_sysInfoIO/sys_vec_portCoor.txt", ios::in);